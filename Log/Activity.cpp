@@ -0,0 +1,142 @@
+#include "pch.h"
+#include "Activity.h"
+#include "LogReader.h"
+
+#include <algorithm>
+#include <atomic>
+#include <random>
+
+namespace
+{
+    /// @brief Activity of the innermost \a ActivityScope of the thread.
+    thread_local EtwLog::ActivityId t_currentActivity;
+
+    EtwLog::ActivityHeader MakeHeader(const EtwLog::ActivityId& activity, const EtwLog::ActivityId& related, EtwLog::ActivityOpcode opcode) noexcept {
+        EtwLog::ActivityHeader header{};
+        header.Activity = activity;
+        header.RelatedActivity = related;
+        header.Opcode = opcode;
+        return header;
+    }
+}
+
+EtwLog::ActivityId EtwLog::NewActivityId() noexcept {
+    static const std::uint64_t s_process{[] {
+        std::random_device random;
+        return (static_cast<std::uint64_t>(random()) << 32) | random();
+    }()};
+    static std::atomic<std::uint64_t> s_next{1};
+
+    return {s_process, s_next.fetch_add(1, std::memory_order_relaxed)};
+}
+
+EtwLog::ActivityScope::ActivityScope(const MiniLog& log, const EventDescriptor& event, std::span<const std::byte> payload)
+    : ActivityScope{log, event, t_currentActivity, payload} {}
+
+EtwLog::ActivityScope::ActivityScope(const MiniLog& log, const EventDescriptor& event, const ActivityId& parent, std::span<const std::byte> payload)
+    :
+    m_log{log},
+    m_event{event},
+    m_enclosing{t_currentActivity}
+{
+    if (m_log.Admit(m_event)) {
+        m_log.WriteActivity(m_event, MakeHeader(m_id, parent, ActivityOpcode::Start), payload);
+        m_started = true;
+    }
+    t_currentActivity = m_id;
+}
+
+EtwLog::ActivityScope::~ActivityScope() {
+    t_currentActivity = m_enclosing;
+    if (!m_started) {
+        return;
+    }
+
+    try {
+        m_log.WriteActivity(m_event, MakeHeader(m_id, {}, ActivityOpcode::Stop), {});
+    } catch (...) {
+        // A lost stop record shows as a span without a stop, no reason to terminate.
+    }
+}
+
+EtwLog::ActivityId EtwLog::ActivityScope::Current() noexcept {
+    return t_currentActivity;
+}
+
+void EtwLog::SpanBuilder::Add(const RecordView& record) {
+    if (!record.Activity) {
+        return;
+    }
+
+    const auto& activity{*record.Activity};
+    if (activity.Opcode == ActivityOpcode::Start) {
+        const auto [entry, inserted]{m_byId.try_emplace(activity.Activity, m_spans.size())};
+        if (!inserted) {
+            return;
+        }
+
+        auto& span{m_spans.emplace_back()};
+        span.Id = activity.Activity;
+        span.Event = record.Event;
+        span.Start = record.Time;
+        span.Payload.assign(record.Payload.begin(), record.Payload.end());
+        m_parents.push_back(activity.RelatedActivity);
+
+        if (const auto early{m_earlyStops.find(activity.Activity)}; early != m_earlyStops.end()) {
+            span.Stop = early->second;
+            m_earlyStops.erase(early);
+        }
+    } else if (activity.Opcode == ActivityOpcode::Stop) {
+        const auto found{m_byId.find(activity.Activity)};
+        if (found != m_byId.end()) {
+            m_spans[found->second].Stop = record.Time;
+        } else {
+            m_earlyStops.emplace(activity.Activity, record.Time);
+        }
+    }
+}
+
+EtwLog::SpanTree EtwLog::SpanBuilder::Build() const {
+    // Sorted by start time, keeping track of where each span went to link parents by their new index.
+    std::vector<std::size_t> order(m_spans.size());
+    for (std::size_t s = 0; s != order.size(); ++s) {
+        order[s] = s;
+    }
+    std::stable_sort(order.begin(), order.end(), [this](std::size_t a, std::size_t b) { return m_spans[a].Start < m_spans[b].Start; });
+    std::vector<std::size_t> sortedIndex(m_spans.size());
+    for (std::size_t s = 0; s != order.size(); ++s) {
+        sortedIndex[order[s]] = s;
+    }
+
+    SpanTree tree;
+    tree.UnmatchedStops = m_earlyStops.size();
+    tree.Spans.reserve(m_spans.size());
+    for (const auto original : order) {
+        auto& span{tree.Spans.emplace_back(m_spans[original])};
+        span.Duration = span.Stop ? *span.Stop - span.Start : std::chrono::nanoseconds{0};
+        span.SelfTime = span.Duration;
+    }
+
+    // Children are linked in start order, so each span's children come out sorted.
+    for (std::size_t s = 0; s != order.size(); ++s) {
+        const auto& parentId{m_parents[order[s]]};
+        const auto parent{parentId ? m_byId.find(parentId) : m_byId.end()};
+        if (parent == m_byId.end()) {
+            tree.Roots.push_back(s);
+            continue;
+        }
+
+        auto& span{tree.Spans[s]};
+        auto& parentSpan{tree.Spans[sortedIndex[parent->second]]};
+        span.Parent = sortedIndex[parent->second];
+        parentSpan.Children.push_back(s);
+        parentSpan.SelfTime = std::max(parentSpan.SelfTime - span.Duration, std::chrono::nanoseconds{0});
+    }
+    return tree;
+}
+
+EtwLog::SpanTree EtwLog::ReadSpans(const std::filesystem::path& file) {
+    SpanBuilder builder;
+    ReadLog(file, [&builder](const RecordView& record) { builder.Add(record); });
+    return builder.Build();
+}
@@ -0,0 +1,121 @@
+#pragma once
+
+#include "MiniEtwLog.h"
+#include "Record.h"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <span>
+#include <unordered_map>
+#include <vector>
+
+namespace EtwLog
+{
+    /// @brief New activity id, unique in the process and, with a random half, across processes.
+    ActivityId NewActivityId() noexcept;
+
+    /// @brief Times an activity, such as handling one request, from construction to destruction.
+    /// Writes a start record (\a ActivityOpcode::Start) when constructed and a stop record when destroyed, with the same event descriptor,
+    /// carrying the activity's id and the id of the activity it is part of, for \a ReadSpans to put together into a tree.
+    /// The scope is the current activity of its thread while it lives, so scopes nested on a thread are nested activities.
+    /// A start record the logger's filter or sampling drops goes with its stop record, and the activity's children are then roots.
+    class ActivityScope {
+    public:
+        /// @brief Starts an activity as part of the thread's current one, if any.
+        /// @param payload - stored with the start record, such as the name of the operation.
+        ActivityScope(const MiniLog& log, const EventDescriptor& event, std::span<const std::byte> payload = {});
+
+        /// @brief Starts an activity as part of \a parent, such as one started on another thread for the work handed over.
+        ActivityScope(const MiniLog& log, const EventDescriptor& event, const ActivityId& parent, std::span<const std::byte> payload = {});
+
+        /// @brief Writes the stop record, and makes the activity current before this one current again.
+        ~ActivityScope();
+
+        ActivityScope(const ActivityScope&) = delete;
+        ActivityScope& operator=(const ActivityScope&) = delete;
+
+        const ActivityId& Id() const noexcept { return m_id; }
+
+        /// @brief Activity of the innermost scope living on the calling thread, zero outside of any.
+        static ActivityId Current() noexcept;
+
+    private:
+        const MiniLog& m_log;
+        const EventDescriptor m_event;
+        const ActivityId m_id{NewActivityId()};
+
+        /// @brief Current activity of the thread before this one.
+        const ActivityId m_enclosing;
+
+        /// @brief False if the start record wasn't written, and so neither is the stop record.
+        bool m_started{false};
+    };
+
+    /// @brief One activity read back from a log.
+    struct Span {
+        ActivityId Id;
+        EventDescriptor Event;
+
+        /// @brief Index in \a SpanTree::Spans of the activity this one is part of. None for a root, or when the parent's start record isn't in the log.
+        std::optional<std::size_t> Parent;
+
+        /// @brief Indexes in \a SpanTree::Spans of the activities part of this one, by start time.
+        std::vector<std::size_t> Children;
+
+        std::chrono::sys_time<std::chrono::nanoseconds> Start;
+
+        /// @brief None if the log has no stop record for the activity: it was still running, or the record was lost.
+        std::optional<std::chrono::sys_time<std::chrono::nanoseconds>> Stop;
+
+        /// @brief Payload of the start record.
+        std::vector<std::byte> Payload;
+
+        /// @brief Time from start to stop, zero without a stop record.
+        std::chrono::nanoseconds Duration{0};
+
+        /// @brief \a Duration not spent in \a Children: the width of the span's own bar in a flame graph. Zero if children running in parallel take longer.
+        std::chrono::nanoseconds SelfTime{0};
+    };
+
+    /// @brief Activities of a log, as a forest of spans.
+    struct SpanTree {
+        /// @brief By start time.
+        std::vector<Span> Spans;
+
+        /// @brief Indexes of the spans without a parent, by start time.
+        std::vector<std::size_t> Roots;
+
+        /// @brief Stop records of activities whose start record isn't in the log.
+        std::uint64_t UnmatchedStops{0};
+    };
+
+    /// @brief Puts the start and stop records of activities together into a \a SpanTree, as they are read.
+    class SpanBuilder {
+    public:
+        /// @brief Takes the activity records, ignoring every other.
+        void Add(const RecordView& record);
+
+        /// @brief Tree of the activities added so far.
+        SpanTree Build() const;
+
+    private:
+        std::vector<Span> m_spans;
+
+        /// @brief Id of the parent of each span, zero for none.
+        std::vector<ActivityId> m_parents;
+
+        struct IdHash {
+            std::size_t operator()(const ActivityId& id) const noexcept { return std::hash<std::uint64_t>{}(id.High ^ (id.Low * 0x9E37'79B9'7F4A'7C15)); }
+        };
+        std::unordered_map<ActivityId, std::size_t, IdHash> m_byId;
+
+        /// @brief Stops read before their start, which ETW may deliver out of order.
+        std::unordered_map<ActivityId, std::chrono::sys_time<std::chrono::nanoseconds>, IdHash> m_earlyStops;
+    };
+
+    /// @brief Reads the activities of the log \a file, see \a SpanBuilder.
+    SpanTree ReadSpans(const std::filesystem::path& file);
+} // EtwLog
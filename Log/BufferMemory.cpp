@@ -0,0 +1,157 @@
+#include "pch.h"
+#include "BufferMemory.h"
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+
+#ifdef __linux__
+#include <linux/mempolicy.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <new>
+#include <string>
+#include <system_error>
+
+namespace
+{
+    std::size_t RoundUp(std::size_t size, std::size_t granularity) noexcept {
+        return (size + granularity - 1) / granularity * granularity;
+    }
+
+#ifdef __linux__
+    /// @brief Asks the kernel to take pages of [data, data + size) from \a node when they are first touched,
+    /// falling back to other nodes rather than failing when it is full.
+    void PreferNode(void* data, std::size_t size, std::size_t node) noexcept {
+        unsigned long nodeMask[4]{};
+        constexpr auto c_maskBits{sizeof(nodeMask) * 8};
+        if (node >= c_maskBits) {
+            return;
+        }
+        nodeMask[node / (sizeof(unsigned long) * 8)] = 1ul << (node % (sizeof(unsigned long) * 8));
+        ::syscall(SYS_mbind, data, size, MPOL_PREFERRED, nodeMask, c_maskBits + 1, 0);
+    }
+#endif
+}
+
+std::size_t EtwLog::Detail::NumaNodeCount() noexcept {
+#if defined(_WIN32)
+    ULONG highest{0};
+    return ::GetNumaHighestNodeNumber(&highest) ? highest + 1 : 1;
+#elif defined(__linux__)
+    // Such as "0" or "0-1": the highest node number is last.
+    std::ifstream online{"/sys/devices/system/node/online"};
+    std::string nodes;
+    if (!(online >> nodes)) {
+        return 1;
+    }
+    const auto last{nodes.find_last_of(",-")};
+    try {
+        return std::stoul(last == std::string::npos ? nodes : nodes.substr(last + 1)) + 1;
+    } catch (const std::exception&) {
+        return 1;
+    }
+#else
+    return 1;
+#endif
+}
+
+std::size_t EtwLog::Detail::CurrentNumaNode() noexcept {
+#if defined(_WIN32)
+    PROCESSOR_NUMBER processor;
+    ::GetCurrentProcessorNumberEx(&processor);
+    USHORT node{0};
+    return ::GetNumaProcessorNodeEx(&processor, &node) ? node : 0;
+#elif defined(__linux__)
+    unsigned cpu{0};
+    unsigned node{0};
+    return ::getcpu(&cpu, &node) == 0 ? node : 0;
+#else
+    return 0;
+#endif
+}
+
+EtwLog::Detail::PageMemory::PageMemory(std::size_t size, std::optional<std::size_t> node, bool hugePages) {
+#if defined(_WIN32)
+    const auto allocate = [&](std::size_t bytes, DWORD largePages) {
+        return ::VirtualAllocExNuma(::GetCurrentProcess(), nullptr, bytes, MEM_RESERVE | MEM_COMMIT | largePages, PAGE_READWRITE,
+            node ? static_cast<DWORD>(*node) : NUMA_NO_PREFERRED_NODE);
+    };
+
+    // Large pages need SeLockMemoryPrivilege, without it the allocation fails and normal pages are used.
+    const auto largePageSize{::GetLargePageMinimum()};
+    if (hugePages && largePageSize != 0) {
+        m_mappingSize = RoundUp(size, largePageSize);
+        m_mapping = allocate(m_mappingSize, MEM_LARGE_PAGES);
+    }
+    if (m_mapping == nullptr) {
+        m_mappingSize = size;
+        m_mapping = allocate(m_mappingSize, 0);
+    }
+    if (m_mapping == nullptr) {
+        throw std::bad_alloc{};
+    }
+    m_data = static_cast<std::byte*>(m_mapping);
+    m_size = m_mappingSize;
+#else
+    const auto map = [](std::size_t bytes, int flags) {
+        const auto mapping{::mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | flags, -1, 0)};
+        return mapping == MAP_FAILED ? nullptr : mapping;
+    };
+
+    m_size = hugePages ? RoundUp(size, c_hugePageSize) : size;
+#ifdef MAP_HUGETLB
+    // Pages reserved for huge page mappings, if the administrator set any aside.
+    if (hugePages) {
+        m_mappingSize = m_size;
+        m_mapping = map(m_mappingSize, MAP_HUGETLB);
+        m_data = static_cast<std::byte*>(m_mapping);
+    }
+#endif
+    if (m_mapping == nullptr && hugePages) {
+        // Otherwise transparent huge pages, which need the memory aligned to a huge page.
+        m_mappingSize = m_size + c_hugePageSize;
+        m_mapping = map(m_mappingSize, 0);
+        if (m_mapping != nullptr) {
+            const auto address{reinterpret_cast<std::uintptr_t>(m_mapping)};
+            m_data = reinterpret_cast<std::byte*>(RoundUp(address, c_hugePageSize));
+#ifdef MADV_HUGEPAGE
+            ::madvise(m_data, m_size, MADV_HUGEPAGE);
+#endif
+        }
+    }
+    if (m_mapping == nullptr) {
+        m_mappingSize = m_size;
+        m_mapping = map(m_mappingSize, 0);
+        m_data = static_cast<std::byte*>(m_mapping);
+    }
+    if (m_mapping == nullptr) {
+        throw std::bad_alloc{};
+    }
+
+#ifdef __linux__
+    if (node) {
+        PreferNode(m_data, m_size, *node);
+    }
+#endif
+#endif
+
+    // Fault the pages in now, on the node asked for, rather than on the writers' first records.
+    if (node || hugePages) {
+        std::memset(m_data, 0, m_size);
+    }
+}
+
+EtwLog::Detail::PageMemory::~PageMemory() {
+#ifdef _WIN32
+    ::VirtualFree(m_mapping, 0, MEM_RELEASE);
+#else
+    ::munmap(m_mapping, m_mappingSize);
+#endif
+}
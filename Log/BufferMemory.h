@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstddef>
+#include <optional>
+
+namespace EtwLog::Detail
+{
+    /// @brief NUMA nodes memory can be placed on, 1 on a system without NUMA.
+    std::size_t NumaNodeCount() noexcept;
+
+    /// @brief NUMA node of the CPU the calling thread is running on. Cheap enough to ask on every record:
+    /// a vDSO call on Linux, a processor number lookup on Windows.
+    std::size_t CurrentNumaNode() noexcept;
+
+    /// @brief Page aligned memory for log buffers, straight from the OS.
+    /// Placed on \a node and backed by huge pages when asked; both are best effort, memory that can't have them is allocated without.
+    /// Memory placed either way is touched right away, so the writers never fault on it.
+    class PageMemory {
+    public:
+        /// @brief Huge pages are 2 MB on the systems MiniLog runs on. Memory in huge pages is rounded up to whole ones.
+        static constexpr std::size_t c_hugePageSize{2 * 1024 * 1024};
+
+        /// @param node - NUMA node to allocate on, none to leave it to the OS (usually the node of the first thread touching the memory).
+        PageMemory(std::size_t size, std::optional<std::size_t> node, bool hugePages);
+        ~PageMemory();
+
+        PageMemory(const PageMemory&) = delete;
+        PageMemory& operator=(const PageMemory&) = delete;
+
+        std::byte* Data() const noexcept { return m_data; }
+
+        /// @brief At least the size asked for.
+        std::size_t Size() const noexcept { return m_size; }
+
+    private:
+        std::byte* m_data{nullptr};
+        std::size_t m_size{0};
+
+        /// @brief Where the mapping really starts, before aligning \a m_data to a huge page.
+        void* m_mapping{nullptr};
+        std::size_t m_mappingSize{0};
+    };
+} // EtwLog::Detail
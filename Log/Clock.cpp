@@ -0,0 +1,156 @@
+#include "pch.h"
+#include "Clock.h"
+
+#if ETWLOG_HAS_TSC && !defined(_MSC_VER)
+#include <cpuid.h>
+#endif
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <optional>
+#include <ratio>
+
+namespace
+{
+    using EtwLog::ClockSource;
+
+    std::int64_t UnixNanosecondsNow() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+
+#if ETWLOG_HAS_TSC
+    /// @brief A TSC reading paired with the steady clock read right before and after it.
+    struct ClockPair {
+        std::uint64_t Tsc;
+        std::chrono::steady_clock::time_point Steady;
+        std::chrono::steady_clock::duration Bracket;
+    };
+
+    /// @brief The reading of a few with the tightest bracket, so a preemption or a VM steal between the reads is left out.
+    ClockPair ReadClockPair() {
+        static constexpr int c_attempts{8};
+
+        ClockPair best{0, {}, std::chrono::steady_clock::duration::max()};
+        for (int attempt = 0; attempt != c_attempts; ++attempt) {
+            const auto before{std::chrono::steady_clock::now()};
+            const auto tsc{__rdtsc()};
+            const auto after{std::chrono::steady_clock::now()};
+            if (after - before < best.Bracket) {
+                best = {tsc, before + (after - before) / 2, after - before};
+            }
+        }
+        return best;
+    }
+
+    /// @brief Measures TSC ticks per second against the steady clock. Done once per process, since the rate of an invariant TSC never changes.
+    /// Measured over several short intervals, each of which has to agree with the rate over all of them: none if they don't,
+    /// rather than an error every timestamp of the process would carry.
+    std::optional<double> TscTicksPerSecond() {
+        static const std::optional<double> c_ticksPerSecond{[]() -> std::optional<double> {
+            static constexpr int c_intervals{5};
+            static constexpr std::chrono::milliseconds c_interval{2};
+
+            // Bracketing errors of tens of nanoseconds over each interval make for an agreement far better than this.
+            static constexpr double c_tolerance{200e-6};
+
+            const auto rate = [](const ClockPair& from, const ClockPair& to) {
+                return static_cast<double>(to.Tsc - from.Tsc) / std::chrono::duration<double>(to.Steady - from.Steady).count();
+            };
+
+            std::array<ClockPair, c_intervals + 1> pairs;
+            pairs[0] = ReadClockPair();
+            for (int i = 1; i != c_intervals + 1; ++i) {
+                auto now{std::chrono::steady_clock::now()};
+                while (now - pairs[i - 1].Steady < c_interval) {
+                    now = std::chrono::steady_clock::now();
+                }
+                pairs[i] = ReadClockPair();
+            }
+
+            const auto overall{rate(pairs.front(), pairs.back())};
+            for (int i = 1; i != c_intervals + 1; ++i) {
+                if (std::abs(rate(pairs[i - 1], pairs[i]) / overall - 1) > c_tolerance) {
+                    return std::nullopt;
+                }
+            }
+            return overall;
+        }()};
+
+        return c_ticksPerSecond;
+    }
+#endif
+
+    EtwLog::ClockCalibration Calibrate(ClockSource source) {
+        EtwLog::ClockCalibration calibration{};
+        calibration.Source = source;
+
+#if ETWLOG_HAS_TSC
+        const auto ticksPerSecond{source == ClockSource::Tsc ? TscTicksPerSecond() : std::nullopt};
+        if (ticksPerSecond) {
+            calibration.TicksPerSecond = *ticksPerSecond;
+
+            // Pair the wall clock with the TSC value in the middle of reading it.
+            const auto before{__rdtsc()};
+            calibration.UnixNanoseconds = UnixNanosecondsNow();
+            const auto after{__rdtsc()};
+            calibration.Ticks = before + (after - before) / 2;
+            return calibration;
+        }
+#endif
+
+        using Period = std::chrono::steady_clock::period;
+        calibration.Source = ClockSource::Steady;
+        calibration.TicksPerSecond = static_cast<double>(Period::den) / static_cast<double>(Period::num);
+        calibration.Ticks = static_cast<std::uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count());
+        calibration.UnixNanoseconds = UnixNanosecondsNow();
+        return calibration;
+    }
+}
+
+EtwLog::Clock::Clock() : Clock{IsTscInvariant() ? ClockSource::Tsc : ClockSource::Steady} {}
+
+EtwLog::Clock::Clock(ClockSource source) : m_calibration{Calibrate(source)} {}
+
+bool EtwLog::Clock::IsTscInvariant() noexcept {
+#if ETWLOG_HAS_TSC
+    // CPUID.80000007H:EDX[8] is the invariant TSC flag.
+    static constexpr unsigned int c_powerManagementLeaf{0x80000007};
+    static constexpr unsigned int c_invariantTscBit{1u << 8};
+#ifdef _MSC_VER
+    int registers[4];
+    __cpuid(registers, 0x80000000);
+    if (static_cast<unsigned int>(registers[0]) < c_powerManagementLeaf) {
+        return false;
+    }
+
+    __cpuid(registers, c_powerManagementLeaf);
+    return (static_cast<unsigned int>(registers[3]) & c_invariantTscBit) != 0;
+#else
+    unsigned int eax, ebx, ecx, edx;
+    if (__get_cpuid(c_powerManagementLeaf, &eax, &ebx, &ecx, &edx) == 0) {
+        return false;
+    }
+
+    return (edx & c_invariantTscBit) != 0;
+#endif
+#else
+    return false;
+#endif
+}
+
+std::chrono::sys_time<std::chrono::nanoseconds> EtwLog::ToSystemTime(const ClockCalibration& calibration, std::uint64_t ticks) noexcept {
+    // Signed difference, records can be stamped slightly before the calibration point.
+    const auto elapsedTicks{static_cast<double>(static_cast<std::int64_t>(ticks - calibration.Ticks))};
+    const auto elapsedNanoseconds{static_cast<std::int64_t>(elapsedTicks * std::nano::den / calibration.TicksPerSecond)};
+    return std::chrono::sys_time<std::chrono::nanoseconds>{std::chrono::nanoseconds{calibration.UnixNanoseconds + elapsedNanoseconds}};
+}
+
+std::uint64_t EtwLog::ToTicks(const ClockCalibration& calibration, std::chrono::sys_time<std::chrono::nanoseconds> time) noexcept {
+    const auto elapsedNanoseconds{static_cast<double>(time.time_since_epoch().count()) - static_cast<double>(calibration.UnixNanoseconds)};
+    const auto ticks{static_cast<double>(calibration.Ticks) + elapsedNanoseconds * calibration.TicksPerSecond / std::nano::den};
+
+    // Largest double below 2^64, converting anything above it would overflow.
+    static constexpr double c_maxTicks{18446744073709549568.0};
+    return static_cast<std::uint64_t>(std::clamp(ticks, 0.0, c_maxTicks));
+}
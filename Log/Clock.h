@@ -0,0 +1,71 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define ETWLOG_HAS_TSC 1
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+#else
+#define ETWLOG_HAS_TSC 0
+#endif
+
+namespace EtwLog
+{
+    /// @brief Counter a \a Clock reads its raw ticks from.
+    enum class ClockSource : std::uint32_t {
+        /// @brief CPU time stamp counter (rdtsc). Only used when the CPU reports an invariant TSC.
+        Tsc = 1,
+        /// @brief std::chrono::steady_clock: QueryPerformanceCounter on Windows, clock_gettime(CLOCK_MONOTONIC) on Linux.
+        Steady = 2,
+    };
+
+    /// @brief Relation between raw clock ticks and wall clock time, captured when a log is started.
+    /// @note Stored as raw bytes in the log, so ticks are converted to time only when the log is read.
+    struct ClockCalibration {
+        ClockSource Source;
+        std::uint32_t Reserved;
+
+        /// @brief Raw ticks at the moment \a UnixNanoseconds was read.
+        std::uint64_t Ticks;
+        std::int64_t UnixNanoseconds;
+        double TicksPerSecond;
+    };
+
+    /// @brief Cheap timestamp source for records: reading it costs a single rdtsc where possible.
+    class Clock {
+    public:
+        /// @brief Uses the TSC when it is invariant, the steady clock otherwise.
+        Clock();
+
+        /// @brief Uses the steady clock instead of the TSC if the TSC's rate can't be measured consistently, as on a busy VM.
+        explicit Clock(ClockSource source);
+
+        std::uint64_t Now() const noexcept {
+#if ETWLOG_HAS_TSC
+            if (m_calibration.Source == ClockSource::Tsc) {
+                return __rdtsc();
+            }
+#endif
+            return static_cast<std::uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count());
+        }
+
+        const ClockCalibration& Calibration() const noexcept { return m_calibration; }
+
+        /// @brief True if the TSC runs at a constant rate across power states and cores, so it can be used as a clock.
+        static bool IsTscInvariant() noexcept;
+
+    private:
+        ClockCalibration m_calibration;
+    };
+
+    /// @brief Converts raw \a ticks of a clock with \a calibration to wall clock time.
+    std::chrono::sys_time<std::chrono::nanoseconds> ToSystemTime(const ClockCalibration& calibration, std::uint64_t ticks) noexcept;
+
+    /// @brief Inverse of \a ToSystemTime, up to rounding. Times outside of the clock's range are clamped to it.
+    std::uint64_t ToTicks(const ClockCalibration& calibration, std::chrono::sys_time<std::chrono::nanoseconds> time) noexcept;
+} // EtwLog
@@ -0,0 +1,73 @@
+#include "pch.h"
+#include "Coalescer.h"
+
+#include <algorithm>
+
+namespace
+{
+    std::uint64_t AddSaturated(std::uint64_t ticks, std::uint64_t span) noexcept {
+        return ticks > UINT64_MAX - span ? UINT64_MAX : ticks + span;
+    }
+}
+
+void EtwLog::Detail::Coalescer::Offer(const EventDescriptor& event, std::uint64_t ticks, std::span<const std::byte> payload, const Emit& emit) {
+    EmitExpired(ticks, emit);
+
+    auto [entry, inserted]{m_runs.try_emplace(event.Id)};
+    auto& run{entry->second};
+    const bool repeats{!inserted && run.Event.Level == event.Level && run.Event.Keyword == event.Keyword
+        && std::equal(payload.begin(), payload.end(), run.Payload.begin(), run.Payload.end())};
+
+    if (repeats) {
+        if (run.Repeats == 0) {
+            run.FirstTicks = ticks;
+            m_nextExpiry = std::min(m_nextExpiry, AddSaturated(ticks, m_maxSpanTicks));
+        }
+        ++run.Repeats;
+        run.LastTicks = ticks;
+        return;
+    }
+
+    EmitRepeats(run, emit);
+    emit(event, ticks, nullptr, payload);
+    run.Event = event;
+    run.Payload.assign(payload.begin(), payload.end());
+}
+
+void EtwLog::Detail::Coalescer::Flush(const Emit& emit) {
+    for (auto& [id, run] : m_runs) {
+        EmitRepeats(run, emit);
+    }
+    m_nextExpiry = UINT64_MAX;
+}
+
+void EtwLog::Detail::Coalescer::EmitRepeats(Run& run, const Emit& emit) {
+    if (run.Repeats == 0) {
+        return;
+    }
+
+    // Has the time of the last repeat, which is when the run was last seen going on.
+    const RepeatHeader repeat{run.Repeats, run.FirstTicks};
+    run.Repeats = 0;
+    emit(run.Event, run.LastTicks, &repeat, run.Payload);
+}
+
+void EtwLog::Detail::Coalescer::EmitExpired(std::uint64_t ticks, const Emit& emit) {
+    if (ticks < m_nextExpiry) {
+        return;
+    }
+
+    m_nextExpiry = UINT64_MAX;
+    for (auto& [id, run] : m_runs) {
+        if (run.Repeats == 0) {
+            continue;
+        }
+
+        const auto expiry{AddSaturated(run.FirstTicks, m_maxSpanTicks)};
+        if (ticks >= expiry) {
+            EmitRepeats(run, emit);
+        } else {
+            m_nextExpiry = std::min(m_nextExpiry, expiry);
+        }
+    }
+}
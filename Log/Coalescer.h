@@ -0,0 +1,57 @@
+#pragma once
+
+#include "Record.h"
+
+#include <cstdint>
+#include <functional>
+#include <span>
+#include <unordered_map>
+#include <vector>
+
+namespace EtwLog::Detail
+{
+    /// @brief Collapses runs of identical records, as enabled with \a MiniLog::SetCoalescing.
+    /// The first record of a run is passed on as it comes; the records repeating it (same event descriptor and payload,
+    /// with no other record of that event id in between) are only counted, and passed on as one record with a \a RepeatHeader
+    /// when the run ends: another record of the event id comes, the run spans \a maxSpanTicks, or \a Flush is called.
+    /// Runs are checked for their span whenever any record is offered, so a run is passed on in time as long as the logger logs.
+    /// @note Not thread safe: MiniLog calls it under a lock, which also keeps records in time order.
+    class Coalescer {
+    public:
+        /// @brief Receives the records to write, with \a repeat set for a run of repeats.
+        using Emit = std::function<void(const EventDescriptor& event, std::uint64_t ticks, const RepeatHeader* repeat, std::span<const std::byte> payload)>;
+
+        explicit Coalescer(std::uint64_t maxSpanTicks) noexcept : m_maxSpanTicks{maxSpanTicks} {}
+
+        void SetMaxSpan(std::uint64_t maxSpanTicks) noexcept { m_maxSpanTicks = maxSpanTicks; }
+
+        /// @brief Passes the record logged at \a ticks to \a emit, unless it repeats the previous record of its event id.
+        void Offer(const EventDescriptor& event, std::uint64_t ticks, std::span<const std::byte> payload, const Emit& emit);
+
+        /// @brief Passes on every run of repeats counted so far.
+        void Flush(const Emit& emit);
+
+    private:
+        /// @brief Last record of an event id, and the repeats of it counted since it was passed on.
+        struct Run {
+            EventDescriptor Event;
+            std::vector<std::byte> Payload;
+            std::uint64_t Repeats{0};
+            std::uint64_t FirstTicks{0};
+            std::uint64_t LastTicks{0};
+        };
+
+        void EmitRepeats(Run& run, const Emit& emit);
+
+        /// @brief Passes on the runs of repeats that span \a m_maxSpanTicks at \a ticks.
+        void EmitExpired(std::uint64_t ticks, const Emit& emit);
+
+        std::uint64_t m_maxSpanTicks;
+
+        /// @brief Earliest tick a run of repeats reaches its span at, UINT64_MAX if none is counting.
+        std::uint64_t m_nextExpiry{UINT64_MAX};
+
+        /// @brief Keeps the last payload of every event id seen, reusing its memory for the next one.
+        std::unordered_map<std::uint16_t, Run> m_runs;
+    };
+} // EtwLog::Detail
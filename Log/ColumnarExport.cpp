@@ -0,0 +1,271 @@
+#include "pch.h"
+#include "ColumnarExport.h"
+#include "LogReader.h"
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <fstream>
+#include <stdexcept>
+#include <system_error>
+
+namespace
+{
+    using EtwLog::Columnar::Column;
+
+    constexpr std::size_t c_columnCount{static_cast<std::size_t>(Column::Count)};
+
+    void PutVarint(std::vector<std::byte>& out, std::uint64_t value) {
+        // Room for the longest varint up front, so the loop doesn't check capacity for every byte.
+        static constexpr std::size_t c_maxVarintSize{10};
+        const auto size{out.size()};
+        out.resize(size + c_maxVarintSize);
+
+        auto* next{out.data() + size};
+        while (value >= 0x80) {
+            *next++ = static_cast<std::byte>(value | 0x80);
+            value >>= 7;
+        }
+        *next++ = static_cast<std::byte>(value);
+        out.resize(static_cast<std::size_t>(next - out.data()));
+    }
+
+    /// @brief Maps small negative numbers to small unsigned ones, so deltas in either direction make short varints.
+    std::uint64_t ZigZag(std::int64_t value) noexcept {
+        return (static_cast<std::uint64_t>(value) << 1) ^ static_cast<std::uint64_t>(value >> 63);
+    }
+
+    std::int64_t UnZigZag(std::uint64_t value) noexcept {
+        return static_cast<std::int64_t>(value >> 1) ^ -static_cast<std::int64_t>(value & 1);
+    }
+
+    class VarintReader {
+    public:
+        explicit VarintReader(std::span<const std::byte> data) : m_data{data} {}
+
+        bool AtEnd() const noexcept { return m_position == m_data.size(); }
+
+        std::uint64_t Next() {
+            std::uint64_t value{0};
+            for (unsigned int shift = 0; shift < 64; shift += 7) {
+                if (AtEnd()) {
+                    break;
+                }
+                const auto byte{static_cast<std::uint64_t>(m_data[m_position++])};
+                value |= (byte & 0x7F) << shift;
+                if ((byte & 0x80) == 0) {
+                    return value;
+                }
+            }
+            throw std::runtime_error{"Columnar log: truncated or oversized varint"};
+        }
+
+    private:
+        std::span<const std::byte> m_data;
+        std::size_t m_position{0};
+    };
+
+    /// @brief Encodes the columns of the row group being exported.
+    class RowGroupBuilder {
+    public:
+        bool Empty() const noexcept { return m_records == 0; }
+        std::size_t Records() const noexcept { return m_records; }
+        std::size_t PayloadBytes() const noexcept { return Chunk(Column::Payloads).size(); }
+
+        void Add(const EtwLog::RecordView& record) {
+            const auto time{static_cast<std::int64_t>(record.Time.time_since_epoch().count())};
+            PutVarint(Chunk(Column::Times), ZigZag(time - m_lastTime));
+            m_lastTime = time;
+
+            if (m_records != 0 && record.Event.Id == m_runId) {
+                ++m_runLength;
+            } else {
+                FinishRun();
+                m_runId = record.Event.Id;
+                m_runLength = 1;
+            }
+
+            PutVarint(Chunk(Column::Sequences), ZigZag(static_cast<std::int64_t>(record.Header.Sequence - m_lastSequence)));
+            m_lastSequence = record.Header.Sequence;
+
+            PutVarint(Chunk(Column::PayloadSizes), record.Payload.size());
+            auto& payloads{Chunk(Column::Payloads)};
+            payloads.insert(payloads.end(), record.Payload.begin(), record.Payload.end());
+
+            ++m_records;
+        }
+
+        /// @brief Writes the row group and starts the next one, keeping the memory allocated for the columns.
+        void WriteTo(std::ostream& out, const EtwLog::ProviderId& provider) {
+            FinishRun();
+
+            EtwLog::Columnar::RowGroupHeader header{};
+            header.Records = static_cast<std::uint32_t>(m_records);
+            header.ColumnCount = static_cast<std::uint32_t>(c_columnCount);
+            header.Provider = provider;
+            for (std::size_t c = 0; c != c_columnCount; ++c) {
+                header.ColumnSizes[c] = m_columns[c].size();
+            }
+
+            out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+            for (auto& column : m_columns) {
+                out.write(reinterpret_cast<const char*>(column.data()), static_cast<std::streamsize>(column.size()));
+                column.clear();
+            }
+
+            m_records = 0;
+            m_lastTime = 0;
+            m_lastSequence = 0;
+        }
+
+    private:
+        std::vector<std::byte>& Chunk(Column column) noexcept { return m_columns[static_cast<std::size_t>(column)]; }
+        const std::vector<std::byte>& Chunk(Column column) const noexcept { return m_columns[static_cast<std::size_t>(column)]; }
+
+        void FinishRun() {
+            if (m_runLength != 0) {
+                PutVarint(Chunk(Column::EventIds), m_runId);
+                PutVarint(Chunk(Column::EventIds), m_runLength);
+                m_runLength = 0;
+            }
+        }
+
+        std::array<std::vector<std::byte>, c_columnCount> m_columns;
+        std::size_t m_records{0};
+
+        std::int64_t m_lastTime{0};
+        std::uint64_t m_lastSequence{0};
+
+        /// @brief Event id run not written to its column yet.
+        std::uint16_t m_runId{0};
+        std::uint64_t m_runLength{0};
+    };
+
+    void Decode(Column column, std::span<const std::byte> chunk, std::size_t records, EtwLog::Columnar::ColumnBatch& batch) {
+        VarintReader reader{chunk};
+        switch (column) {
+        case Column::Times: {
+            std::int64_t time{0};
+            for (std::size_t r = 0; r != records; ++r) {
+                time += UnZigZag(reader.Next());
+                batch.Times.push_back(time);
+            }
+            break;
+        }
+        case Column::EventIds:
+            while (!reader.AtEnd() && batch.EventIds.size() < records) {
+                const auto id{static_cast<std::uint16_t>(reader.Next())};
+                const auto runLength{reader.Next()};
+                batch.EventIds.insert(batch.EventIds.end(), std::min<std::uint64_t>(runLength, records - batch.EventIds.size()), id);
+            }
+            break;
+        case Column::Sequences: {
+            std::uint64_t sequence{0};
+            for (std::size_t r = 0; r != records; ++r) {
+                sequence += static_cast<std::uint64_t>(UnZigZag(reader.Next()));
+                batch.Sequences.push_back(sequence);
+            }
+            break;
+        }
+        case Column::PayloadSizes:
+            batch.PayloadOffsets.push_back(0);
+            for (std::size_t r = 0; r != records; ++r) {
+                batch.PayloadOffsets.push_back(batch.PayloadOffsets.back() + reader.Next());
+            }
+            break;
+        case Column::Payloads:
+        case Column::Count:
+            break;
+        }
+    }
+}
+
+EtwLog::Columnar::ExportResult EtwLog::Columnar::Export(std::span<const std::filesystem::path> logs, const std::filesystem::path& output, std::size_t rowGroupRecords) {
+    std::ofstream out{output, std::ios::binary | std::ios::trunc};
+    if (!out) {
+        throw std::system_error{errno, std::generic_category(), "Opening " + output.string()};
+    }
+
+    FileHeader header{};
+    std::copy(std::begin(c_magic), std::end(c_magic), header.Magic);
+    header.Version = c_version;
+    header.HeaderSize = sizeof(header);
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    ExportResult result;
+    RowGroupBuilder group;
+    ProviderId provider{};
+    for (const auto& log : logs) {
+        // Runs of repeats are exported as the records they stand for, columns compress them well enough.
+        ReadLog(log, ExpandRepeats([&](const RecordView& record) {
+            if (!group.Empty() && (record.Provider != provider || group.Records() == rowGroupRecords || group.PayloadBytes() >= c_maxRowGroupPayloadBytes)) {
+                group.WriteTo(out, provider);
+                ++result.RowGroups;
+            }
+
+            provider = record.Provider;
+            group.Add(record);
+            ++result.Records;
+        }));
+    }
+
+    if (!group.Empty()) {
+        group.WriteTo(out, provider);
+        ++result.RowGroups;
+    }
+
+    out.close();
+    if (!out) {
+        throw std::system_error{errno, std::generic_category(), "Writing " + output.string()};
+    }
+
+    result.Bytes = std::filesystem::file_size(output);
+    return result;
+}
+
+std::uint64_t EtwLog::Columnar::Import(const std::filesystem::path& file, const std::function<void(const ColumnBatch&)>& callback) {
+    std::ifstream in{file, std::ios::binary};
+    FileHeader header;
+    if (!in.read(reinterpret_cast<char*>(&header), sizeof(header))
+        || !std::equal(std::begin(c_magic), std::end(c_magic), header.Magic)
+        || header.Version != c_version
+        || header.HeaderSize < sizeof(header)) {
+        throw std::runtime_error{"Not a columnar MiniLog file: " + file.string()};
+    }
+    in.seekg(header.HeaderSize);
+
+    std::uint64_t records{0};
+    ColumnBatch batch;
+    std::vector<std::byte> chunk;
+    RowGroupHeader group;
+    while (in.read(reinterpret_cast<char*>(&group), sizeof(group))) {
+        if (group.ColumnCount != c_columnCount) {
+            throw std::runtime_error{"Unsupported columnar row group in " + file.string()};
+        }
+
+        batch.Provider = group.Provider;
+        batch.Times.clear();
+        batch.EventIds.clear();
+        batch.Sequences.clear();
+        batch.PayloadOffsets.clear();
+
+        for (std::size_t c = 0; c != c_columnCount; ++c) {
+            // Payloads are used as they are, straight from the file.
+            auto& target{static_cast<Column>(c) == Column::Payloads ? batch.Payloads : chunk};
+            target.resize(group.ColumnSizes[c]);
+            if (!in.read(reinterpret_cast<char*>(target.data()), static_cast<std::streamsize>(target.size()))) {
+                throw std::runtime_error{"Truncated columnar row group in " + file.string()};
+            }
+            Decode(static_cast<Column>(c), target, group.Records, batch);
+        }
+
+        if (batch.EventIds.size() != group.Records || batch.PayloadOffsets.back() != batch.Payloads.size()) {
+            throw std::runtime_error{"Inconsistent columnar row group in " + file.string()};
+        }
+
+        callback(batch);
+        records += group.Records;
+    }
+
+    return records;
+}
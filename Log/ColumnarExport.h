@@ -0,0 +1,93 @@
+#pragma once
+
+#include "Record.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <span>
+#include <vector>
+
+/// @brief Export of MiniLog logs into a columnar file for analytics tools.
+/// The file is a \a Columnar::FileHeader followed by row groups. Each row group holds the records of one provider
+/// as a \a Columnar::RowGroupHeader and one contiguous, compressed chunk per column:
+/// - Times: wall clock nanoseconds since 1970, as zigzag varint deltas from the previous record (the first from 0).
+/// - EventIds: runs of equal ids, as varint pairs of id and run length.
+/// - Sequences: \a RecordHeader::Sequence, as zigzag varint deltas like Times.
+/// - PayloadSizes: varint byte count of each payload.
+/// - Payloads: the payloads, back to back.
+/// Varints are LEB128: 7 bits per byte, least significant first, high bit set on all but the last byte.
+namespace EtwLog::Columnar
+{
+    inline constexpr char c_magic[8]{'M', 'L', 'O', 'G', 'C', 'O', 'L', '\0'};
+    inline constexpr std::uint32_t c_version{1};
+
+    enum class Column : std::uint32_t {
+        Times,
+        EventIds,
+        Sequences,
+        PayloadSizes,
+        Payloads,
+        Count,
+    };
+
+    struct FileHeader {
+        char Magic[8];
+        std::uint32_t Version;
+
+        /// @brief Size of this header, row groups start right after it.
+        std::uint32_t HeaderSize;
+    };
+
+    struct RowGroupHeader {
+        std::uint32_t Records;
+        std::uint32_t ColumnCount;
+        ProviderId Provider;
+
+        /// @brief Bytes of each column chunk following the header, in \a Column order.
+        std::uint64_t ColumnSizes[static_cast<std::size_t>(Column::Count)];
+    };
+
+    /// @brief Most records in a row group, unless set otherwise when exporting.
+    inline constexpr std::size_t c_defaultRowGroupRecords{64 * 1024};
+
+    /// @brief A row group is closed early once its payloads reach this many bytes, which bounds the memory export and import take.
+    inline constexpr std::size_t c_maxRowGroupPayloadBytes{64 * 1024 * 1024};
+
+    struct ExportResult {
+        std::uint64_t Records{0};
+        std::uint64_t RowGroups{0};
+
+        /// @brief Size of the columnar file.
+        std::uint64_t Bytes{0};
+    };
+
+    /// @brief Converts \a logs, written by either MiniLog backend, into one columnar file at \a output.
+    /// Logs are read with \a ReadLog, one after the other, keeping no more than one row group in memory.
+    /// A record standing for a run of repeats is exported as each of them, see \a ExpandRepeats.
+    ExportResult Export(std::span<const std::filesystem::path> logs, const std::filesystem::path& output, std::size_t rowGroupRecords = c_defaultRowGroupRecords);
+
+    /// @brief One decoded row group.
+    struct ColumnBatch {
+        ProviderId Provider;
+        std::vector<std::int64_t> Times;
+        std::vector<std::uint16_t> EventIds;
+        std::vector<std::uint64_t> Sequences;
+
+        /// @brief Start of each record's payload in \a Payloads, plus the end of the last one.
+        std::vector<std::size_t> PayloadOffsets;
+        std::vector<std::byte> Payloads;
+
+        std::size_t Size() const noexcept { return Times.size(); }
+
+        std::span<const std::byte> Payload(std::size_t record) const noexcept {
+            return std::span{Payloads}.subspan(PayloadOffsets[record], PayloadOffsets[record + 1] - PayloadOffsets[record]);
+        }
+    };
+
+    /// @brief Reads a file written by \a Export, passing each row group to \a callback.
+    /// The batch is reused for the next row group, so it is only valid during the call.
+    /// @return Number of records read.
+    std::uint64_t Import(const std::filesystem::path& file, const std::function<void(const ColumnBatch&)>& callback);
+} // EtwLog::Columnar
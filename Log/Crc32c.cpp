@@ -0,0 +1,113 @@
+#include "pch.h"
+#include "Crc32c.h"
+
+#include <array>
+#include <cstring>
+
+#if defined(_M_X64) || defined(__x86_64__)
+#define ETWLOG_HAS_SSE42_CRC 1
+#ifdef _MSC_VER
+#include <intrin.h>
+#include <nmmintrin.h>
+#define ETWLOG_TARGET_SSE42
+#else
+#include <cpuid.h>
+#include <nmmintrin.h>
+#define ETWLOG_TARGET_SSE42 __attribute__((target("sse4.2")))
+#endif
+#else
+#define ETWLOG_HAS_SSE42_CRC 0
+#endif
+
+namespace
+{
+    using Update = std::uint32_t (*)(std::uint32_t crc, const std::byte* data, std::size_t size) noexcept;
+
+    /// @brief Castagnoli polynomial, bit reversed.
+    constexpr std::uint32_t c_polynomial{0x82F63B78};
+
+    constexpr auto c_table{[] {
+        std::array<std::uint32_t, 256> table{};
+        for (std::uint32_t i = 0; i != table.size(); ++i) {
+            auto crc{i};
+            for (int bit = 0; bit != 8; ++bit) {
+                crc = (crc & 1) != 0 ? (crc >> 1) ^ c_polynomial : crc >> 1;
+            }
+            table[i] = crc;
+        }
+        return table;
+    }()};
+
+    std::uint32_t UpdateWithTable(std::uint32_t crc, const std::byte* data, std::size_t size) noexcept {
+        for (std::size_t i = 0; i != size; ++i) {
+            crc = c_table[(crc ^ static_cast<std::uint8_t>(data[i])) & 0xFF] ^ (crc >> 8);
+        }
+        return crc;
+    }
+
+#if ETWLOG_HAS_SSE42_CRC
+    ETWLOG_TARGET_SSE42 std::uint32_t UpdateWithSse42(std::uint32_t crc, const std::byte* data, std::size_t size) noexcept {
+        std::uint64_t crc64{crc};
+        for (; size >= sizeof(std::uint64_t); size -= sizeof(std::uint64_t), data += sizeof(std::uint64_t)) {
+            std::uint64_t word;
+            std::memcpy(&word, data, sizeof(word));
+            crc64 = _mm_crc32_u64(crc64, word);
+        }
+
+        // Records are short, so finish the tail in as few steps as possible.
+        crc = static_cast<std::uint32_t>(crc64);
+        if ((size & 4) != 0) {
+            std::uint32_t word;
+            std::memcpy(&word, data, sizeof(word));
+            crc = _mm_crc32_u32(crc, word);
+            data += sizeof(word);
+        }
+        if ((size & 2) != 0) {
+            std::uint16_t word;
+            std::memcpy(&word, data, sizeof(word));
+            crc = _mm_crc32_u16(crc, word);
+            data += sizeof(word);
+        }
+        if ((size & 1) != 0) {
+            crc = _mm_crc32_u8(crc, static_cast<std::uint8_t>(*data));
+        }
+        return crc;
+    }
+
+    bool HasSse42() noexcept {
+        // CPUID.01H:ECX[20] is SSE4.2, which brings the crc32 instruction.
+        static constexpr unsigned int c_sse42Bit{1u << 20};
+#ifdef _MSC_VER
+        int registers[4];
+        __cpuid(registers, 1);
+        return (static_cast<unsigned int>(registers[2]) & c_sse42Bit) != 0;
+#else
+        unsigned int eax, ebx, ecx, edx;
+        return __get_cpuid(1, &eax, &ebx, &ecx, &edx) != 0 && (ecx & c_sse42Bit) != 0;
+#endif
+    }
+#endif
+
+    Update SelectUpdate() noexcept {
+#if ETWLOG_HAS_SSE42_CRC
+        if (HasSse42()) {
+            return UpdateWithSse42;
+        }
+#endif
+        return UpdateWithTable;
+    }
+
+    const Update c_update{SelectUpdate()};
+}
+
+std::uint32_t EtwLog::Crc32c(std::span<const std::byte> data, std::uint32_t previous) noexcept {
+    return ~c_update(~previous, data.data(), data.size());
+}
+
+std::uint32_t EtwLog::Crc32cPortable(std::span<const std::byte> data, std::uint32_t previous) noexcept {
+    return ~UpdateWithTable(~previous, data.data(), data.size());
+}
+
+bool EtwLog::IsCrc32cAccelerated() noexcept {
+    return c_update != UpdateWithTable;
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+namespace EtwLog
+{
+    /// @brief CRC32C (Castagnoli) of \a data, using the CPU's crc32 instruction when it has one.
+    /// @param previous - result of the call for the data preceding \a data, to checksum data in pieces.
+    std::uint32_t Crc32c(std::span<const std::byte> data, std::uint32_t previous = 0) noexcept;
+
+    /// @brief Same as \a Crc32c, always computed with a lookup table.
+    std::uint32_t Crc32cPortable(std::span<const std::byte> data, std::uint32_t previous = 0) noexcept;
+
+    /// @brief True if \a Crc32c uses a CPU instruction.
+    bool IsCrc32cAccelerated() noexcept;
+} // EtwLog
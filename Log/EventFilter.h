@@ -0,0 +1,42 @@
+#pragma once
+
+#include "Record.h"
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+namespace EtwLog::Detail
+{
+    /// @brief Which records a logger writes at all, by level and keyword, as set with \a MiniLog::SetFilter.
+    /// Same rules as an ETW session enabling a provider: a record passes when its level is at most the filter's and,
+    /// unless the record's keyword or the filter's mask is zero, the two share a bit.
+    /// Checking a record is a single relaxed atomic load, so the filter can be changed while other threads log;
+    /// a record checked during a change may see either filter.
+    class EventFilter {
+    public:
+        /// @brief Passes every record, of any level and keyword.
+        EventFilter() noexcept { Set(Level::Verbose, 0); }
+
+        EventFilter(const EventFilter&) = delete;
+        EventFilter& operator=(const EventFilter&) = delete;
+
+        bool Passes(const EventDescriptor& event) const noexcept {
+            const auto mask{m_masks[static_cast<std::uint8_t>(event.Level)].load(std::memory_order_relaxed)};
+            return mask != 0 && (event.Keyword == 0 || (event.Keyword & mask) != 0);
+        }
+
+        /// @param keywordMask - keyword bits of which a record needs one. Zero passes records of any keyword.
+        void Set(Level maxLevel, std::uint64_t keywordMask) noexcept {
+            for (std::size_t level = 0; level != m_masks.size(); ++level) {
+                const bool levelPasses{level <= static_cast<std::uint8_t>(maxLevel)};
+                m_masks[level].store(!levelPasses ? 0 : keywordMask == 0 ? UINT64_MAX : keywordMask, std::memory_order_relaxed);
+            }
+        }
+
+    private:
+        /// @brief For each level a record can have, the keyword bits that pass it: zero if the level doesn't pass,
+        /// all ones if any keyword does. Indexed by level so a check needs one load.
+        std::array<std::atomic<std::uint64_t>, 256> m_masks;
+    };
+} // EtwLog::Detail
@@ -0,0 +1,326 @@
+#include "pch.h"
+#include "FileWriter.h"
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <cerrno>
+#include <unistd.h>
+#endif
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#define ETWLOG_HAS_IO_URING 1
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#else
+#define ETWLOG_HAS_IO_URING 0
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <optional>
+#include <unordered_map>
+
+#if ETWLOG_HAS_IO_URING
+/// @brief io_uring set up with the bare system calls, so there is no liburing to depend on.
+/// One submission queue entry per write, taken straight from the queue's memory shared with the kernel.
+class EtwLog::Detail::FileWriter::Ring {
+public:
+    /// @return Empty if the kernel doesn't let this process use io_uring.
+    static std::unique_ptr<Ring> Create(std::span<const std::span<std::byte>> memory, std::size_t entries) {
+        std::unique_ptr<Ring> ring{new Ring};
+        io_uring_params parameters{};
+        ring->m_fd = static_cast<int>(::syscall(__NR_io_uring_setup, static_cast<unsigned>(entries), &parameters));
+        if (ring->m_fd < 0 || !ring->Map(parameters)) {
+            return {};
+        }
+        ring->Register(memory);
+        return ring;
+    }
+
+    ~Ring() {
+        if (m_sqes != nullptr) {
+            ::munmap(m_sqes, m_sqesSize);
+        }
+        if (m_cqRing != nullptr && m_cqRing != m_sqRing) {
+            ::munmap(m_cqRing, m_cqRingSize);
+        }
+        if (m_sqRing != nullptr) {
+            ::munmap(m_sqRing, m_sqRingSize);
+        }
+        if (m_fd >= 0) {
+            ::close(m_fd);
+        }
+    }
+
+    Ring(const Ring&) = delete;
+    Ring& operator=(const Ring&) = delete;
+
+    void Submit(int file, std::span<const std::byte> data, std::uint64_t offset, std::uint64_t tag) {
+        auto [entry, inserted]{m_pending.try_emplace(tag, Pending{file, data, offset, {}})};
+        auto& pending{entry->second};
+
+        const auto tail{*m_sqTail};
+        const auto index{tail & *m_sqMask};
+        auto& sqe{m_sqes[index]};
+        std::memset(&sqe, 0, sizeof(sqe));
+        sqe.fd = file;
+        sqe.off = offset;
+        sqe.user_data = tag;
+
+        const auto registered{RegisteredIndex(data)};
+        if (registered) {
+            sqe.opcode = IORING_OP_WRITE_FIXED;
+            sqe.addr = reinterpret_cast<std::uint64_t>(data.data());
+            sqe.len = static_cast<std::uint32_t>(data.size());
+            sqe.buf_index = static_cast<std::uint16_t>(*registered);
+        } else {
+            // Plain writes from an iovec go back to the first kernels with io_uring.
+            pending.Vector = {const_cast<std::byte*>(data.data()), data.size()};
+            sqe.opcode = IORING_OP_WRITEV;
+            sqe.addr = reinterpret_cast<std::uint64_t>(&pending.Vector);
+            sqe.len = 1;
+        }
+
+        m_sqArray[index] = index;
+        std::atomic_ref{*m_sqTail}.store(tail + 1, std::memory_order_release);
+        try {
+            Enter(1, 0, 0);
+        } catch (const std::system_error&) {
+            // The kernel didn't take the entry, take it back.
+            std::atomic_ref{*m_sqTail}.store(tail, std::memory_order_release);
+            m_pending.erase(entry);
+            throw;
+        }
+    }
+
+    /// @brief Waits for \a minComplete writes to finish, and reaps all that have.
+    void Wait(unsigned minComplete, std::vector<Completion>& done) {
+        if (minComplete != 0) {
+            Enter(0, minComplete, IORING_ENTER_GETEVENTS);
+        }
+
+        auto head{*m_cqHead};
+        const auto tail{std::atomic_ref{*m_cqTail}.load(std::memory_order_acquire)};
+        for (; head != tail; ++head) {
+            const auto& cqe{m_cqes[head & *m_cqMask]};
+            done.push_back(Finish(cqe.user_data, cqe.res));
+        }
+        std::atomic_ref{*m_cqHead}.store(head, std::memory_order_release);
+    }
+
+    std::size_t InFlight() const noexcept { return m_pending.size(); }
+
+    /// @brief Reports every write in flight as failed with \a error, to stop waiting for a ring that has failed.
+    void Abandon(std::error_code error, std::vector<Completion>& done) {
+        for (const auto& [tag, pending] : m_pending) {
+            done.push_back({tag, error});
+        }
+        m_pending.clear();
+    }
+
+private:
+    /// @brief What a write in flight needs once it finishes short, and the iovec a plain write reads.
+    struct Pending {
+        int File;
+        std::span<const std::byte> Data;
+        std::uint64_t Offset;
+        iovec Vector;
+    };
+
+    Ring() = default;
+
+    bool Map(const io_uring_params& parameters) {
+        const auto map = [this](std::size_t size, std::uint64_t offset) {
+            const auto mapping{::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, static_cast<off_t>(offset))};
+            return mapping == MAP_FAILED ? nullptr : static_cast<std::byte*>(mapping);
+        };
+
+        m_sqRingSize = parameters.sq_off.array + parameters.sq_entries * sizeof(std::uint32_t);
+        m_cqRingSize = parameters.cq_off.cqes + parameters.cq_entries * sizeof(io_uring_cqe);
+        const bool singleMapping{(parameters.features & IORING_FEAT_SINGLE_MMAP) != 0};
+        if (singleMapping) {
+            m_sqRingSize = m_cqRingSize = std::max(m_sqRingSize, m_cqRingSize);
+        }
+
+        m_sqRing = map(m_sqRingSize, IORING_OFF_SQ_RING);
+        m_cqRing = singleMapping ? m_sqRing : map(m_cqRingSize, IORING_OFF_CQ_RING);
+        m_sqesSize = parameters.sq_entries * sizeof(io_uring_sqe);
+        m_sqes = reinterpret_cast<io_uring_sqe*>(map(m_sqesSize, IORING_OFF_SQES));
+        if (m_sqRing == nullptr || m_cqRing == nullptr || m_sqes == nullptr) {
+            return false;
+        }
+
+        m_sqTail = reinterpret_cast<std::uint32_t*>(m_sqRing + parameters.sq_off.tail);
+        m_sqMask = reinterpret_cast<std::uint32_t*>(m_sqRing + parameters.sq_off.ring_mask);
+        m_sqArray = reinterpret_cast<std::uint32_t*>(m_sqRing + parameters.sq_off.array);
+        m_cqHead = reinterpret_cast<std::uint32_t*>(m_cqRing + parameters.cq_off.head);
+        m_cqTail = reinterpret_cast<std::uint32_t*>(m_cqRing + parameters.cq_off.tail);
+        m_cqMask = reinterpret_cast<std::uint32_t*>(m_cqRing + parameters.cq_off.ring_mask);
+        m_cqes = reinterpret_cast<io_uring_cqe*>(m_cqRing + parameters.cq_off.cqes);
+        return true;
+    }
+
+    /// @brief Best effort: registered memory counts against RLIMIT_MEMLOCK on older kernels, without it writes go through iovecs.
+    void Register(std::span<const std::span<std::byte>> memory) {
+        std::vector<iovec> vectors;
+        for (const auto& region : memory) {
+            vectors.push_back({region.data(), region.size()});
+        }
+        if (!vectors.empty() && ::syscall(__NR_io_uring_register, m_fd, IORING_REGISTER_BUFFERS, vectors.data(), static_cast<unsigned>(vectors.size())) == 0) {
+            m_registered.assign(memory.begin(), memory.end());
+        }
+    }
+
+    std::optional<std::size_t> RegisteredIndex(std::span<const std::byte> data) const noexcept {
+        for (std::size_t index = 0; index != m_registered.size(); ++index) {
+            const auto& region{m_registered[index]};
+            if (data.data() >= region.data() && data.data() + data.size() <= region.data() + region.size()) {
+                return index;
+            }
+        }
+        return std::nullopt;
+    }
+
+    void Enter(unsigned submit, unsigned minComplete, unsigned flags) {
+        while (::syscall(__NR_io_uring_enter, m_fd, submit, minComplete, flags, nullptr, 0) < 0) {
+            if (errno != EINTR) {
+                throw std::system_error{errno, std::generic_category(), "io_uring_enter"};
+            }
+        }
+    }
+
+    /// @brief Completes the write \a tag with its \a result, writing what the kernel left out of a short write.
+    Completion Finish(std::uint64_t tag, std::int32_t result) {
+        const auto entry{m_pending.find(tag)};
+        Completion completion{tag, {}};
+        if (result < 0) {
+            completion.Error = {-result, std::generic_category()};
+        } else if (entry != m_pending.end() && static_cast<std::size_t>(result) < entry->second.Data.size()) {
+            const auto& pending{entry->second};
+            completion.Error = WriteAt(pending.File, pending.Data.subspan(static_cast<std::size_t>(result)), pending.Offset + static_cast<std::uint64_t>(result));
+        }
+        if (entry != m_pending.end()) {
+            m_pending.erase(entry);
+        }
+        return completion;
+    }
+
+    int m_fd{-1};
+
+    std::byte* m_sqRing{nullptr};
+    std::size_t m_sqRingSize{0};
+    std::byte* m_cqRing{nullptr};
+    std::size_t m_cqRingSize{0};
+    io_uring_sqe* m_sqes{nullptr};
+    std::size_t m_sqesSize{0};
+
+    std::uint32_t* m_sqTail{nullptr};
+    std::uint32_t* m_sqMask{nullptr};
+    std::uint32_t* m_sqArray{nullptr};
+    std::uint32_t* m_cqHead{nullptr};
+    std::uint32_t* m_cqTail{nullptr};
+    std::uint32_t* m_cqMask{nullptr};
+    io_uring_cqe* m_cqes{nullptr};
+
+    /// @brief Memory registered with the kernel, by registration index.
+    std::vector<std::span<std::byte>> m_registered;
+
+    /// @brief Writes in flight, by tag. Nodes don't move, so the kernel can read their iovecs until the write is submitted.
+    std::unordered_map<std::uint64_t, Pending> m_pending;
+};
+#else
+class EtwLog::Detail::FileWriter::Ring {
+public:
+    static std::unique_ptr<Ring> Create(std::span<const std::span<std::byte>>, std::size_t) { return {}; }
+
+    void Submit(int, std::span<const std::byte>, std::uint64_t, std::uint64_t) {}
+    void Wait(unsigned, std::vector<Completion>&) {}
+    std::size_t InFlight() const noexcept { return 0; }
+    void Abandon(std::error_code, std::vector<Completion>&) {}
+};
+#endif
+
+EtwLog::Detail::FileWriter::FileWriter(std::span<const std::span<std::byte>> memory, std::size_t maxInFlight, bool ioUring)
+    :
+    m_ring{ioUring ? Ring::Create(memory, std::max<std::size_t>(maxInFlight, 1)) : nullptr}
+{}
+
+EtwLog::Detail::FileWriter::~FileWriter() {
+    std::vector<Completion> done;
+    WaitAll(done);
+}
+
+void EtwLog::Detail::FileWriter::Write(int file, std::span<const std::byte> data, std::uint64_t offset, std::uint64_t tag, std::vector<Completion>& done) {
+    if (!m_ring) {
+        done.push_back({tag, WriteAt(file, data, offset)});
+        return;
+    }
+
+    try {
+        m_ring->Submit(file, data, offset, tag);
+    } catch (const std::system_error&) {
+        done.push_back({tag, WriteAt(file, data, offset)});
+        return;
+    }
+    Wait(0, done);
+}
+
+void EtwLog::Detail::FileWriter::WaitSome(std::vector<Completion>& done) {
+    if (m_ring && m_ring->InFlight() != 0) {
+        Wait(1, done);
+    }
+}
+
+void EtwLog::Detail::FileWriter::WaitAll(std::vector<Completion>& done) {
+    while (m_ring && m_ring->InFlight() != 0) {
+        Wait(static_cast<unsigned>(m_ring->InFlight()), done);
+    }
+}
+
+void EtwLog::Detail::FileWriter::Wait(unsigned minComplete, std::vector<Completion>& done) {
+    try {
+        m_ring->Wait(minComplete, done);
+    } catch (const std::system_error& e) {
+        // Can't tell how the writes in flight went, report them failed and continue without io_uring.
+        m_ring->Abandon(e.code(), done);
+        m_ring.reset();
+    }
+}
+
+std::size_t EtwLog::Detail::FileWriter::InFlight() const noexcept {
+    return m_ring ? m_ring->InFlight() : 0;
+}
+
+bool EtwLog::Detail::FileWriter::IsAsync() const noexcept {
+    return m_ring != nullptr;
+}
+
+std::error_code EtwLog::Detail::WriteAt(int file, std::span<const std::byte> data, std::uint64_t offset) noexcept {
+    while (!data.empty()) {
+#ifdef _WIN32
+        OVERLAPPED position{};
+        position.Offset = static_cast<DWORD>(offset);
+        position.OffsetHigh = static_cast<DWORD>(offset >> 32);
+        DWORD written{0};
+        const auto chunk{static_cast<DWORD>(std::min<std::size_t>(data.size(), 1u << 30))};
+        if (!::WriteFile(reinterpret_cast<HANDLE>(::_get_osfhandle(file)), data.data(), chunk, &written, &position)) {
+            return {static_cast<int>(::GetLastError()), std::system_category()};
+        }
+#else
+        const auto written{::pwrite(file, data.data(), data.size(), static_cast<off_t>(offset))};
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return {errno, std::generic_category()};
+        }
+#endif
+        data = data.subspan(static_cast<std::size_t>(written));
+        offset += static_cast<std::uint64_t>(written);
+    }
+    return {};
+}
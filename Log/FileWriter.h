@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <system_error>
+#include <vector>
+
+namespace EtwLog::Detail
+{
+    /// @brief Writes buffers to files at given offsets, for the flush thread of \a PortableSink.
+    /// With io_uring (Linux 5.1 and later) several writes are in flight at once, from memory registered with the kernel
+    /// so it isn't mapped again for every write. Otherwise, or when the kernel or a sandbox refuses io_uring,
+    /// each write is done right away with pwrite (WriteFile on Windows), and finishes before \a Write returns.
+    /// A write the ring won't take is done with pwrite too; if waiting on the ring fails, the writes in flight are
+    /// reported failed and the ring is dropped for good.
+    /// @note Not thread safe: used by the flush thread only.
+    class FileWriter {
+    public:
+        /// @brief A write that finished, with the tag it was started with.
+        struct Completion {
+            std::uint64_t Tag;
+            std::error_code Error;
+        };
+
+        /// @param memory - where all buffers written from live. Registered with io_uring, writes from elsewhere can't use it.
+        /// @param maxInFlight - writes in flight at most, which the ring is sized for. Up to the caller to keep to.
+        /// @param ioUring - whether to try io_uring at all.
+        FileWriter(std::span<const std::span<std::byte>> memory, std::size_t maxInFlight, bool ioUring);
+
+        /// @brief Waits for the writes in flight, so the memory they are written from can go.
+        ~FileWriter();
+
+        FileWriter(const FileWriter&) = delete;
+        FileWriter& operator=(const FileWriter&) = delete;
+
+        /// @brief Starts writing \a data to \a file at \a offset. Writes that finished meanwhile are appended to \a done.
+        /// @param file - file descriptor, open for writing.
+        void Write(int file, std::span<const std::byte> data, std::uint64_t offset, std::uint64_t tag, std::vector<Completion>& done);
+
+        /// @brief Waits for at least one write in flight to finish, and appends the finished ones to \a done.
+        void WaitSome(std::vector<Completion>& done);
+
+        /// @brief Waits for every write in flight, such as before a file is closed.
+        void WaitAll(std::vector<Completion>& done);
+
+        std::size_t InFlight() const noexcept;
+
+        /// @brief True if writes go through io_uring.
+        bool IsAsync() const noexcept;
+
+    private:
+        class Ring;
+
+        /// @brief Waits on the ring, dropping it if that fails.
+        void Wait(unsigned minComplete, std::vector<Completion>& done);
+
+        /// @brief Empty without io_uring.
+        std::unique_ptr<Ring> m_ring;
+    };
+
+    /// @brief Writes all of \a data to \a file at \a offset, however many calls it takes.
+    std::error_code WriteAt(int file, std::span<const std::byte> data, std::uint64_t offset) noexcept;
+} // EtwLog::Detail
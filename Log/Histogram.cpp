@@ -0,0 +1,137 @@
+#include "pch.h"
+#include "Histogram.h"
+#include "LogReader.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+void EtwLog::Histogram::Add(std::uint64_t value, std::uint64_t count) {
+    if (count == 0) {
+        return;
+    }
+    AddToBucket(BucketOf(value), count);
+    m_sum += value * count;
+    m_min = std::min(m_min, value);
+    m_max = std::max(m_max, value);
+}
+
+void EtwLog::Histogram::AddToBucket(std::size_t bucket, std::uint64_t count) {
+    if (m_buckets.empty()) {
+        m_buckets.resize(c_bucketCount);
+    }
+    m_buckets[bucket] += count;
+    m_count += count;
+}
+
+void EtwLog::Histogram::AddTotals(std::uint64_t sum, std::uint64_t min, std::uint64_t max) noexcept {
+    m_sum += sum;
+    m_min = std::min(m_min, min);
+    m_max = std::max(m_max, max);
+}
+
+void EtwLog::Histogram::Merge(const Histogram& other) {
+    if (other.m_count == 0) {
+        return;
+    }
+    for (std::size_t bucket = 0; bucket != c_bucketCount; ++bucket) {
+        if (other.m_buckets[bucket] != 0) {
+            AddToBucket(bucket, other.m_buckets[bucket]);
+        }
+    }
+    AddTotals(other.m_sum, other.m_min, other.m_max);
+}
+
+std::uint64_t EtwLog::Histogram::ValueAtQuantile(double quantile) const noexcept {
+    if (m_count == 0) {
+        return 0;
+    }
+
+    // Rank of the value asked for, from 1.
+    const auto rank{std::max<std::uint64_t>(1, static_cast<std::uint64_t>(std::ceil(std::clamp(quantile, 0.0, 1.0) * static_cast<double>(m_count))))};
+    std::uint64_t seen{0};
+    for (std::size_t bucket = 0; bucket != c_bucketCount; ++bucket) {
+        seen += m_buckets[bucket];
+        if (seen >= rank) {
+            return std::clamp(BucketHighest(bucket), Min(), m_max);
+        }
+    }
+    return m_max;
+}
+
+EtwLog::Histogram EtwLog::LatencyHistogram::TakeInterval() noexcept {
+    Histogram interval;
+    for (std::size_t bucket = 0; bucket != m_buckets.size(); ++bucket) {
+        // Most buckets are empty: looking first saves writing to their cache lines.
+        if (m_buckets[bucket].load(std::memory_order_relaxed) != 0) {
+            interval.AddToBucket(bucket, m_buckets[bucket].exchange(0, std::memory_order_relaxed));
+        }
+    }
+    interval.AddTotals(
+        m_sum.exchange(0, std::memory_order_relaxed),
+        m_min.exchange(UINT64_MAX, std::memory_order_relaxed),
+        m_max.exchange(0, std::memory_order_relaxed));
+    return interval;
+}
+
+std::vector<std::byte> EtwLog::EncodeHistogramSnapshot(std::uint32_t key, std::chrono::nanoseconds interval, const Histogram& histogram) {
+    std::vector<HistogramBucket> buckets;
+    const auto counts{histogram.Buckets()};
+    for (std::size_t bucket = 0; bucket != counts.size(); ++bucket) {
+        if (counts[bucket] != 0) {
+            buckets.push_back({static_cast<std::uint32_t>(bucket), 0, counts[bucket]});
+        }
+    }
+
+    const HistogramSnapshotHeader header{
+        key, static_cast<std::uint32_t>(buckets.size()), static_cast<std::uint64_t>(interval.count()), histogram.Sum(), histogram.Min(), histogram.Max()};
+    std::vector<std::byte> payload(sizeof(header) + buckets.size() * sizeof(HistogramBucket));
+    std::memcpy(payload.data(), &header, sizeof(header));
+    std::memcpy(payload.data() + sizeof(header), buckets.data(), buckets.size() * sizeof(HistogramBucket));
+    return payload;
+}
+
+std::optional<EtwLog::HistogramSnapshot> EtwLog::DecodeHistogramSnapshot(const RecordView& record) {
+    if (record.Event.Id != EventIds::HistogramSnapshot) {
+        return {};
+    }
+    return DecodeHistogramSnapshot(record.Payload, record.Time);
+}
+
+std::optional<EtwLog::HistogramSnapshot> EtwLog::DecodeHistogramSnapshot(std::span<const std::byte> payload, std::chrono::sys_time<std::chrono::nanoseconds> end) {
+    HistogramSnapshotHeader header;
+    if (payload.size() < sizeof(header)) {
+        return {};
+    }
+    std::memcpy(&header, payload.data(), sizeof(header));
+    if (payload.size() != sizeof(header) + std::size_t{header.BucketCount} * sizeof(HistogramBucket)) {
+        return {};
+    }
+
+    HistogramSnapshot snapshot{header.Key, end - std::chrono::nanoseconds{header.IntervalNanoseconds}, end, {}};
+    for (std::uint32_t b = 0; b != header.BucketCount; ++b) {
+        HistogramBucket bucket;
+        std::memcpy(&bucket, payload.data() + sizeof(header) + b * sizeof(bucket), sizeof(bucket));
+        if (bucket.Index >= Histogram::c_bucketCount) {
+            return {};
+        }
+        snapshot.Histogram.AddToBucket(bucket.Index, bucket.Count);
+    }
+    snapshot.Histogram.AddTotals(header.Sum, header.Min, header.Max);
+    return snapshot;
+}
+
+std::map<std::uint32_t, EtwLog::Histogram> EtwLog::ReadHistograms(std::span<const std::filesystem::path> logs, const RecordFilter& filter) {
+    auto snapshots{filter};
+    snapshots.EventId = EventIds::HistogramSnapshot;
+
+    std::map<std::uint32_t, Histogram> merged;
+    for (const auto& log : logs) {
+        ReadLog(log, snapshots, [&merged](const RecordView& record) {
+            if (const auto snapshot{DecodeHistogramSnapshot(record)}) {
+                merged[snapshot->Key].Merge(snapshot->Histogram);
+            }
+        });
+    }
+    return merged;
+}
@@ -0,0 +1,165 @@
+#pragma once
+
+#include "Record.h"
+
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <optional>
+#include <span>
+#include <vector>
+
+namespace EtwLog
+{
+    struct RecordFilter;
+
+    /// @brief Counts of values in log-linear buckets, like HdrHistogram: values below 128 are counted exactly,
+    /// larger ones in 64 buckets per power of two, so a value is known to within 1/64 (1.6%) of itself up to UINT64_MAX.
+    /// Histograms of the same values add up bucket by bucket, so snapshots of any intervals and logs can be merged.
+    class Histogram {
+    public:
+        static constexpr std::size_t c_exactValues{128};
+        static constexpr std::size_t c_subBuckets{64};
+        static constexpr std::size_t c_bucketCount{c_exactValues + (64 - 7) * c_subBuckets};
+
+        /// @brief Bucket counting \a value.
+        static constexpr std::size_t BucketOf(std::uint64_t value) noexcept {
+            if (value < c_exactValues) {
+                return static_cast<std::size_t>(value);
+            }
+            // Values from 2^(group + 6) on are counted in buckets 2^group wide.
+            const auto group{static_cast<std::size_t>(std::bit_width(value)) - 7};
+            return c_exactValues + (group - 1) * c_subBuckets + static_cast<std::size_t>(value >> group) - c_subBuckets;
+        }
+
+        /// @brief Lowest value \a bucket counts.
+        static constexpr std::uint64_t BucketLowest(std::size_t bucket) noexcept {
+            if (bucket < c_exactValues) {
+                return bucket;
+            }
+            const auto group{(bucket - c_exactValues) / c_subBuckets + 1};
+            return static_cast<std::uint64_t>((bucket - c_exactValues) % c_subBuckets + c_subBuckets) << group;
+        }
+
+        /// @brief Highest value \a bucket counts.
+        static constexpr std::uint64_t BucketHighest(std::size_t bucket) noexcept {
+            return bucket + 1 == c_bucketCount ? UINT64_MAX : BucketLowest(bucket + 1) - 1;
+        }
+
+        void Add(std::uint64_t value, std::uint64_t count = 1);
+
+        /// @brief Adds \a count values of \a bucket, whose sum, minimum and maximum are given by \a AddTotals.
+        void AddToBucket(std::size_t bucket, std::uint64_t count);
+
+        /// @brief Sets the sum, minimum and maximum of values added with \a AddToBucket.
+        void AddTotals(std::uint64_t sum, std::uint64_t min, std::uint64_t max) noexcept;
+
+        void Merge(const Histogram& other);
+
+        std::uint64_t Count() const noexcept { return m_count; }
+        std::uint64_t Sum() const noexcept { return m_sum; }
+
+        /// @brief Zero for an empty histogram.
+        std::uint64_t Min() const noexcept { return m_count == 0 ? 0 : m_min; }
+        std::uint64_t Max() const noexcept { return m_max; }
+        double Mean() const noexcept { return m_count == 0 ? 0.0 : static_cast<double>(m_sum) / static_cast<double>(m_count); }
+
+        /// @brief Value that \a quantile (0 to 1) of the values are at or below, such as 0.999 for the 99.9th percentile:
+        /// the highest value of its bucket, but no more than \a Max. Zero for an empty histogram.
+        std::uint64_t ValueAtQuantile(double quantile) const noexcept;
+
+        /// @brief Count of each bucket, empty while nothing was added.
+        std::span<const std::uint64_t> Buckets() const noexcept { return m_buckets; }
+
+    private:
+        std::vector<std::uint64_t> m_buckets;
+        std::uint64_t m_count{0};
+        std::uint64_t m_sum{0};
+        std::uint64_t m_min{UINT64_MAX};
+        std::uint64_t m_max{0};
+    };
+
+    /// @brief Latencies recorded by many threads without locks, in a \a Histogram's buckets. Got from \a MiniLog::Latencies.
+    /// The logger writes what was recorded in each interval as an \a EventIds::HistogramSnapshot record, and starts counting anew.
+    class LatencyHistogram {
+    public:
+        LatencyHistogram() = default;
+
+        LatencyHistogram(const LatencyHistogram&) = delete;
+        LatencyHistogram& operator=(const LatencyHistogram&) = delete;
+
+        /// @brief Negative latencies are counted as zero.
+        void Record(std::chrono::nanoseconds latency) noexcept {
+            RecordValue(latency.count() < 0 ? 0 : static_cast<std::uint64_t>(latency.count()));
+        }
+
+        /// @brief Costs two relaxed atomic adds, plus a compare and swap for a new minimum or maximum of the interval.
+        void RecordValue(std::uint64_t value) noexcept {
+            m_buckets[Histogram::BucketOf(value)].fetch_add(1, std::memory_order_relaxed);
+            m_sum.fetch_add(value, std::memory_order_relaxed);
+
+            auto min{m_min.load(std::memory_order_relaxed)};
+            while (value < min && !m_min.compare_exchange_weak(min, value, std::memory_order_relaxed)) {
+            }
+            auto max{m_max.load(std::memory_order_relaxed)};
+            while (value > max && !m_max.compare_exchange_weak(max, value, std::memory_order_relaxed)) {
+            }
+        }
+
+        /// @brief Takes the values recorded since the last call, leaving the histogram empty.
+        /// A value recorded meanwhile is counted in this interval or the next, with its sum, minimum and maximum possibly in the other.
+        Histogram TakeInterval() noexcept;
+
+    private:
+        std::array<std::atomic<std::uint64_t>, Histogram::c_bucketCount> m_buckets{};
+        std::atomic<std::uint64_t> m_sum{0};
+        std::atomic<std::uint64_t> m_min{UINT64_MAX};
+        std::atomic<std::uint64_t> m_max{0};
+    };
+
+    /// @brief Start of the payload of an \a EventIds::HistogramSnapshot record, followed by \a BucketCount \a HistogramBucket entries,
+    /// one for each bucket that counted anything in the interval. The record's time is the end of the interval.
+    /// @note Part of the on-disk format, so it is written and read as raw bytes.
+    struct HistogramSnapshotHeader {
+        /// @brief Key of the histogram, as passed to \a MiniLog::Latencies.
+        std::uint32_t Key;
+        std::uint32_t BucketCount;
+        std::uint64_t IntervalNanoseconds;
+        std::uint64_t Sum;
+        std::uint64_t Min;
+        std::uint64_t Max;
+    };
+
+    /// @note Part of the on-disk format, so it is written and read as raw bytes.
+    struct HistogramBucket {
+        std::uint32_t Index;
+        std::uint32_t Reserved;
+        std::uint64_t Count;
+    };
+
+    /// @brief What an \a EventIds::HistogramSnapshot record holds.
+    struct HistogramSnapshot {
+        std::uint32_t Key;
+        std::chrono::sys_time<std::chrono::nanoseconds> Begin;
+        std::chrono::sys_time<std::chrono::nanoseconds> End;
+        EtwLog::Histogram Histogram;
+    };
+
+    /// @brief Payload of an \a EventIds::HistogramSnapshot record for the values \a histogram took over \a interval.
+    std::vector<std::byte> EncodeHistogramSnapshot(std::uint32_t key, std::chrono::nanoseconds interval, const Histogram& histogram);
+
+    /// @brief Reads a snapshot back, empty if \a record isn't one or is damaged.
+    std::optional<HistogramSnapshot> DecodeHistogramSnapshot(const RecordView& record);
+
+    /// @brief Same as above, for a snapshot's \a payload found elsewhere than as a record's, over the interval up to \a end.
+    std::optional<HistogramSnapshot> DecodeHistogramSnapshot(std::span<const std::byte> payload, std::chrono::sys_time<std::chrono::nanoseconds> end);
+
+    /// @brief Merges the snapshots in \a logs, written by either backend, into one histogram per key.
+    /// @param filter - which snapshots to merge, such as those of a time range. Its event id is set to \a EventIds::HistogramSnapshot.
+    std::map<std::uint32_t, Histogram> ReadHistograms(std::span<const std::filesystem::path> logs, const RecordFilter& filter);
+} // EtwLog
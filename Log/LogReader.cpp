@@ -0,0 +1,559 @@
+#include "pch.h"
+#include "LogReader.h"
+#include "MiniEtwLog.h"
+#include "PortableFormat.h"
+#include "RecordScan.h"
+
+#ifdef _WIN32
+#include <Windows.h>
+#include <initguid.h>
+#include <evntrace.h>
+#include <evntcons.h>
+#endif
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <optional>
+#include <stdexcept>
+#include <utility>
+
+namespace
+{
+    using EtwLog::RecordHeader;
+    using EtwLog::RecordView;
+
+    bool IsPortableLog(const std::filesystem::path& file) {
+        std::ifstream stream{file, std::ios::binary};
+        char magic[sizeof(EtwLog::Portable::c_magic)]{};
+        stream.read(magic, sizeof(magic));
+        return stream && std::equal(std::begin(magic), std::end(magic), std::begin(EtwLog::Portable::c_magic));
+    }
+
+    /// @brief Bytes of a portable log read from the file at once. Grows for a record that is larger.
+    constexpr std::size_t c_readChunkSize{4 * 1024 * 1024};
+
+    /// @brief Full check of \a filter, for the records \a SelectRecords kept and for ETW records.
+    /// @param checkPayload - false for a fragment, whose payload is only checked once reassembled.
+    bool Selects(const EtwLog::RecordFilter& filter, const RecordView& record, bool checkPayload = true) {
+        const auto& prefix{filter.PayloadPrefix};
+        return (!filter.Provider || record.Provider == *filter.Provider)
+            && (!filter.EventId || record.Event.Id == *filter.EventId)
+            && (!filter.MaxLevel || record.Event.Level <= *filter.MaxLevel)
+            && (filter.KeywordMask == 0 || (record.Event.Keyword & filter.KeywordMask) != 0)
+            && (!filter.Begin || record.Time >= *filter.Begin)
+            && (!filter.End || record.Time < *filter.End)
+            && (!checkPayload || (record.Payload.size() >= prefix.size() && std::equal(prefix.begin(), prefix.end(), record.Payload.begin())));
+    }
+
+    /// @brief The part of \a filter that can be tested on record frames, with times converted to ticks of \a clock.
+    /// The time range is widened by a microsecond for rounding errors, \a Selects has the final word on it.
+    EtwLog::Portable::FrameFilter ToFrameFilter(const EtwLog::RecordFilter& filter, const EtwLog::ClockCalibration& clock) {
+        EtwLog::Portable::FrameFilter frameFilter;
+        frameFilter.EventId = filter.EventId;
+        if (filter.MaxLevel) {
+            frameFilter.MaxLevel = static_cast<std::uint8_t>(*filter.MaxLevel);
+        }
+        frameFilter.KeywordMask = filter.KeywordMask;
+
+        const auto slack{static_cast<std::uint64_t>(clock.TicksPerSecond / 1'000'000) + 1};
+        if (filter.Begin) {
+            const auto ticks{EtwLog::ToTicks(clock, *filter.Begin)};
+            frameFilter.FirstTicks = ticks > slack ? ticks - slack : 0;
+        }
+        if (filter.End) {
+            const auto ticks{EtwLog::ToTicks(clock, *filter.End)};
+            frameFilter.LastTicks = ticks < UINT64_MAX - slack ? ticks + slack : UINT64_MAX;
+        }
+        return frameFilter;
+    }
+
+    /// @brief A record as it is stored, with the \a FragmentHeader of the larger payload it holds a piece of, if any.
+    struct StoredRecord {
+        RecordView View;
+        std::optional<EtwLog::FragmentHeader> Fragment;
+    };
+
+    /// @brief Takes the extra headers the \a RecordFlags in \a flags announce off the front of the payload of \a record.
+    /// Without a \a clock to convert the first repeat's time, a run of repeats is reported at the time of its last one.
+    void ReadExtraHeaders(std::uint8_t flags, const EtwLog::ClockCalibration* clock, StoredRecord& record) {
+        auto& view{record.View};
+        if ((flags & EtwLog::RecordFlags::Repeated) != 0 && view.Payload.size() >= sizeof(EtwLog::RepeatHeader)) {
+            EtwLog::RepeatHeader repeat;
+            std::memcpy(&repeat, view.Payload.data(), sizeof(repeat));
+            view.Repeats = repeat.Count;
+            if (clock != nullptr) {
+                view.FirstTime = EtwLog::ToSystemTime(*clock, repeat.FirstTimestamp);
+            }
+            view.Payload = view.Payload.subspan(sizeof(repeat));
+        }
+        if ((flags & EtwLog::RecordFlags::Fragment) != 0 && view.Payload.size() >= sizeof(EtwLog::FragmentHeader)) {
+            record.Fragment.emplace();
+            std::memcpy(&*record.Fragment, view.Payload.data(), sizeof(EtwLog::FragmentHeader));
+            view.Payload = view.Payload.subspan(sizeof(EtwLog::FragmentHeader));
+        }
+        if ((flags & EtwLog::RecordFlags::Activity) != 0 && view.Payload.size() >= sizeof(EtwLog::ActivityHeader)) {
+            view.Activity.emplace();
+            std::memcpy(&*view.Activity, view.Payload.data(), sizeof(EtwLog::ActivityHeader));
+            view.Payload = view.Payload.subspan(sizeof(EtwLog::ActivityHeader));
+        }
+    }
+
+    /// @brief Largest payload one record carries: a whole buffer of the largest size the portable sink takes. ETW's are smaller.
+    constexpr std::uint64_t c_maxFragmentSize{16 * 1024 * 1024};
+
+    /// @brief Checks \a fragment, carrying \a size bytes, against the way MiniLog splits a payload: every fragment but the last
+    /// is as large as a record allows, and the last one ends the payload. So a damaged header, which ETW doesn't checksum,
+    /// can't have the reader allocate more than the fragments it claims could carry.
+    bool IsPlausible(const EtwLog::FragmentHeader& fragment, std::uint64_t size) noexcept {
+        if (fragment.Index >= fragment.Count || size == 0 || size > c_maxFragmentSize) {
+            return false;
+        }
+        if (fragment.Index + 1 == fragment.Count) {
+            return fragment.Offset <= fragment.Index * c_maxFragmentSize && fragment.PayloadSize == fragment.Offset + size;
+        }
+        return fragment.Offset == fragment.Index * size && fragment.PayloadSize > (fragment.Count - 1) * size && fragment.PayloadSize <= fragment.Count * size;
+    }
+
+    /// @brief Passes the records read to the callback: whole records as they come, fragments once the payload they are part of is complete.
+    /// Fragments are put together by offset, so they may come in any order, interleaved with other records, as ETW may deliver them.
+    /// A fragment delivered twice is only put in once.
+    class RecordDelivery {
+    public:
+        RecordDelivery(const EtwLog::RecordFilter& filter, const std::function<void(const RecordView&)>& callback, EtwLog::LogReadResult& result)
+            :
+            m_filter{filter},
+            m_callback{callback},
+            m_result{result}
+        {}
+
+        RecordDelivery(const RecordDelivery&) = delete;
+        RecordDelivery& operator=(const RecordDelivery&) = delete;
+
+        /// @brief Takes an intact record that \a Selects, short of the payload of a fragment.
+        void Offer(const StoredRecord& record) {
+            if (!record.Fragment) {
+                m_callback(record.View);
+                ++m_result.Records;
+                return;
+            }
+
+            const auto& fragment{*record.Fragment};
+            const auto& view{record.View};
+            if (!IsPlausible(fragment, view.Payload.size()) || view.Header.Sequence < fragment.Index) {
+                ++m_result.IncompleteRecords;
+                return;
+            }
+
+            // Fragments of a payload have consecutive sequence numbers, so the first one names the record.
+            const auto first{view.Header.Sequence - fragment.Index};
+            auto [entry, inserted]{m_pending.try_emplace(first)};
+            auto& pending{entry->second};
+            if (inserted) {
+                pending.View = view;
+                pending.View.Header.Sequence = first;
+                pending.View.Fragments = fragment.Count;
+                pending.Payload.resize(fragment.PayloadSize);
+                pending.Arrived.resize(fragment.Count);
+            } else if (pending.Arrived.size() != fragment.Count || pending.Payload.size() != fragment.PayloadSize) {
+                // Not a fragment of this payload: the record it belongs to is counted as incomplete with the others.
+                return;
+            }
+            if (pending.Arrived[fragment.Index]) {
+                return;
+            }
+            pending.Arrived[fragment.Index] = true;
+
+            std::copy(view.Payload.begin(), view.Payload.end(), pending.Payload.begin() + static_cast<std::ptrdiff_t>(fragment.Offset));
+            if (++pending.Received != fragment.Count) {
+                return;
+            }
+
+            pending.View.Payload = pending.Payload;
+            if (Selects(m_filter, pending.View)) {
+                m_callback(pending.View);
+                ++m_result.Records;
+            } else {
+                ++m_result.RecordsFiltered;
+            }
+            m_pending.erase(entry);
+        }
+
+        /// @brief Counts the records still missing fragments at the end of the log.
+        void Finish() {
+            m_result.IncompleteRecords += m_pending.size();
+            m_pending.clear();
+        }
+
+    private:
+        /// @brief A payload being put together, and the record it belongs to.
+        struct Pending {
+            RecordView View;
+            std::vector<std::byte> Payload;
+
+            /// @brief Fragments put in so far, by index, and how many.
+            std::vector<bool> Arrived;
+            std::uint32_t Received{0};
+        };
+
+        const EtwLog::RecordFilter& m_filter;
+        const std::function<void(const RecordView&)>& m_callback;
+        EtwLog::LogReadResult& m_result;
+
+        /// @brief By the sequence number of the first fragment.
+        std::map<std::uint64_t, Pending> m_pending;
+    };
+
+    StoredRecord ReadPortableRecord(const EtwLog::Portable::FileHeader& header, const std::byte* record) {
+        using EtwLog::Portable::RecordFrame;
+
+        RecordFrame frame;
+        std::memcpy(&frame, record, sizeof(frame));
+
+        StoredRecord stored;
+        auto& view{stored.View};
+        view.Provider = header.Provider;
+        view.Event = {frame.EventId, frame.Level, frame.Keyword};
+        std::memcpy(&view.Header, record + sizeof(frame), sizeof(RecordHeader));
+        view.Time = EtwLog::ToSystemTime(header.Clock, view.Header.Timestamp);
+        view.FirstTime = view.Time;
+        view.Payload = {record + sizeof(frame) + sizeof(RecordHeader), frame.Size - sizeof(RecordHeader)};
+
+        ReadExtraHeaders(frame.Flags, &header.Clock, stored);
+        return stored;
+    }
+
+    bool IsIntact(const std::byte* record) {
+        using EtwLog::Portable::RecordFrame;
+
+        RecordFrame frame;
+        std::memcpy(&frame, record, sizeof(frame));
+        return EtwLog::Portable::RecordCrc({record, sizeof(frame) + frame.Size}) == frame.Crc;
+    }
+
+    /// @brief Reads one segment of a portable log, many records at a time. Records are passed to \a delivery straight from the read buffer.
+    /// @return false if the rest of the log shouldn't be read: the segment ends with something other than a valid record, or belongs to another provider.
+    bool ReadPortableSegment(
+        const std::filesystem::path& file,
+        const EtwLog::RecordFilter& filter,
+        RecordDelivery& delivery,
+        EtwLog::LogReadResult& result)
+    {
+        using namespace EtwLog::Portable;
+
+        std::ifstream stream{file, std::ios::binary};
+        FileHeader header;
+        if (!stream.read(reinterpret_cast<char*>(&header), sizeof(header)) || header.Version < c_minVersion || header.Version > c_version || header.HeaderSize < sizeof(header)) {
+            throw std::runtime_error{"Unsupported portable log header in " + file.string()};
+        }
+        if (filter.Provider && header.Provider != *filter.Provider) {
+            return false;
+        }
+        stream.seekg(header.HeaderSize);
+
+        const auto frameFilter{ToFrameFilter(filter, header.Clock)};
+        const auto fileSize{std::filesystem::file_size(file)};
+        std::uint64_t validBytes{header.HeaderSize};
+
+        std::vector<std::byte> buffer(c_readChunkSize);
+        std::vector<std::uint32_t> offsets;
+        std::vector<std::uint32_t> selected;
+        std::size_t filled{0};
+        for (;;) {
+            stream.read(reinterpret_cast<char*>(buffer.data() + filled), static_cast<std::streamsize>(buffer.size() - filled));
+            const auto read{static_cast<std::size_t>(stream.gcount())};
+            filled += read;
+
+            const std::span<const std::byte> records{buffer.data(), filled};
+            offsets.clear();
+            const auto scan{ScanRecords(records, offsets)};
+            selected = offsets;
+            selected.resize(SelectRecords(records, selected, frameFilter));
+
+            // Payloads and checksums are only looked at for the records the frames didn't rule out.
+            auto chunkValidBytes{scan.ValidBytes};
+            bool damaged{scan.Damaged};
+            std::uint64_t passed{0};
+            for (const auto offset : selected) {
+                const auto record{ReadPortableRecord(header, buffer.data() + offset)};
+                if (!Selects(filter, record.View, !record.Fragment)) {
+                    continue;
+                }
+                if (!IsIntact(buffer.data() + offset)) {
+                    chunkValidBytes = offset;
+                    damaged = true;
+                    break;
+                }
+                delivery.Offer(record);
+                ++passed;
+            }
+
+            // The records passed on are counted by the delivery, fragments once their payload is complete.
+            const auto recordsBefore{static_cast<std::uint64_t>(std::lower_bound(offsets.begin(), offsets.end(), chunkValidBytes) - offsets.begin())};
+            result.RecordsFiltered += recordsBefore - passed;
+            validBytes += chunkValidBytes;
+
+            if (damaged || read == 0) {
+                break;
+            }
+
+            // Keep the partial record at the end for the next read.
+            std::copy(buffer.begin() + static_cast<std::ptrdiff_t>(scan.ValidBytes), buffer.begin() + static_cast<std::ptrdiff_t>(filled), buffer.begin());
+            filled -= scan.ValidBytes;
+            if (scan.NextRecordSize > buffer.size()) {
+                buffer.resize(scan.NextRecordSize);
+            }
+        }
+
+        result.ValidBytes += validBytes;
+        result.DiscardedBytes += fileSize - validBytes;
+        return validBytes == fileSize;
+    }
+
+    void ReadPortableLog(const std::filesystem::path& file, const EtwLog::RecordFilter& filter, RecordDelivery& delivery, EtwLog::LogReadResult& result) {
+        for (std::size_t index = 0;; ++index) {
+            const auto segment{EtwLog::Portable::SegmentPath(file, index)};
+            if (index != 0 && !std::filesystem::exists(segment)) {
+                break;
+            }
+
+            // Anything after a damaged record can't be trusted to continue the log, so stop there.
+            if (!ReadPortableSegment(segment, filter, delivery, result)) {
+                break;
+            }
+        }
+    }
+
+#ifdef _WIN32
+    namespace Consumers {
+        struct AutoTraceHandle {
+            AutoTraceHandle(TRACEHANDLE trace) : Trace{trace} {
+                if (Trace == INVALID_PROCESSTRACE_HANDLE) {
+                    throw std::invalid_argument{"Trace is invalid"};
+                }
+            }
+
+            ~AutoTraceHandle() { ::CloseTrace(Trace); }
+
+            AutoTraceHandle(const AutoTraceHandle&) = delete;
+            AutoTraceHandle& operator=(const AutoTraceHandle&) = delete;
+
+            TRACEHANDLE Trace;
+        };
+
+        struct EventHandler {
+            EventHandler(std::function<void(const EVENT_RECORD&)> callback)
+                :
+                m_callback{std::move(callback)}
+            {}
+
+            EventHandler(const EventHandler&) = delete;
+            EventHandler& operator=(const EventHandler&) = delete;
+
+            void* Context{this};
+            PEVENT_RECORD_CALLBACK Callback = CallbackImpl;
+
+        private:
+            static void CallbackImpl(EVENT_RECORD* evt) {
+                static_cast<EventHandler*>(evt->UserContext)->m_callback(*evt);
+            }
+
+            std::function<void(const EVENT_RECORD&)> m_callback;
+        };
+    }
+
+    /// @brief Converts ETW's own timestamp (FILETIME: 100ns since 1601), used for logs without a clock calibration.
+    std::chrono::sys_time<std::chrono::nanoseconds> FileTimeToSystemTime(std::int64_t fileTime) {
+        static constexpr std::int64_t c_unixEpochAsFileTime{116444736000000000};
+        return std::chrono::sys_time<std::chrono::nanoseconds>{std::chrono::nanoseconds{(fileTime - c_unixEpochAsFileTime) * 100}};
+    }
+
+    void ReadEtwLog(const std::filesystem::path& file, const EtwLog::RecordFilter& filter, RecordDelivery& delivery, EtwLog::LogReadResult& result) {
+        EVENT_TRACE_LOGFILEA traceFile;
+        std::optional<EtwLog::ClockCalibration> calibration;
+
+        Consumers::EventHandler handler{[&filter, &delivery, &calibration, &result](const EVENT_RECORD& evt) {
+            // Skip metadata records with predefined EventTraceGuid guid.
+            if (::IsEqualGUID(evt.EventHeader.ProviderId, EventTraceGuid) != 0) {
+                return;
+            }
+
+            const std::byte* data{static_cast<const std::byte*>(evt.UserData)};
+            if (evt.EventHeader.EventDescriptor.Id == EtwLog::EventIds::ClockCalibration && evt.UserDataLength == sizeof(EtwLog::ClockCalibration)) {
+                calibration.emplace();
+                std::memcpy(&*calibration, data, sizeof(EtwLog::ClockCalibration));
+                return;
+            }
+
+            // Skip anything too short to be written by MiniLog.
+            if (evt.UserDataLength >= sizeof(RecordHeader)) {
+                const auto& descriptor{evt.EventHeader.EventDescriptor};
+                StoredRecord stored;
+                auto& record{stored.View};
+                std::memcpy(&record.Provider, &evt.EventHeader.ProviderId, sizeof(record.Provider));
+                record.Event = {descriptor.Id, static_cast<EtwLog::Level>(descriptor.Level), descriptor.Keyword};
+                std::memcpy(&record.Header, data, sizeof(RecordHeader));
+                record.Time = calibration ? EtwLog::ToSystemTime(*calibration, record.Header.Timestamp) : FileTimeToSystemTime(evt.EventHeader.TimeStamp.QuadPart);
+                record.FirstTime = record.Time;
+                record.Payload = {data + sizeof(RecordHeader), evt.UserDataLength - sizeof(RecordHeader)};
+
+                ReadExtraHeaders(EtwLog::RecordFlagsOfEtwVersion(descriptor.Version), calibration ? &*calibration : nullptr, stored);
+
+                // ETW hands over one event at a time and has already copied it, so this is all the filtering there is to do.
+                if (!Selects(filter, record, !stored.Fragment)) {
+                    ++result.RecordsFiltered;
+                    return;
+                }
+                delivery.Offer(stored);
+            }
+        }};
+
+        const auto narrowString{file.string()};
+        ::ZeroMemory(&traceFile, sizeof(traceFile));
+        traceFile.LogFileName = const_cast<char*>(narrowString.c_str());
+        traceFile.EventRecordCallback = handler.Callback;
+        traceFile.ProcessTraceMode = PROCESS_TRACE_MODE_EVENT_RECORD;
+        traceFile.Context = handler.Context;
+
+        FILETIME startTime;
+        ::ZeroMemory(&startTime, sizeof(startTime));
+
+        FILETIME currentTime;
+        SYSTEMTIME st;
+
+        ::GetSystemTime(&st);
+        ::SystemTimeToFileTime(&st, &currentTime);
+
+        Consumers::AutoTraceHandle trace{::OpenTraceA(&traceFile)};
+        EtwLog::VerifyHResult(::ProcessTrace(&trace.Trace, 1, &startTime, &currentTime), "ProcessTrace", ERROR_SUCCESS);
+    }
+#endif
+
+    void AddGap(EtwLog::GapReport& report, std::uint64_t first, std::uint64_t end) {
+        report.Gaps.push_back({first, end - first});
+        report.RecordsMissing += end - first;
+    }
+}
+
+EtwLog::LogReadResult EtwLog::ReadLog(const std::filesystem::path& file, const std::function<void(const RecordView&)>& callback) {
+    return ReadLog(file, RecordFilter{}, callback);
+}
+
+EtwLog::LogReadResult EtwLog::ReadLog(const std::filesystem::path& file, const RecordFilter& filter, const std::function<void(const RecordView&)>& callback) {
+    LogReadResult result;
+    RecordDelivery delivery{filter, callback, result};
+    if (IsPortableLog(file)) {
+        ReadPortableLog(file, filter, delivery, result);
+    } else {
+#ifdef _WIN32
+        ReadEtwLog(file, filter, delivery, result);
+#else
+        throw std::invalid_argument{"Not a portable MiniLog file, and ETW logs can only be read on Windows: " + file.string()};
+#endif
+    }
+
+    delivery.Finish();
+    return result;
+}
+
+EtwLog::LogReadResult EtwLog::ReadLogByTime(const std::filesystem::path& file, const RecordFilter& filter, const std::function<void(const RecordView&)>& callback) {
+    RecordBatch batch;
+    const auto result{ReadLog(file, filter, batch)};
+
+    struct Position {
+        std::chrono::sys_time<std::chrono::nanoseconds> Time;
+        std::uint64_t Sequence;
+        std::size_t Index;
+    };
+    std::vector<Position> order;
+    order.reserve(batch.Size());
+    for (std::size_t r = 0; r != batch.Size(); ++r) {
+        const auto record{batch[r]};
+        order.push_back({record.Time, record.Header.Sequence, r});
+    }
+    std::ranges::sort(order, {}, [](const Position& position) { return std::pair{position.Time, position.Sequence}; });
+
+    for (const auto& position : order) {
+        callback(batch[position.Index]);
+    }
+    return result;
+}
+
+std::function<void(const EtwLog::RecordView&)> EtwLog::ExpandRepeats(std::function<void(const RecordView&)> callback) {
+    return [callback = std::move(callback)](const RecordView& record) {
+        if (record.Repeats <= 1) {
+            callback(record);
+            return;
+        }
+
+        // The times in between weren't stored, so they are spread evenly over the run.
+        auto repeat{record};
+        repeat.Repeats = 1;
+        const auto span{record.Time - record.FirstTime};
+        for (std::uint64_t r = 0; r != record.Repeats; ++r) {
+            repeat.Time = record.FirstTime + span * static_cast<std::int64_t>(r) / static_cast<std::int64_t>(record.Repeats - 1);
+            repeat.FirstTime = repeat.Time;
+            callback(repeat);
+        }
+    };
+}
+
+EtwLog::LogReadResult EtwLog::ReadLog(const std::filesystem::path& file, const RecordFilter& filter, RecordBatch& batch) {
+    return ReadLog(file, filter, [&batch](const RecordView& record) { batch.Add(record); });
+}
+
+void EtwLog::GapDetector::Observe(std::uint64_t sequence) {
+    if (sequence < m_next || m_ahead.contains(sequence)) {
+        ++m_report.RecordsDuplicated;
+        return;
+    }
+
+    ++m_report.RecordsSeen;
+    if (sequence == m_next) {
+        ++m_next;
+        SkipSeen();
+        return;
+    }
+
+    m_ahead.insert(sequence);
+
+    // Waited long enough for the records before the first one ahead, consider them lost.
+    if (m_ahead.size() > m_reorderWindow) {
+        const auto firstSeen{*m_ahead.begin()};
+        AddGap(m_report, m_next, firstSeen);
+        m_next = firstSeen;
+        SkipSeen();
+    }
+}
+
+void EtwLog::GapDetector::SkipSeen() {
+    while (!m_ahead.empty() && *m_ahead.begin() == m_next) {
+        m_ahead.erase(m_ahead.begin());
+        ++m_next;
+    }
+}
+
+EtwLog::GapReport EtwLog::GapDetector::Report() const {
+    auto report{m_report};
+
+    auto next{m_next};
+    for (const auto sequence : m_ahead) {
+        if (sequence != next) {
+            AddGap(report, next, sequence);
+        }
+        next = sequence + 1;
+    }
+
+    return report;
+}
+
+EtwLog::GapReport EtwLog::FindSequenceGaps(const std::filesystem::path& file) {
+    GapDetector detector;
+    ReadLog(file, [&detector](const RecordView& record) {
+        for (std::uint64_t fragment = 0; fragment != record.Fragments; ++fragment) {
+            detector.Observe(record.Header.Sequence + fragment);
+        }
+    });
+    return detector.Report();
+}
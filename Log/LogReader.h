@@ -0,0 +1,127 @@
+#pragma once
+
+#include "Record.h"
+#include "RecordBatch.h"
+
+#include <chrono>
+#include <filesystem>
+#include <functional>
+#include <optional>
+#include <set>
+#include <vector>
+
+namespace EtwLog
+{
+    /// @brief What \a ReadLog found in the log besides the records.
+    struct LogReadResult {
+        /// @brief Records passed to the callback.
+        std::uint64_t Records{0};
+
+        /// @brief Records the \a RecordFilter didn't select.
+        std::uint64_t RecordsFiltered{0};
+
+        /// @brief Records written in fragments (see \a RecordView::Fragments) of which some weren't found, and which aren't passed on.
+        std::uint64_t IncompleteRecords{0};
+
+        /// @brief Bytes of the portable log up to the end of the last valid record, over all segments.
+        std::uint64_t ValidBytes{0};
+
+        /// @brief Bytes of the portable log after the last valid record, such as a record torn by a crash. Zero for a complete log.
+        std::uint64_t DiscardedBytes{0};
+    };
+
+    /// @brief Selects the records \a ReadLog passes on. Every member left empty selects all records.
+    /// Portable logs are filtered by the record frames, before payloads are looked at: see RecordScan.h.
+    struct RecordFilter {
+        /// @brief Records of the logger with this \a MiniLog::Provider. A portable log of another logger isn't read at all.
+        std::optional<ProviderId> Provider;
+
+        std::optional<std::uint16_t> EventId;
+
+        /// @brief Records of this level or more severe.
+        std::optional<Level> MaxLevel;
+
+        /// @brief Records with at least one of these keyword bits set. Zero selects records regardless of their keyword.
+        std::uint64_t KeywordMask{0};
+
+        /// @brief Records stamped at or after this time.
+        std::optional<std::chrono::sys_time<std::chrono::nanoseconds>> Begin;
+
+        /// @brief Records stamped before this time.
+        std::optional<std::chrono::sys_time<std::chrono::nanoseconds>> End;
+
+        /// @brief Records with a payload starting with these bytes.
+        std::vector<std::byte> PayloadPrefix;
+    };
+
+    /// @brief Reads every record MiniLog wrote into \a file and passes it to \a callback.
+    /// Reading a portable log stops at the first record that is truncated or fails its checksum.
+    /// @param file - path to the log file (\a LogFileName in the MiniLog output folder), written by either backend.
+    /// @param callback - called once per record. \a RecordView::Payload is only valid during the call.
+    LogReadResult ReadLog(const std::filesystem::path& file, const std::function<void(const RecordView&)>& callback);
+
+    /// @brief Same as above, passing only the records \a filter selects.
+    /// In a portable log, only the selected records are checksummed: a record the filter skips is only found to be damaged when its size is impossible.
+    LogReadResult ReadLog(const std::filesystem::path& file, const RecordFilter& filter, const std::function<void(const RecordView&)>& callback);
+
+    /// @brief Same as above, adding the selected records to \a batch rather than passing them to a callback.
+    /// Records already in \a batch are kept: \a RecordBatch::Clear it first to reuse its memory for another log.
+    LogReadResult ReadLog(const std::filesystem::path& file, const RecordFilter& filter, RecordBatch& batch);
+
+    /// @brief Same as \a ReadLog with a filter, passing the selected records in time order rather than file order, records of the same time in sequence order.
+    /// Puts records of \a PriorityLanes, which reach the file ahead of or behind records of the same time, back in place.
+    /// Keeps every selected record in memory until the whole log is read: narrow a large log down with \a filter, such as to a time range.
+    LogReadResult ReadLogByTime(const std::filesystem::path& file, const RecordFilter& filter, const std::function<void(const RecordView&)>& callback);
+
+    /// @brief Wraps \a callback for \a ReadLog, so that a record standing for a run of repeats (see \a MiniLog::SetCoalescing)
+    /// is passed to it once for each repeat, with \a RecordView::Repeats of 1 and times spread evenly between the run's first and last.
+    /// The repeats share the run record's sequence number.
+    std::function<void(const RecordView&)> ExpandRepeats(std::function<void(const RecordView&)> callback);
+
+    /// @brief Records missing from a log, as found by \a GapDetector.
+    struct GapReport {
+        /// @brief Range of consecutive missing sequence numbers [First, First + Count).
+        struct Gap {
+            std::uint64_t First;
+            std::uint64_t Count;
+        };
+
+        std::uint64_t RecordsSeen{0};
+        std::uint64_t RecordsMissing{0};
+
+        /// @brief Records with a sequence number that was already seen, or already declared missing.
+        std::uint64_t RecordsDuplicated{0};
+
+        std::vector<Gap> Gaps;
+    };
+
+    /// @brief Finds gaps in record sequence numbers as records are read.
+    /// Records of concurrent writers can be stored slightly out of sequence order, so a missing number
+    /// is only declared lost once \a reorderWindow records with higher numbers have been seen after it.
+    class GapDetector {
+    public:
+        explicit GapDetector(std::size_t reorderWindow = 4096) : m_reorderWindow{reorderWindow} {}
+
+        void Observe(std::uint64_t sequence);
+
+        /// @brief Report of everything observed so far. Numbers still missing inside the reorder window are reported as gaps.
+        GapReport Report() const;
+
+    private:
+        /// @brief Moves m_next past the numbers already seen ahead of it.
+        void SkipSeen();
+
+        std::size_t m_reorderWindow;
+
+        /// @brief Lowest sequence number not seen yet.
+        std::uint64_t m_next{0};
+
+        /// @brief Seen numbers above m_next, waiting for the numbers before them to arrive.
+        std::set<std::uint64_t> m_ahead;
+
+        GapReport m_report;
+    };
+
+    /// @brief Reads the whole \a file and reports which records are missing from it.
+    GapReport FindSequenceGaps(const std::filesystem::path& file);
+} // EtwLog
@@ -0,0 +1,130 @@
+#include "pch.h"
+#include "MemoryRingSink.h"
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <fstream>
+#include <system_error>
+
+namespace
+{
+    /// @brief Room for a record of the largest buffer the file sink has by default, and a few seconds of small records.
+    constexpr std::size_t c_minRingSize{64 * 1024};
+}
+
+EtwLog::Detail::MemoryRingSink::MemoryRingSink(std::size_t kilobytes, const ClockCalibration& calibration, const ProviderId& provider)
+    :
+    m_fileHeader{Portable::MakeFileHeader(calibration, provider)},
+    m_ring(std::max(kilobytes * 1024, c_minRingSize))
+{}
+
+void EtwLog::Detail::MemoryRingSink::Write(const EventDescriptor& event, const RecordHeader& header, std::span<const std::byte> payload) {
+    Write(event, header, {}, payload);
+}
+
+void EtwLog::Detail::MemoryRingSink::Write(const EventDescriptor& event, const RecordHeader& header, const ExtraHeaders& extra, std::span<const std::byte> payload) {
+    std::array<std::byte, ExtraHeaders::c_maxPackedSize> extraBytes;
+    const auto extraSize{extra.Pack(extraBytes)};
+
+    const auto recordSize{sizeof(header) + extraSize + payload.size()};
+    const auto frameSize{sizeof(Portable::RecordFrame) + recordSize};
+    if (frameSize > m_ring.size()) {
+        m_dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    // The checksum is filled in by Dump, if the record is still there by then.
+    const Portable::RecordFrame frame{0, static_cast<std::uint32_t>(recordSize), event.Id, event.Level, extra.Flags(), 0, event.Keyword};
+
+    std::lock_guard lock{m_mutex};
+    auto* out{Reserve(frameSize)};
+    std::memcpy(out, &frame, sizeof(frame));
+    std::memcpy(out + sizeof(frame), &header, sizeof(header));
+    std::memcpy(out + sizeof(frame) + sizeof(header), extraBytes.data(), extraSize);
+    if (!payload.empty()) {
+        std::memcpy(out + sizeof(frame) + sizeof(header) + extraSize, payload.data(), payload.size());
+    }
+}
+
+std::size_t EtwLog::Detail::MemoryRingSink::MaxPayloadSize() const noexcept {
+    return m_ring.size() - sizeof(Portable::RecordFrame) - sizeof(RecordHeader) - ExtraHeaders::c_maxPackedSize;
+}
+
+std::uint64_t EtwLog::Detail::MemoryRingSink::Dump(const std::filesystem::path& file) const {
+    // Copied out under the lock, sealed and written without it.
+    std::vector<std::byte> records;
+    {
+        std::lock_guard lock{m_mutex};
+        records.reserve(static_cast<std::size_t>(m_end - m_oldest));
+        for (auto position = m_oldest; position != m_end;) {
+            const auto size{FrameSizeAt(position)};
+            const auto* record{m_ring.data() + position % m_ring.size()};
+            if (size >= sizeof(Portable::RecordFrame) && (static_cast<std::uint8_t>(record[offsetof(Portable::RecordFrame, Flags)]) & Portable::c_paddingFlag) == 0) {
+                records.insert(records.end(), record, record + size);
+            }
+            position += size;
+        }
+    }
+
+    std::uint64_t count{0};
+    for (std::size_t offset = 0; offset != records.size(); ++count) {
+        Portable::RecordFrame frame;
+        std::memcpy(&frame, records.data() + offset, sizeof(frame));
+
+        const auto recordSize{sizeof(frame) + frame.Size};
+        frame.Crc = Portable::RecordCrc({records.data() + offset, recordSize});
+        std::memcpy(records.data() + offset, &frame.Crc, sizeof(frame.Crc));
+        offset += recordSize;
+    }
+
+    std::ofstream out{file, std::ios::binary | std::ios::trunc};
+    if (!out) {
+        throw std::system_error{errno, std::generic_category(), "Opening " + file.string()};
+    }
+    out.write(reinterpret_cast<const char*>(&m_fileHeader), sizeof(m_fileHeader));
+    out.write(reinterpret_cast<const char*>(records.data()), static_cast<std::streamsize>(records.size()));
+    if (!out.flush()) {
+        throw std::system_error{errno, std::generic_category(), "Writing " + file.string()};
+    }
+    return count;
+}
+
+std::byte* EtwLog::Detail::MemoryRingSink::Reserve(std::size_t size) noexcept {
+    const auto ringSize{m_ring.size()};
+    const auto pushOutFor = [&](std::size_t bytes) {
+        while (m_end + bytes - m_oldest > ringSize) {
+            m_oldest += FrameSizeAt(m_oldest);
+        }
+    };
+
+    // Records never wrap: the end of the ring is skipped, as a padding record where it has room for a frame.
+    const auto left{ringSize - static_cast<std::size_t>(m_end % ringSize)};
+    if (left < size) {
+        pushOutFor(left);
+        if (left >= sizeof(Portable::RecordFrame)) {
+            const Portable::RecordFrame padding{0, static_cast<std::uint32_t>(left - sizeof(Portable::RecordFrame)), 0, Level{}, Portable::c_paddingFlag, 0, 0};
+            std::memcpy(m_ring.data() + ringSize - left, &padding, sizeof(padding));
+        }
+        m_end += left;
+    }
+
+    pushOutFor(size);
+    auto* out{m_ring.data() + m_end % ringSize};
+    m_end += size;
+    return out;
+}
+
+std::size_t EtwLog::Detail::MemoryRingSink::FrameSizeAt(std::uint64_t position) const noexcept {
+    const auto offset{static_cast<std::size_t>(position % m_ring.size())};
+    const auto left{m_ring.size() - offset};
+    if (left < sizeof(Portable::RecordFrame)) {
+        return left;
+    }
+
+    Portable::RecordFrame frame;
+    std::memcpy(&frame, m_ring.data() + offset, sizeof(frame));
+    return sizeof(frame) + frame.Size;
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include "Clock.h"
+#include "PortableFormat.h"
+#include "Sink.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <span>
+#include <vector>
+
+namespace EtwLog::Detail
+{
+    /// @brief Sink keeping the latest records in memory, in a ring of \a kilobytes, for a crash handler or a support request to save.
+    /// A record that doesn't fit pushes the oldest ones out, so writes never wait and nothing reaches a disk until \a Dump.
+    /// Records are kept as the portable format stores them (see PortableFormat.h), so a dump is a portable log, read with \a ReadLog.
+    class MemoryRingSink final : public Sink {
+    public:
+        MemoryRingSink(std::size_t kilobytes, const ClockCalibration& calibration, const ProviderId& provider);
+
+        void Write(const EventDescriptor& event, const RecordHeader& header, std::span<const std::byte> payload) override;
+        void Write(const EventDescriptor& event, const RecordHeader& header, const ExtraHeaders& extra, std::span<const std::byte> payload) override;
+
+        /// @brief A record, with its frame and all headers, has to fit into the ring.
+        std::size_t MaxPayloadSize() const noexcept override;
+
+        /// @brief Writes never wait: the ring makes room by dropping its oldest records, whatever the policy.
+        void SetBackpressure(const BackpressurePolicy&) override {}
+
+        /// @brief Records too large for the ring. Records pushed out by newer ones aren't counted.
+        std::uint64_t DroppedRecords() const noexcept override { return m_dropped.load(std::memory_order_relaxed); }
+
+        /// @brief Saves the records in the ring, oldest first, to \a file as a portable log. Writers go on meanwhile.
+        /// @return Records saved.
+        std::uint64_t Dump(const std::filesystem::path& file) const;
+
+    private:
+        /// @brief Pushes out the oldest records until \a size bytes fit at the end of the ring without wrapping, and returns where.
+        /// Room at the end of the ring too small for them is filled with a padding record. Called under \a m_mutex.
+        std::byte* Reserve(std::size_t size) noexcept;
+
+        /// @brief Size of the record starting at stream position \a position, or of the room left before the ring wraps
+        /// if it is too small for a frame. Called under \a m_mutex.
+        std::size_t FrameSizeAt(std::uint64_t position) const noexcept;
+
+        const Portable::FileHeader m_fileHeader;
+
+        mutable std::mutex m_mutex;
+        std::vector<std::byte> m_ring;
+
+        /// @brief Positions of the oldest record and of the end of the newest, counted in bytes ever written to the ring:
+        /// the one in the ring is the position modulo its size.
+        std::uint64_t m_oldest{0};
+        std::uint64_t m_end{0};
+
+        std::atomic<std::uint64_t> m_dropped{0};
+    };
+} // EtwLog::Detail
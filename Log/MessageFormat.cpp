@@ -0,0 +1,304 @@
+#include "pch.h"
+#include "MessageFormat.h"
+
+#include <atomic>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <stdexcept>
+#include <system_error>
+#include <variant>
+
+namespace
+{
+    /// @brief Format strings this program has logged, by id. Open addressing in a fixed table, so finding a string
+    /// takes no lock and entries never move; strings are only added, under a lock.
+    class FormatRegistry {
+    public:
+        static FormatRegistry& Instance() {
+            static FormatRegistry s_registry;
+            return s_registry;
+        }
+
+        void Register(std::uint64_t id, std::string_view text, std::span<const EtwLog::ArgumentType> arguments) {
+            for (std::size_t probe = 0; probe != c_slotCount; ++probe) {
+                auto& slot{m_slots[(id + probe) % c_slotCount]};
+                auto slotId{slot.Id.load(std::memory_order_acquire)};
+                if (slotId == id) {
+                    return;
+                }
+                if (slotId != 0) {
+                    continue;
+                }
+
+                std::lock_guard lock{m_mutex};
+                slotId = slot.Id.load(std::memory_order_relaxed);
+                if (slotId == id) {
+                    return;
+                }
+                if (slotId == 0) {
+                    slot.Format = &m_formats.emplace_back(EtwLog::FormatDefinition{id, std::string{text}, {arguments.begin(), arguments.end()}});
+                    slot.Id.store(id, std::memory_order_release);
+                    return;
+                }
+            }
+        }
+
+        const EtwLog::FormatDefinition* Find(std::uint64_t id) const noexcept {
+            for (std::size_t probe = 0; probe != c_slotCount; ++probe) {
+                const auto& slot{m_slots[(id + probe) % c_slotCount]};
+                const auto slotId{slot.Id.load(std::memory_order_acquire)};
+                if (slotId == id) {
+                    return slot.Format;
+                }
+                if (slotId == 0) {
+                    break;
+                }
+            }
+            return nullptr;
+        }
+
+        std::size_t Count() {
+            std::lock_guard lock{m_mutex};
+            return m_formats.size();
+        }
+
+        std::vector<EtwLog::FormatDefinition> Formats() {
+            std::lock_guard lock{m_mutex};
+            return {m_formats.begin(), m_formats.end()};
+        }
+
+    private:
+        static constexpr std::size_t c_slotCount{8192};
+
+        struct Slot {
+            /// @brief Zero while the slot is free. Set after \a Format, which is then never changed.
+            std::atomic<std::uint64_t> Id{0};
+            const EtwLog::FormatDefinition* Format{nullptr};
+        };
+
+        std::array<Slot, c_slotCount> m_slots;
+
+        std::mutex m_mutex;
+
+        /// @brief Formats in the order they were registered. A deque, so slots can point to them.
+        std::deque<EtwLog::FormatDefinition> m_formats;
+    };
+
+    /// @brief The manifest file is this magic, then per format a \a ManifestEntry, its argument types (a byte each) and its text.
+    inline constexpr char c_manifestMagic[8]{'M', 'L', 'O', 'G', 'F', 'M', 'T', '1'};
+
+    struct ManifestEntry {
+        std::uint64_t Id;
+        std::uint32_t TextSize;
+        std::uint32_t ArgumentCount;
+    };
+
+    using Argument = std::variant<bool, char, std::int64_t, std::uint64_t, double, std::string_view>;
+
+    /// @brief Reads the arguments following the \a FormattedMessageHeader, empty if they don't fit in \a payload.
+    std::optional<std::vector<Argument>> DecodeArguments(std::span<const std::byte> payload) {
+        std::vector<Argument> arguments;
+        const auto take = [&payload]<typename T>(T& value) {
+            if (payload.size() < sizeof(value)) {
+                return false;
+            }
+            std::memcpy(&value, payload.data(), sizeof(value));
+            payload = payload.subspan(sizeof(value));
+            return true;
+        };
+        const auto takeArgument = [&]<typename T>(T value) {
+            if (!take(value)) {
+                return false;
+            }
+            arguments.emplace_back(value);
+            return true;
+        };
+
+        while (!payload.empty()) {
+            EtwLog::ArgumentType type;
+            take(type);
+
+            bool valid{false};
+            switch (type) {
+            case EtwLog::ArgumentType::Bool: {
+                char value{0};
+                valid = take(value);
+                arguments.emplace_back(value != 0);
+                break;
+            }
+            case EtwLog::ArgumentType::Char: valid = takeArgument(char{}); break;
+            case EtwLog::ArgumentType::Int: valid = takeArgument(std::int64_t{}); break;
+            case EtwLog::ArgumentType::UInt: valid = takeArgument(std::uint64_t{}); break;
+            case EtwLog::ArgumentType::Double: valid = takeArgument(double{}); break;
+            case EtwLog::ArgumentType::String: {
+                std::uint32_t size;
+                valid = take(size) && size <= payload.size();
+                if (valid) {
+                    arguments.emplace_back(std::string_view{reinterpret_cast<const char*>(payload.data()), size});
+                    payload = payload.subspan(size);
+                }
+                break;
+            }
+            }
+
+            if (!valid) {
+                return {};
+            }
+        }
+        return arguments;
+    }
+
+    /// @brief Formats \a text like std::format, one replacement field at a time since the argument types are only known now.
+    std::optional<std::string> Render(std::string_view text, const std::vector<Argument>& arguments) {
+        std::string out;
+        std::size_t nextArgument{0};
+        for (std::size_t i = 0; i != text.size(); ++i) {
+            const auto c{text[i]};
+            if ((c == '{' || c == '}') && i + 1 != text.size() && text[i + 1] == c) {
+                out += c;
+                ++i;
+                continue;
+            }
+            if (c != '{') {
+                out += c;
+                continue;
+            }
+
+            const auto end{text.find('}', i)};
+            const auto field{text.substr(i + 1, end - i - 1)};
+            if (end == std::string_view::npos || field.find('{') != std::string_view::npos) {
+                return {};
+            }
+            i = end;
+
+            const auto colon{field.find(':')};
+            const auto index{field.substr(0, colon)};
+            std::size_t argument{0};
+            if (index.empty()) {
+                argument = nextArgument++;
+            } else {
+                for (const auto digit : index) {
+                    argument = argument * 10 + static_cast<std::size_t>(digit - '0');
+                }
+            }
+            if (argument >= arguments.size()) {
+                return {};
+            }
+
+            const auto spec{colon == std::string_view::npos ? std::string{"{}"} : "{" + std::string{field.substr(colon)} + "}"};
+            std::visit([&](const auto& value) { out += std::vformat(spec, std::make_format_args(value)); }, arguments[argument]);
+        }
+        return out;
+    }
+
+    /// @brief Formats \a record with the format \a find gives for its id. The arguments must be of the types the format has.
+    template <typename TFind>
+    std::optional<std::string> FormatWith(const EtwLog::RecordView& record, TFind&& find) {
+        EtwLog::FormattedMessageHeader header;
+        if (record.Event.Id != EtwLog::EventIds::FormattedMessage || record.Payload.size() < sizeof(header)) {
+            return {};
+        }
+        std::memcpy(&header, record.Payload.data(), sizeof(header));
+
+        const EtwLog::FormatDefinition* format{find(header.FormatId)};
+        const auto arguments{DecodeArguments(record.Payload.subspan(sizeof(header)))};
+        if (format == nullptr || !arguments || arguments->size() != format->Arguments.size()) {
+            return {};
+        }
+        for (std::size_t a = 0; a != arguments->size(); ++a) {
+            // Variant alternatives are in ArgumentType order.
+            if ((*arguments)[a].index() + 1 != static_cast<std::size_t>(format->Arguments[a])) {
+                return {};
+            }
+        }
+
+        try {
+            return Render(format->Text, *arguments);
+        } catch (const std::format_error&) {
+            return {};
+        }
+    }
+}
+
+void EtwLog::Detail::RegisterFormat(std::uint64_t id, std::string_view text, std::span<const ArgumentType> arguments) {
+    FormatRegistry::Instance().Register(id, text, arguments);
+}
+
+const EtwLog::FormatDefinition* EtwLog::Detail::FindFormat(std::uint64_t id) noexcept {
+    return FormatRegistry::Instance().Find(id);
+}
+
+std::size_t EtwLog::Detail::RegisteredFormatCount() {
+    return FormatRegistry::Instance().Count();
+}
+
+void EtwLog::Detail::WriteFormatManifest(const std::filesystem::path& file) {
+    std::ofstream out{file, std::ios::binary | std::ios::trunc};
+    if (!out) {
+        throw std::system_error{errno, std::generic_category(), "Opening " + file.string()};
+    }
+
+    out.write(c_manifestMagic, sizeof(c_manifestMagic));
+    for (const auto& format : FormatRegistry::Instance().Formats()) {
+        const ManifestEntry entry{format.Id, static_cast<std::uint32_t>(format.Text.size()), static_cast<std::uint32_t>(format.Arguments.size())};
+        out.write(reinterpret_cast<const char*>(&entry), sizeof(entry));
+        out.write(reinterpret_cast<const char*>(format.Arguments.data()), static_cast<std::streamsize>(format.Arguments.size()));
+        out.write(format.Text.data(), static_cast<std::streamsize>(format.Text.size()));
+    }
+
+    if (!out.flush()) {
+        throw std::system_error{errno, std::generic_category(), "Writing " + file.string()};
+    }
+}
+
+std::filesystem::path EtwLog::FormatManifestFile(const std::filesystem::path& logFile) {
+    return std::filesystem::path{logFile}.replace_extension(".formats");
+}
+
+EtwLog::FormatManifest EtwLog::FormatManifest::Read(const std::filesystem::path& logFile) {
+    FormatManifest manifest;
+    std::ifstream in{FormatManifestFile(logFile), std::ios::binary};
+    if (!in) {
+        return manifest;
+    }
+
+    char magic[sizeof(c_manifestMagic)];
+    if (!in.read(magic, sizeof(magic)) || !std::equal(std::begin(magic), std::end(magic), std::begin(c_manifestMagic))) {
+        throw std::runtime_error{"Not a MiniLog format manifest: " + FormatManifestFile(logFile).string()};
+    }
+
+    // Sizes are checked against what is left of the file before anything is allocated for them, so a damaged entry can't ask for gigabytes.
+    const auto fileSize{std::filesystem::file_size(FormatManifestFile(logFile))};
+    ManifestEntry entry;
+    while (in.read(reinterpret_cast<char*>(&entry), sizeof(entry))) {
+        const auto remaining{fileSize - static_cast<std::uint64_t>(in.tellg())};
+        if (entry.ArgumentCount > Detail::c_maxFormatArguments || std::uint64_t{entry.TextSize} + entry.ArgumentCount > remaining) {
+            throw std::runtime_error{"Damaged MiniLog format manifest: " + FormatManifestFile(logFile).string()};
+        }
+        FormatDefinition format{entry.Id, std::string(entry.TextSize, '\0'), std::vector<ArgumentType>(entry.ArgumentCount)};
+        if (!in.read(reinterpret_cast<char*>(format.Arguments.data()), entry.ArgumentCount) || !in.read(format.Text.data(), entry.TextSize)) {
+            throw std::runtime_error{"Truncated MiniLog format manifest: " + FormatManifestFile(logFile).string()};
+        }
+        manifest.Add(std::move(format));
+    }
+    return manifest;
+}
+
+void EtwLog::FormatManifest::Add(FormatDefinition definition) {
+    const auto id{definition.Id};
+    m_formats.insert_or_assign(id, std::move(definition));
+}
+
+const EtwLog::FormatDefinition* EtwLog::FormatManifest::Find(std::uint64_t id) const noexcept {
+    const auto found{m_formats.find(id)};
+    return found != m_formats.end() ? &found->second : nullptr;
+}
+
+std::optional<std::string> EtwLog::FormatMessage(const RecordView& record) {
+    return FormatWith(record, [](std::uint64_t id) { return Detail::FindFormat(id); });
+}
+
+std::optional<std::string> EtwLog::FormatMessage(const RecordView& record, const FormatManifest& manifest) {
+    return FormatWith(record, [&manifest](std::uint64_t id) { return manifest.Find(id); });
+}
@@ -0,0 +1,259 @@
+#pragma once
+
+#include "Record.h"
+
+#include <algorithm>
+#include <array>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <format>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+namespace EtwLog
+{
+    /// @brief Start of the payload of an \a EventIds::FormattedMessage record, written by \a MiniLog::Log.
+    /// The arguments follow, each as an \a ArgumentType byte and its value: 1 byte for Bool and Char, 8 bytes for numbers,
+    /// and a 32 bit length and the characters for String.
+    /// @note Part of the on-disk format, so it is written and read as raw bytes.
+    struct FormattedMessageHeader {
+        /// @brief \a FormatId of the format string.
+        std::uint64_t FormatId;
+    };
+
+    /// @brief How an argument of \a MiniLog::Log is stored. Integers are widened to 64 bits, floating point numbers to double.
+    enum class ArgumentType : std::uint8_t {
+        Bool = 1,
+        Char = 2,
+        Int = 3,
+        UInt = 4,
+        Double = 5,
+        String = 6,
+    };
+
+    /// @brief Id of a format string in the log: the 64 bit FNV-1a hash of its text and argument types, never zero.
+    /// The same text logged with arguments of other types is another format.
+    constexpr std::uint64_t FormatId(std::string_view text, std::span<const ArgumentType> arguments) noexcept {
+        std::uint64_t hash{0xCBF2'9CE4'8422'2325};
+        const auto add = [&hash](std::uint8_t byte) { hash = (hash ^ byte) * 0x100'0000'01B3; };
+        for (const auto c : text) {
+            add(static_cast<unsigned char>(c));
+        }
+        for (const auto type : arguments) {
+            add(static_cast<std::uint8_t>(type));
+        }
+        return hash != 0 ? hash : 1;
+    }
+
+    /// @brief A format string and the types of its arguments, as listed in a format manifest.
+    struct FormatDefinition {
+        std::uint64_t Id;
+        std::string Text;
+        std::vector<ArgumentType> Arguments;
+    };
+} // EtwLog
+
+namespace EtwLog::Detail
+{
+    template <typename T>
+    constexpr ArgumentType ArgumentTypeOf() noexcept {
+        using Value = std::remove_cvref_t<T>;
+        if constexpr (std::is_same_v<Value, bool>) {
+            return ArgumentType::Bool;
+        } else if constexpr (std::is_same_v<Value, char>) {
+            return ArgumentType::Char;
+        } else if constexpr (std::is_integral_v<Value> && std::is_signed_v<Value>) {
+            return ArgumentType::Int;
+        } else if constexpr (std::is_integral_v<Value>) {
+            return ArgumentType::UInt;
+        } else if constexpr (std::is_floating_point_v<Value>) {
+            return ArgumentType::Double;
+        } else {
+            static_assert(std::is_convertible_v<const T&, std::string_view>, "MiniLog::Log takes numbers, bool, char and strings");
+            return ArgumentType::String;
+        }
+    }
+
+    /// @brief Most arguments a format takes. Readers of a format manifest take an entry listing more for a damaged one.
+    inline constexpr std::size_t c_maxFormatArguments{256};
+
+    template <typename... TArgs>
+    inline constexpr std::array<ArgumentType, sizeof...(TArgs)> c_argumentTypes{ArgumentTypeOf<TArgs>()...};
+
+    /// @brief Makes the format known to \a FormatMessage in this program, and lists it in the manifests of the loggers closed from now on.
+    /// Costs one atomic load once the format is known. Past a few thousand formats, new ones aren't remembered.
+    void RegisterFormat(std::uint64_t id, std::string_view text, std::span<const ArgumentType> arguments);
+
+    /// @brief Format registered with \a RegisterFormat, null if none has \a id.
+    const FormatDefinition* FindFormat(std::uint64_t id) noexcept;
+
+    /// @brief Number of formats registered so far. Formats are never removed, so this only grows.
+    std::size_t RegisteredFormatCount();
+
+    /// @brief Writes the formats registered so far to \a file, see \a FormatManifest.
+    void WriteFormatManifest(const std::filesystem::path& file);
+} // EtwLog::Detail
+
+namespace EtwLog
+{
+    /// @brief Format string of \a MiniLog::Log, checked against the argument types and hashed into its \a FormatId at compile time.
+    template <typename... TArgs>
+    class FormatString {
+        static_assert(sizeof...(TArgs) <= Detail::c_maxFormatArguments, "MiniLog::Log takes at most 256 arguments");
+
+    public:
+        template <typename T>
+            requires std::convertible_to<const T&, std::string_view>
+        consteval FormatString(const T& text) : m_text{text}, m_id{FormatId(m_text, Arguments())} {
+            [[maybe_unused]] const std::format_string<const TArgs&...> checked{text};
+        }
+
+        constexpr std::string_view Text() const noexcept { return m_text; }
+        constexpr std::uint64_t Id() const noexcept { return m_id; }
+        static constexpr std::span<const ArgumentType> Arguments() noexcept { return Detail::c_argumentTypes<TArgs...>; }
+
+    private:
+        std::string_view m_text;
+        std::uint64_t m_id;
+    };
+
+    /// @brief Characters of a format string literal, held in a type so it can be a template argument.
+    template <std::size_t N>
+    struct FormatText {
+        consteval FormatText(const char (&text)[N]) { std::copy_n(text, N, Chars); }
+
+        constexpr std::string_view View() const noexcept { return {Chars, N - 1}; }
+
+        char Chars[N]{};
+    };
+
+    /// @brief Format string known at compile time as a type, written as "..."_format (see \a Literals).
+    /// \a MiniLog::Log registers each of these with its argument types before main starts, rather than when first logging it,
+    /// so they are in the format manifest from the logger's start and logging them looks nothing up.
+    template <FormatText c_text>
+    struct StaticFormat {};
+
+    namespace Literals {
+        template <FormatText c_text>
+        consteval StaticFormat<c_text> operator""_format() noexcept { return {}; }
+    }
+
+    /// @brief Format strings and argument types of the \a EventIds::FormattedMessage records in a log, read from the manifest
+    /// each logger writes next to its log file (\a FormatManifestFile). Lets any program format the messages, not only the one that logged them.
+    /// The manifest is written when the logger starts, with every format of the program it can know of by then,
+    /// and written again when it closes if formats were logged for the first time meanwhile.
+    /// A logger that crashed has the formats registered at the start (\a StaticFormat ones) in its manifest, but not always the others.
+    class FormatManifest {
+    public:
+        /// @brief The manifest of the log \a logFile. Empty if it has none, such as one written before manifests were.
+        /// Throws \a std::runtime_error if it is truncated or damaged, before allocating more than the file holds.
+        static FormatManifest Read(const std::filesystem::path& logFile);
+
+        /// @brief Adds \a definition, or replaces the format with its id.
+        void Add(FormatDefinition definition);
+
+        /// @brief Null if the manifest has no format with \a id.
+        const FormatDefinition* Find(std::uint64_t id) const noexcept;
+
+        std::size_t Size() const noexcept { return m_formats.size(); }
+
+    private:
+        std::unordered_map<std::uint64_t, FormatDefinition> m_formats;
+    };
+
+    /// @brief The file next to \a logFile that its format manifest is written to.
+    std::filesystem::path FormatManifestFile(const std::filesystem::path& logFile);
+
+    /// @brief Text of an \a EventIds::FormattedMessage record: its format string with the arguments stored in the record.
+    /// Formatting happens here, on the reader's side, rather than on the thread that logged the message.
+    /// @return Empty if \a record isn't a formatted message, its payload is damaged, or its format string isn't known to this program:
+    /// format strings are known once the program has logged them with \a MiniLog::Log, or from its start for \a StaticFormat ones.
+    /// Replacement fields taking the width or precision from another argument aren't supported.
+    std::optional<std::string> FormatMessage(const RecordView& record);
+
+    /// @brief Same as above, with the format strings from \a manifest rather than the ones of this program.
+    /// Empty as well if the arguments in the record aren't of the types the manifest has for the format.
+    std::optional<std::string> FormatMessage(const RecordView& record, const FormatManifest& manifest);
+} // EtwLog
+
+namespace EtwLog::Detail
+{
+    /// @brief Registers \a c_text with the argument types \a TArgs before main starts, since \a MiniLog::Log refers to \a c_registered.
+    template <FormatText c_text, typename... TArgs>
+    struct StaticFormatEntry {
+        static constexpr FormatString<TArgs...> c_format{c_text.View()};
+
+        static inline const bool c_registered{(RegisterFormat(c_format.Id(), c_format.Text(), c_format.Arguments()), true)};
+    };
+
+    template <typename T>
+    std::size_t EncodedSize(const T& arg) noexcept {
+        constexpr auto c_type{ArgumentTypeOf<T>()};
+        if constexpr (c_type == ArgumentType::Bool || c_type == ArgumentType::Char) {
+            return 2;
+        } else if constexpr (c_type == ArgumentType::String) {
+            return 1 + sizeof(std::uint32_t) + std::string_view{arg}.size();
+        } else {
+            return 1 + sizeof(std::uint64_t);
+        }
+    }
+
+    template <typename T>
+    std::byte* Encode(std::byte* out, const T& arg) noexcept {
+        constexpr auto c_type{ArgumentTypeOf<T>()};
+        *out++ = static_cast<std::byte>(c_type);
+        const auto put = [&out](const auto& value) {
+            std::memcpy(out, &value, sizeof(value));
+            out += sizeof(value);
+        };
+
+        if constexpr (c_type == ArgumentType::Bool || c_type == ArgumentType::Char) {
+            put(static_cast<char>(arg));
+        } else if constexpr (c_type == ArgumentType::Int) {
+            put(static_cast<std::int64_t>(arg));
+        } else if constexpr (c_type == ArgumentType::UInt) {
+            put(static_cast<std::uint64_t>(arg));
+        } else if constexpr (c_type == ArgumentType::Double) {
+            put(static_cast<double>(arg));
+        } else {
+            const std::string_view text{arg};
+            put(static_cast<std::uint32_t>(text.size()));
+            std::memcpy(out, text.data(), text.size());
+            out += text.size();
+        }
+        return out;
+    }
+
+    /// @brief Encodes the payload of an \a EventIds::FormattedMessage record and passes it to \a write.
+    /// Payloads up to \a c_stackSize bytes are encoded on the stack, larger ones in a vector.
+    template <typename TWrite, typename... TArgs>
+    void EncodeFormattedMessage(std::uint64_t formatId, TWrite&& write, const TArgs&... args) {
+        static constexpr std::size_t c_stackSize{256};
+
+        const auto size{sizeof(FormattedMessageHeader) + (std::size_t{0} + ... + EncodedSize(args))};
+        const auto encode = [&](std::byte* out) {
+            const FormattedMessageHeader header{formatId};
+            std::memcpy(out, &header, sizeof(header));
+            out += sizeof(header);
+            ((out = Encode(out, args)), ...);
+        };
+
+        if (size <= c_stackSize) {
+            std::array<std::byte, c_stackSize> payload;
+            encode(payload.data());
+            write(std::span<const std::byte>{payload.data(), size});
+        } else {
+            std::vector<std::byte> payload(size);
+            encode(payload.data());
+            write(std::span<const std::byte>{payload});
+        }
+    }
+} // EtwLog::Detail
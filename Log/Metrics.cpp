@@ -0,0 +1,65 @@
+#include "pch.h"
+#include "Metrics.h"
+#include "LogReader.h"
+
+#include <cstring>
+
+std::size_t EtwLog::Detail::NextMetricCell() noexcept {
+    static std::atomic<std::size_t> s_nextThread{0};
+    return s_nextThread.fetch_add(1, std::memory_order_relaxed) % MetricCells::c_cellCount;
+}
+
+std::int64_t EtwLog::Detail::MetricCells::Sum() const noexcept {
+    std::int64_t sum{0};
+    for (const auto& cell : m_cells) {
+        sum += cell.Value.load(std::memory_order_relaxed);
+    }
+    return sum;
+}
+
+std::int64_t EtwLog::Detail::MetricCells::Take() noexcept {
+    std::int64_t sum{0};
+    for (auto& cell : m_cells) {
+        // Untouched cells are only read, saving taking their cache lines away from the threads adding to them.
+        if (cell.Value.load(std::memory_order_relaxed) != 0) {
+            sum += cell.Value.exchange(0, std::memory_order_relaxed);
+        }
+    }
+    return sum;
+}
+
+std::vector<std::byte> EtwLog::EncodeMetrics(std::chrono::nanoseconds interval, std::span<const MetricValue> values) {
+    const MetricsHeader header{static_cast<std::uint64_t>(interval.count()), static_cast<std::uint32_t>(values.size()), 0};
+    std::vector<std::byte> payload(sizeof(header) + values.size_bytes());
+    std::memcpy(payload.data(), &header, sizeof(header));
+    std::memcpy(payload.data() + sizeof(header), values.data(), values.size_bytes());
+    return payload;
+}
+
+std::optional<EtwLog::MetricsSnapshot> EtwLog::DecodeMetrics(const RecordView& record) {
+    MetricsHeader header;
+    if (record.Event.Id != EventIds::Metrics || record.Payload.size() < sizeof(header)) {
+        return {};
+    }
+    std::memcpy(&header, record.Payload.data(), sizeof(header));
+    if (record.Payload.size() != sizeof(header) + std::size_t{header.Count} * sizeof(MetricValue)) {
+        return {};
+    }
+
+    MetricsSnapshot snapshot{record.Time - std::chrono::nanoseconds{header.IntervalNanoseconds}, record.Time, std::vector<MetricValue>(header.Count)};
+    std::memcpy(snapshot.Values.data(), record.Payload.data() + sizeof(header), snapshot.Values.size() * sizeof(MetricValue));
+    return snapshot;
+}
+
+std::vector<EtwLog::MetricsSnapshot> EtwLog::ReadMetrics(const std::filesystem::path& log, const RecordFilter& filter) {
+    auto metrics{filter};
+    metrics.EventId = EventIds::Metrics;
+
+    std::vector<MetricsSnapshot> snapshots;
+    ReadLog(log, metrics, [&snapshots](const RecordView& record) {
+        if (auto snapshot{DecodeMetrics(record)}) {
+            snapshots.push_back(std::move(*snapshot));
+        }
+    });
+    return snapshots;
+}
@@ -0,0 +1,134 @@
+#pragma once
+
+#include "Record.h"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <span>
+#include <vector>
+
+namespace EtwLog
+{
+    struct RecordFilter;
+
+    namespace Detail {
+        /// @brief Cell of \a MetricCells the calling thread adds to. Threads take the cells in turn as they first update a metric.
+        std::size_t NextMetricCell() noexcept;
+
+        inline std::size_t ThreadMetricCell() noexcept {
+            thread_local const std::size_t t_cell{NextMetricCell()};
+            return t_cell;
+        }
+
+        /// @brief Value striped over \a c_cellCount cache lines, so threads updating it mostly don't contend for a line.
+        /// Cells go to threads round-robin: past that many threads, they share cells, still without locks.
+        class MetricCells {
+        public:
+            static constexpr std::size_t c_cellCount{16};
+
+            void Add(std::int64_t delta) noexcept { m_cells[ThreadMetricCell()].Value.fetch_add(delta, std::memory_order_relaxed); }
+
+            /// @brief Sum of the cells, not counting adds made meanwhile.
+            std::int64_t Sum() const noexcept;
+
+            /// @brief Sum of the cells, leaving them at zero. An add made meanwhile is counted now or by the next call.
+            std::int64_t Take() noexcept;
+
+        private:
+            struct alignas(64) Cell {
+                std::atomic<std::int64_t> Value{0};
+            };
+
+            std::array<Cell, c_cellCount> m_cells{};
+        };
+    }
+
+    /// @brief Count of something happening, such as bytes processed, updated from many threads. Got from \a MiniLog::CounterOf.
+    /// The logger writes how much it went up in each interval, in an \a EventIds::Metrics record.
+    class Counter {
+    public:
+        Counter() = default;
+
+        Counter(const Counter&) = delete;
+        Counter& operator=(const Counter&) = delete;
+
+        /// @brief Costs one relaxed atomic add, to the calling thread's one of 16 striped cells.
+        void Add(std::uint64_t count = 1) noexcept { m_cells.Add(static_cast<std::int64_t>(count)); }
+
+        /// @brief Takes what was added since the last call.
+        std::uint64_t TakeInterval() noexcept { return static_cast<std::uint64_t>(m_cells.Take()); }
+
+    private:
+        Detail::MetricCells m_cells;
+    };
+
+    /// @brief Level of something going up and down, such as a queue's depth, updated from many threads. Got from \a MiniLog::GaugeOf.
+    /// The logger writes its level at the end of each interval, in an \a EventIds::Metrics record.
+    /// Updated by deltas rather than set, so that an update stays a single add to the thread's striped cell.
+    class Gauge {
+    public:
+        Gauge() = default;
+
+        Gauge(const Gauge&) = delete;
+        Gauge& operator=(const Gauge&) = delete;
+
+        /// @brief Costs one relaxed atomic add, to the calling thread's one of 16 striped cells.
+        void Add(std::int64_t delta) noexcept { m_cells.Add(delta); }
+        void Subtract(std::int64_t delta) noexcept { m_cells.Add(-delta); }
+
+        /// @brief Sum of every update so far, as of some moment during the call.
+        std::int64_t Value() const noexcept { return m_cells.Sum(); }
+
+    private:
+        Detail::MetricCells m_cells;
+    };
+
+    enum class MetricKind : std::uint8_t {
+        Counter = 1,
+        Gauge = 2,
+    };
+
+    /// @brief Start of the payload of an \a EventIds::Metrics record, followed by \a Count \a MetricValue entries.
+    /// The record's time is the end of the interval.
+    /// @note Part of the on-disk format, so it is written and read as raw bytes.
+    struct MetricsHeader {
+        std::uint64_t IntervalNanoseconds;
+        std::uint32_t Count;
+        std::uint32_t Reserved;
+    };
+
+    /// @note Part of the on-disk format, so it is written and read as raw bytes.
+    struct MetricValue {
+        /// @brief Key of the metric, as passed to \a MiniLog::CounterOf or \a MiniLog::GaugeOf. Counters and gauges have keys of their own.
+        std::uint32_t Key;
+        MetricKind Kind;
+        std::uint8_t Reserved[3];
+
+        /// @brief How much a counter went up over the interval, or a gauge's level at its end.
+        std::int64_t Value;
+    };
+
+    /// @brief What an \a EventIds::Metrics record holds.
+    struct MetricsSnapshot {
+        std::chrono::sys_time<std::chrono::nanoseconds> Begin;
+        std::chrono::sys_time<std::chrono::nanoseconds> End;
+
+        /// @brief Counters by key, then gauges by key. Counters that didn't go up in the interval are left out.
+        std::vector<MetricValue> Values;
+    };
+
+    /// @brief Payload of an \a EventIds::Metrics record of \a values over \a interval.
+    std::vector<std::byte> EncodeMetrics(std::chrono::nanoseconds interval, std::span<const MetricValue> values);
+
+    /// @brief Reads a snapshot back, empty if \a record isn't one or is damaged.
+    std::optional<MetricsSnapshot> DecodeMetrics(const RecordView& record);
+
+    /// @brief Snapshots of the metrics in \a log, in the order they were written.
+    /// @param filter - which snapshots to read, such as those of a time range. Its event id is set to \a EventIds::Metrics.
+    std::vector<MetricsSnapshot> ReadMetrics(const std::filesystem::path& log, const RecordFilter& filter);
+} // EtwLog
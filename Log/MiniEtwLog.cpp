@@ -1,18 +1,43 @@
 #include "pch.h"
 #include "MiniEtwLog.h"
-
-
+#include "Clock.h"
+#include "Coalescer.h"
+#include "EventFilter.h"
+#include "Histogram.h"
+#include "MemoryRingSink.h"
+#include "MessageFormat.h"
+#include "Metrics.h"
+#include "PeriodicTask.h"
+#include "PortableSink.h"
+#include "Record.h"
+#include "Sampling.h"
+#include "Sink.h"
+#include "WriteProfiler.h"
+
+#ifdef _WIN32
 #include <Windows.h>
 #include <combaseapi.h>
 #include <evntrace.h>
 #include <evntprov.h>
+#endif
 
 #include <cassert>
 #include <algorithm>
 #include <optional>
 #include <system_error>
 #include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
 #include <filesystem>
+#include <future>
+#include <map>
+#include <mutex>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
 
 using EtwLog::MiniLog;
 
@@ -21,6 +46,7 @@ void EtwLog::VerifyHResult(std::uint32_t hresult, std::string_view additionalInf
     if (hresult != expectedGoodResult) {
         std::error_code error{static_cast<int>(hresult), std::system_category()};
 
+#ifdef _WIN32
         // If error was not properly formatted.
         if (error.message() == std::error_code{}.message()) {
             std::array<char, 512> errStr;
@@ -34,6 +60,7 @@ void EtwLog::VerifyHResult(std::uint32_t hresult, std::string_view additionalInf
                     throw std::system_error{error, std::string{ errStr.data() } + std::string{additionalInfo}};
             }
         }
+#endif
 
         throw std::system_error{error, std::string{additionalInfo}};
     }
@@ -41,6 +68,7 @@ void EtwLog::VerifyHResult(std::uint32_t hresult, std::string_view additionalInf
 
 namespace
 {
+#ifdef _WIN32
     using EtwLog::VerifyHResult;
 
     GUID MakeGuid() {
@@ -49,6 +77,14 @@ namespace
         return guid;
     }
 
+    static_assert(sizeof(GUID) == sizeof(EtwLog::ProviderId));
+
+    GUID ToGuid(const EtwLog::ProviderId& provider) {
+        GUID guid;
+        std::memcpy(&guid, &provider, sizeof(guid));
+        return guid;
+    }
+
     namespace Controllers {
         /// @brief EVENT_TRACE_PROPERTIES has weird requirements that session name and log file path 
         /// buffers are located after this structure in memory, and their offsets are specified instead of actual strings.
@@ -92,13 +128,19 @@ namespace
         /// @brief RAII wrapper around enabling/disabling provider for the session.
         class EnabledProvider {
         public:
+            /// @brief Enables every event of the provider, like a new MiniLog's filter.
             EnabledProvider(TRACEHANDLE sessionHandle, const GUID& providerIdToEnable) : SessionHandle{sessionHandle}, EnabledProviderId{providerIdToEnable} {
+                Enable(TRACE_LEVEL_VERBOSE, 0);
+            }
+
+            /// @brief Enables the provider again with another level and keyword mask, which the session applies right away.
+            void Enable(UCHAR level, ULONGLONG matchAnyKeyword) {
                 VerifyHResult(::EnableTraceEx2(
                         SessionHandle,
                         &EnabledProviderId,
                         EVENT_CONTROL_CODE_ENABLE_PROVIDER,
-                        TRACE_LEVEL_INFORMATION,
-                        0,
+                        level,
+                        matchAnyKeyword,
                         0,
                         0,
                         NULL
@@ -178,58 +220,758 @@ namespace
         };
     }
 
-    std::string_view MakeDirectories(std::string_view outputFolder)
+    /// @brief Payload bytes left in the largest event ETW takes, after MiniLog's headers.
+    /// An event can't be larger than 64KB, nor than a session buffer, and ETW adds its own header of about 100 bytes.
+    std::size_t MaxEventPayload(std::size_t bufferSize) noexcept {
+        static constexpr std::size_t c_maxEventSize{64 * 1024};
+        static constexpr std::size_t c_etwHeaderAllowance{512};
+
+        // Zero lets ETW pick the buffer size, which is at least as large as the event limit.
+        const auto eventSize{bufferSize == 0 ? c_maxEventSize : std::min(c_maxEventSize, bufferSize * 1024)};
+        return eventSize - c_etwHeaderAllowance - sizeof(EtwLog::RecordHeader) - sizeof(EtwLog::RepeatHeader) - sizeof(EtwLog::FragmentHeader) - sizeof(EtwLog::ActivityHeader);
+    }
+
+    /// @brief Sink writing records as events of a private ETW session, which saves them into log.etl.
+    class EtwSink final : public EtwLog::Detail::Sink {
+    public:
+        EtwSink(
+            const EtwLog::ProviderId& provider,
+            const char* sessionName,
+            const std::filesystem::path& logFile,
+            std::size_t bufferSize,
+            const EtwLog::ClockCalibration& calibration)
+            :
+            m_providerId{ToGuid(provider)},
+            m_provider{m_providerId},
+            m_session{m_providerId, sessionName, logFile.string(), bufferSize},
+            m_enabledProvider{m_session.EnableProvider(m_providerId)},
+            m_maxPayloadSize{MaxEventPayload(bufferSize)}
+        {
+            constexpr static const EVENT_DESCRIPTOR c_descriptor = {
+               EtwLog::EventIds::ClockCalibration, // Id
+               0x1,    // Version
+               0x0,    // Channel
+               0x0,    // LevelSeverity
+               0x0,    // Opcode
+               0x0,    // Task
+               0x0,    // Keyword
+            };
+
+            // The .etl file header belongs to ETW, so the calibration is stored as the first event instead.
+            EVENT_DATA_DESCRIPTOR eventDataDescriptors[1];
+            EventDataDescCreate(&eventDataDescriptors[0], &calibration, sizeof(calibration));
+
+            VerifyHResult(::EventWrite(m_provider.Handle, &c_descriptor, 1, eventDataDescriptors), "EventWrite", ERROR_SUCCESS);
+        }
+
+        void Write(const EtwLog::EventDescriptor& event, const EtwLog::RecordHeader& header, std::span<const std::byte> payload) override {
+            Write(event, header, {}, payload);
+        }
+
+        /// @brief The event version tells the reader which extra headers follow the RecordHeader, see EtwLog::EtwEventVersion.
+        /// The start and stop of an activity are written with EventWriteTransfer and a start or stop opcode as well, so ETW's own tools see the activity.
+        void Write(const EtwLog::EventDescriptor& event, const EtwLog::RecordHeader& header, const EtwLog::Detail::ExtraHeaders& extra, std::span<const std::byte> payload) override {
+            const auto opcode{extra.Activity != nullptr ? static_cast<UCHAR>(extra.Activity->Opcode) : 0};
+            EVENT_DESCRIPTOR descriptor;
+            EventDescCreate(&descriptor, event.Id, EtwLog::EtwEventVersion(extra.Flags()), 0x0, static_cast<UCHAR>(event.Level), 0x0, opcode, event.Keyword);
+
+            EVENT_DATA_DESCRIPTOR eventDataDescriptors[5];
+            ULONG count{0};
+            EventDataDescCreate(&eventDataDescriptors[count++], &header, sizeof(header));
+            if (extra.Repeat != nullptr) {
+                EventDataDescCreate(&eventDataDescriptors[count++], extra.Repeat, sizeof(*extra.Repeat));
+            }
+            if (extra.Fragment != nullptr) {
+                EventDataDescCreate(&eventDataDescriptors[count++], extra.Fragment, sizeof(*extra.Fragment));
+            }
+            if (extra.Activity != nullptr) {
+                EventDataDescCreate(&eventDataDescriptors[count++], extra.Activity, sizeof(*extra.Activity));
+            }
+            EventDataDescCreate(&eventDataDescriptors[count++], payload.data(), static_cast<ULONG>(payload.size()));
+
+            if (extra.Activity != nullptr) {
+                static_assert(sizeof(GUID) == sizeof(EtwLog::ActivityId));
+                GUID activity;
+                GUID related;
+                std::memcpy(&activity, &extra.Activity->Activity, sizeof(activity));
+                std::memcpy(&related, &extra.Activity->RelatedActivity, sizeof(related));
+                WriteEvent("EventWriteTransfer", [&] {
+                    return ::EventWriteTransfer(m_provider.Handle, &descriptor, &activity, extra.Activity->RelatedActivity ? &related : nullptr, count, eventDataDescriptors);
+                });
+                return;
+            }
+
+            WriteEvent("EventWrite", [&] { return ::EventWrite(m_provider.Handle, &descriptor, count, eventDataDescriptors); });
+        }
+
+        std::size_t MaxPayloadSize() const noexcept override { return m_maxPayloadSize; }
+
+        void SetFilter(EtwLog::Level maxLevel, std::uint64_t keywordMask) override {
+            m_enabledProvider.Enable(static_cast<UCHAR>(maxLevel), keywordMask);
+        }
+
+        void SetBackpressure(const EtwLog::BackpressurePolicy& policy) override {
+            std::lock_guard lock{m_backpressureMutex};
+            m_backpressure = policy;
+        }
+
+        std::uint64_t DroppedRecords() const noexcept override { return m_dropped.load(std::memory_order_relaxed); }
+
+    private:
+        /// @brief Calls \a write, and handles the session having no free buffer as the backpressure policy says.
+        /// ETW owns its buffers, so the policies that would free or add one drop the event instead.
+        template <typename TWrite>
+        void WriteEvent(std::string_view api, TWrite&& write) {
+            auto result{write()};
+            if (result == ERROR_NOT_ENOUGH_MEMORY) {
+                EtwLog::BackpressurePolicy policy;
+                {
+                    std::lock_guard lock{m_backpressureMutex};
+                    policy = m_backpressure;
+                }
+
+                const auto deadline{std::chrono::steady_clock::now() + policy.Timeout};
+                while (result == ERROR_NOT_ENOUGH_MEMORY
+                    && (policy.Mode == EtwLog::Backpressure::Block || (policy.Mode == EtwLog::Backpressure::BlockWithTimeout && std::chrono::steady_clock::now() < deadline))) {
+                    // The session frees buffers as its flush thread writes them, there is nothing to wait on.
+                    std::this_thread::sleep_for(std::chrono::microseconds{100});
+                    result = write();
+                }
+                if (result == ERROR_NOT_ENOUGH_MEMORY) {
+                    m_dropped.fetch_add(1, std::memory_order_relaxed);
+                    return;
+                }
+            }
+            VerifyHResult(result, api, ERROR_SUCCESS);
+        }
+
+        const GUID m_providerId;
+
+        /// @brief Create the provider and use it for event logging.
+        /// @note: For a private logging session, the provider needs to register its GUID first, then the session is created with the same GUID.
+        Providers::Provider m_provider;
+
+        /// @brief Create ETW session
+        Controllers::Session m_session;
+
+        /// @brief Enable the provider with m_providerId in it.
+        Controllers::EnabledProvider m_enabledProvider;
+
+        const std::size_t m_maxPayloadSize;
+
+        std::mutex m_backpressureMutex;
+        EtwLog::BackpressurePolicy m_backpressure;
+        std::atomic<std::uint64_t> m_dropped{0};
+    };
+#endif
+
+    /// @brief Background thread finishing the loggers handed over by MiniLog::CloseAsync, in the order they were closed.
+    /// One thread for the process: closes are rare, and this keeps them from competing with each other for the disk.
+    class BackgroundCloser {
+    public:
+        static BackgroundCloser& Instance() {
+            static BackgroundCloser s_closer;
+            return s_closer;
+        }
+
+        void Post(std::packaged_task<void()> close) {
+            {
+                std::lock_guard lock{m_mutex};
+                m_pending.push_back(std::move(close));
+            }
+            m_posted.notify_one();
+        }
+
+    private:
+        BackgroundCloser() : m_thread{[this] { CloseThread(); }} {}
+
+        /// @brief Finishes whatever is still pending at process exit, so closed logs are complete.
+        ~BackgroundCloser() {
+            {
+                std::lock_guard lock{m_mutex};
+                m_stopping = true;
+            }
+            m_posted.notify_one();
+            m_thread.join();
+        }
+
+        void CloseThread() {
+            std::unique_lock lock{m_mutex};
+            for (;;) {
+                m_posted.wait(lock, [this] { return m_stopping || !m_pending.empty(); });
+                if (m_pending.empty()) {
+                    return;
+                }
+
+                auto close{std::move(m_pending.front())};
+                m_pending.pop_front();
+
+                lock.unlock();
+                close();
+                lock.lock();
+            }
+        }
+
+        std::mutex m_mutex;
+        std::condition_variable m_posted;
+        std::deque<std::packaged_task<void()>> m_pending;
+        bool m_stopping{false};
+        std::thread m_thread;
+    };
+
+    EtwLog::ProviderId MakeProviderId() {
+        EtwLog::ProviderId provider;
+#ifdef _WIN32
+        const auto guid{MakeGuid()};
+        std::memcpy(&provider, &guid, sizeof(provider));
+#else
+        // Random UUID (version 4), like CoCreateGuid makes.
+        std::random_device random;
+        const std::array<std::uint32_t, 4> bits{random(), random(), random(), random()};
+        std::memcpy(&provider, bits.data(), sizeof(provider));
+        provider.Data3 = static_cast<std::uint16_t>((provider.Data3 & 0x0FFF) | 0x4000);
+        provider.Data4[0] = static_cast<std::uint8_t>((provider.Data4[0] & 0x3F) | 0x80);
+#endif
+        return provider;
+    }
+
+    std::filesystem::path MakeDirectories(std::string_view outputFolder)
     {
         std::filesystem::create_directories(outputFolder);
         return outputFolder;
     }
+
+    std::unique_ptr<EtwLog::Detail::Sink> MakeSink(
+        const EtwLog::ProviderId& provider,
+        [[maybe_unused]] const char* sessionName,
+        const std::filesystem::path& logFile,
+        std::size_t bufferSize,
+        EtwLog::Backend backend,
+        const EtwLog::BufferPlacement& placement,
+        const EtwLog::FileWriting& writing,
+        const EtwLog::PriorityLanes& priority,
+        const EtwLog::ClockCalibration& calibration,
+        EtwLog::Detail::WriteProfiler* profiler)
+    {
+        switch (backend) {
+        case EtwLog::Backend::Etw:
+#ifdef _WIN32
+            return std::make_unique<EtwSink>(provider, sessionName, logFile, bufferSize, calibration);
+#else
+            throw std::invalid_argument{"ETW backend is only available on Windows"};
+#endif
+        case EtwLog::Backend::Portable:
+            return std::make_unique<EtwLog::Detail::PortableSink>(
+                logFile, bufferSize, calibration, provider, EtwLog::Detail::PortableSink::c_defaultSegmentSize, placement, writing, priority, profiler);
+        }
+
+        throw std::invalid_argument{"Unknown MiniLog backend"};
+    }
+
+    /// @brief Keeps callers off the ids of MiniLog's own records, which sinks and readers take at their word.
+    void CheckCallerEvent(const EtwLog::EventDescriptor& event) {
+        if (EtwLog::EventIds::IsReserved(event.Id)) {
+            throw std::invalid_argument{"MiniLog: event id " + std::to_string(event.Id) + " is reserved for the logger's own records"};
+        }
+    }
 }
 
 class EtwLog::MiniLog::Impl {
 public:
-    Impl(const char* sessionName, std::string_view outputFolder, std::size_t bufferSize) :
-        m_provider{m_providerId},
-        m_session{m_providerId, sessionName, std::string{MakeDirectories(outputFolder)} + "\\log.etl", bufferSize},
-        m_enabledProvider{m_session.EnableProvider(m_providerId)}
-    {}
-
-    void Write(std::span<const std::byte> message) const {
-        constexpr static const EVENT_DESCRIPTOR c_descriptor = {
-           0x1,    // Id
-           0x1,    // Version
-           0x0,    // Channel
-           0x0,    // LevelSeverity
-           0x0,    // Opcode
-           0x0,    // Task
-           0x0,    // Keyword
-        };
+    Impl(
+        const char* sessionName,
+        std::string_view outputFolder,
+        std::size_t bufferSize,
+        Backend backend,
+        const BufferPlacement& placement,
+        const FileWriting& writing,
+        const PriorityLanes& priority)
+        :
+        m_logFile{MakeDirectories(outputFolder) / LogFileName(backend)},
+        m_sink{MakeSink(m_provider, sessionName, m_logFile, bufferSize, backend, placement, writing, priority, m_clock.Calibration(), Profiler())}
+    {
+        WriteFormatManifest();
+        if constexpr (c_profileWrites) {
+            m_lastProfile = m_clock.Now();
+            m_profileTask.emplace(std::chrono::seconds{1}, [this] { WriteProfile(); });
+        }
+    }
+
+    /// @brief Leaves the repeats still being counted, the last histogram snapshots, metrics and write profile, the final sampling counts in the log, and every format logged in the manifest.
+    ~Impl() {
+        // Stopped first, as they write to the sink, which goes before them.
+        m_histogramTask.reset();
+        m_metricsTask.reset();
+        m_profileTask.reset();
+        try {
+            SetCoalescing(false, {});
+            WriteHistogramSnapshots();
+            WriteMetrics();
+            WriteProfile();
+            WriteSamplingCounts();
+            WriteFormatManifest();
+        } catch (...) {
+            // The records are all written by now, losing the counts is no reason to terminate.
+        }
+    }
+
+    void Write(const EventDescriptor& event, std::span<const std::byte> message) {
+        if (Admit(event)) {
+            WriteAdmitted(event, message);
+        }
+    }
+
+    /// @brief Records the filter stops aren't sampled, nor counted by sampling.
+    bool Admit(const EventDescriptor& event) noexcept {
+        const Detail::StageTimer timer{Profiler(), WriteStage::Admit};
+        return m_filter.Passes(event) && m_sampler.Admit(event.Id);
+    }
+
+    bool IsEnabled(const EventDescriptor& event) const noexcept { return m_filter.Passes(event); }
+
+    void SetFilter(Level maxLevel, std::uint64_t keywordMask) {
+        std::lock_guard lock{m_filterMutex};
+        m_sink->SetFilter(maxLevel, keywordMask);
+        m_filter.Set(maxLevel, keywordMask);
+    }
+
+    SinkId AddMemoryRing(std::size_t kilobytes) {
+        std::lock_guard lock{m_memoryRingMutex};
+        const auto count{m_memoryRingCount.load(std::memory_order_relaxed)};
+        if (count == m_memoryRings.size()) {
+            throw std::length_error{"MiniLog: too many memory rings"};
+        }
+        auto ring{std::make_unique<MemoryRing>(kilobytes, m_clock.Calibration(), m_provider)};
+        // Records are split into fragments for the file sink alone, so a ring has to take the largest fragment it writes.
+        if (ring->Sink.MaxPayloadSize() < m_maxPayloadSize) {
+            throw std::invalid_argument{"MiniLog: memory ring of " + std::to_string(kilobytes) + " KB is too small for a record of the log file's buffers"};
+        }
+        m_memoryRings[count] = std::move(ring);
+        // Writers find the ring once it is counted, never before it is constructed.
+        m_memoryRingCount.store(count + 1, std::memory_order_release);
+        return count + 1;
+    }
+
+    void SetSinkFilter(SinkId sink, Level maxLevel, std::uint64_t keywordMask) {
+        if (sink == c_fileSink) {
+            m_fileFilter.Set(maxLevel, keywordMask);
+        } else {
+            Ring(sink).Filter.Set(maxLevel, keywordMask);
+        }
+    }
+
+    std::uint64_t DumpMemoryRing(SinkId ring, const std::filesystem::path& file) { return Ring(ring).Sink.Dump(file); }
+
+    void WriteAdmitted(const EventDescriptor& event, std::span<const std::byte> message) {
+        if (m_coalescing.load(std::memory_order_relaxed)) {
+            const Detail::StageTimer timer{Profiler(), WriteStage::Coalesce};
+            std::lock_guard lock{m_coalescerMutex};
+            if (m_coalescer) {
+                m_coalescer->Offer(event, m_clock.Now(), message, m_emit);
+                return;
+            }
+        }
+
+        WriteRecord(event, m_clock.Now(), {}, message);
+    }
+
+    /// @brief Activity records are never coalesced: no two are the same.
+    void WriteActivity(const EventDescriptor& event, const ActivityHeader& activity, std::span<const std::byte> message) {
+        WriteRecord(event, m_clock.Now(), {nullptr, nullptr, &activity}, message);
+    }
+
+    void SetCoalescing(bool enabled, std::chrono::nanoseconds maxSpan) {
+        const auto maxSpanTicks{static_cast<std::uint64_t>(std::chrono::duration<double>(maxSpan).count() * m_clock.Calibration().TicksPerSecond)};
+
+        std::lock_guard lock{m_coalescerMutex};
+        if (enabled && m_coalescer) {
+            m_coalescer->SetMaxSpan(maxSpanTicks);
+        } else if (enabled) {
+            m_coalescer.emplace(maxSpanTicks);
+        } else if (m_coalescer) {
+            m_coalescer->Flush(m_emit);
+            m_coalescer.reset();
+        }
+        m_coalescing.store(enabled, std::memory_order_relaxed);
+    }
+
+    void SetSampling(const SamplingPolicy& policy) {
+        WriteSamplingCounts();
+        m_sampler.SetPolicy(policy);
+    }
+
+    void SetSampling(std::uint16_t eventId, const SamplingPolicy& policy) {
+        WriteSamplingCounts();
+        m_sampler.SetPolicy(eventId, policy);
+    }
+
+    std::vector<SamplingCount> SamplingCounts() const { return m_sampler.Counts(); }
+
+    void SetBackpressure(const BackpressurePolicy& policy) { m_sink->SetBackpressure(policy); }
+    std::uint64_t DroppedRecords() const noexcept { return m_sink->DroppedRecords(); }
+    std::uint64_t DroppedRecords(SinkId sink) const { return sink == c_fileSink ? DroppedRecords() : Ring(sink).Sink.DroppedRecords(); }
+
+    /// @brief Starts the thread writing snapshots with the first histogram, so loggers without any don't have one.
+    LatencyHistogram& Latencies(std::uint32_t key) {
+        std::lock_guard lock{m_histogramMutex};
+        if (!m_histogramTask) {
+            m_lastSnapshot = m_clock.Now();
+            m_histogramTask.emplace(m_histogramInterval, [this] { WriteHistogramSnapshots(); });
+        }
+        return m_histograms.try_emplace(key).first->second;
+    }
+
+    void SetHistogramInterval(std::chrono::nanoseconds interval) {
+        std::lock_guard lock{m_histogramMutex};
+        m_histogramInterval = interval;
+        if (m_histogramTask) {
+            m_histogramTask->SetInterval(interval);
+        }
+    }
+
+    Counter& CounterOf(std::uint32_t key) {
+        std::lock_guard lock{m_metricsMutex};
+        StartMetricsTask();
+        return m_counters.try_emplace(key).first->second;
+    }
+
+    Gauge& GaugeOf(std::uint32_t key) {
+        std::lock_guard lock{m_metricsMutex};
+        StartMetricsTask();
+        return m_gauges.try_emplace(key).first->second;
+    }
 
-        EVENT_DATA_DESCRIPTOR eventDataDescriptors[1];
-        EventDataDescCreate(&eventDataDescriptors[0], message.data(), static_cast<ULONG>(message.size()));
+    std::vector<StageProfile> Profile() { return m_profiler.Totals(); }
 
-        VerifyHResult(::EventWrite(m_provider.Handle, &c_descriptor, 1, eventDataDescriptors), "EventWrite", ERROR_SUCCESS);
+    void SetProfileInterval(std::chrono::nanoseconds interval) {
+        if (m_profileTask) {
+            m_profileTask->SetInterval(interval);
+        }
     }
 
-    const GUID& GetProviderId() const noexcept { return m_providerId; }
+    void SetMetricsInterval(std::chrono::nanoseconds interval) {
+        std::lock_guard lock{m_metricsMutex};
+        m_metricsInterval = interval;
+        if (m_metricsTask) {
+            m_metricsTask->SetInterval(interval);
+        }
+    }
+
+    const std::filesystem::path& LogFile() const noexcept { return m_logFile; }
+    const ProviderId& Provider() const noexcept { return m_provider; }
 
 private:
-    const GUID m_providerId{MakeGuid()};
+    /// @brief Sink added with \a AddMemoryRing, and which records it gets.
+    struct MemoryRing {
+        MemoryRing(std::size_t kilobytes, const ClockCalibration& calibration, const ProviderId& provider) : Sink{kilobytes, calibration, provider} {}
+
+        Detail::MemoryRingSink Sink;
+        Detail::EventFilter Filter;
+    };
+
+    /// @param extra - repeat and activity headers of the record, if any. Fragment headers are added here.
+    void WriteRecord(const EventDescriptor& event, std::uint64_t ticks, const Detail::ExtraHeaders& extra, std::span<const std::byte> message) {
+        if (message.size() > m_maxPayloadSize) {
+            WriteFragments(event, ticks, extra, message);
+            return;
+        }
+
+        const RecordHeader header{m_nextSequence.fetch_add(1, std::memory_order_relaxed), ticks};
+        const Detail::StageTimer timer{Profiler(), WriteStage::SinkWrite};
+        WriteToSinks(event, header, extra, message);
+    }
+
+    /// @brief Records MiniLog writes itself go to every sink whatever its filter, so each has what reading its records needs.
+    static bool IsOwnRecord(std::uint16_t eventId) noexcept {
+        return EventIds::IsReserved(eventId);
+    }
+
+    /// @brief Hands the record to every sink whose filter passes it, all from the same header and the caller's payload.
+    void WriteToSinks(const EventDescriptor& event, const RecordHeader& header, const Detail::ExtraHeaders& extra, std::span<const std::byte> message) {
+        const bool ownRecord{IsOwnRecord(event.Id)};
+        if (ownRecord || m_fileFilter.Passes(event)) {
+            if (extra.Flags() != 0) {
+                m_sink->Write(event, header, extra, message);
+            } else {
+                m_sink->Write(event, header, message);
+            }
+        }
+
+        const auto ringCount{m_memoryRingCount.load(std::memory_order_acquire)};
+        for (std::size_t r = 0; r != ringCount; ++r) {
+            auto& ring{*m_memoryRings[r]};
+            if (ownRecord || ring.Filter.Passes(event)) {
+                ring.Sink.Write(event, header, extra, message);
+            }
+        }
+    }
+
+    MemoryRing& Ring(SinkId ring) const {
+        if (ring == c_fileSink || ring > m_memoryRingCount.load(std::memory_order_acquire)) {
+            throw std::out_of_range{"MiniLog: no memory ring " + std::to_string(ring)};
+        }
+        return *m_memoryRings[ring - 1];
+    }
+
+    /// @brief Writes \a message, too large for one record, as records of one fragment each, straight from the caller's memory.
+    /// All fragments get the same timestamp and consecutive sequence numbers, taken at once so other writers can't come in between.
+    void WriteFragments(const EventDescriptor& event, std::uint64_t ticks, const Detail::ExtraHeaders& extra, std::span<const std::byte> message) {
+        const auto count{(message.size() + m_maxPayloadSize - 1) / m_maxPayloadSize};
+        if (count > UINT32_MAX) {
+            throw std::system_error{std::make_error_code(std::errc::message_size), "MiniLog: message too large"};
+        }
+
+        const auto firstSequence{m_nextSequence.fetch_add(count, std::memory_order_relaxed)};
+        for (std::size_t index = 0; index != count; ++index) {
+            const auto offset{index * m_maxPayloadSize};
+            const FragmentHeader fragment{static_cast<std::uint32_t>(index), static_cast<std::uint32_t>(count), offset, message.size()};
+            const RecordHeader header{firstSequence + index, ticks};
+            const Detail::StageTimer timer{Profiler(), WriteStage::SinkWrite};
+            WriteToSinks(event, header, {extra.Repeat, &fragment, extra.Activity}, message.subspan(offset, std::min(m_maxPayloadSize, message.size() - offset)));
+        }
+    }
+
+    /// @brief Written as they are, counts never repeat each other anyway.
+    void WriteSamplingCounts() {
+        const auto counts{m_sampler.Counts()};
+        if (!counts.empty()) {
+            WriteRecord({EventIds::SamplingCounts}, m_clock.Now(), {}, std::as_bytes(std::span{counts}));
+        }
+    }
+
+    /// @brief Writes what each histogram recorded since the last snapshots, skipping those that recorded nothing.
+    void WriteHistogramSnapshots() {
+        std::lock_guard lock{m_histogramMutex};
+        const auto now{m_clock.Now()};
+        const auto interval{ToSystemTime(m_clock.Calibration(), now) - ToSystemTime(m_clock.Calibration(), m_lastSnapshot)};
+        m_lastSnapshot = now;
+
+        for (auto& [key, histogram] : m_histograms) {
+            const auto taken{histogram.TakeInterval()};
+            if (taken.Count() != 0) {
+                WriteRecord({EventIds::HistogramSnapshot}, now, {}, EncodeHistogramSnapshot(key, interval, taken));
+            }
+        }
+    }
+
+    /// @brief Starts the thread writing metrics with the first one, under \a m_metricsMutex.
+    void StartMetricsTask() {
+        if (!m_metricsTask) {
+            m_lastMetrics = m_clock.Now();
+            m_metricsTask.emplace(m_metricsInterval, [this] { WriteMetrics(); });
+        }
+    }
+
+    /// @brief Writes every metric in one record: the counters that went up since the last one, and every gauge.
+    void WriteMetrics() {
+        std::lock_guard lock{m_metricsMutex};
+        const auto now{m_clock.Now()};
+        const auto interval{ToSystemTime(m_clock.Calibration(), now) - ToSystemTime(m_clock.Calibration(), m_lastMetrics)};
+        m_lastMetrics = now;
+
+        std::vector<MetricValue> values;
+        values.reserve(m_counters.size() + m_gauges.size());
+        for (auto& [key, counter] : m_counters) {
+            if (const auto count{counter.TakeInterval()}; count != 0) {
+                values.push_back({key, MetricKind::Counter, {}, static_cast<std::int64_t>(count)});
+            }
+        }
+        for (const auto& [key, gauge] : m_gauges) {
+            values.push_back({key, MetricKind::Gauge, {}, gauge.Value()});
+        }
+
+        if (!values.empty()) {
+            WriteRecord({EventIds::Metrics}, now, {}, EncodeMetrics(interval, values));
+        }
+    }
+
+    /// @brief Profiler the stages are timed into, null when profiling is off.
+    Detail::WriteProfiler* Profiler() noexcept { return c_profileWrites ? &m_profiler : nullptr; }
+
+    /// @brief Writes the time spent in each stage since the last profile, if any stage ran.
+    void WriteProfile() {
+        std::lock_guard lock{m_profileMutex};
+        const auto now{m_clock.Now()};
+        const auto interval{ToSystemTime(m_clock.Calibration(), now) - ToSystemTime(m_clock.Calibration(), m_lastProfile)};
+        m_lastProfile = now;
+
+        const auto stages{m_profiler.TakeInterval()};
+        if (!stages.empty()) {
+            WriteRecord({EventIds::WriteProfile}, now, {}, EncodeWriteProfile(interval, m_clock.Calibration().TicksPerSecond, stages));
+        }
+    }
 
-    /// @brief Create the provider and use it for event logging.
-    /// @note: For a private logging session, the provider needs to register its GUID first, then the session is created with the same GUID.
-    Providers::Provider m_provider;
+    /// @brief Writes the manifest with every format registered so far, unless it already has them all.
+    /// None is written while the program hasn't registered any format.
+    void WriteFormatManifest() {
+        const auto count{Detail::RegisteredFormatCount()};
+        if (count != m_formatsInManifest) {
+            Detail::WriteFormatManifest(FormatManifestFile(m_logFile));
+            m_formatsInManifest = count;
+        }
+    }
+
+    const std::filesystem::path m_logFile;
+    const ProviderId m_provider{MakeProviderId()};
+
+    /// @brief Formats registered when the manifest was last written.
+    std::size_t m_formatsInManifest{0};
+
+    /// @brief Timestamps the records; its calibration is stored in the log for the reader.
+    const Clock m_clock;
+
+    /// @brief Left empty unless \a c_profileWrites is on.
+    Detail::WriteProfiler m_profiler{m_clock};
+
+    /// @brief Keeps the profile written on close from racing with the last periodic one.
+    std::mutex m_profileMutex;
+    std::uint64_t m_lastProfile{0};
+
+    /// @brief Writes the profile while profiling is on.
+    std::optional<Detail::PeriodicTask> m_profileTask;
+
+    Detail::EventFilter m_filter;
+
+    /// @brief Keeps the filter and the sink's in step when it is set from several threads at once.
+    std::mutex m_filterMutex;
+
+    Detail::Sampler m_sampler{m_clock};
+
+    /// @brief Guards the histograms map, not the histograms: recording takes no lock.
+    std::mutex m_histogramMutex;
+
+    /// @brief A map, so histograms never move once handed out.
+    std::map<std::uint32_t, LatencyHistogram> m_histograms;
+    std::chrono::nanoseconds m_histogramInterval{std::chrono::seconds{1}};
+
+    /// @brief Clock ticks when the snapshots were last taken, the start of the current interval.
+    std::uint64_t m_lastSnapshot{0};
 
-    /// @brief Create ETW session
-    Controllers::Session m_session;
+    /// @brief Writes the snapshots, once there is a histogram.
+    std::optional<Detail::PeriodicTask> m_histogramTask;
 
-    /// @brief Enable the provider with m_providerId in it.
-    Controllers::EnabledProvider m_enabledProvider;
+    /// @brief Guards the maps of counters and gauges, not the metrics: updating them takes no lock.
+    std::mutex m_metricsMutex;
+    std::map<std::uint32_t, Counter> m_counters;
+    std::map<std::uint32_t, Gauge> m_gauges;
+    std::chrono::nanoseconds m_metricsInterval{std::chrono::seconds{1}};
+
+    /// @brief Clock ticks when the metrics were last written.
+    std::uint64_t m_lastMetrics{0};
+
+    /// @brief Writes the metrics, once there is one.
+    std::optional<Detail::PeriodicTask> m_metricsTask;
+
+    /// @brief Set while coalescing is on, so the lock is only taken then.
+    std::atomic<bool> m_coalescing{false};
+    std::mutex m_coalescerMutex;
+    std::optional<Detail::Coalescer> m_coalescer;
+    const Detail::Coalescer::Emit m_emit{[this](const EventDescriptor& event, std::uint64_t ticks, const RepeatHeader* repeat, std::span<const std::byte> message) {
+        WriteRecord(event, ticks, {repeat}, message);
+    }};
+
+    /// @brief Sequence number of the next record. A record that fails to be written leaves a gap, as it should.
+    std::atomic<std::uint64_t> m_nextSequence{0};
+
+    std::unique_ptr<Detail::Sink> m_sink;
+
+    /// @brief Which records go to \a m_sink, of those \a m_filter passes.
+    Detail::EventFilter m_fileFilter;
+
+    /// @brief Guards adding rings. Writers find them through \a m_memoryRingCount alone, so rings are never moved nor removed.
+    std::mutex m_memoryRingMutex;
+    std::array<std::unique_ptr<MemoryRing>, 7> m_memoryRings;
+    std::atomic<std::size_t> m_memoryRingCount{0};
+
+    /// @brief Larger messages are written in fragments.
+    const std::size_t m_maxPayloadSize{m_sink->MaxPayloadSize()};
 };
 
-EtwLog::MiniLog::MiniLog(const char* sessionName, std::string_view outputFolder, std::size_t bufferSize) : m_impl{std::make_unique<Impl>(sessionName, outputFolder, bufferSize)} {}
+std::string_view EtwLog::LogFileName(Backend backend) noexcept {
+    return backend == Backend::Etw ? "log.etl" : "log.mlog";
+}
+
+EtwLog::MiniLog::MiniLog(
+    const char* sessionName,
+    std::string_view outputFolder,
+    std::size_t bufferSize,
+    Backend backend,
+    const BufferPlacement& placement,
+    const FileWriting& writing,
+    const PriorityLanes& priority)
+    : m_impl{std::make_unique<Impl>(sessionName, outputFolder, bufferSize, backend, placement, writing, priority)} {}
 EtwLog::MiniLog::~MiniLog() = default;
 
 EtwLog::MiniLog::MiniLog(MiniLog&&) noexcept = default;
 EtwLog::MiniLog& EtwLog::MiniLog::MiniLog::operator=(MiniLog&&) noexcept = default;
 
-void EtwLog::MiniLog::operator()(std::span<const std::byte> message) const { m_impl->Write(message); }
\ No newline at end of file
+void EtwLog::MiniLog::operator()(std::span<const std::byte> message) const { m_impl->Write(EventDescriptor{}, message); }
+
+void EtwLog::MiniLog::operator()(const EventDescriptor& event, std::span<const std::byte> message) const {
+    CheckCallerEvent(event);
+    m_impl->Write(event, message);
+}
+
+bool EtwLog::MiniLog::Admit(const EventDescriptor& event) const {
+    CheckCallerEvent(event);
+    return m_impl->Admit(event);
+}
+
+void EtwLog::MiniLog::WriteAdmitted(const EventDescriptor& event, std::span<const std::byte> message) const {
+    CheckCallerEvent(event);
+    m_impl->WriteAdmitted(event, message);
+}
+
+void EtwLog::MiniLog::WriteActivity(const EventDescriptor& event, const ActivityHeader& activity, std::span<const std::byte> message) const {
+    CheckCallerEvent(event);
+    m_impl->WriteActivity(event, activity, message);
+}
+
+void EtwLog::MiniLog::SetCoalescing(bool enabled, std::chrono::nanoseconds maxSpan) { m_impl->SetCoalescing(enabled, maxSpan); }
+
+bool EtwLog::MiniLog::IsEnabled(const EventDescriptor& event) const noexcept { return m_impl->IsEnabled(event); }
+
+void EtwLog::MiniLog::SetFilter(Level maxLevel, std::uint64_t keywordMask) { m_impl->SetFilter(maxLevel, keywordMask); }
+
+EtwLog::SinkId EtwLog::MiniLog::AddMemoryRing(std::size_t kilobytes) { return m_impl->AddMemoryRing(kilobytes); }
+
+void EtwLog::MiniLog::SetSinkFilter(SinkId sink, Level maxLevel, std::uint64_t keywordMask) { m_impl->SetSinkFilter(sink, maxLevel, keywordMask); }
+
+std::uint64_t EtwLog::MiniLog::DumpMemoryRing(SinkId ring, const std::filesystem::path& file) const { return m_impl->DumpMemoryRing(ring, file); }
+
+void EtwLog::MiniLog::SetSampling(const SamplingPolicy& policy) { m_impl->SetSampling(policy); }
+
+void EtwLog::MiniLog::SetSampling(std::uint16_t eventId, const SamplingPolicy& policy) { m_impl->SetSampling(eventId, policy); }
+
+std::vector<EtwLog::SamplingCount> EtwLog::MiniLog::SamplingCounts() const { return m_impl->SamplingCounts(); }
+
+void EtwLog::MiniLog::SetBackpressure(const BackpressurePolicy& policy) { m_impl->SetBackpressure(policy); }
+
+std::uint64_t EtwLog::MiniLog::DroppedRecords() const noexcept { return m_impl->DroppedRecords(); }
+
+std::uint64_t EtwLog::MiniLog::DroppedRecords(SinkId sink) const { return m_impl->DroppedRecords(sink); }
+
+EtwLog::LatencyHistogram& EtwLog::MiniLog::Latencies(std::uint32_t key) { return m_impl->Latencies(key); }
+
+void EtwLog::MiniLog::SetHistogramInterval(std::chrono::nanoseconds interval) { m_impl->SetHistogramInterval(interval); }
+
+EtwLog::Counter& EtwLog::MiniLog::CounterOf(std::uint32_t key) { return m_impl->CounterOf(key); }
+
+EtwLog::Gauge& EtwLog::MiniLog::GaugeOf(std::uint32_t key) { return m_impl->GaugeOf(key); }
+
+void EtwLog::MiniLog::SetMetricsInterval(std::chrono::nanoseconds interval) { m_impl->SetMetricsInterval(interval); }
+
+std::vector<EtwLog::StageProfile> EtwLog::MiniLog::Profile() const { return m_impl->Profile(); }
+
+void EtwLog::MiniLog::SetProfileInterval(std::chrono::nanoseconds interval) { m_impl->SetProfileInterval(interval); }
+
+const std::filesystem::path& EtwLog::MiniLog::LogFile() const noexcept { return m_impl->LogFile(); }
+
+const EtwLog::ProviderId& EtwLog::MiniLog::Provider() const noexcept { return m_impl->Provider(); }
+
+std::shared_future<void> EtwLog::MiniLog::CloseAsync() {
+    std::packaged_task<void()> close{[impl = std::move(m_impl)]() mutable { impl.reset(); }};
+    auto closed{close.get_future().share()};
+    BackgroundCloser::Instance().Post(std::move(close));
+    return closed;
+}
\ No newline at end of file
@@ -1,14 +1,121 @@
 #pragma once
 
+#include "Histogram.h"
+#include "MessageFormat.h"
+#include "Metrics.h"
+#include "Record.h"
+#include "Sampling.h"
+#include "WriteProfiler.h"
+
+#include <chrono>
+#include <filesystem>
+#include <future>
 #include <memory>
 #include <span>
 #include <string_view>
 #include <optional>
+#include <type_traits>
+#include <vector>
 
 namespace EtwLog
 {
     void VerifyHResult(std::uint32_t hresult, std::string_view additionalInfo, std::uint32_t expectedGoodResult);
 
+    /// @brief Where MiniLog stores its records.
+    enum class Backend {
+        /// @brief Private Event Tracing for Windows session writing log.etl. Windows only.
+        Etw,
+        /// @brief MiniLog's own buffers and writer thread, writing log.mlog. Available on every platform.
+        Portable,
+    };
+
+#ifdef _WIN32
+    inline constexpr Backend c_defaultBackend{Backend::Etw};
+#else
+    inline constexpr Backend c_defaultBackend{Backend::Portable};
+#endif
+
+    /// @brief Where the portable backend keeps its buffers. The ETW backend has its buffers managed by ETW, and ignores it.
+    struct BufferPlacement {
+        /// @brief Gives every NUMA node buffers of its own, in its own memory, and has each record appended
+        /// to the buffers of the node its writer runs on, so records aren't copied across sockets.
+        /// Buffers of different nodes are written to the file as they fill, so records come out of sequence
+        /// order by up to a buffer's worth: read them with a \a GapDetector window of that many records.
+        bool NumaLocal{false};
+
+        /// @brief Backs buffers with 2 MB huge pages where the system allows, saving TLB misses on large buffers.
+        /// Buffer memory is then rounded up to whole huge pages.
+        bool HugePages{false};
+    };
+
+    /// @brief How the portable backend writes full buffers to its file. The ETW backend ignores it.
+    struct FileWriting {
+        /// @brief Writes with io_uring, keeping several buffers in flight at once, from buffer memory registered with the kernel.
+        /// Where io_uring isn't available (not Linux, a kernel before 5.1, or a sandbox forbidding it) buffers are written one at a time with pwrite, as without it.
+        bool IoUring{false};
+
+        /// @brief Opens the log with O_DIRECT, bypassing the page cache. Buffers are rounded up to whole 4 KB blocks,
+        /// and each is padded to a whole number of blocks with a padding record that readers skip.
+        /// Where the file system doesn't support it, the log is written through the page cache, still padded.
+        bool DirectIo{false};
+    };
+
+    /// @brief Buffers the portable backend keeps apart for the most severe records, so that a flood of less severe ones can neither delay nor drop them.
+    /// Priority records reach the file out of time order with the others: read them back with \a ReadLogByTime.
+    /// The ETW backend, whose buffers belong to its session, ignores it.
+    struct PriorityLanes {
+        /// @brief Records of this level or more severe get buffers of their own, a lane per level, so \a Level::Critical records
+        /// always have buffers reserved for them alone. None, the default, has every record share the same buffers.
+        std::optional<Level> Threshold;
+
+        /// @brief Buffers of each priority lane, at least 2, of \a bufferSize kilobytes like the others.
+        std::size_t BufferCount{4};
+
+        /// @brief Longest a record waits in a partly filled buffer of a priority lane before it is queued for the file.
+        /// Queued buffers of priority lanes are written ahead of the others'.
+        std::chrono::milliseconds FlushInterval{100};
+    };
+
+    /// @brief What a write does when the logger's buffers are all full, waiting for the file.
+    enum class Backpressure {
+        /// @brief Waits for a buffer, however long it takes. On ETW, retries until the session takes the event.
+        Block,
+        /// @brief Drops the record being written.
+        DropNewest,
+        /// @brief Drops the oldest full buffer not yet being written to the file, and reuses it for the record.
+        /// Drops the record being written if every full buffer is already being written. On ETW, which owns its buffers, same as \a DropNewest.
+        DropOldest,
+        /// @brief Waits for a buffer up to \a BackpressurePolicy::Timeout, then drops the record being written.
+        BlockWithTimeout,
+        /// @brief Appends the record to a memory-mapped overflow file of \a BackpressurePolicy::SpillKilobytes next to the log,
+        /// which is moved into buffers, in order, as they become free; records written meanwhile go after it. Drops the record when the file is full.
+        /// On ETW, same as \a DropNewest.
+        Spill,
+    };
+
+    /// @brief How a logger handles writers outpacing its file, see \a MiniLog::SetBackpressure.
+    /// Every policy but \a Backpressure::Block bounds the time a write takes: by \a Timeout for \a Backpressure::BlockWithTimeout,
+    /// otherwise by the wait for the lock of its buffers, which is held to copy a record, never a whole buffer:
+    /// buffers are neither walked nor copied into under it. A dropped record leaves a gap in the sequence numbers.
+    struct BackpressurePolicy {
+        Backpressure Mode{Backpressure::Block};
+
+        /// @brief Longest a write waits for a buffer, with \a Backpressure::BlockWithTimeout.
+        std::chrono::nanoseconds Timeout{std::chrono::milliseconds{1}};
+
+        /// @brief Size of the overflow file of each lane of buffers, with \a Backpressure::Spill. Created, with its disk space, when the policy is set.
+        std::size_t SpillKilobytes{4096};
+    };
+
+    /// @brief A sink of a logger, for \a MiniLog::SetSinkFilter: \a c_fileSink, or a memory ring added with \a MiniLog::AddMemoryRing.
+    using SinkId = std::size_t;
+
+    /// @brief The sink writing the logger's file, which every logger has.
+    inline constexpr SinkId c_fileSink{0};
+
+    /// @brief Name of the log file \a backend creates in the MiniLog output folder.
+    std::string_view LogFileName(Backend backend) noexcept;
+
     class MiniLog
     {
     public:
@@ -16,19 +123,180 @@ namespace EtwLog
         /// @param sessionName - unique name of the ETW session created internally.
         /// @param outputFolder
         /// @param bufferSize - Kilobytes of memory allocated for each event tracing session buffer.
+        /// @param backend - what stores the records, see \a Backend.
+        /// @param placement - where the portable backend allocates its buffers.
+        /// @param writing - how the portable backend writes its buffers to the file.
+        /// @param priority - which records the portable backend gives buffers of their own.
         MiniLog(
             const char* sessionName, 
             std::string_view outputFolder, 
-            std::size_t bufferSize);
+            std::size_t bufferSize,
+            Backend backend = c_defaultBackend,
+            const BufferPlacement& placement = {},
+            const FileWriting& writing = {},
+            const PriorityLanes& priority = {});
         ~MiniLog();
 
         MiniLog(MiniLog&&) noexcept;
         MiniLog& operator=(MiniLog&&) noexcept;
 
-        /// @brief Uses EventWrite API to write the \a message into the provider.
+        /// @brief Uses EventWrite API (or the portable backend) to write the \a message into the provider.
+        /// The message is prefixed with a \a RecordHeader carrying the next sequence number of this logger and a timestamp.
         /// @param message 
         void operator()(std::span<const std::byte> message) const;
 
+        /// @brief Same as above, for a record described by \a event instead of the default \a EventIds::Message at information level.
+        /// @throws std::invalid_argument if \a event has an id reserved for MiniLog's own records (see \a EventIds::IsReserved),
+        /// as do \a Admit, \a WriteAdmitted and \a WriteActivity.
+        void operator()(const EventDescriptor& event, std::span<const std::byte> message) const;
+
+        /// @brief Logs a message to be formatted like std::format when it is read, with \a FormatMessage, rather than now.
+        /// The record (\a EventIds::FormattedMessage at \a level) holds the id of \a format and the arguments in binary,
+        /// so logging costs copying the arguments, and formatting them is left to whoever reads the log.
+        /// Arguments can be numbers, bool, char and strings; strings are copied into the record.
+        /// The format is registered the first time it is logged, and listed in the logger's \a FormatManifest when it closes.
+        template <typename... TArgs>
+        void Log(Level level, FormatString<std::type_identity_t<TArgs>...> format, const TArgs&... args) const {
+            const EventDescriptor event{EventIds::FormattedMessage, level};
+            if (Admit(event)) {
+                Detail::RegisterFormat(format.Id(), format.Text(), format.Arguments());
+                Detail::EncodeFormattedMessage(format.Id(), [&](std::span<const std::byte> payload) { WriteAdmitted(event, payload); }, args...);
+            }
+        }
+
+        /// @brief Same as above, at information level.
+        template <typename... TArgs>
+        void Log(FormatString<std::type_identity_t<TArgs>...> format, const TArgs&... args) const {
+            Log(Level::Information, format, args...);
+        }
+
+        /// @brief Same as above, for a format string written as "..."_format: the format and its argument types are registered
+        /// before main starts, so they are in the manifest from the logger's start, and the id written is a constant.
+        template <FormatText c_text, typename... TArgs>
+        void Log(Level level, StaticFormat<c_text>, const TArgs&... args) const {
+            using Entry = Detail::StaticFormatEntry<c_text, std::remove_cvref_t<TArgs>...>;
+            static_cast<void>(&Entry::c_registered);
+
+            const EventDescriptor event{EventIds::FormattedMessage, level};
+            if (Admit(event)) {
+                Detail::EncodeFormattedMessage(Entry::c_format.Id(), [&](std::span<const std::byte> payload) { WriteAdmitted(event, payload); }, args...);
+            }
+        }
+
+        template <FormatText c_text, typename... TArgs>
+        void Log(StaticFormat<c_text> format, const TArgs&... args) const {
+            Log(Level::Information, format, args...);
+        }
+
+        /// @brief True if records described by \a event pass the filter set with \a SetFilter. Costs one relaxed atomic load.
+        bool IsEnabled(const EventDescriptor& event) const noexcept;
+
+        /// @brief Writes only records of \a maxLevel or more severe and, unless \a keywordMask is zero, with one of its keyword bits
+        /// (records with no keyword at all pass by level alone, as in ETW). Takes effect right away, from any thread,
+        /// without restarting the session: ETW is told to enable the provider again with the new level and keywords.
+        /// A new logger writes every record.
+        void SetFilter(Level maxLevel, std::uint64_t keywordMask = 0);
+
+        /// @brief Adds a sink keeping the latest \a kilobytes (at least 64) of records in memory, pushing out the oldest,
+        /// to be saved with \a DumpMemoryRing, such as by a crash handler. Up to 7 per logger.
+        /// A record is stamped and encoded once, then handed to every sink whose filter passes it, straight from the caller's memory.
+        /// Large records are split into fragments the size of the log file's buffers, so a ring has to be at least that large:
+        /// throws \a std::invalid_argument otherwise.
+        /// @return Id of the ring, for \a SetSinkFilter and \a DumpMemoryRing.
+        SinkId AddMemoryRing(std::size_t kilobytes);
+
+        /// @brief Hands \a sink only the records, of those \a SetFilter passes, of \a maxLevel or more severe and, unless \a keywordMask is zero,
+        /// with one of its keyword bits: such as verbose records to a memory ring and only warnings to the file. Takes effect right away, from any thread.
+        /// A new sink gets every record. Records MiniLog writes itself, such as metrics and sampling counts, go to every sink.
+        /// Records the file's filter leaves out still take sequence numbers, so they show as gaps in the file.
+        void SetSinkFilter(SinkId sink, Level maxLevel, std::uint64_t keywordMask = 0);
+
+        /// @brief Saves the records memory ring \a ring holds, oldest first, to \a file as a portable log, to read with \a ReadLog.
+        /// Logging goes on meanwhile.
+        /// @return Records saved.
+        std::uint64_t DumpMemoryRing(SinkId ring, const std::filesystem::path& file) const;
+
+        /// @brief Decides whether a record described by \a event passes the filter and is kept by the sampling policies, counting it as kept or dropped.
+        /// For call sites with costly payloads: call it before building the payload, then write a kept record with \a WriteAdmitted.
+        bool Admit(const EventDescriptor& event) const;
+
+        /// @brief Writes a record \a Admit kept, without deciding again.
+        void WriteAdmitted(const EventDescriptor& event, std::span<const std::byte> message) const;
+
+        /// @brief Writes a record \a Admit kept that starts or stops an activity, with \a activity as its \a ActivityHeader.
+        /// Used by \a ActivityScope, see Activity.h.
+        void WriteActivity(const EventDescriptor& event, const ActivityHeader& activity, std::span<const std::byte> message) const;
+
+        /// @brief Keeps only the records \a policy selects out of all records of this logger. Takes effect right away, from any thread.
+        /// The counts so far are written to the log as an \a EventIds::SamplingCounts record before the change, and again when the logger closes.
+        void SetSampling(const SamplingPolicy& policy);
+
+        /// @brief Same as above, for the records with \a eventId. They are then subject to both policies, this one first.
+        void SetSampling(std::uint16_t eventId, const SamplingPolicy& policy);
+
+        /// @brief Collapses runs of identical records, such as a failure logged in a loop, while \a enabled.
+        /// The first record of a run is written as usual. The records repeating it (same event descriptor and payload,
+        /// with no other record of that event id in between) are written as one record with a \a RepeatHeader instead:
+        /// once another record of the event id comes, once the run spans \a maxSpan, and when coalescing is turned off or the logger closes.
+        /// Readers report such a record with \a RecordView::Repeats, or pass each repeat with \a ExpandRepeats.
+        /// @note While enabled, records are written one at a time under a lock.
+        void SetCoalescing(bool enabled, std::chrono::nanoseconds maxSpan = std::chrono::seconds{1});
+
+        /// @brief Histogram of the latencies recorded under \a key, created empty on the first call. Recording into it takes no lock.
+        /// Every histogram interval (see \a SetHistogramInterval), each histogram that recorded anything is written to the log
+        /// as an \a EventIds::HistogramSnapshot record of that interval's latencies, and again when the logger closes.
+        /// Read them back merged over any time range and logs with \a ReadHistograms.
+        /// @return Lives as long as the logger.
+        LatencyHistogram& Latencies(std::uint32_t key);
+
+        /// @brief Writes histogram snapshots every \a interval from now on. One second for a new logger.
+        void SetHistogramInterval(std::chrono::nanoseconds interval);
+
+        /// @brief Counter under \a key, created at zero on the first call. Adding to it costs one relaxed atomic add.
+        /// Every metrics interval (see \a SetMetricsInterval), how much each counter went up and each gauge's level
+        /// are written to the log together, as one \a EventIds::Metrics record, and again when the logger closes. Read them back with \a ReadMetrics.
+        /// @return Lives as long as the logger.
+        Counter& CounterOf(std::uint32_t key);
+
+        /// @brief Gauge under \a key, created at zero on the first call. See \a CounterOf.
+        Gauge& GaugeOf(std::uint32_t key);
+
+        /// @brief Writes the metrics every \a interval from now on. One second for a new logger.
+        void SetMetricsInterval(std::chrono::nanoseconds interval);
+
+        /// @brief Time spent in each \a WriteStage since the logger started, by every thread, in clock ticks.
+        /// Empty unless MiniLog is built with \a c_profileWrites on. The logger then also writes the time spent over each
+        /// profile interval (see \a SetProfileInterval) as an \a EventIds::WriteProfile record, read back with \a DecodeWriteProfile.
+        std::vector<StageProfile> Profile() const;
+
+        /// @brief Writes the profile every \a interval from now on. One second for a new logger. Does nothing with profiling off.
+        void SetProfileInterval(std::chrono::nanoseconds interval);
+
+        /// @brief Handles writes finding every buffer full as \a policy says, from now on. A new logger uses \a Backpressure::Block.
+        /// Setting \a Backpressure::Spill creates the overflow files, and throws \a std::system_error if that fails.
+        void SetBackpressure(const BackpressurePolicy& policy);
+
+        /// @brief Records dropped by the backpressure policy so far.
+        std::uint64_t DroppedRecords() const noexcept;
+
+        /// @brief Records \a sink dropped so far: by the backpressure policy for \a c_fileSink, as too large for a memory ring.
+        /// Records a ring pushed out to make room for newer ones aren't counted.
+        std::uint64_t DroppedRecords(SinkId sink) const;
+
+        /// @brief Records kept and dropped by each policy set so far, for analysis to reweight sampled records.
+        std::vector<SamplingCount> SamplingCounts() const;
+
+        /// @brief Path of the file this logger writes, to read it back with \a ReadLog.
+        const std::filesystem::path& LogFile() const noexcept;
+
+        /// @brief Id of this logger, stored in its log. Unique for every MiniLog constructed.
+        const ProviderId& Provider() const noexcept;
+
+        /// @brief Hands the flush and teardown the destructor would do to a background thread, and returns right away.
+        /// The logger is empty afterwards, like a moved-from one: it can only be destroyed or assigned to.
+        /// @return Ready once everything written to the logger is in the file.
+        std::shared_future<void> CloseAsync();
+
     private:
         class Impl;
 
@@ -0,0 +1,75 @@
+#include "pch.h"
+#include "MiniLogPool.h"
+
+EtwLog::MiniLogPool::MiniLogPool(
+    std::string sessionName,
+    std::filesystem::path outputFolder,
+    std::size_t bufferSize,
+    std::size_t spareCount,
+    Backend backend)
+    :
+    m_sessionName{std::move(sessionName)},
+    m_outputFolder{std::move(outputFolder)},
+    m_bufferSize{bufferSize},
+    m_spareCount{spareCount},
+    m_backend{backend},
+    m_prepareThread{[this] { PrepareThread(); }}
+{}
+
+EtwLog::MiniLogPool::~MiniLogPool() {
+    {
+        std::lock_guard lock{m_mutex};
+        m_stopping = true;
+    }
+
+    m_spareTaken.notify_one();
+    m_prepareThread.join();
+}
+
+EtwLog::MiniLog EtwLog::MiniLogPool::Take() {
+    std::unique_lock lock{m_mutex};
+    if (m_spares.empty()) {
+        const auto number{m_nextNumber++};
+        lock.unlock();
+        return Construct(number);
+    }
+
+    auto log{std::move(m_spares.front())};
+    m_spares.pop_front();
+    lock.unlock();
+
+    m_spareTaken.notify_one();
+    return log;
+}
+
+std::size_t EtwLog::MiniLogPool::Ready() const {
+    std::lock_guard lock{m_mutex};
+    return m_spares.size();
+}
+
+EtwLog::MiniLog EtwLog::MiniLogPool::Construct(std::size_t number) const {
+    const auto suffix{std::to_string(number)};
+    return MiniLog{(m_sessionName + " " + suffix).c_str(), (m_outputFolder / suffix).string(), m_bufferSize, m_backend};
+}
+
+void EtwLog::MiniLogPool::PrepareThread() {
+    std::unique_lock lock{m_mutex};
+    for (;;) {
+        m_spareTaken.wait(lock, [this] { return m_stopping || m_spares.size() < m_spareCount; });
+        if (m_stopping) {
+            return;
+        }
+
+        const auto number{m_nextNumber++};
+        lock.unlock();
+
+        // A logger that fails to construct here will fail in Take as well, and report the error there.
+        try {
+            auto log{Construct(number)};
+            lock.lock();
+            m_spares.push_back(std::move(log));
+        } catch (const std::exception&) {
+            return;
+        }
+    }
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include "MiniEtwLog.h"
+
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace EtwLog
+{
+    /// @brief Warm start for short-lived loggers.
+    /// Registering the provider, starting and enabling the session and creating the output folder and files
+    /// all happen on a background thread ahead of time, so taking a logger from the pool is just a move.
+    /// @note ETW allows only a few private sessions per process, and spare loggers count against that limit.
+    class MiniLogPool {
+    public:
+        /// @param sessionName - prefix of the session names, each logger gets "<sessionName> <number>".
+        /// @param outputFolder - each logger writes into its own numbered subfolder of it.
+        /// @param bufferSize - Kilobytes of memory allocated for each event tracing session buffer.
+        /// @param spareCount - number of loggers kept ready to be taken.
+        /// @param backend - what stores the records, see \a Backend.
+        MiniLogPool(
+            std::string sessionName,
+            std::filesystem::path outputFolder,
+            std::size_t bufferSize,
+            std::size_t spareCount,
+            Backend backend = c_defaultBackend);
+
+        /// @brief Stops preparing loggers and destroys the spare ones, leaving their empty logs behind.
+        ~MiniLogPool();
+
+        MiniLogPool(const MiniLogPool&) = delete;
+        MiniLogPool& operator=(const MiniLogPool&) = delete;
+
+        /// @brief Takes a ready logger, or constructs one on the calling thread if none is ready yet.
+        MiniLog Take();
+
+        /// @brief Number of loggers ready to be taken.
+        std::size_t Ready() const;
+
+    private:
+        /// @brief Constructs the next logger. Called without holding m_mutex.
+        MiniLog Construct(std::size_t number) const;
+
+        void PrepareThread();
+
+        const std::string m_sessionName;
+        const std::filesystem::path m_outputFolder;
+        const std::size_t m_bufferSize;
+        const std::size_t m_spareCount;
+        const Backend m_backend;
+
+        mutable std::mutex m_mutex;
+        std::condition_variable m_spareTaken;
+        std::deque<MiniLog> m_spares;
+        std::size_t m_nextNumber{0};
+        bool m_stopping{false};
+
+        /// @brief Last member, so it starts after everything it uses is constructed.
+        std::thread m_prepareThread;
+    };
+} // EtwLog
@@ -0,0 +1,50 @@
+#include "pch.h"
+#include "PeriodicTask.h"
+
+EtwLog::Detail::PeriodicTask::PeriodicTask(std::chrono::nanoseconds interval, std::function<void()> task)
+    :
+    m_task{std::move(task)},
+    m_interval{interval},
+    m_thread{[this] { Run(); }}
+{}
+
+EtwLog::Detail::PeriodicTask::~PeriodicTask() {
+    {
+        std::lock_guard lock{m_mutex};
+        m_stopping = true;
+    }
+    m_changed.notify_one();
+    m_thread.join();
+}
+
+void EtwLog::Detail::PeriodicTask::SetInterval(std::chrono::nanoseconds interval) {
+    {
+        std::lock_guard lock{m_mutex};
+        m_interval = interval;
+    }
+    m_changed.notify_one();
+}
+
+void EtwLog::Detail::PeriodicTask::Run() {
+    auto lastRun{std::chrono::steady_clock::now()};
+    std::unique_lock lock{m_mutex};
+    for (;;) {
+        // Waits again after an interval change, until the new interval has passed since the last run.
+        m_changed.wait_until(lock, lastRun + m_interval);
+        if (m_stopping) {
+            return;
+        }
+        if (std::chrono::steady_clock::now() < lastRun + m_interval) {
+            continue;
+        }
+
+        lastRun = std::chrono::steady_clock::now();
+        lock.unlock();
+        try {
+            m_task();
+        } catch (...) {
+            // Nothing to report to; the next run tries again.
+        }
+        lock.lock();
+    }
+}
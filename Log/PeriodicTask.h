@@ -0,0 +1,37 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+namespace EtwLog::Detail
+{
+    /// @brief Background thread running a task every interval, such as writing the snapshots of a logger's histograms.
+    class PeriodicTask {
+    public:
+        PeriodicTask(std::chrono::nanoseconds interval, std::function<void()> task);
+
+        /// @brief Stops the thread, waiting for a run in progress to finish. The task isn't run once more.
+        ~PeriodicTask();
+
+        PeriodicTask(const PeriodicTask&) = delete;
+        PeriodicTask& operator=(const PeriodicTask&) = delete;
+
+        /// @brief Runs the task every \a interval from now on, the next time \a interval after the last run.
+        void SetInterval(std::chrono::nanoseconds interval);
+
+    private:
+        void Run();
+
+        const std::function<void()> m_task;
+
+        std::mutex m_mutex;
+        std::condition_variable m_changed;
+        std::chrono::nanoseconds m_interval;
+        bool m_stopping{false};
+
+        std::thread m_thread;
+    };
+} // EtwLog::Detail
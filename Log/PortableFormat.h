@@ -0,0 +1,97 @@
+#pragma once
+
+#include "Clock.h"
+#include "Crc32c.h"
+#include "Record.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <span>
+#include <string>
+
+/// @brief Layout of log.mlog, the file written by the portable backend.
+/// The file starts with a \a FileHeader, followed by records, each stored as a \a RecordFrame,
+/// the \a RecordHeader and the payload, with a \a RepeatHeader, a \a FragmentHeader and an \a ActivityHeader in between as the frame's \a RecordFlags tell. The frame carries the record's \a EventDescriptor, so readers can select records from frames alone. Everything is unaligned and in the writer's byte order.
+/// The frame's checksum lets the reader tell a record torn by a crash from a complete one.
+/// Long logs continue in segment files log.1.mlog, log.2.mlog, ..., each starting with its own \a FileHeader.
+namespace EtwLog::Portable
+{
+    inline constexpr char c_magic[8]{'M', 'I', 'N', 'I', 'L', 'O', 'G', '\0'};
+
+    /// @brief Version written, raised with every change to the layout: 6 added fragments (\a RecordFlags::Fragment),
+    /// 7 padding records (\a c_paddingFlag) and headers of a whole block (\a FileHeader::HeaderSize), 8 activities (\a RecordFlags::Activity).
+    inline constexpr std::uint32_t c_version{8};
+
+    /// @brief Oldest version readers take. The versions since only add what older logs don't have, so they read as they are.
+    inline constexpr std::uint32_t c_minVersion{5};
+
+    /// @brief No record is larger than the largest buffer.
+    inline constexpr std::uint32_t c_maxRecordSize{16384 * 1024};
+
+    struct FileHeader {
+        char Magic[8];
+        std::uint32_t Version;
+
+        /// @brief Size of this header, records start right after it. A whole block when the log is written with direct I/O.
+        std::uint32_t HeaderSize;
+
+        ClockCalibration Clock;
+
+        /// @brief \a MiniLog::Provider of the logger writing the log.
+        ProviderId Provider;
+    };
+
+    inline FileHeader MakeFileHeader(const ClockCalibration& clock, const ProviderId& provider) noexcept {
+        FileHeader header{};
+        std::copy(std::begin(c_magic), std::end(c_magic), header.Magic);
+        header.Version = c_version;
+        header.HeaderSize = sizeof(header);
+        header.Clock = clock;
+        header.Provider = provider;
+        return header;
+    }
+
+    struct RecordFrame {
+        /// @brief \a RecordCrc of the record.
+        std::uint32_t Crc;
+
+        /// @brief Bytes of \a RecordHeader and payload following the frame.
+        std::uint32_t Size;
+
+        std::uint16_t EventId;
+        EtwLog::Level Level;
+
+        /// @brief Bits of \a RecordFlags.
+        std::uint8_t Flags;
+
+        /// @brief Zero, keeps \a Keyword aligned within the frame.
+        std::uint32_t Padding;
+
+        std::uint64_t Keyword;
+    };
+
+    /// @brief \a RecordFrame::Flags bit of a padding record, which a log written with direct I/O has at the end of each buffer
+    /// to fill it up to a whole block. It has a \a RecordHeader and zeros, no sequence number of its own, and readers skip it.
+    inline constexpr std::uint8_t c_paddingFlag{0x80};
+
+    static_assert(sizeof(RecordFrame) == 24, "RecordFrame is part of the file format, it can't have padding the compiler chose");
+
+    /// @brief Checksum for \a RecordFrame::Crc: CRC32C of everything after the Crc field, up to the end of the payload.
+    /// @param record - frame, header and payload of one record, as stored in the file.
+    inline std::uint32_t RecordCrc(std::span<const std::byte> record) noexcept {
+        return Crc32c(record.subspan(offsetof(RecordFrame, Size)));
+    }
+
+    /// @brief Path of segment \a index of the log starting with \a firstSegment.
+    inline std::filesystem::path SegmentPath(const std::filesystem::path& firstSegment, std::size_t index) {
+        if (index == 0) {
+            return firstSegment;
+        }
+
+        auto path{firstSegment};
+        path.replace_filename(firstSegment.stem().string() + "." + std::to_string(index) + firstSegment.extension().string());
+        return path;
+    }
+} // EtwLog::Portable
@@ -0,0 +1,615 @@
+#include "pch.h"
+#include "PortableSink.h"
+#include "PortableFormat.h"
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#include <sys/stat.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstring>
+#include <span>
+#include <string>
+#include <utility>
+
+namespace
+{
+    /// @brief Same limit ETW puts on its buffers.
+    constexpr std::size_t c_maxBufferSize{16384};
+
+    /// @brief Buffers of a lane: one being filled, the others waiting for or being written by the flush thread.
+    constexpr std::size_t c_lanedBufferCount{4};
+
+    /// @brief Alignment of file offsets, sizes and memory for direct I/O. The logical block size of any disk MiniLog writes to.
+    constexpr std::size_t c_directIoBlockSize{4096};
+
+    /// @brief Smallest padding record: a frame and a record header.
+    constexpr std::size_t c_minPaddingSize{sizeof(EtwLog::Portable::RecordFrame) + sizeof(EtwLog::RecordHeader)};
+
+    std::size_t RoundUp(std::size_t size, std::size_t granularity) noexcept {
+        return (size + granularity - 1) / granularity * granularity;
+    }
+
+    EtwLog::Portable::FileHeader MakeSegmentHeader(const EtwLog::ClockCalibration& calibration, const EtwLog::ProviderId& provider, bool directIo) {
+        auto header{EtwLog::Portable::MakeFileHeader(calibration, provider)};
+        if (directIo) {
+            header.HeaderSize = c_directIoBlockSize;
+        }
+        return header;
+    }
+
+    /// @brief Fills in the checksum of every record in \a buffer.
+    /// Done on the flush thread right before the buffer goes to the file, which keeps it off the writers' path.
+    void SealRecords(std::span<std::byte> buffer) noexcept {
+        using EtwLog::Portable::RecordFrame;
+
+        for (std::size_t offset = 0; offset + sizeof(RecordFrame) <= buffer.size();) {
+            RecordFrame frame;
+            std::memcpy(&frame, buffer.data() + offset, sizeof(frame));
+
+            const auto recordSize{sizeof(frame) + frame.Size};
+            frame.Crc = EtwLog::Portable::RecordCrc({buffer.data() + offset, recordSize});
+            std::memcpy(buffer.data() + offset, &frame.Crc, sizeof(frame.Crc));
+
+            offset += recordSize;
+        }
+    }
+
+    /// @brief Reserves disk space for \a size bytes without changing the file size, so appending doesn't have to allocate.
+    /// Best effort: where this isn't supported, space is allocated while writing as usual.
+    void Preallocate(int file, std::uint64_t size) {
+#if defined(_WIN32)
+        FILE_ALLOCATION_INFO allocation{};
+        allocation.AllocationSize.QuadPart = static_cast<LONGLONG>(size);
+        ::SetFileInformationByHandle(reinterpret_cast<HANDLE>(::_get_osfhandle(file)), FileAllocationInfo, &allocation, sizeof(allocation));
+#elif defined(__linux__)
+        ::fallocate(file, FALLOC_FL_KEEP_SIZE, 0, static_cast<off_t>(size));
+#else
+        (void)file;
+        (void)size;
+#endif
+    }
+
+    /// @brief Gives back the space preallocated past the end of the data. Windows does it when the file is closed.
+    void TrimPreallocation([[maybe_unused]] int file, [[maybe_unused]] std::uint64_t size) {
+#ifndef _WIN32
+        ::ftruncate(file, static_cast<off_t>(size));
+#endif
+    }
+
+    /// @brief Creates \a path for writing, bypassing the page cache if \a directIo and the file system allows it.
+    int OpenSegmentFile(const std::filesystem::path& path, [[maybe_unused]] bool directIo) {
+#ifdef _WIN32
+        const auto file{::_wopen(path.wstring().c_str(), _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, _S_IREAD | _S_IWRITE)};
+#else
+        constexpr int c_flags{O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC};
+        int file{-1};
+#ifdef O_DIRECT
+        if (directIo) {
+            file = ::open(path.c_str(), c_flags | O_DIRECT, 0644);
+        }
+#endif
+        if (file < 0) {
+            file = ::open(path.c_str(), c_flags, 0644);
+        }
+#endif
+        if (file < 0) {
+            throw std::system_error{errno, std::generic_category(), "Opening " + path.string()};
+        }
+        return file;
+    }
+}
+
+EtwLog::Detail::PortableSink::FileHandle& EtwLog::Detail::PortableSink::FileHandle::operator=(FileHandle&& other) noexcept {
+    if (this != &other) {
+        this->~FileHandle();
+        m_file = std::exchange(other.m_file, -1);
+    }
+    return *this;
+}
+
+EtwLog::Detail::PortableSink::FileHandle::~FileHandle() {
+    if (m_file >= 0) {
+#ifdef _WIN32
+        ::_close(m_file);
+#else
+        ::close(m_file);
+#endif
+    }
+}
+
+EtwLog::Detail::PortableSink::Lane::Lane(std::size_t index, std::size_t bufferBytes, std::size_t bufferCount, std::optional<std::size_t> node, bool hugePages)
+    :
+    Index{index},
+    Memory{bufferBytes * bufferCount, node, hugePages}
+{
+    Active = {Memory.Data(), 0, index};
+    for (std::size_t b = 1; b != bufferCount; ++b) {
+        Free.push_back({Memory.Data() + b * bufferBytes, 0, index});
+    }
+}
+
+EtwLog::Detail::PortableSink::PortableSink(
+    const std::filesystem::path& logFile,
+    std::size_t bufferSize,
+    const ClockCalibration& calibration,
+    const ProviderId& provider,
+    std::uint64_t segmentSize,
+    const BufferPlacement& placement,
+    const FileWriting& writing,
+    const PriorityLanes& priority,
+    WriteProfiler* profiler)
+    :
+    m_directIo{writing.DirectIo},
+    m_profiler{profiler},
+    m_bufferBytes{RoundUp(std::clamp<std::size_t>(bufferSize, 1, c_maxBufferSize) * 1024, m_directIo ? c_directIoBlockSize : 1)},
+    m_bufferCapacity{m_directIo ? m_bufferBytes - c_minPaddingSize : m_bufferBytes},
+    m_logFile{logFile},
+    m_fileHeader{MakeSegmentHeader(calibration, provider, m_directIo)},
+    m_segmentSize{std::max<std::uint64_t>(segmentSize, m_bufferBytes + m_fileHeader.HeaderSize)},
+    m_ordinaryLaneCount{placement.NumaLocal ? NumaNodeCount() : 1},
+    m_priorityThreshold{priority.Threshold ? std::optional{std::clamp(*priority.Threshold, Level::Critical, Level::Verbose)} : std::nullopt}
+{
+    std::vector<std::span<std::byte>> memory;
+    std::size_t bufferCount{0};
+    const auto addLane = [&](std::size_t buffers, std::optional<std::size_t> node) {
+        m_lanes.push_back(std::make_unique<Lane>(m_lanes.size(), m_bufferBytes, buffers, node, placement.HugePages));
+        memory.emplace_back(m_lanes.back()->Memory.Data(), m_lanes.back()->Memory.Size());
+        bufferCount += buffers;
+    };
+    for (std::size_t node = 0; node != m_ordinaryLaneCount; ++node) {
+        addLane(c_lanedBufferCount, placement.NumaLocal ? std::optional{node} : std::nullopt);
+    }
+    if (m_priorityThreshold) {
+        for (auto level = static_cast<int>(Level::Critical); level <= static_cast<int>(*m_priorityThreshold); ++level) {
+            addLane(std::max<std::size_t>(priority.BufferCount, 2), std::nullopt);
+        }
+    }
+
+    // Every buffer but the ones being filled can be on its way to the file.
+    m_writer.emplace(memory, bufferCount, writing.IoUring);
+
+    PrepareNextSegment();
+    m_flushThread = std::thread{[this] { FlushThread(); }};
+    if (m_priorityThreshold) {
+        m_priorityFlush.emplace(priority.FlushInterval, [this] { FlushPriorityLanes(); });
+    }
+}
+
+EtwLog::Detail::PortableSink::~PortableSink() {
+    m_priorityFlush.reset();
+    for (auto& lane : m_lanes) {
+        std::unique_lock lock{lane->Mutex};
+        QueueAll(*lane, lock);
+    }
+    {
+        std::lock_guard lock{m_mutex};
+        m_stopping = true;
+    }
+
+    m_bufferFull.notify_one();
+    m_flushThread.join();
+
+    try {
+        // Even an empty log gets its first segment.
+        if (!m_segment.File) {
+            SwitchSegment();
+        }
+
+        TrimPreallocation(m_segment.File.Get(), m_segment.Size);
+        m_segment.File = {};
+
+        // Remove the segment prepared ahead, nothing went into it.
+        if (m_nextSegment.valid()) {
+            const auto unused{m_nextSegment.get()};
+            std::filesystem::remove(unused.Path);
+        }
+    } catch (const std::exception&) {
+        // Nothing to report the error to, the file is as complete as it could get.
+    }
+}
+
+void EtwLog::Detail::PortableSink::Write(const EventDescriptor& event, const RecordHeader& header, std::span<const std::byte> payload) {
+    Write(event, header, {}, payload);
+}
+
+void EtwLog::Detail::PortableSink::Write(const EventDescriptor& event, const RecordHeader& header, const ExtraHeaders& extra, std::span<const std::byte> payload) {
+    std::array<std::byte, ExtraHeaders::c_maxPackedSize> extraBytes;
+    const auto extraSize{extra.Pack(extraBytes)};
+
+    const auto recordSize{sizeof(header) + extraSize + payload.size()};
+    const auto frameSize{sizeof(Portable::RecordFrame) + recordSize};
+
+    // Like ETW, a record has to fit into one buffer.
+    if (frameSize > m_bufferCapacity) {
+        throw std::system_error{std::make_error_code(std::errc::message_size), "PortableSink::Write"};
+    }
+
+    // The checksum is filled in by the flush thread, see SealRecords.
+    const Portable::RecordFrame frame{0, static_cast<std::uint32_t>(recordSize), event.Id, event.Level, extra.Flags(), 0, event.Keyword};
+
+    auto& lane{LaneOf(event.Level)};
+    std::unique_lock lock{lane.Mutex};
+    if (m_failed.load(std::memory_order_relaxed)) {
+        ThrowWriteError();
+    }
+
+    // The active buffer has room most of the time; the policy is only looked at when it hasn't.
+    std::byte* out{nullptr};
+    if (lane.Active.Data != nullptr && lane.Active.Size + frameSize <= m_bufferCapacity) {
+        out = lane.Active.Data + lane.Active.Size;
+        lane.Active.Size += frameSize;
+        ++lane.Active.Records;
+    } else {
+        BackpressurePolicy policy;
+        {
+            std::lock_guard policyLock{m_mutex};
+            policy = m_backpressure;
+        }
+
+        if (auto* active{ActiveBuffer(lane, lock, frameSize, policy)}) {
+            out = active->Data + active->Size;
+            active->Size += frameSize;
+            ++active->Records;
+        } else if (policy.Mode == Backpressure::Spill) {
+            out = SpillSpace(lane, frameSize);
+        }
+        if (out == nullptr) {
+            m_dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+    }
+
+    std::memcpy(out, &frame, sizeof(frame));
+    std::memcpy(out + sizeof(frame), &header, sizeof(header));
+    std::memcpy(out + sizeof(frame) + sizeof(header), extraBytes.data(), extraSize);
+    if (!payload.empty()) {
+        std::memcpy(out + sizeof(frame) + sizeof(header) + extraSize, payload.data(), payload.size());
+    }
+}
+
+std::size_t EtwLog::Detail::PortableSink::MaxPayloadSize() const noexcept {
+    return m_bufferCapacity - sizeof(Portable::RecordFrame) - sizeof(RecordHeader) - sizeof(RepeatHeader) - sizeof(FragmentHeader) - sizeof(ActivityHeader);
+}
+
+void EtwLog::Detail::PortableSink::SetBackpressure(const BackpressurePolicy& policy) {
+    if (policy.Mode == Backpressure::Spill) {
+        const auto slotCount{std::max<std::size_t>(policy.SpillKilobytes * 1024 / m_bufferCapacity, 1)};
+        for (auto& lane : m_lanes) {
+            std::size_t fileIndex;
+            {
+                std::lock_guard lock{m_mutex};
+                fileIndex = m_spillFileCount++;
+            }
+            // Created outside the lane's lock, so its writers don't wait for the file system.
+            auto spill{std::make_unique<SpillFile>(
+                m_logFile.parent_path() / (m_logFile.stem().string() + "." + std::to_string(fileIndex) + ".spill"), m_bufferCapacity, slotCount)};
+
+            // A file still holding records is kept until they are drained, along with its size.
+            std::lock_guard lock{lane->Mutex};
+            if (!lane->Spilling()) {
+                lane->Spill = std::move(spill);
+            }
+        }
+    }
+
+    std::lock_guard lock{m_mutex};
+    m_backpressure = policy;
+}
+
+std::uint64_t EtwLog::Detail::PortableSink::DroppedRecords() const noexcept {
+    return m_dropped.load(std::memory_order_relaxed);
+}
+
+EtwLog::Detail::PortableSink::Segment EtwLog::Detail::PortableSink::PrepareSegment(
+    std::filesystem::path path,
+    Portable::FileHeader header,
+    std::uint64_t preallocateSize,
+    bool directIo)
+{
+    Segment segment;
+    segment.File = FileHandle{OpenSegmentFile(path, directIo)};
+
+    // Direct I/O writes whole blocks from aligned memory, the header too.
+    const PageMemory block{header.HeaderSize, std::nullopt, false};
+    std::memcpy(block.Data(), &header, sizeof(header));
+    if (const auto error{WriteAt(segment.File.Get(), {block.Data(), header.HeaderSize}, 0)}) {
+        throw std::system_error{error, "Writing " + path.string()};
+    }
+
+    Preallocate(segment.File.Get(), preallocateSize);
+
+    segment.Path = std::move(path);
+    segment.Size = header.HeaderSize;
+    return segment;
+}
+
+void EtwLog::Detail::PortableSink::PrepareNextSegment() {
+    m_nextSegment = std::async(
+        std::launch::async,
+        PrepareSegment,
+        Portable::SegmentPath(m_logFile, m_nextSegmentIndex++),
+        m_fileHeader,
+        m_segmentSize,
+        m_directIo);
+}
+
+void EtwLog::Detail::PortableSink::SwitchSegment() {
+    if (m_segment.File) {
+        m_writer->WaitAll(m_completions);
+        ReturnWritten();
+        TrimPreallocation(m_segment.File.Get(), m_segment.Size);
+    }
+
+    if (!m_nextSegment.valid()) {
+        PrepareNextSegment();
+    }
+
+    m_segment = m_nextSegment.get();
+}
+
+EtwLog::Detail::PortableSink::Lane& EtwLog::Detail::PortableSink::LaneOf(Level level) noexcept {
+    if (m_priorityThreshold && level <= *m_priorityThreshold) {
+        // Levels below Critical, such as ETW's "log always", count as Critical.
+        return *m_lanes[m_ordinaryLaneCount + static_cast<std::size_t>(std::max(level, Level::Critical)) - static_cast<std::size_t>(Level::Critical)];
+    }
+    return m_ordinaryLaneCount == 1 ? *m_lanes.front() : *m_lanes[CurrentNumaNode() % m_ordinaryLaneCount];
+}
+
+void EtwLog::Detail::PortableSink::FlushPriorityLanes() {
+    for (auto lane = m_ordinaryLaneCount; lane != m_lanes.size(); ++lane) {
+        std::lock_guard lock{m_lanes[lane]->Mutex};
+        if (m_lanes[lane]->Active.Data != nullptr && !m_lanes[lane]->Active.Empty()) {
+            QueueFull(std::exchange(m_lanes[lane]->Active, {}));
+        }
+    }
+}
+
+void EtwLog::Detail::PortableSink::QueueFull(Buffer buffer) {
+    {
+        std::lock_guard lock{m_mutex};
+        if (IsPriorityLane(buffer.Lane)) {
+            m_full.insert(std::ranges::find_if(m_full, [this](const Buffer& queued) { return !IsPriorityLane(queued.Lane); }), buffer);
+        } else {
+            m_full.push_back(buffer);
+        }
+    }
+    m_bufferFull.notify_one();
+}
+
+EtwLog::Detail::PortableSink::Buffer* EtwLog::Detail::PortableSink::ActiveBuffer(
+    Lane& lane,
+    std::unique_lock<std::mutex>& lock,
+    std::size_t frameSize,
+    const BackpressurePolicy& policy)
+{
+    std::optional<std::chrono::steady_clock::time_point> deadline;
+    for (;;) {
+        if (!lane.Spilling()) {
+            if (lane.Active.Data == nullptr && !lane.Free.empty()) {
+                lane.Active = lane.Free.back();
+                lane.Free.pop_back();
+            }
+            if (lane.Active.Data != nullptr) {
+                if (lane.Active.Size + frameSize <= m_bufferCapacity) {
+                    return &lane.Active;
+                }
+                QueueFull(std::exchange(lane.Active, {}));
+                continue;
+            }
+        }
+
+        // All buffers are waiting for the file, or older records are still spilled.
+        if (!WaitForBuffer(lane, lock, policy, deadline)) {
+            return nullptr;
+        }
+    }
+}
+
+bool EtwLog::Detail::PortableSink::WaitForBuffer(
+    Lane& lane,
+    std::unique_lock<std::mutex>& lock,
+    const BackpressurePolicy& policy,
+    std::optional<std::chrono::steady_clock::time_point>& deadline)
+{
+    // Woken when the flush thread returns a buffer, or another writer takes one as the active buffer.
+    const auto bufferReady = [&lane] { return lane.Active.Data != nullptr || !lane.Free.empty(); };
+
+    switch (policy.Mode) {
+    case Backpressure::Block: {
+        const StageTimer timer{m_profiler, WriteStage::BufferWait};
+        lane.BufferFree.wait(lock, bufferReady);
+        return true;
+    }
+    case Backpressure::BlockWithTimeout: {
+        const StageTimer timer{m_profiler, WriteStage::BufferWait};
+        if (!deadline) {
+            deadline = std::chrono::steady_clock::now() + policy.Timeout;
+        }
+        return lane.BufferFree.wait_until(lock, *deadline, bufferReady);
+    }
+    case Backpressure::DropOldest: {
+        // Only buffers still queued can go: the ones being written are in the kernel's hands.
+        // Older records still spilled would have to go first, so the record is dropped instead.
+        if (lane.Spilling()) {
+            return false;
+        }
+        std::lock_guard fullLock{m_mutex};
+        const auto oldest{std::ranges::find(m_full, lane.Index, &Buffer::Lane)};
+        if (oldest == m_full.end()) {
+            return false;
+        }
+        m_dropped.fetch_add(oldest->Records, std::memory_order_relaxed);
+        lane.Free.push_back({oldest->Data, 0, oldest->Lane});
+        m_full.erase(oldest);
+        return true;
+    }
+    case Backpressure::DropNewest:
+    case Backpressure::Spill:
+        break;
+    }
+    return false;
+}
+
+void EtwLog::Detail::PortableSink::DrainSpill(Lane& lane, Buffer buffer, std::unique_lock<std::mutex>& lock) {
+    const auto copied{lane.Spill->Front()};
+    lock.unlock();
+    std::memcpy(buffer.Data, copied.data(), copied.size());
+    lock.lock();
+
+    // Only the newest slot can have grown meanwhile.
+    const auto slot{lane.Spill->Front()};
+    std::memcpy(buffer.Data + copied.size(), slot.data() + copied.size(), slot.size() - copied.size());
+    buffer.Size = slot.size();
+    buffer.Records = lane.Spill->FrontRecords();
+    lane.Spill->PopFront();
+
+    // The last slot may have room left: records written next go after it.
+    if (lane.Spill->Empty()) {
+        lane.Active = buffer;
+    } else {
+        QueueFull(buffer);
+    }
+}
+
+std::byte* EtwLog::Detail::PortableSink::SpillSpace(Lane& lane, std::size_t frameSize) noexcept {
+    return lane.Spill ? lane.Spill->Append(frameSize) : nullptr;
+}
+
+void EtwLog::Detail::PortableSink::QueueAll(Lane& lane, std::unique_lock<std::mutex>& lock) {
+    lane.BufferFree.wait(lock, [&lane] { return !lane.Spilling(); });
+    if (lane.Active.Data != nullptr && !lane.Active.Empty()) {
+        QueueFull(std::exchange(lane.Active, {}));
+    }
+}
+
+void EtwLog::Detail::PortableSink::ThrowWriteError() {
+    std::lock_guard lock{m_mutex};
+    throw std::system_error{m_writeError, "PortableSink: writing log file"};
+}
+
+void EtwLog::Detail::PortableSink::SetWriteError(std::error_code error) {
+    std::lock_guard lock{m_mutex};
+    if (!m_writeError) {
+        m_writeError = error;
+        m_failed.store(true, std::memory_order_relaxed);
+    }
+}
+
+void EtwLog::Detail::PortableSink::PadToBlock(Buffer& buffer) const noexcept {
+    auto padding{RoundUp(buffer.Size, c_directIoBlockSize) - buffer.Size};
+    if (padding == 0) {
+        return;
+    }
+    if (padding < c_minPaddingSize) {
+        padding += c_directIoBlockSize;
+    }
+
+    const Portable::RecordFrame frame{0, static_cast<std::uint32_t>(padding - sizeof(Portable::RecordFrame)), 0, Level{}, Portable::c_paddingFlag, 0, 0};
+    std::memset(buffer.Data + buffer.Size, 0, padding);
+    std::memcpy(buffer.Data + buffer.Size, &frame, sizeof(frame));
+    buffer.Size += padding;
+}
+
+void EtwLog::Detail::PortableSink::StartWrite(Buffer buffer) {
+    if (m_directIo) {
+        PadToBlock(buffer);
+    }
+    {
+        const StageTimer timer{m_profiler, WriteStage::Seal};
+        SealRecords({buffer.Data, buffer.Size});
+    }
+
+    try {
+        const StageTimer timer{m_profiler, WriteStage::FileWrite};
+        // Buffers are never split between segments, so each segment holds whole records.
+        if (!m_segment.File || m_segment.Size + buffer.Size > m_segmentSize) {
+            SwitchSegment();
+        }
+
+        const auto tag{m_nextWriteTag++};
+        m_writing.emplace(tag, buffer);
+        const auto offset{m_segment.Size};
+        m_segment.Size += buffer.Size;
+        m_writer->Write(m_segment.File.Get(), {buffer.Data, buffer.Size}, offset, tag, m_completions);
+
+        // Get the next segment ready while this one still has room.
+        if (!m_nextSegment.valid() && m_segment.Size > m_segmentSize / 2) {
+            PrepareNextSegment();
+        }
+    } catch (const std::system_error& e) {
+        // The buffer won't reach the file, it is free all the same.
+        SetWriteError(e.code());
+        std::erase_if(m_writing, [&buffer](const auto& writing) { return writing.second.Data == buffer.Data; });
+        ReturnToLane(buffer);
+    }
+
+    ReturnWritten();
+}
+
+void EtwLog::Detail::PortableSink::ReturnWritten() {
+    for (const auto& completion : m_completions) {
+        if (completion.Error) {
+            SetWriteError(completion.Error);
+        }
+
+        const auto writing{m_writing.find(completion.Tag)};
+        if (writing != m_writing.end()) {
+            ReturnToLane(writing->second);
+            m_writing.erase(writing);
+        }
+    }
+    m_completions.clear();
+}
+
+void EtwLog::Detail::PortableSink::ReturnToLane(Buffer buffer) {
+    buffer.Size = 0;
+    buffer.Records = 0;
+    auto& lane{*m_lanes[buffer.Lane]};
+    {
+        std::unique_lock lock{lane.Mutex};
+        if (lane.Spilling()) {
+            DrainSpill(lane, buffer, lock);
+        } else {
+            lane.Free.push_back(buffer);
+        }
+    }
+    lane.BufferFree.notify_all();
+}
+
+void EtwLog::Detail::PortableSink::FlushThread() {
+    std::unique_lock lock{m_mutex};
+    for (;;) {
+        // Nothing to start, so wait for the writes in flight to hand their buffers back.
+        if (m_full.empty() && m_writer->InFlight() != 0) {
+            lock.unlock();
+            try {
+                m_writer->WaitSome(m_completions);
+            } catch (const std::system_error& e) {
+                SetWriteError(e.code());
+            }
+            ReturnWritten();
+            lock.lock();
+            continue;
+        }
+
+        m_bufferFull.wait(lock, [this] { return m_stopping || !m_full.empty(); });
+        if (m_full.empty()) {
+            return;
+        }
+
+        const auto buffer{m_full.front()};
+        m_full.pop_front();
+
+        lock.unlock();
+        StartWrite(buffer);
+        lock.lock();
+    }
+}
@@ -0,0 +1,250 @@
+#pragma once
+
+#include "BufferMemory.h"
+#include "Clock.h"
+#include "FileWriter.h"
+#include "MiniEtwLog.h"
+#include "PeriodicTask.h"
+#include "PortableFormat.h"
+#include "Sink.h"
+#include "SpillFile.h"
+#include "WriteProfiler.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <system_error>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace EtwLog::Detail
+{
+    /// @brief Sink writing the portable log format (see PortableFormat.h) without any OS tracing facility.
+    /// Works like an ETW session: records are appended to in-memory buffers of \a bufferSize kilobytes,
+    /// and full buffers are written to the file by a background thread.
+    /// The log is split into segment files of \a segmentSize bytes. Each segment is created and preallocated
+    /// on a background task before it is needed, so neither construction nor flushing waits for the file system.
+    /// Buffers come in lanes, each with its own lock: one lane, or one per NUMA node with \a BufferPlacement::NumaLocal.
+    /// The flush thread writes buffers one at a time, or keeps several in flight with \a FileWriting::IoUring.
+    /// With \a PriorityLanes, the most severe levels get a lane each, whose partly filled buffer is queued every flush interval, ahead of other lanes' buffers.
+    /// With a \a profiler, and \a c_profileWrites on, waits for buffers and the flush thread's stages are timed into it.
+    class PortableSink final : public Sink {
+    public:
+        static constexpr std::uint64_t c_defaultSegmentSize{64 * 1024 * 1024};
+
+        PortableSink(
+            const std::filesystem::path& logFile,
+            std::size_t bufferSize,
+            const ClockCalibration& calibration,
+            const ProviderId& provider,
+            std::uint64_t segmentSize = c_defaultSegmentSize,
+            const BufferPlacement& placement = {},
+            const FileWriting& writing = {},
+            const PriorityLanes& priority = {},
+            WriteProfiler* profiler = nullptr);
+
+        /// @brief Writes the partially filled buffer and waits for all buffers to reach the file.
+        ~PortableSink() override;
+
+        void Write(const EventDescriptor& event, const RecordHeader& header, std::span<const std::byte> payload) override;
+        void Write(const EventDescriptor& event, const RecordHeader& header, const ExtraHeaders& extra, std::span<const std::byte> payload) override;
+
+        /// @brief A record, with its frame and all headers, has to fit into one buffer.
+        std::size_t MaxPayloadSize() const noexcept override;
+
+        void SetBackpressure(const BackpressurePolicy& policy) override;
+        std::uint64_t DroppedRecords() const noexcept override;
+
+    private:
+        /// @brief A buffer's share of its lane's memory, and how much of it is filled.
+        struct Buffer {
+            std::byte* Data{nullptr};
+            std::size_t Size{0};
+            std::size_t Lane{0};
+
+            /// @brief Records in it, counted as they are appended, so that dropping it doesn't have to walk it.
+            std::uint64_t Records{0};
+
+            bool Empty() const noexcept { return Size == 0; }
+        };
+
+        /// @brief Buffers records are appended to by the writers running on one NUMA node (or all writers, with a single lane),
+        /// or, for a priority lane, by the writers of one level.
+        /// Aligned so that lanes written from different nodes don't share cache lines.
+        struct alignas(64) Lane {
+            Lane(std::size_t index, std::size_t bufferBytes, std::size_t bufferCount, std::optional<std::size_t> node, bool hugePages);
+
+            /// @brief Position in \a m_lanes, and the \a Buffer::Lane of its buffers.
+            const std::size_t Index;
+
+            /// @brief Holds every buffer of the lane.
+            PageMemory Memory;
+
+            std::mutex Mutex;
+            std::condition_variable BufferFree;
+
+            /// @brief Buffer records are appended to. Has no memory while a writer waits for a free one.
+            Buffer Active;
+
+            std::vector<Buffer> Free;
+
+            /// @brief Records spilled with \a Backpressure::Spill, in slots of a buffer's capacity. Created when that policy is set.
+            /// While it holds any, the lane has no active buffer, so records written meanwhile go after them,
+            /// and buffers written to the file come back filled with its oldest slot rather than free.
+            std::unique_ptr<SpillFile> Spill;
+
+            bool Spilling() const noexcept { return Spill && !Spill->Empty(); }
+        };
+
+        /// @brief File descriptor, closed with the object.
+        class FileHandle {
+        public:
+            FileHandle() = default;
+            explicit FileHandle(int file) noexcept : m_file{file} {}
+            FileHandle(FileHandle&& other) noexcept : m_file{std::exchange(other.m_file, -1)} {}
+            FileHandle& operator=(FileHandle&& other) noexcept;
+            ~FileHandle();
+
+            int Get() const noexcept { return m_file; }
+            explicit operator bool() const noexcept { return m_file >= 0; }
+
+        private:
+            int m_file{-1};
+        };
+
+        /// @brief Segment file, with its \a FileHeader already written.
+        struct Segment {
+            std::filesystem::path Path;
+            FileHandle File;
+
+            /// @brief Bytes written so far, including the header.
+            std::uint64_t Size{0};
+        };
+
+        static Segment PrepareSegment(std::filesystem::path path, Portable::FileHeader header, std::uint64_t preallocateSize, bool directIo);
+
+        /// @brief Starts preparing the segment after the current one. Called on the flush thread.
+        void PrepareNextSegment();
+
+        /// @brief Closes the current segment, once the writes to it are done, and continues with the prepared one. Called on the flush thread.
+        void SwitchSegment();
+
+        /// @brief Lane of a record at \a level written by the calling thread.
+        Lane& LaneOf(Level level) noexcept;
+
+        bool IsPriorityLane(std::size_t lane) const noexcept { return lane >= m_ordinaryLaneCount; }
+
+        /// @brief Queues the partly filled buffers of the priority lanes. Called every flush interval.
+        void FlushPriorityLanes();
+
+        /// @brief Hands a filled buffer to the flush thread, behind the other buffers of priority lanes if it is one, else last.
+        void QueueFull(Buffer buffer);
+
+        /// @brief Buffer of \a lane with room for \a frameSize more bytes: the one being filled, or the next free one once that is full.
+        /// If all are waiting for the file, or records are still spilled, does what \a policy says, and so may release \a lock for a while.
+        /// Called under the lane's lock.
+        /// @return Null if the policy gives up waiting: the record is then spilled or dropped.
+        Buffer* ActiveBuffer(Lane& lane, std::unique_lock<std::mutex>& lock, std::size_t frameSize, const BackpressurePolicy& policy);
+
+        /// @brief Waits for a free buffer in \a lane, or frees one, as \a policy says. Called under the lane's lock.
+        /// @return False if the policy gives up.
+        bool WaitForBuffer(Lane& lane, std::unique_lock<std::mutex>& lock, const BackpressurePolicy& policy, std::optional<std::chrono::steady_clock::time_point>& deadline);
+
+        /// @brief Fills \a buffer, just written to the file, with the oldest spilled records of \a lane, and queues it,
+        /// or makes it the lane's active buffer if that was the last slot. Called on the flush thread, under the lane's lock,
+        /// which is released while the slot is copied: writers only append past what is copied, and only this thread takes slots out.
+        void DrainSpill(Lane& lane, Buffer buffer, std::unique_lock<std::mutex>& lock);
+
+        /// @brief Room for \a frameSize more bytes at the end of \a lane's spill file, null if it is full or there is none.
+        static std::byte* SpillSpace(Lane& lane, std::size_t frameSize) noexcept;
+
+        /// @brief Queues the buffer being filled, once the flush thread has drained the spilled records of \a lane. Called under the lane's lock.
+        void QueueAll(Lane& lane, std::unique_lock<std::mutex>& lock);
+
+        /// @brief Throws the error the flush thread got writing the file.
+        [[noreturn]] void ThrowWriteError();
+
+        /// @brief Keeps the first error writing the file, for the writers to throw.
+        void SetWriteError(std::error_code error);
+
+        /// @brief Fills \a buffer up to a whole number of direct I/O blocks with a padding record.
+        void PadToBlock(Buffer& buffer) const noexcept;
+
+        /// @brief Seals \a buffer and starts writing it at the end of the current segment. Called on the flush thread.
+        void StartWrite(Buffer buffer);
+
+        /// @brief Hands the buffers of the writes in \a m_completions back to their lanes. Called on the flush thread.
+        void ReturnWritten();
+
+        /// @brief Makes \a buffer free for the writers of its lane again, or drains the lane's spilled records into it.
+        void ReturnToLane(Buffer buffer);
+
+        void FlushThread();
+
+        const bool m_directIo;
+
+        /// @brief Null when not profiling.
+        WriteProfiler* const m_profiler;
+
+        /// @brief Memory of one buffer.
+        const std::size_t m_bufferBytes;
+
+        /// @brief Bytes of records a buffer takes: all of its memory, short of the room for a padding record with direct I/O.
+        const std::size_t m_bufferCapacity;
+        const std::filesystem::path m_logFile;
+        /// @brief Written at the start of every segment.
+        const Portable::FileHeader m_fileHeader;
+        const std::uint64_t m_segmentSize;
+
+        /// @brief Used by the flush thread only (and by the destructor, once it's gone).
+        Segment m_segment;
+        std::size_t m_nextSegmentIndex{0};
+        std::future<Segment> m_nextSegment;
+
+        /// @brief Lanes of every record, then the priority lanes, most severe level first.
+        std::vector<std::unique_ptr<Lane>> m_lanes;
+        const std::size_t m_ordinaryLaneCount;
+
+        /// @brief Least severe level with a priority lane, none without.
+        const std::optional<Level> m_priorityThreshold;
+
+        /// @brief Used by the flush thread only, along with the writes in flight and the ones it reported done.
+        std::optional<FileWriter> m_writer;
+        std::unordered_map<std::uint64_t, Buffer> m_writing;
+        std::uint64_t m_nextWriteTag{0};
+        std::vector<FileWriter::Completion> m_completions;
+
+        /// @brief Guards the members below. Taken after a lane's lock, never before.
+        std::mutex m_mutex;
+        std::condition_variable m_bufferFull;
+
+        /// @brief Buffers waiting for the flush thread, in file order.
+        std::deque<Buffer> m_full;
+
+        /// @brief First error the flush thread got writing the file; reported by the following Write.
+        std::error_code m_writeError;
+
+        /// @brief Set along with m_writeError, so writers can check it under their lane's lock only.
+        std::atomic<bool> m_failed{false};
+
+        BackpressurePolicy m_backpressure;
+
+        /// @brief Spill files created so far, to name each one differently from those it replaces.
+        std::size_t m_spillFileCount{0};
+        std::atomic<std::uint64_t> m_dropped{0};
+
+        bool m_stopping{false};
+
+        /// @brief Last members, so they start after everything they use is constructed.
+        std::thread m_flushThread;
+        std::optional<PeriodicTask> m_priorityFlush;
+    };
+} // EtwLog::Detail
@@ -0,0 +1,181 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <span>
+
+namespace EtwLog
+{
+    /// @brief Header MiniLog writes in front of every message payload.
+    /// @note This is part of the on-disk format, so it is written and read as raw bytes.
+    struct RecordHeader {
+        /// @brief Per-logger number, starting at 0 and incremented by 1 for every record written.
+        /// A missing number means the record was lost somewhere between the writer and the file.
+        std::uint64_t Sequence;
+
+        /// @brief Raw ticks of the logger's \a Clock, converted to time by the reader using the log's \a ClockCalibration.
+        std::uint64_t Timestamp;
+    };
+
+    /// @brief Stored between the \a RecordHeader and the payload of a record that stands for a run of identical records,
+    /// as collapsed by \a MiniLog::SetCoalescing. The record's own timestamp is the last repeat's.
+    /// @note This is part of the on-disk format, so it is written and read as raw bytes.
+    struct RepeatHeader {
+        /// @brief Number of identical records the record stands for.
+        std::uint64_t Count;
+
+        /// @brief Raw ticks of the first of them, like \a RecordHeader::Timestamp.
+        std::uint64_t FirstTimestamp;
+    };
+
+    /// @brief Stored between the \a RecordHeader (and \a RepeatHeader, if any) and the payload of a record holding one fragment of a payload too large for one record.
+    /// The fragments of a payload are written with consecutive sequence numbers, the first fragment's being the payload's.
+    /// @note This is part of the on-disk format, so it is written and read as raw bytes.
+    struct FragmentHeader {
+        /// @brief Position of this fragment among the \a Count fragments of the payload, from 0.
+        std::uint32_t Index;
+        std::uint32_t Count;
+
+        /// @brief Where this fragment goes in the payload.
+        std::uint64_t Offset;
+
+        /// @brief Bytes of the whole payload.
+        std::uint64_t PayloadSize;
+    };
+
+    /// @brief Identifies an activity, such as one \a ActivityScope times. Zero for none.
+    /// Same size as a GUID, so ETW takes it as an activity id.
+    struct ActivityId {
+        std::uint64_t High{0};
+        std::uint64_t Low{0};
+
+        explicit operator bool() const noexcept { return High != 0 || Low != 0; }
+
+        friend bool operator==(const ActivityId&, const ActivityId&) = default;
+    };
+
+    /// @brief What a record tells about its activity. Same values as ETW's EVENT_OPCODE_*.
+    enum class ActivityOpcode : std::uint8_t {
+        Info = 0,
+        Start = 1,
+        Stop = 2,
+    };
+
+    /// @brief Stored after the other extra headers of a record starting or stopping an activity, see \a ActivityScope.
+    /// On ETW the ids are also passed to EventWriteTransfer, and the opcode set in the event descriptor, for ETW's own tools.
+    /// @note This is part of the on-disk format, so it is written and read as raw bytes.
+    struct ActivityHeader {
+        ActivityId Activity;
+
+        /// @brief Activity the started one is part of, zero for a top level activity or a stop record.
+        ActivityId RelatedActivity;
+
+        ActivityOpcode Opcode;
+        std::uint8_t Reserved[7];
+    };
+
+    /// @brief Which headers a record has between its \a RecordHeader and its payload, in this order.
+    namespace RecordFlags {
+        inline constexpr std::uint8_t Repeated{0x1};
+        inline constexpr std::uint8_t Fragment{0x2};
+        inline constexpr std::uint8_t Activity{0x4};
+    }
+
+    /// @brief ETW event version of a record with \a flags (see \a RecordFlags): 1 for a record with neither header.
+    constexpr std::uint8_t EtwEventVersion(std::uint8_t flags) noexcept {
+        return static_cast<std::uint8_t>(1 + flags);
+    }
+
+    /// @brief \a RecordFlags of an ETW event of \a version, the inverse of \a EtwEventVersion.
+    constexpr std::uint8_t RecordFlagsOfEtwVersion(std::uint8_t version) noexcept {
+        return version == 0 ? 0 : static_cast<std::uint8_t>(version - 1);
+    }
+
+    /// @brief Event ids MiniLog uses for its records. Callers pick their own ids, other than the reserved ones (see \a IsReserved).
+    namespace EventIds {
+        /// @brief Message passed to MiniLog::operator().
+        inline constexpr std::uint16_t Message{1};
+
+        /// @brief \a ClockCalibration of the logger, written first where the log format has no header of its own (ETW).
+        inline constexpr std::uint16_t ClockCalibration{2};
+
+        /// @brief Records kept and dropped by sampling so far, as \a SamplingCount entries (see Sampling.h).
+        /// Written when a sampling policy changes and when the logger closes.
+        inline constexpr std::uint16_t SamplingCounts{3};
+
+        /// @brief Message logged with \a MiniLog::Log: a \a FormattedMessageHeader and the arguments, formatted by \a FormatMessage when read.
+        inline constexpr std::uint16_t FormattedMessage{4};
+
+        /// @brief Latencies recorded in a \a LatencyHistogram over an interval: a \a HistogramSnapshotHeader and the nonzero buckets (see Histogram.h).
+        inline constexpr std::uint16_t HistogramSnapshot{5};
+
+        /// @brief Counters and gauges over an interval: a \a MetricsHeader and a \a MetricValue for each (see Metrics.h).
+        inline constexpr std::uint16_t Metrics{6};
+
+        /// @brief Time MiniLog spent in each stage of writing records over an interval, when built with \a c_profileWrites (see WriteProfiler.h).
+        inline constexpr std::uint16_t WriteProfile{7};
+
+        /// @brief Whether \a id is one of the records MiniLog writes itself, told apart by their ids alone. MiniLog refuses them from callers.
+        constexpr bool IsReserved(std::uint16_t id) noexcept {
+            return id == ClockCalibration || id == SamplingCounts || id == HistogramSnapshot || id == Metrics || id == WriteProfile;
+        }
+    }
+
+    /// @brief Severity of a record. Same values as ETW's TRACE_LEVEL_*: lower is more severe.
+    enum class Level : std::uint8_t {
+        Critical = 1,
+        Error = 2,
+        Warning = 3,
+        Information = 4,
+        Verbose = 5,
+    };
+
+    /// @brief What kind of record a message is. Stored with the record, so readers can select records without looking at payloads.
+    /// Maps to ETW's EVENT_DESCRIPTOR.
+    struct EventDescriptor {
+        std::uint16_t Id{EventIds::Message};
+        EtwLog::Level Level{Level::Information};
+
+        /// @brief Bit mask of categories the record belongs to, meaning is up to the application.
+        std::uint64_t Keyword{0};
+    };
+
+    /// @brief Identifies the logger that wrote a log: its ETW provider GUID, or an id of the same shape for the portable backend.
+    /// Same layout as GUID.
+    struct ProviderId {
+        std::uint32_t Data1;
+        std::uint16_t Data2;
+        std::uint16_t Data3;
+        std::uint8_t Data4[8];
+
+        friend bool operator==(const ProviderId&, const ProviderId&) = default;
+    };
+
+    /// @brief One record read back from the log: the MiniLog header and the payload following it.
+    struct RecordView {
+        ProviderId Provider;
+        EventDescriptor Event;
+        RecordHeader Header;
+
+        /// @brief \a RecordHeader::Timestamp converted to wall clock time.
+        std::chrono::sys_time<std::chrono::nanoseconds> Time;
+
+        std::span<const std::byte> Payload;
+
+        /// @brief Number of identical records this one stands for: \a RepeatHeader::Count for a run of repeats, 1 otherwise.
+        /// See \a ExpandRepeats to get each of them instead.
+        std::uint64_t Repeats{1};
+
+        /// @brief Time of the first of the \a Repeats records, the same as \a Time for a single record.
+        std::chrono::sys_time<std::chrono::nanoseconds> FirstTime;
+
+        /// @brief Number of records the payload was stored in, see \a FragmentHeader.
+        /// They have the sequence numbers from \a Header.Sequence to \a Header.Sequence + Fragments - 1.
+        std::uint32_t Fragments{1};
+
+        /// @brief Activity started or stopped by the record, see \a ActivityScope.
+        std::optional<ActivityHeader> Activity;
+    };
+} // EtwLog
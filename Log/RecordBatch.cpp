@@ -0,0 +1,34 @@
+#include "pch.h"
+#include "RecordBatch.h"
+
+EtwLog::RecordBatch::RecordBatch(std::pmr::memory_resource* memory)
+    :
+    m_arena{memory},
+    m_records{memory}
+{}
+
+void EtwLog::RecordBatch::Reserve(std::size_t records, std::size_t payloadBytes) {
+    m_records.reserve(records);
+    m_arena.reserve(payloadBytes);
+}
+
+void EtwLog::RecordBatch::Clear() noexcept {
+    m_records.clear();
+    m_arena.clear();
+}
+
+void EtwLog::RecordBatch::Add(const RecordView& record) {
+    m_records.push_back({record.Provider, record.Event, record.Header, record.Time, record.Repeats, record.FirstTime, record.Fragments, record.Activity, m_arena.size()});
+    m_arena.insert(m_arena.end(), record.Payload.begin(), record.Payload.end());
+}
+
+EtwLog::RecordView EtwLog::RecordBatch::operator[](std::size_t index) const noexcept {
+    const auto& entry{m_records[index]};
+    return {entry.Provider, entry.Event, entry.Header, entry.Time, Payload(index), entry.Repeats, entry.FirstTime, entry.Fragments, entry.Activity};
+}
+
+std::span<const std::byte> EtwLog::RecordBatch::Payload(std::size_t index) const noexcept {
+    const auto begin{m_records[index].PayloadOffset};
+    const auto end{index + 1 == m_records.size() ? m_arena.size() : m_records[index + 1].PayloadOffset};
+    return std::span{m_arena}.subspan(begin, end - begin);
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "Record.h"
+
+#include <cstddef>
+#include <memory_resource>
+#include <optional>
+#include <span>
+#include <vector>
+
+namespace EtwLog
+{
+    /// @brief Records kept after reading, such as by \a ReadLog into a batch.
+    /// Payloads are copied back to back into one arena, and everything else about a record into one array,
+    /// so a batch of any number of records takes two allocations once it has grown to size.
+    /// \a Clear keeps the memory, so reusing a batch for the next read doesn't allocate at all.
+    class RecordBatch {
+    public:
+        /// @param memory - where the arena and the record array are allocated.
+        explicit RecordBatch(std::pmr::memory_resource* memory = std::pmr::get_default_resource());
+
+        /// @brief Allocates room for \a records records with \a payloadBytes bytes of payloads in total.
+        void Reserve(std::size_t records, std::size_t payloadBytes);
+
+        /// @brief Removes all records, keeping the memory for the next ones.
+        void Clear() noexcept;
+
+        /// @brief Copies \a record, payload included, to the end of the batch.
+        void Add(const RecordView& record);
+
+        std::size_t Size() const noexcept { return m_records.size(); }
+        bool Empty() const noexcept { return m_records.empty(); }
+
+        /// @brief Bytes of all payloads in the batch.
+        std::size_t PayloadBytes() const noexcept { return m_arena.size(); }
+
+        /// @brief Record \a index, with its payload pointing into the batch: valid until the batch is changed.
+        RecordView operator[](std::size_t index) const noexcept;
+
+        std::span<const std::byte> Payload(std::size_t index) const noexcept;
+
+    private:
+        /// @brief A record without its payload, which starts at \a PayloadOffset in the arena and ends where the next one starts.
+        struct Entry {
+            ProviderId Provider;
+            EventDescriptor Event;
+            RecordHeader Header;
+            std::chrono::sys_time<std::chrono::nanoseconds> Time;
+            std::uint64_t Repeats;
+            std::chrono::sys_time<std::chrono::nanoseconds> FirstTime;
+            std::uint32_t Fragments;
+            std::optional<ActivityHeader> Activity;
+            std::size_t PayloadOffset;
+        };
+
+        std::pmr::vector<std::byte> m_arena;
+        std::pmr::vector<Entry> m_records;
+    };
+} // EtwLog
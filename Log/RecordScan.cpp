@@ -0,0 +1,211 @@
+#include "pch.h"
+#include "RecordScan.h"
+#include "PortableFormat.h"
+#include "Record.h"
+
+#include <array>
+#include <bit>
+#include <cstring>
+
+#if defined(_M_X64) || defined(__x86_64__)
+#define ETWLOG_HAS_AVX2_SCAN 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define ETWLOG_TARGET_AVX2
+#else
+#define ETWLOG_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#else
+#define ETWLOG_HAS_AVX2_SCAN 0
+#endif
+
+namespace
+{
+    using EtwLog::Portable::FrameFilter;
+    using EtwLog::Portable::RecordFrame;
+
+    using Select = std::size_t (*)(const std::byte* buffer, std::uint32_t* offsets, std::size_t count, const FrameFilter& filter) noexcept;
+
+    /// @brief Offset of the timestamp from the start of the frame.
+    constexpr std::size_t c_timestampOffset{sizeof(RecordFrame) + offsetof(EtwLog::RecordHeader, Timestamp)};
+
+    template <typename TField>
+    TField FieldAt(const std::byte* buffer, std::uint32_t offset, std::size_t fieldOffset) noexcept {
+        TField field;
+        std::memcpy(&field, buffer + offset + fieldOffset, sizeof(field));
+        return field;
+    }
+
+    bool Selects(const std::byte* buffer, std::uint32_t offset, const FrameFilter& filter) noexcept {
+        const auto eventId{FieldAt<std::uint16_t>(buffer, offset, offsetof(RecordFrame, EventId))};
+        const auto level{FieldAt<std::uint8_t>(buffer, offset, offsetof(RecordFrame, Level))};
+        const auto keyword{FieldAt<std::uint64_t>(buffer, offset, offsetof(RecordFrame, Keyword))};
+        const auto timestamp{FieldAt<std::uint64_t>(buffer, offset, c_timestampOffset)};
+
+        return (!filter.EventId || eventId == *filter.EventId)
+            && level <= filter.MaxLevel
+            && (filter.KeywordMask == 0 || (keyword & filter.KeywordMask) != 0)
+            && timestamp >= filter.FirstTicks && timestamp <= filter.LastTicks;
+    }
+
+    std::size_t SelectOneByOne(const std::byte* buffer, std::uint32_t* offsets, std::size_t count, const FrameFilter& filter) noexcept {
+        std::size_t kept{0};
+        for (std::size_t i = 0; i != count; ++i) {
+            // No branch, it would be mispredicted all the time when selected records are mixed with others.
+            offsets[kept] = offsets[i];
+            kept += Selects(buffer, offsets[i], filter) ? 1 : 0;
+        }
+        return kept;
+    }
+
+#if ETWLOG_HAS_AVX2_SCAN
+    /// @brief For each mask of 8 matching lanes, the permutation moving the matching lanes to the front.
+    constexpr auto c_compress{[] {
+        std::array<std::array<std::uint32_t, 8>, 256> table{};
+        for (std::uint32_t mask = 0; mask != table.size(); ++mask) {
+            std::uint32_t kept{0};
+            for (std::uint32_t lane = 0; lane != 8; ++lane) {
+                if ((mask & (1u << lane)) != 0) {
+                    table[mask][kept++] = lane;
+                }
+            }
+        }
+        return table;
+    }()};
+
+    /// @brief The 64 bit fields at \a fieldOffset of the 4 records at \a offsets.
+    ETWLOG_TARGET_AVX2 __m256i Gather64(const std::byte* buffer, __m128i offsets, std::size_t fieldOffset) noexcept {
+        return _mm256_i32gather_epi64(reinterpret_cast<const long long*>(buffer + fieldOffset), offsets, 1);
+    }
+
+    /// @brief Bit mask of the 64 bit lanes of \a lanes that are all ones.
+    ETWLOG_TARGET_AVX2 std::uint32_t LaneMask64(__m256i lanes) noexcept {
+        return static_cast<std::uint32_t>(_mm256_movemask_pd(_mm256_castsi256_pd(lanes)));
+    }
+
+    ETWLOG_TARGET_AVX2 std::size_t SelectWithAvx2(const std::byte* buffer, std::uint32_t* offsets, std::size_t count, const FrameFilter& filter) noexcept {
+        // Event id and level are in the 32 bit word at the frame's EventId field.
+        const auto* words{reinterpret_cast<const int*>(buffer + offsetof(RecordFrame, EventId))};
+        const auto idMask{_mm256_set1_epi32(filter.EventId ? 0xFFFF : 0)};
+        const auto wantedId{_mm256_set1_epi32(filter.EventId.value_or(0))};
+        const auto levelMask{_mm256_set1_epi32(0xFF)};
+        const auto maxLevel{_mm256_set1_epi32(filter.MaxLevel)};
+
+        const bool filterKeyword{filter.KeywordMask != 0};
+        const auto keywordMask{_mm256_set1_epi64x(static_cast<long long>(filter.KeywordMask))};
+        const auto zero{_mm256_setzero_si256()};
+
+        // AVX2 only compares signed 64 bit numbers, so ticks are compared with their top bit flipped.
+        const bool filterTime{filter.FirstTicks != 0 || filter.LastTicks != UINT64_MAX};
+        const auto signBit{_mm256_set1_epi64x(static_cast<long long>(0x8000'0000'0000'0000))};
+        const auto firstTicks{_mm256_xor_si256(_mm256_set1_epi64x(static_cast<long long>(filter.FirstTicks)), signBit)};
+        const auto lastTicks{_mm256_xor_si256(_mm256_set1_epi64x(static_cast<long long>(filter.LastTicks)), signBit)};
+
+        std::size_t kept{0};
+        std::size_t i{0};
+        for (; i + 8 <= count; i += 8) {
+            const auto indices{_mm256_loadu_si256(reinterpret_cast<const __m256i*>(offsets + i))};
+            const auto fields{_mm256_i32gather_epi32(words, indices, 1)};
+            const auto idMatches{_mm256_cmpeq_epi32(_mm256_and_si256(fields, idMask), wantedId)};
+            const auto levelTooHigh{_mm256_cmpgt_epi32(_mm256_and_si256(_mm256_srli_epi32(fields, 16), levelMask), maxLevel)};
+            auto mask{static_cast<std::uint32_t>(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_andnot_si256(levelTooHigh, idMatches))))};
+
+            // The 64 bit fields take two gathers of 4 records each, and only while some record is still selected.
+            const __m128i halves[2]{_mm256_castsi256_si128(indices), _mm256_extracti128_si256(indices, 1)};
+            for (std::size_t half = 0; half != std::size(halves); ++half) {
+                const auto shift{4 * half};
+                if (filterKeyword && ((mask >> shift) & 0xF) != 0) {
+                    const auto keywords{Gather64(buffer, halves[half], offsetof(RecordFrame, Keyword))};
+                    const auto noneSet{_mm256_cmpeq_epi64(_mm256_and_si256(keywords, keywordMask), zero)};
+                    mask &= ~(LaneMask64(noneSet) << shift);
+                }
+                if (filterTime && ((mask >> shift) & 0xF) != 0) {
+                    const auto ticks{_mm256_xor_si256(Gather64(buffer, halves[half], c_timestampOffset), signBit)};
+                    const auto outside{_mm256_or_si256(_mm256_cmpgt_epi64(firstTicks, ticks), _mm256_cmpgt_epi64(ticks, lastTicks))};
+                    mask &= ~(LaneMask64(outside) << shift);
+                }
+            }
+
+            // Writes 8 lanes, but only over offsets already tested: kept never passes i.
+            const auto permutation{_mm256_loadu_si256(reinterpret_cast<const __m256i*>(c_compress[mask].data()))};
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(offsets + kept), _mm256_permutevar8x32_epi32(indices, permutation));
+            kept += static_cast<std::size_t>(std::popcount(mask));
+        }
+
+        for (; i != count; ++i) {
+            offsets[kept] = offsets[i];
+            kept += Selects(buffer, offsets[i], filter) ? 1 : 0;
+        }
+        return kept;
+    }
+
+    bool HasAvx2() noexcept {
+#ifdef _MSC_VER
+        // CPUID.01H:ECX[27] is OSXSAVE, CPUID.07H:EBX[5] is AVX2, and XCR0 has to show the OS saves the YMM registers.
+        int registers[4];
+        __cpuid(registers, 1);
+        if ((static_cast<unsigned int>(registers[2]) & (1u << 27)) == 0 || (_xgetbv(0) & 0x6) != 0x6) {
+            return false;
+        }
+        __cpuidex(registers, 7, 0);
+        return (static_cast<unsigned int>(registers[1]) & (1u << 5)) != 0;
+#else
+        // Checks the OS support as well.
+        return __builtin_cpu_supports("avx2") != 0;
+#endif
+    }
+#endif
+
+    Select SelectImplementation() noexcept {
+#if ETWLOG_HAS_AVX2_SCAN
+        if (HasAvx2()) {
+            return SelectWithAvx2;
+        }
+#endif
+        return SelectOneByOne;
+    }
+
+    const Select c_select{SelectImplementation()};
+}
+
+EtwLog::Portable::ScanResult EtwLog::Portable::ScanRecords(std::span<const std::byte> buffer, std::vector<std::uint32_t>& offsets) {
+    ScanResult result;
+
+    // Each record's offset depends on the size of the one before, so this can't go wider than one record at a time.
+    std::size_t offset{0};
+    while (offset + sizeof(RecordFrame) <= buffer.size()) {
+        const auto size{FieldAt<std::uint32_t>(buffer.data(), static_cast<std::uint32_t>(offset), offsetof(RecordFrame, Size))};
+        if (size < sizeof(RecordHeader) || size > c_maxRecordSize) {
+            result.Damaged = true;
+            break;
+        }
+
+        const auto recordSize{sizeof(RecordFrame) + size};
+        if (offset + recordSize > buffer.size()) {
+            result.NextRecordSize = recordSize;
+            break;
+        }
+
+        const auto flags{FieldAt<std::uint8_t>(buffer.data(), static_cast<std::uint32_t>(offset), offsetof(RecordFrame, Flags))};
+        if ((flags & c_paddingFlag) == 0) {
+            offsets.push_back(static_cast<std::uint32_t>(offset));
+        }
+        offset += recordSize;
+    }
+
+    result.ValidBytes = offset;
+    return result;
+}
+
+std::size_t EtwLog::Portable::SelectRecords(std::span<const std::byte> buffer, std::span<std::uint32_t> offsets, const FrameFilter& filter) noexcept {
+    return c_select(buffer.data(), offsets.data(), offsets.size(), filter);
+}
+
+std::size_t EtwLog::Portable::SelectRecordsPortable(std::span<const std::byte> buffer, std::span<std::uint32_t> offsets, const FrameFilter& filter) noexcept {
+    return SelectOneByOne(buffer.data(), offsets.data(), offsets.size(), filter);
+}
+
+bool EtwLog::Portable::IsRecordScanAccelerated() noexcept {
+    return c_select != SelectOneByOne;
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <vector>
+
+/// @brief Bulk decoding of portable log records (see PortableFormat.h) held in memory.
+/// Readers load many records at once, find where each starts with \a ScanRecords, narrow the
+/// result down with \a SelectRecords and only then look at the payloads and checksums of the records they kept.
+/// Offsets are 32 bit, so a buffer has to be smaller than 2GB.
+namespace EtwLog::Portable
+{
+    /// @brief What \a ScanRecords found in a buffer.
+    struct ScanResult {
+        /// @brief Bytes of complete records at the start of the buffer.
+        std::size_t ValidBytes{0};
+
+        /// @brief Frame and record size of the record the buffer ends in the middle of, to know how much to read for it.
+        /// Zero when the buffer ends at a record boundary, with a partial frame, or with a damaged record.
+        std::size_t NextRecordSize{0};
+
+        /// @brief The record following the complete ones has an impossible size.
+        bool Damaged{false};
+    };
+
+    /// @brief Finds the records in \a buffer, which starts with a \a RecordFrame.
+    /// Stops at the first record with an impossible size, or one that doesn't end within \a buffer.
+    /// Checksums are left to the caller (see \a RecordCrc), which may only need them for the records it selects.
+    /// Padding records (see \a c_paddingFlag) are skipped.
+    /// @param offsets - the offset of each record's frame is appended here.
+    ScanResult ScanRecords(std::span<const std::byte> buffer, std::vector<std::uint32_t>& offsets);
+
+    /// @brief Properties of a record \a SelectRecords tests, all found in the frame and \a RecordHeader.
+    struct FrameFilter {
+        /// @brief Event id to select, any if empty.
+        std::optional<std::uint16_t> EventId;
+
+        /// @brief Least severe level to select.
+        std::uint8_t MaxLevel{0xFF};
+
+        /// @brief Keyword bits, of which a record needs at least one. Zero selects any keyword.
+        std::uint64_t KeywordMask{0};
+
+        /// @brief Timestamps to select, in clock ticks: [FirstTicks, LastTicks].
+        std::uint64_t FirstTicks{0};
+        std::uint64_t LastTicks{UINT64_MAX};
+    };
+
+    /// @brief Keeps the \a offsets of the records \a filter selects, in order.
+    /// Tests 8 records at once with AVX2 where the CPU has it.
+    /// @param offsets - frame offsets of records in \a buffer, as found by \a ScanRecords.
+    /// @return Number of offsets kept at the start of \a offsets.
+    std::size_t SelectRecords(std::span<const std::byte> buffer, std::span<std::uint32_t> offsets, const FrameFilter& filter) noexcept;
+
+    /// @brief Same as \a SelectRecords, always one record at a time.
+    std::size_t SelectRecordsPortable(std::span<const std::byte> buffer, std::span<std::uint32_t> offsets, const FrameFilter& filter) noexcept;
+
+    /// @brief True if \a SelectRecords uses vector instructions.
+    bool IsRecordScanAccelerated() noexcept;
+} // EtwLog::Portable
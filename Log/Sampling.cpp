@@ -0,0 +1,173 @@
+#include "pch.h"
+#include "Sampling.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace
+{
+    /// @brief Random numbers for probabilistic sampling: splitmix64, one sequence per thread so threads don't share a cache line.
+    std::uint64_t NextRandom() noexcept {
+        thread_local std::uint64_t t_state{reinterpret_cast<std::uintptr_t>(&t_state) ^ static_cast<std::uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count())};
+        auto z{t_state += 0x9E37'79B9'7F4A'7C15};
+        z = (z ^ (z >> 30)) * 0xBF58'476D'1CE4'E5B9;
+        z = (z ^ (z >> 27)) * 0x94D0'49BB'1331'11EB;
+        return z ^ (z >> 31);
+    }
+
+    std::uint64_t ProbabilityThreshold(double probability) noexcept {
+        if (!(probability < 1.0)) {
+            return UINT64_MAX;
+        }
+        if (!(probability > 0.0)) {
+            return 0;
+        }
+
+        // Largest double below 2^64, so the conversion can't overflow.
+        static constexpr double c_maxThreshold{18446744073709549568.0};
+        return static_cast<std::uint64_t>(std::min(std::ldexp(probability, 64), c_maxThreshold));
+    }
+
+    /// @brief Clock ticks of a rate limit, capped at 2^62 (over a century at GHz clock rates), so that the conversion can't overflow
+    /// and adding them to a timestamp can't wrap. Also caps a NaN.
+    std::uint64_t RateTicks(double ticks) noexcept {
+        static constexpr double c_maxTicks{4611686018427387904.0};
+        return ticks < c_maxTicks ? static_cast<std::uint64_t>(ticks) : static_cast<std::uint64_t>(c_maxTicks);
+    }
+}
+
+std::vector<EtwLog::SamplingCount> EtwLog::DecodeSamplingCounts(std::span<const std::byte> payload) {
+    std::vector<SamplingCount> counts(payload.size() / sizeof(SamplingCount));
+    std::memcpy(counts.data(), payload.data(), counts.size() * sizeof(SamplingCount));
+    return counts;
+}
+
+void EtwLog::Detail::Sampler::Rule::Set(const SamplingPolicy& policy, double ticksPerSecond) noexcept {
+    m_oneIn.store(std::max<std::uint32_t>(policy.OneIn, 1), std::memory_order_relaxed);
+    m_probabilityThreshold.store(ProbabilityThreshold(policy.Probability), std::memory_order_relaxed);
+
+    std::uint64_t interval{0};
+    std::uint64_t tolerance{0};
+    if (policy.RatePerSecond > 0) {
+        const auto ticks{std::max(ticksPerSecond / policy.RatePerSecond, 1.0)};
+        interval = RateTicks(ticks);
+        tolerance = RateTicks(ticks * (std::max(policy.Burst, 1.0) - 1));
+    }
+    m_interval.store(interval, std::memory_order_relaxed);
+    m_tolerance.store(tolerance, std::memory_order_relaxed);
+
+    m_keepsAll.store(policy.OneIn <= 1 && !(policy.Probability < 1.0) && interval == 0, std::memory_order_relaxed);
+}
+
+bool EtwLog::Detail::Sampler::Rule::Admit(const Clock& clock) noexcept {
+    // One atomic add for a dropped record: the dropped count is what remains of the records seen.
+    const auto seen{m_seen.fetch_add(1, std::memory_order_relaxed)};
+    const auto keep{[&] {
+        const auto oneIn{m_oneIn.load(std::memory_order_relaxed)};
+        if (oneIn > 1 && seen % oneIn != 0) {
+            return false;
+        }
+
+        const auto threshold{m_probabilityThreshold.load(std::memory_order_relaxed)};
+        if (threshold != UINT64_MAX && NextRandom() >= threshold) {
+            return false;
+        }
+
+        // The clock is only read for rate limiting, the other checks don't need it.
+        const auto interval{m_interval.load(std::memory_order_relaxed)};
+        if (interval != 0) {
+            const auto now{clock.Now()};
+            const auto tolerance{m_tolerance.load(std::memory_order_relaxed)};
+            auto due{m_nextDue.load(std::memory_order_relaxed)};
+            do {
+                if (due > now + tolerance) {
+                    return false;
+                }
+            } while (!m_nextDue.compare_exchange_weak(due, std::max(due, now) + interval, std::memory_order_relaxed));
+        }
+
+        return true;
+    }()};
+
+    if (keep) {
+        m_kept.fetch_add(1, std::memory_order_relaxed);
+    }
+    return keep;
+}
+
+EtwLog::SamplingCount EtwLog::Detail::Sampler::Rule::Count(std::uint32_t eventId) const noexcept {
+    // Kept first, so a record counted in between is not taken for a dropped one.
+    const auto kept{m_kept.load(std::memory_order_relaxed)};
+    const auto seen{m_seen.load(std::memory_order_relaxed)};
+    return {eventId, 0, kept, seen - std::min(kept, seen)};
+}
+
+EtwLog::Detail::Sampler::Sampler(const Clock& clock) : m_clock{clock} {}
+
+bool EtwLog::Detail::Sampler::AdmitSampled(std::uint16_t eventId) noexcept {
+    if (const auto* table{m_eventTable.load(std::memory_order_acquire)}) {
+        const auto rule{std::lower_bound(table->begin(), table->end(), eventId, [](const auto& entry, std::uint16_t id) { return entry.first < id; })};
+        if (rule != table->end() && rule->first == eventId && !rule->second->KeepsAll() && !rule->second->Admit(m_clock)) {
+            return false;
+        }
+    }
+
+    return m_loggerRule.KeepsAll() || m_loggerRule.Admit(m_clock);
+}
+
+void EtwLog::Detail::Sampler::SetPolicy(const SamplingPolicy& policy) {
+    std::lock_guard lock{m_mutex};
+    m_loggerRule.Set(policy, m_clock.Calibration().TicksPerSecond);
+    m_loggerRuleSet = true;
+    UpdateEnabled();
+}
+
+void EtwLog::Detail::Sampler::SetPolicy(std::uint16_t eventId, const SamplingPolicy& policy) {
+    std::lock_guard lock{m_mutex};
+
+    const auto* table{m_eventTable.load(std::memory_order_relaxed)};
+    Rule* found{nullptr};
+    if (table != nullptr) {
+        const auto entry{std::find_if(table->begin(), table->end(), [eventId](const auto& entry) { return entry.first == eventId; })};
+        found = entry == table->end() ? nullptr : entry->second;
+    }
+
+    if (found != nullptr) {
+        found->Set(policy, m_clock.Calibration().TicksPerSecond);
+    } else {
+        auto& rule{m_eventRules.emplace_back()};
+        rule.Set(policy, m_clock.Calibration().TicksPerSecond);
+
+        // Threads deciding right now may be using the current table, so it is replaced rather than changed.
+        auto next{table == nullptr ? std::make_unique<EventTable>() : std::make_unique<EventTable>(*table)};
+        next->insert(std::upper_bound(next->begin(), next->end(), eventId, [](std::uint16_t id, const auto& entry) { return id < entry.first; }), {eventId, &rule});
+        m_eventTable.store(next.get(), std::memory_order_release);
+        m_eventTables.push_back(std::move(next));
+    }
+
+    UpdateEnabled();
+}
+
+void EtwLog::Detail::Sampler::UpdateEnabled() noexcept {
+    bool enabled{!m_loggerRule.KeepsAll()};
+    for (const auto& rule : m_eventRules) {
+        enabled = enabled || !rule.KeepsAll();
+    }
+    m_enabled.store(enabled, std::memory_order_relaxed);
+}
+
+std::vector<EtwLog::SamplingCount> EtwLog::Detail::Sampler::Counts() const {
+    std::lock_guard lock{m_mutex};
+
+    std::vector<SamplingCount> counts;
+    if (m_loggerRuleSet) {
+        counts.push_back(m_loggerRule.Count(SamplingCount::c_allEvents));
+    }
+    if (const auto* table{m_eventTable.load(std::memory_order_relaxed)}) {
+        for (const auto& [id, rule] : *table) {
+            counts.push_back(rule->Count(id));
+        }
+    }
+    return counts;
+}
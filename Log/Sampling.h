@@ -0,0 +1,128 @@
+#pragma once
+
+#include "Clock.h"
+#include "Record.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <utility>
+#include <vector>
+
+namespace EtwLog
+{
+    /// @brief Which records a logger keeps, see \a MiniLog::SetSampling. A record has to pass every limit set.
+    /// The default keeps every record.
+    struct SamplingPolicy {
+        /// @brief Keeps the first record of every \a OneIn. 1 keeps them all.
+        std::uint32_t OneIn{1};
+
+        /// @brief Chance of keeping a record, from 0 to 1.
+        double Probability{1.0};
+
+        /// @brief Most records kept per second on average, with a token bucket. 0 for no limit.
+        double RatePerSecond{0};
+
+        /// @brief Records the token bucket lets through back to back, after a quiet period.
+        double Burst{1};
+    };
+
+    /// @brief Payload of an \a EventIds::SamplingCounts record, which holds one of these per sampling policy set.
+    /// @note Part of the on-disk format, so it is written and read as raw bytes.
+    struct SamplingCount {
+        /// @brief \a EventId of the logger's own policy, which applies to the records of every event id.
+        static constexpr std::uint32_t c_allEvents{0xFFFFFFFF};
+
+        /// @brief Event id the policy was set for, or \a c_allEvents.
+        std::uint32_t EventId;
+        std::uint32_t Reserved;
+
+        /// @brief Records the policy kept and dropped since it was first set, counted while it limits anything.
+        /// A record of an event id with a policy of its own only reaches the logger's policy if it was kept by the first one.
+        std::uint64_t Kept;
+        std::uint64_t Dropped;
+    };
+
+    /// @brief Reads the payload of an \a EventIds::SamplingCounts record.
+    std::vector<SamplingCount> DecodeSamplingCounts(std::span<const std::byte> payload);
+} // EtwLog
+
+namespace EtwLog::Detail
+{
+    /// @brief Decides which records a logger keeps, according to the \a SamplingPolicy of the logger and of each event id.
+    /// Policies can be changed at any time while other threads log; a decision made during a change may use some of the old settings.
+    /// Until a policy is set, deciding costs one relaxed atomic load.
+    class Sampler {
+    public:
+        explicit Sampler(const Clock& clock);
+
+        Sampler(const Sampler&) = delete;
+        Sampler& operator=(const Sampler&) = delete;
+
+        /// @brief True to keep a record with \a eventId. Counts the record as kept or dropped.
+        bool Admit(std::uint16_t eventId) noexcept {
+            return !m_enabled.load(std::memory_order_relaxed) || AdmitSampled(eventId);
+        }
+
+        void SetPolicy(const SamplingPolicy& policy);
+        void SetPolicy(std::uint16_t eventId, const SamplingPolicy& policy);
+
+        /// @brief Counts of every policy set so far, the logger's first. Empty if none was ever set.
+        std::vector<SamplingCount> Counts() const;
+
+    private:
+        /// @brief Settings and counts of one policy, updated in place so deciding threads never see it go away.
+        class Rule {
+        public:
+            void Set(const SamplingPolicy& policy, double ticksPerSecond) noexcept;
+            bool Admit(const Clock& clock) noexcept;
+            bool KeepsAll() const noexcept { return m_keepsAll.load(std::memory_order_relaxed); }
+            SamplingCount Count(std::uint32_t eventId) const noexcept;
+
+        private:
+            std::atomic<bool> m_keepsAll{true};
+
+            std::atomic<std::uint32_t> m_oneIn{1};
+
+            /// @brief A record is kept when a random 64 bit number is below this. UINT64_MAX keeps every record.
+            std::atomic<std::uint64_t> m_probabilityThreshold{UINT64_MAX};
+
+            /// @brief Token bucket as a generic cell rate algorithm: clock ticks between records at the average rate,
+            /// ticks a record may come early to make a burst, and the tick the next record is due at. Zero interval for no limit.
+            std::atomic<std::uint64_t> m_interval{0};
+            std::atomic<std::uint64_t> m_tolerance{0};
+            std::atomic<std::uint64_t> m_nextDue{0};
+
+            /// @brief Records decided on, and those of them kept.
+            std::atomic<std::uint64_t> m_seen{0};
+            std::atomic<std::uint64_t> m_kept{0};
+        };
+
+        /// @brief Rules of the event ids with a policy, sorted by id. Replaced by a new table when an id is added.
+        using EventTable = std::vector<std::pair<std::uint16_t, Rule*>>;
+
+        bool AdmitSampled(std::uint16_t eventId) noexcept;
+
+        /// @brief Lets \a Admit skip the rules while none of them drops anything. Called under m_mutex.
+        void UpdateEnabled() noexcept;
+
+        const Clock& m_clock;
+
+        /// @brief False while no policy drops anything, so \a Admit doesn't look further.
+        std::atomic<bool> m_enabled{false};
+
+        Rule m_loggerRule;
+        bool m_loggerRuleSet{false};
+
+        std::atomic<const EventTable*> m_eventTable{nullptr};
+
+        /// @brief Guards changes. Rules and replaced tables are only freed with the sampler, since deciding threads may still use them.
+        mutable std::mutex m_mutex;
+        std::deque<Rule> m_eventRules;
+        std::vector<std::unique_ptr<EventTable>> m_eventTables;
+    };
+} // EtwLog::Detail
@@ -0,0 +1,73 @@
+#pragma once
+
+#include "MiniEtwLog.h"
+#include "Record.h"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <span>
+
+namespace EtwLog::Detail
+{
+    /// @brief Headers of a record besides its \a RecordHeader. Set for a run of repeats, for a fragment of a large payload,
+    /// and for the start and stop of an activity.
+    struct ExtraHeaders {
+        const RepeatHeader* Repeat{nullptr};
+        const FragmentHeader* Fragment{nullptr};
+        const ActivityHeader* Activity{nullptr};
+
+        static constexpr std::size_t c_maxPackedSize{sizeof(RepeatHeader) + sizeof(FragmentHeader) + sizeof(ActivityHeader)};
+
+        std::uint8_t Flags() const noexcept {
+            return static_cast<std::uint8_t>((Repeat != nullptr ? RecordFlags::Repeated : 0) | (Fragment != nullptr ? RecordFlags::Fragment : 0)
+                | (Activity != nullptr ? RecordFlags::Activity : 0));
+        }
+
+        /// @brief Copies the headers back to back into \a out, in the order \a RecordFlags gives them, as the portable format stores them.
+        /// @return Bytes copied.
+        std::size_t Pack(std::array<std::byte, c_maxPackedSize>& out) const noexcept {
+            std::size_t size{0};
+            if (Repeat != nullptr) {
+                std::memcpy(out.data() + size, Repeat, sizeof(RepeatHeader));
+                size += sizeof(RepeatHeader);
+            }
+            if (Fragment != nullptr) {
+                std::memcpy(out.data() + size, Fragment, sizeof(FragmentHeader));
+                size += sizeof(FragmentHeader);
+            }
+            if (Activity != nullptr) {
+                std::memcpy(out.data() + size, Activity, sizeof(ActivityHeader));
+                size += sizeof(ActivityHeader);
+            }
+            return size;
+        }
+    };
+
+    /// @brief Backend storing the records of a MiniLog.
+    /// MiniLog stamps the \a RecordHeader, the sink only has to store header and payload next to each other.
+    /// @note Write is called concurrently from any thread that logs.
+    class Sink {
+    public:
+        virtual ~Sink() = default;
+
+        virtual void Write(const EventDescriptor& event, const RecordHeader& header, std::span<const std::byte> payload) = 0;
+
+        /// @brief Same as above, for a record with \a extra headers.
+        virtual void Write(const EventDescriptor& event, const RecordHeader& header, const ExtraHeaders& extra, std::span<const std::byte> payload) = 0;
+
+        /// @brief Largest payload \a Write takes, with all headers. MiniLog splits larger ones into fragments.
+        virtual std::size_t MaxPayloadSize() const noexcept = 0;
+
+        /// @brief Called when the logger's level and keyword filter changes, for sinks whose storage filters records as well (ETW).
+        /// MiniLog already checks records against the filter before writing them.
+        virtual void SetFilter([[maybe_unused]] Level maxLevel, [[maybe_unused]] std::uint64_t keywordMask) {}
+
+        /// @brief Handles writes finding the sink's buffers full as \a policy says, from now on.
+        virtual void SetBackpressure(const BackpressurePolicy& policy) = 0;
+
+        /// @brief Records \a Write dropped under the backpressure policy so far.
+        virtual std::uint64_t DroppedRecords() const noexcept = 0;
+    };
+} // EtwLog::Detail
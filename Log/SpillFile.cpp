@@ -0,0 +1,107 @@
+#include "pch.h"
+#include "SpillFile.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include <cerrno>
+#include <cstdint>
+#include <system_error>
+
+EtwLog::Detail::SpillFile::SpillFile(const std::filesystem::path& path, std::size_t slotSize, std::size_t slotCount)
+    :
+    m_slotSize{slotSize},
+    m_sizes(slotCount, 0),
+    m_records(slotCount, 0),
+    m_size{slotSize * slotCount}
+{
+#ifdef _WIN32
+    const auto throwLastError = [&path](const char* what) {
+        throw std::system_error{static_cast<int>(::GetLastError()), std::system_category(), what + path.string()};
+    };
+
+    const auto file{::CreateFileW(path.wstring().c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS,
+        FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE, nullptr)};
+    if (file == INVALID_HANDLE_VALUE) {
+        throwLastError("Creating ");
+    }
+    m_file = file;
+
+    // Sizes the file, allocating its space.
+    const auto size{static_cast<std::uint64_t>(m_size)};
+    m_mapping = ::CreateFileMappingW(file, nullptr, PAGE_READWRITE, static_cast<DWORD>(size >> 32), static_cast<DWORD>(size), nullptr);
+    if (m_mapping == nullptr) {
+        ::CloseHandle(file);
+        throwLastError("Mapping ");
+    }
+    m_data = static_cast<std::byte*>(::MapViewOfFile(m_mapping, FILE_MAP_ALL_ACCESS, 0, 0, m_size));
+    if (m_data == nullptr) {
+        ::CloseHandle(m_mapping);
+        ::CloseHandle(file);
+        throwLastError("Mapping ");
+    }
+#else
+    const auto file{::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600)};
+    if (file < 0) {
+        throw std::system_error{errno, std::generic_category(), "Creating " + path.string()};
+    }
+
+    // A page of a sparse file written through the mapping with the disk full would kill the process with SIGBUS.
+    auto error{::posix_fallocate(file, 0, static_cast<off_t>(m_size))};
+    if (error == 0) {
+#ifdef MAP_POPULATE
+        // Fault the pages in now, rather than on the writers spilling, when time matters most.
+        constexpr int c_populate{MAP_POPULATE};
+#else
+        constexpr int c_populate{0};
+#endif
+        const auto mapping{::mmap(nullptr, m_size, PROT_READ | PROT_WRITE, MAP_SHARED | c_populate, file, 0)};
+        if (mapping == MAP_FAILED) {
+            error = errno;
+        } else {
+            m_data = static_cast<std::byte*>(mapping);
+        }
+    }
+    // The mapping keeps the file alive.
+    ::unlink(path.c_str());
+    ::close(file);
+    if (error != 0) {
+        throw std::system_error{error, std::generic_category(), "Mapping " + path.string()};
+    }
+#endif
+}
+
+EtwLog::Detail::SpillFile::~SpillFile() {
+#ifdef _WIN32
+    ::UnmapViewOfFile(m_data);
+    ::CloseHandle(m_mapping);
+    ::CloseHandle(m_file);
+#else
+    ::munmap(m_data, m_size);
+#endif
+}
+
+std::byte* EtwLog::Detail::SpillFile::Append(std::size_t size) noexcept {
+    auto last{(m_first + m_count + m_sizes.size() - 1) % m_sizes.size()};
+    if (m_count == 0 || m_sizes[last] + size > m_slotSize) {
+        if (m_count == m_sizes.size()) {
+            return nullptr;
+        }
+        last = (m_first + m_count++) % m_sizes.size();
+    }
+
+    auto* space{m_data + last * m_slotSize + m_sizes[last]};
+    m_sizes[last] += size;
+    ++m_records[last];
+    return space;
+}
+
+void EtwLog::Detail::SpillFile::PopFront() noexcept {
+    m_sizes[m_first] = 0;
+    m_records[m_first] = 0;
+    m_first = (m_first + 1) % m_sizes.size();
+    --m_count;
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <span>
+#include <vector>
+
+namespace EtwLog::Detail
+{
+    /// @brief Overflow area for records a lane's buffers have no room for: a file of \a slotCount slots of \a slotSize bytes, mapped into memory.
+    /// Records are appended to the newest slot and taken back a whole slot at a time, oldest first.
+    /// The mapping is backed by the file rather than by swap, so the kernel can write spilled pages out under memory pressure,
+    /// and a burst can spill far more than the buffers hold. The file's space is allocated up front, so writing a page never runs out of disk.
+    /// The file is deleted as soon as it is mapped (on Windows, once it is closed), so nothing is left behind, even by a crash.
+    class SpillFile {
+    public:
+        SpillFile(const std::filesystem::path& path, std::size_t slotSize, std::size_t slotCount);
+        ~SpillFile();
+
+        SpillFile(const SpillFile&) = delete;
+        SpillFile& operator=(const SpillFile&) = delete;
+
+        bool Empty() const noexcept { return m_count == 0; }
+
+        std::size_t SlotCount() const noexcept { return m_sizes.size(); }
+
+        /// @brief Room for a record of \a size bytes after the records spilled last, in a new slot if the newest has no room left.
+        /// Null if every slot is taken.
+        std::byte* Append(std::size_t size) noexcept;
+
+        /// @brief Records of the oldest slot. Only called when not \a Empty.
+        std::span<const std::byte> Front() const noexcept { return {m_data + m_first * m_slotSize, m_sizes[m_first]}; }
+
+        /// @brief Number of records in \a Front.
+        std::uint64_t FrontRecords() const noexcept { return m_records[m_first]; }
+
+        /// @brief Frees the oldest slot, once its records are copied out.
+        void PopFront() noexcept;
+
+    private:
+        const std::size_t m_slotSize;
+
+        /// @brief Bytes filled of each slot, and the records in them.
+        std::vector<std::size_t> m_sizes;
+        std::vector<std::uint64_t> m_records;
+
+        /// @brief Oldest slot in use, and how many are, wrapping around the end of the file.
+        std::size_t m_first{0};
+        std::size_t m_count{0};
+
+        std::byte* m_data{nullptr};
+        std::size_t m_size{0};
+
+#ifdef _WIN32
+        void* m_file{nullptr};
+        void* m_mapping{nullptr};
+#endif
+    };
+} // EtwLog::Detail
@@ -0,0 +1,141 @@
+#include "pch.h"
+#include "WriteProfiler.h"
+
+#include <atomic>
+#include <cstring>
+
+namespace
+{
+    /// @brief Histograms of the calling thread in the profiler it last recorded to.
+    struct ThreadCache {
+        std::uint64_t Profiler{0};
+        std::array<EtwLog::LatencyHistogram, EtwLog::c_writeStageCount>* Stages{nullptr};
+    };
+    thread_local ThreadCache t_cache;
+
+    std::uint64_t NextProfilerId() noexcept {
+        static std::atomic<std::uint64_t> s_next{1};
+        return s_next.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    std::vector<EtwLog::StageProfile> NonEmpty(std::array<EtwLog::Histogram, EtwLog::c_writeStageCount>& stages, bool take) {
+        std::vector<EtwLog::StageProfile> profiles;
+        for (std::size_t stage = 0; stage != stages.size(); ++stage) {
+            if (stages[stage].Count() != 0) {
+                profiles.push_back({std::string{EtwLog::WriteStageName(static_cast<EtwLog::WriteStage>(stage))}, take ? std::move(stages[stage]) : stages[stage]});
+                if (take) {
+                    stages[stage] = {};
+                }
+            }
+        }
+        return profiles;
+    }
+}
+
+std::string_view EtwLog::WriteStageName(WriteStage stage) noexcept {
+    switch (stage) {
+    case WriteStage::Admit: return "Admit";
+    case WriteStage::Coalesce: return "Coalesce";
+    case WriteStage::SinkWrite: return "SinkWrite";
+    case WriteStage::BufferWait: return "BufferWait";
+    case WriteStage::Seal: return "Seal";
+    case WriteStage::FileWrite: return "FileWrite";
+    }
+    return "Unknown";
+}
+
+std::vector<std::byte> EtwLog::EncodeWriteProfile(std::chrono::nanoseconds interval, double ticksPerSecond, std::span<const StageProfile> stages) {
+    const WriteProfileHeader header{static_cast<std::uint64_t>(interval.count()), ticksPerSecond, static_cast<std::uint32_t>(stages.size()), 0};
+    std::vector<std::byte> payload(sizeof(header));
+    std::memcpy(payload.data(), &header, sizeof(header));
+
+    for (std::size_t stage = 0; stage != stages.size(); ++stage) {
+        const auto histogram{EncodeHistogramSnapshot(static_cast<std::uint32_t>(stage), interval, stages[stage].Ticks)};
+        const StageProfileHeader stageHeader{static_cast<std::uint32_t>(stages[stage].Name.size()), static_cast<std::uint32_t>(histogram.size())};
+
+        const auto offset{payload.size()};
+        payload.resize(offset + sizeof(stageHeader) + stageHeader.NameSize + stageHeader.HistogramSize);
+        std::memcpy(payload.data() + offset, &stageHeader, sizeof(stageHeader));
+        std::memcpy(payload.data() + offset + sizeof(stageHeader), stages[stage].Name.data(), stageHeader.NameSize);
+        std::memcpy(payload.data() + offset + sizeof(stageHeader) + stageHeader.NameSize, histogram.data(), histogram.size());
+    }
+    return payload;
+}
+
+std::optional<EtwLog::WriteProfileSnapshot> EtwLog::DecodeWriteProfile(const RecordView& record) {
+    WriteProfileHeader header;
+    if (record.Event.Id != EventIds::WriteProfile || record.Payload.size() < sizeof(header)) {
+        return {};
+    }
+    std::memcpy(&header, record.Payload.data(), sizeof(header));
+
+    WriteProfileSnapshot snapshot{record.Time - std::chrono::nanoseconds{header.IntervalNanoseconds}, record.Time, header.TicksPerSecond, {}};
+    auto rest{record.Payload.subspan(sizeof(header))};
+    for (std::uint32_t stage = 0; stage != header.StageCount; ++stage) {
+        StageProfileHeader stageHeader;
+        if (rest.size() < sizeof(stageHeader)) {
+            return {};
+        }
+        std::memcpy(&stageHeader, rest.data(), sizeof(stageHeader));
+        rest = rest.subspan(sizeof(stageHeader));
+        if (rest.size() < std::size_t{stageHeader.NameSize} + stageHeader.HistogramSize) {
+            return {};
+        }
+
+        auto histogram{DecodeHistogramSnapshot(rest.subspan(stageHeader.NameSize, stageHeader.HistogramSize), record.Time)};
+        if (!histogram) {
+            return {};
+        }
+        snapshot.Stages.push_back({std::string{reinterpret_cast<const char*>(rest.data()), stageHeader.NameSize}, std::move(histogram->Histogram)});
+        rest = rest.subspan(std::size_t{stageHeader.NameSize} + stageHeader.HistogramSize);
+    }
+    if (!rest.empty()) {
+        return {};
+    }
+    return snapshot;
+}
+
+EtwLog::Detail::WriteProfiler::WriteProfiler(const Clock& clock) : m_clock{clock}, m_id{NextProfilerId()} {}
+
+void EtwLog::Detail::WriteProfiler::Record(WriteStage stage, std::uint64_t ticks) noexcept {
+    if (t_cache.Profiler != m_id) {
+        try {
+            t_cache.Stages = &ThreadHistograms();
+            t_cache.Profiler = m_id;
+        } catch (...) {
+            return;
+        }
+    }
+    (*t_cache.Stages)[static_cast<std::size_t>(stage)].RecordValue(ticks);
+}
+
+std::vector<EtwLog::StageProfile> EtwLog::Detail::WriteProfiler::TakeInterval() {
+    std::lock_guard lock{m_mutex};
+    Collect();
+    return NonEmpty(m_pending, true);
+}
+
+std::vector<EtwLog::StageProfile> EtwLog::Detail::WriteProfiler::Totals() {
+    std::lock_guard lock{m_mutex};
+    Collect();
+    return NonEmpty(m_totals, false);
+}
+
+void EtwLog::Detail::WriteProfiler::Collect() {
+    for (auto& [thread, stages] : m_threads) {
+        for (std::size_t stage = 0; stage != c_writeStageCount; ++stage) {
+            const auto taken{(*stages)[stage].TakeInterval()};
+            m_pending[stage].Merge(taken);
+            m_totals[stage].Merge(taken);
+        }
+    }
+}
+
+EtwLog::Detail::WriteProfiler::ThreadStages& EtwLog::Detail::WriteProfiler::ThreadHistograms() {
+    std::lock_guard lock{m_mutex};
+    auto& stages{m_threads[std::this_thread::get_id()]};
+    if (!stages) {
+        stages = std::make_unique<ThreadStages>();
+    }
+    return *stages;
+}
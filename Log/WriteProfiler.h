@@ -0,0 +1,171 @@
+#pragma once
+
+#include "Clock.h"
+#include "Histogram.h"
+#include "Record.h"
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+/// @brief Define as 1 to build MiniLog with its write path timed, see \a EtwLog::c_profileWrites.
+#ifndef ETWLOG_PROFILE_WRITES
+#define ETWLOG_PROFILE_WRITES 0
+#endif
+
+namespace EtwLog
+{
+    /// @brief True if MiniLog times the stages of its write and flush paths (\a WriteStage) into per-thread histograms,
+    /// for \a MiniLog::Profile and the \a EventIds::WriteProfile records. Off by default: the timers then compile to nothing.
+    inline constexpr bool c_profileWrites{ETWLOG_PROFILE_WRITES != 0};
+
+    /// @brief Stages of writing a record timed by the write profile, in clock ticks (CPU cycles where the clock is the TSC).
+    enum class WriteStage : std::uint8_t {
+        /// @brief Deciding whether the record passes the filter and sampling.
+        Admit,
+        /// @brief Offering the record to the coalescer, lock included, while coalescing is on.
+        Coalesce,
+        /// @brief Handing the record to the sink: EventWrite and checking its result on ETW, appending to a buffer on the portable backend.
+        SinkWrite,
+        /// @brief Part of \a SinkWrite spent waiting for the flush thread to free a buffer, all being on their way to the file. Portable backend only.
+        BufferWait,
+        /// @brief Checksumming a full buffer's records on the flush thread. Portable backend only.
+        Seal,
+        /// @brief Starting the write of a full buffer to the file on the flush thread, switching segments included. Portable backend only.
+        FileWrite,
+    };
+
+    inline constexpr std::size_t c_writeStageCount{6};
+
+    std::string_view WriteStageName(WriteStage stage) noexcept;
+
+    /// @brief Time one stage took, each time it ran.
+    struct StageProfile {
+        std::string Name;
+
+        /// @brief In clock ticks.
+        Histogram Ticks;
+    };
+
+    /// @brief Start of the payload of an \a EventIds::WriteProfile record, followed by \a StageCount stages: each a \a StageProfileHeader,
+    /// its name and its histogram, encoded as the payload of an \a EventIds::HistogramSnapshot record keyed by the stage.
+    /// Stage names and the clock rate are in the record, so it can be read without knowing this version's stages.
+    /// @note Part of the on-disk format, so it is written and read as raw bytes.
+    struct WriteProfileHeader {
+        std::uint64_t IntervalNanoseconds;
+        /// @brief Rate of the ticks the histograms count.
+        double TicksPerSecond;
+        std::uint32_t StageCount;
+        std::uint32_t Reserved;
+    };
+
+    /// @note Part of the on-disk format, so it is written and read as raw bytes.
+    struct StageProfileHeader {
+        std::uint32_t NameSize;
+        std::uint32_t HistogramSize;
+    };
+
+    /// @brief What an \a EventIds::WriteProfile record holds.
+    struct WriteProfileSnapshot {
+        std::chrono::sys_time<std::chrono::nanoseconds> Begin;
+        std::chrono::sys_time<std::chrono::nanoseconds> End;
+        double TicksPerSecond;
+
+        /// @brief The stages that ran in the interval.
+        std::vector<StageProfile> Stages;
+    };
+
+    /// @brief Payload of an \a EventIds::WriteProfile record of \a stages over \a interval.
+    std::vector<std::byte> EncodeWriteProfile(std::chrono::nanoseconds interval, double ticksPerSecond, std::span<const StageProfile> stages);
+
+    /// @brief Reads a profile back, empty if \a record isn't one or is damaged.
+    std::optional<WriteProfileSnapshot> DecodeWriteProfile(const RecordView& record);
+
+    namespace Detail {
+        /// @brief Histograms of the time each \a WriteStage takes, one set per thread, so threads timing stages only write cache lines of their own.
+        class WriteProfiler {
+        public:
+            explicit WriteProfiler(const Clock& clock);
+
+            WriteProfiler(const WriteProfiler&) = delete;
+            WriteProfiler& operator=(const WriteProfiler&) = delete;
+
+            std::uint64_t Now() const noexcept { return m_clock.Now(); }
+
+            /// @brief Counts \a ticks spent in \a stage by the calling thread.
+            /// The thread's histograms are found through a thread-local cache of the last profiler used, so a thread alternating between
+            /// loggers takes a lock each time it changes. A thread's first record allocates its histograms, and is lost if that fails.
+            void Record(WriteStage stage, std::uint64_t ticks) noexcept;
+
+            /// @brief Takes the stages timed since the last call, by every thread. Stages that didn't run are left out.
+            std::vector<StageProfile> TakeInterval();
+
+            /// @brief Every stage timed so far, by every thread. Stages that didn't run are left out.
+            std::vector<StageProfile> Totals();
+
+        private:
+            using ThreadStages = std::array<LatencyHistogram, c_writeStageCount>;
+
+            /// @brief Moves what the threads timed into \a m_pending and \a m_totals. Called under \a m_mutex.
+            void Collect();
+
+            ThreadStages& ThreadHistograms();
+
+            const Clock m_clock;
+
+            /// @brief Unique for every profiler, unlike its address, for the thread-local cache.
+            const std::uint64_t m_id;
+
+            std::mutex m_mutex;
+            std::unordered_map<std::thread::id, std::unique_ptr<ThreadStages>> m_threads;
+
+            /// @brief Timed since the last \a TakeInterval.
+            std::array<Histogram, c_writeStageCount> m_pending;
+            std::array<Histogram, c_writeStageCount> m_totals;
+        };
+
+        /// @brief Times the scope it lives in as \a stage of \a profiler, if not null.
+        template <bool c_enabled>
+        class BasicStageTimer {
+        public:
+            BasicStageTimer(WriteProfiler* profiler, WriteStage stage) noexcept
+                : m_profiler{profiler}, m_stage{stage}, m_start{profiler != nullptr ? profiler->Now() : 0} {}
+
+            ~BasicStageTimer() {
+                if (m_profiler != nullptr) {
+                    m_profiler->Record(m_stage, m_profiler->Now() - m_start);
+                }
+            }
+
+            BasicStageTimer(const BasicStageTimer&) = delete;
+            BasicStageTimer& operator=(const BasicStageTimer&) = delete;
+
+        private:
+            WriteProfiler* const m_profiler;
+            const WriteStage m_stage;
+            const std::uint64_t m_start;
+        };
+
+        /// @brief Does nothing, and is optimized away entirely.
+        template <>
+        class BasicStageTimer<false> {
+        public:
+            BasicStageTimer(WriteProfiler*, WriteStage) noexcept {}
+
+            BasicStageTimer(const BasicStageTimer&) = delete;
+            BasicStageTimer& operator=(const BasicStageTimer&) = delete;
+        };
+
+        using StageTimer = BasicStageTimer<c_profileWrites>;
+    }
+} // EtwLog
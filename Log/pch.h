@@ -8,7 +8,9 @@
 #define PCH_H
 
 // add headers that you want to pre-compile here
+#ifdef _WIN32
 #define WIN32_LEAN_AND_MEAN             // Exclude rarely-used stuff from Windows headers
 #include <Windows.h>
+#endif
 
 #endif //PCH_H
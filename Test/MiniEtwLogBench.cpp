@@ -0,0 +1,699 @@
+#include "MiniEtwLog.h"
+#include "Activity.h"
+#include "BufferMemory.h"
+#include "Clock.h"
+#include "ColumnarExport.h"
+#include "Crc32c.h"
+#include "Histogram.h"
+#include "LogReader.h"
+#include "MiniLogPool.h"
+#include "PortableFormat.h"
+#include "RecordBatch.h"
+#include "RecordScan.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <format>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+namespace {
+    /// @brief Results are added here so the compiler can't drop the measured work.
+    volatile std::uint64_t g_keepAlive{0};
+
+    /// @brief Runs \a body \a iterations times and prints the average cost of one call.
+    template <typename TBody>
+    void Measure(const char* name, std::size_t iterations, TBody&& body) {
+        const auto start{std::chrono::steady_clock::now()};
+        for (std::size_t i = 0; i != iterations; ++i) {
+            body(i);
+        }
+        const std::chrono::duration<double, std::nano> elapsed{std::chrono::steady_clock::now() - start};
+
+        std::printf("%-56s %10.2f ns/op\n", name, elapsed.count() / static_cast<double>(iterations));
+    }
+
+    struct BenchFolder {
+        BenchFolder() { std::filesystem::remove_all(Path); }
+        ~BenchFolder() { std::filesystem::remove_all(Path); }
+
+        std::filesystem::path Path{std::filesystem::current_path() / "bench_out"};
+    };
+
+#ifdef _WIN32
+    constexpr EtwLog::Backend c_backends[]{EtwLog::Backend::Etw, EtwLog::Backend::Portable};
+#else
+    constexpr EtwLog::Backend c_backends[]{EtwLog::Backend::Portable};
+#endif
+
+    const char* BackendName(EtwLog::Backend backend) {
+        return backend == EtwLog::Backend::Etw ? "ETW" : "portable";
+    }
+
+    void PrintDuration(const std::string& name, std::chrono::steady_clock::duration total, std::size_t count) {
+        const std::chrono::duration<double, std::micro> average{total / count};
+        std::printf("%-56s %10.2f us/op\n", name.c_str(), average.count());
+    }
+
+    void PrintThroughput(const char* name, std::uint64_t bytes, std::chrono::steady_clock::duration elapsed) {
+        const std::chrono::duration<double> seconds{elapsed};
+        std::printf("%-56s %10.2f GB/s\n", name, static_cast<double>(bytes) / seconds.count() / 1e9);
+    }
+
+#ifdef __linux__
+    /// @brief Hardware event counts of this process's threads, including the ones started after it is constructed.
+    /// Counters the kernel or the machine doesn't offer (such as in a VM without a virtual PMU) read as empty.
+    class PerfCounters {
+    public:
+        PerfCounters() {
+            constexpr auto c_miss{PERF_COUNT_HW_CACHE_RESULT_MISS << 16};
+            constexpr std::pair<const char*, std::uint64_t> c_events[]{
+                {"dTLB load miss", PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | c_miss},
+                {"dTLB store miss", PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_WRITE << 8) | c_miss},
+                {"remote load", PERF_COUNT_HW_CACHE_NODE | (PERF_COUNT_HW_CACHE_OP_READ << 8) | c_miss},
+                {"remote store", PERF_COUNT_HW_CACHE_NODE | (PERF_COUNT_HW_CACHE_OP_WRITE << 8) | c_miss},
+            };
+
+            for (const auto& [name, config] : c_events) {
+                perf_event_attr attributes{};
+                attributes.size = sizeof(attributes);
+                attributes.type = PERF_TYPE_HW_CACHE;
+                attributes.config = config;
+                attributes.inherit = 1;
+                attributes.exclude_kernel = 1;
+                attributes.exclude_hv = 1;
+                m_counters.push_back({name, static_cast<int>(::syscall(SYS_perf_event_open, &attributes, 0, -1, -1, 0))});
+            }
+        }
+
+        ~PerfCounters() {
+            for (const auto& counter : m_counters) {
+                if (counter.Fd >= 0) {
+                    ::close(counter.Fd);
+                }
+            }
+        }
+
+        /// @brief Prints each count divided by \a operations. Counts of threads are in once they have exited.
+        void Print(const std::string& name, std::uint64_t operations) const {
+            for (const auto& counter : m_counters) {
+                std::uint64_t count{0};
+                const auto label{name + ", " + counter.Name};
+                if (counter.Fd < 0 || ::read(counter.Fd, &count, sizeof(count)) != sizeof(count)) {
+                    std::printf("%-56s %10s\n", label.c_str(), "n/a");
+                } else {
+                    std::printf("%-56s %10.4f /op\n", label.c_str(), static_cast<double>(count) / static_cast<double>(operations));
+                }
+            }
+        }
+
+    private:
+        struct Counter {
+            const char* Name;
+            int Fd;
+        };
+
+        std::vector<Counter> m_counters;
+    };
+#endif
+
+    /// @brief Portable log records as the sink stores them, with 8 event ids and 16 to 112 byte payloads.
+    std::vector<std::byte> MakePortableRecords(std::size_t size) {
+        using EtwLog::Portable::RecordFrame;
+
+        std::vector<std::byte> buffer;
+        buffer.reserve(size);
+        for (std::uint64_t r = 0;; ++r) {
+            const std::uint32_t payloadSize{16 + static_cast<std::uint32_t>(r * 37 % 97)};
+            const RecordFrame frame{0, static_cast<std::uint32_t>(sizeof(EtwLog::RecordHeader)) + payloadSize, static_cast<std::uint16_t>(100 + r % 8), EtwLog::Level::Information, 0, 0, 0};
+            if (buffer.size() + sizeof(frame) + frame.Size > size) {
+                return buffer;
+            }
+
+            const auto offset{buffer.size()};
+            const EtwLog::RecordHeader header{r, r};
+            buffer.resize(offset + sizeof(frame) + frame.Size, std::byte{'x'});
+            std::memcpy(buffer.data() + offset, &frame, sizeof(frame));
+            std::memcpy(buffer.data() + offset + sizeof(frame), &header, sizeof(header));
+
+            const auto crc{EtwLog::Portable::RecordCrc({buffer.data() + offset, sizeof(frame) + frame.Size})};
+            std::memcpy(buffer.data() + offset, &crc, sizeof(crc));
+        }
+    }
+}
+
+void Benchmark_clock_reads() {
+    static constexpr std::size_t c_iterations{10'000'000};
+
+    const EtwLog::Clock steady{EtwLog::ClockSource::Steady};
+    Measure("Clock::Now (steady)", c_iterations, [&](std::size_t) { g_keepAlive = g_keepAlive + steady.Now(); });
+
+    if (EtwLog::Clock::IsTscInvariant()) {
+        const EtwLog::Clock tsc{EtwLog::ClockSource::Tsc};
+        Measure("Clock::Now (TSC)", c_iterations, [&](std::size_t) { g_keepAlive = g_keepAlive + tsc.Now(); });
+    }
+
+#ifdef __linux__
+    Measure("clock_gettime(CLOCK_MONOTONIC)", c_iterations, [](std::size_t) {
+        timespec time;
+        ::clock_gettime(CLOCK_MONOTONIC, &time);
+        g_keepAlive = g_keepAlive + static_cast<std::uint64_t>(time.tv_nsec);
+    });
+
+    Measure("clock_gettime(CLOCK_REALTIME)", c_iterations, [](std::size_t) {
+        timespec time;
+        ::clock_gettime(CLOCK_REALTIME, &time);
+        g_keepAlive = g_keepAlive + static_cast<std::uint64_t>(time.tv_nsec);
+    });
+#endif
+}
+
+void Benchmark_portable_log_write() {
+    static constexpr std::size_t c_iterations{1'000'000};
+
+    const BenchFolder folder;
+    const std::vector<std::byte> message(16, std::byte{'x'});
+
+    EtwLog::MiniLog log{"Bench logger", folder.Path.string(), 1024, EtwLog::Backend::Portable};
+    Measure("MiniLog write, 16 byte payload (portable)", c_iterations, [&](std::size_t) { log(message); });
+    Measure("ActivityScope, start and stop records", c_iterations, [&](std::size_t) { const EtwLog::ActivityScope scope{log, {300}}; });
+
+    // Repeats are only counted, other records pay for the comparison and the copy kept to compare the next one with.
+    log.SetCoalescing(true);
+    Measure("MiniLog write, coalescing, repeated payload", c_iterations, [&](std::size_t) { log(message); });
+    std::vector<std::byte> changing(message);
+    Measure("MiniLog write, coalescing, changing payload", c_iterations, [&](std::size_t i) {
+        std::memcpy(changing.data(), &i, sizeof(i));
+        log(changing);
+    });
+}
+
+void Benchmark_deferred_formatting() {
+    static constexpr std::size_t c_iterations{1'000'000};
+
+    const BenchFolder folder;
+    EtwLog::MiniLog log{"Bench logger", folder.Path.string(), 1024, EtwLog::Backend::Portable};
+    const std::string_view status{"completed"};
+
+    // Formatting on the logging thread, as callers did before MiniLog::Log.
+    Measure("MiniLog write, std::format on the caller", c_iterations, [&](std::size_t i) {
+        const auto text{std::format("Request {} took {:.3f} ms, status {}", i, static_cast<double>(i) * 0.25, status)};
+        log(std::as_bytes(std::span{text}));
+    });
+    Measure("MiniLog::Log, formatted when read", c_iterations, [&](std::size_t i) {
+        log.Log("Request {} took {:.3f} ms, status {}", i, static_cast<double>(i) * 0.25, status);
+    });
+
+    // Registered before main, so nothing is looked up per record.
+    using namespace EtwLog::Literals;
+    Measure("MiniLog::Log, \"...\"_format", c_iterations, [&](std::size_t i) {
+        log.Log("Request {} took {:.3f} ms, status {}"_format, i, static_cast<double>(i) * 0.25, status);
+    });
+}
+
+void Benchmark_latency_histogram() {
+    static constexpr std::size_t c_iterations{10'000'000};
+
+    const BenchFolder folder;
+    EtwLog::MiniLog log{"Bench logger", folder.Path.string(), 1024, EtwLog::Backend::Portable};
+    auto& latencies{log.Latencies(1)};
+
+    // What a histogram saves: a record per sample, to compute the percentiles from when read.
+    Measure("MiniLog write, one record per latency", c_iterations / 10, [&](std::size_t i) {
+        const std::uint64_t latency{i * 37 % 100'000};
+        log(std::as_bytes(std::span{&latency, 1}));
+    });
+    Measure("LatencyHistogram::RecordValue", c_iterations, [&](std::size_t i) { latencies.RecordValue(i * 37 % 100'000); });
+}
+
+void Benchmark_counter_update() {
+    static constexpr std::size_t c_updatesPerThread{10'000'000};
+
+    const BenchFolder folder;
+    EtwLog::MiniLog log{"Bench logger", folder.Path.string(), 1024, EtwLog::Backend::Portable};
+    auto& counter{log.CounterOf(1)};
+    std::atomic<std::uint64_t> shared{0};
+
+    // 16 striped cells, which threads take round-robin, against one atomic all threads add to, which bounces its cache line between cores.
+    const std::size_t threadCount{std::max<std::size_t>(std::thread::hardware_concurrency(), 2)};
+    const auto run = [&](const char* name, const auto& update) {
+        const auto start{std::chrono::steady_clock::now()};
+        {
+            std::vector<std::jthread> threads;
+            for (std::size_t t = 0; t != threadCount; ++t) {
+                threads.emplace_back([&] {
+                    for (std::size_t i = 0; i != c_updatesPerThread; ++i) {
+                        update();
+                    }
+                });
+            }
+        }
+        const std::chrono::duration<double, std::nano> elapsed{std::chrono::steady_clock::now() - start};
+        std::printf("%-56s %10.2f ns/op\n", std::format("{}, {} threads", name, threadCount).c_str(), elapsed.count() / static_cast<double>(c_updatesPerThread));
+    };
+    run("Counter::Add", [&] { counter.Add(); });
+    run("Shared std::atomic fetch_add", [&] { shared.fetch_add(1, std::memory_order_relaxed); });
+}
+
+void Benchmark_write_profile() {
+    static constexpr std::size_t c_iterations{1'000'000};
+
+    const BenchFolder folder;
+    EtwLog::MiniLog log{"Bench logger", folder.Path.string(), 1024, EtwLog::Backend::Portable};
+    const std::vector<std::byte> message(64, std::byte{'x'});
+
+    // Compare with a build defining ETWLOG_PROFILE_WRITES=1 for the cost of the timers.
+    Measure(EtwLog::c_profileWrites ? "MiniLog write, profiled" : "MiniLog write, profiling compiled out", c_iterations, [&](std::size_t) { log(message); });
+
+    const auto ticksPerSecond{EtwLog::Clock{}.Calibration().TicksPerSecond};
+    for (const auto& stage : log.Profile()) {
+        const auto nanoseconds = [&](double quantile) {
+            return static_cast<double>(stage.Ticks.ValueAtQuantile(quantile)) * 1e9 / ticksPerSecond;
+        };
+        std::printf("%-56s %10.2f ns p50, %.2f ns p99\n", std::format("  {}", stage.Name).c_str(), nanoseconds(0.5), nanoseconds(0.99));
+    }
+}
+
+void Benchmark_spill_burst() {
+    static constexpr std::size_t c_burstRecords{200'000};
+
+    // Small buffers and a burst far larger than they hold: with Block the writer runs at the file's pace,
+    // with Spill it runs at the overflow file's, and closing waits for the spilled records to drain.
+    const std::vector<std::byte> message(128, std::byte{'x'});
+    constexpr std::pair<const char*, EtwLog::BackpressurePolicy> c_policies[]{
+        {"Block", {}},
+        {"Spill", {EtwLog::Backpressure::Spill, {}, 64 * 1024}},
+    };
+
+    for (const auto& [policyName, policy] : c_policies) {
+        const BenchFolder folder;
+        std::chrono::steady_clock::duration burst{};
+        EtwLog::Histogram latencies;
+        std::uint64_t dropped{0};
+        const auto start{std::chrono::steady_clock::now()};
+        {
+            EtwLog::MiniLog log{"Bench logger", folder.Path.string(), 4, EtwLog::Backend::Portable};
+            log.SetBackpressure(policy);
+            for (std::size_t r = 0; r != c_burstRecords; ++r) {
+                const auto write{std::chrono::steady_clock::now()};
+                log(message);
+                latencies.Add(static_cast<std::uint64_t>((std::chrono::steady_clock::now() - write).count()));
+            }
+            burst = std::chrono::steady_clock::now() - start;
+            dropped = log.DroppedRecords();
+        }
+        const std::chrono::duration<double, std::nano> total{std::chrono::steady_clock::now() - start};
+
+        std::printf("%-56s %10.2f ns/op\n", std::format("MiniLog write burst, {}", policyName).c_str(),
+            std::chrono::duration<double, std::nano>{burst}.count() / static_cast<double>(c_burstRecords));
+        std::printf("%-56s %10.2f ns/op, %llu dropped\n", std::format("  and close, {}", policyName).c_str(),
+            total.count() / static_cast<double>(c_burstRecords), static_cast<unsigned long long>(dropped));
+        std::printf("%-56s %10llu ns p99.9, %llu ns max\n", std::format("  write latency, {}", policyName).c_str(),
+            static_cast<unsigned long long>(latencies.ValueAtQuantile(0.999)), static_cast<unsigned long long>(latencies.Max()));
+    }
+}
+
+void Benchmark_backpressure_latency() {
+    static constexpr std::size_t c_threads{4};
+    static constexpr std::size_t c_recordsPerThread{20'000};
+
+    // Buffers of 1 KB fill in a few records, so writers outpace the flush thread. Only Block waits for it: the others
+    // wait for a lane's lock at most, which is never held for a whole buffer, and BlockWithTimeout for its timeout on top.
+    const std::vector<std::byte> message(200, std::byte{'x'});
+    const std::pair<const char*, EtwLog::BackpressurePolicy> c_policies[]{
+        {"Block", {}},
+        {"DropNewest", {EtwLog::Backpressure::DropNewest}},
+        {"DropOldest", {EtwLog::Backpressure::DropOldest}},
+        {"BlockWithTimeout", {EtwLog::Backpressure::BlockWithTimeout, std::chrono::microseconds{200}}},
+        {"Spill", {EtwLog::Backpressure::Spill, {}, 64 * 1024}},
+    };
+
+    for (const auto& [policyName, policy] : c_policies) {
+        const BenchFolder folder;
+        EtwLog::Histogram latencies;
+        std::uint64_t dropped{0};
+        {
+            EtwLog::MiniLog log{"Bench logger", folder.Path.string(), 1, EtwLog::Backend::Portable};
+            log.SetBackpressure(policy);
+
+            std::mutex mutex;
+            {
+                std::vector<std::jthread> threads;
+                for (std::size_t t = 0; t != c_threads; ++t) {
+                    threads.emplace_back([&] {
+                        EtwLog::Histogram threadLatencies;
+                        for (std::size_t r = 0; r != c_recordsPerThread; ++r) {
+                            const auto start{std::chrono::steady_clock::now()};
+                            log(message);
+                            threadLatencies.Add(static_cast<std::uint64_t>((std::chrono::steady_clock::now() - start).count()));
+                        }
+                        std::lock_guard lock{mutex};
+                        latencies.Merge(threadLatencies);
+                    });
+                }
+            }
+            dropped = log.DroppedRecords();
+        }
+
+        std::printf("%-56s %10llu ns p50, %llu ns p99.9, %llu ns max, %llu dropped\n",
+            std::format("MiniLog write latency, {} threads, {}", c_threads, policyName).c_str(),
+            static_cast<unsigned long long>(latencies.ValueAtQuantile(0.5)), static_cast<unsigned long long>(latencies.ValueAtQuantile(0.999)),
+            static_cast<unsigned long long>(latencies.Max()), static_cast<unsigned long long>(dropped));
+    }
+}
+
+void Benchmark_sink_fan_out() {
+    static constexpr std::size_t c_iterations{1'000'000};
+
+    // Each ring costs a copy of the encoded record under its lock, and a filter check.
+    const std::vector<std::byte> message(16, std::byte{'x'});
+    for (std::size_t rings = 0; rings != 4; ++rings) {
+        const BenchFolder folder;
+        EtwLog::MiniLog log{"Bench logger", folder.Path.string(), 1024, EtwLog::Backend::Portable};
+        for (std::size_t ring = 0; ring != rings; ++ring) {
+            log.AddMemoryRing(1024);
+        }
+        Measure(std::format("MiniLog write, file and {} memory rings", rings).c_str(), c_iterations, [&](std::size_t) { log(message); });
+    }
+
+    // A ring left out by its filter costs only the check.
+    const BenchFolder folder;
+    EtwLog::MiniLog log{"Bench logger", folder.Path.string(), 1024, EtwLog::Backend::Portable};
+    const auto ring{log.AddMemoryRing(1024)};
+    log.SetSinkFilter(ring, EtwLog::Level::Warning);
+    Measure("MiniLog write, file and a filtered out memory ring", c_iterations, [&](std::size_t) { log(message); });
+}
+
+void Benchmark_buffer_placement() {
+    static constexpr std::size_t c_recordsPerThread{1'000'000};
+    // Large buffers, where TLB reach matters.
+    static constexpr std::size_t c_bufferSize{4096};
+
+    const std::size_t threadCount{std::max<std::size_t>(std::thread::hardware_concurrency(), 2)};
+    const std::vector<std::byte> message(128, std::byte{'x'});
+
+    constexpr std::pair<const char*, EtwLog::BufferPlacement> c_placements[]{
+        {"default", {}},
+        {"NUMA", {.NumaLocal = true}},
+        {"huge pages", {.HugePages = true}},
+        {"NUMA, huge pages", {.NumaLocal = true, .HugePages = true}},
+    };
+
+    for (const auto& [placementName, placement] : c_placements) {
+        const BenchFolder folder;
+#ifdef __linux__
+        const PerfCounters counters;
+#endif
+        const auto start{std::chrono::steady_clock::now()};
+        {
+            EtwLog::MiniLog log{"Bench logger", folder.Path.string(), c_bufferSize, EtwLog::Backend::Portable, placement};
+            std::vector<std::jthread> writers;
+            for (std::size_t t = 0; t != threadCount; ++t) {
+                writers.emplace_back([&] {
+                    for (std::size_t r = 0; r != c_recordsPerThread; ++r) {
+                        log(message);
+                    }
+                });
+            }
+        }
+        const std::chrono::duration<double, std::nano> elapsed{std::chrono::steady_clock::now() - start};
+
+        const auto records{threadCount * c_recordsPerThread};
+        const auto name{std::string{"MiniLog write, "} + std::to_string(threadCount) + " threads, " + placementName};
+        std::printf("%-56s %10.2f ns/op\n", name.c_str(), elapsed.count() / static_cast<double>(records));
+#ifdef __linux__
+        counters.Print(name, records);
+#endif
+    }
+    std::printf("%-56s %10zu\n", "NUMA nodes", EtwLog::Detail::NumaNodeCount());
+}
+
+void Benchmark_file_writing() {
+    static constexpr std::uint64_t c_bytes{1024 * 1024 * 1024};
+
+    const std::vector<std::byte> message(256, std::byte{'x'});
+    const auto recordSize{sizeof(EtwLog::Portable::RecordFrame) + sizeof(EtwLog::RecordHeader) + message.size()};
+
+    constexpr std::pair<const char*, EtwLog::FileWriting> c_writings[]{
+        {"pwrite", {}},
+        {"io_uring", {.IoUring = true}},
+        {"pwrite, O_DIRECT", {.DirectIo = true}},
+        {"io_uring, O_DIRECT", {.IoUring = true, .DirectIo = true}},
+    };
+
+    for (const auto& [writingName, writing] : c_writings) {
+        const BenchFolder folder;
+        // Until everything is in the file, as that is what the flush thread keeps up with.
+        const auto start{std::chrono::steady_clock::now()};
+        {
+            EtwLog::MiniLog log{"Bench logger", folder.Path.string(), 1024, EtwLog::Backend::Portable, {}, writing};
+            for (std::uint64_t r = 0; r != c_bytes / recordSize; ++r) {
+                log(message);
+            }
+        }
+        const auto name{std::string{"MiniLog write 1GB and close, "} + writingName};
+        PrintThroughput(name.c_str(), c_bytes, std::chrono::steady_clock::now() - start);
+    }
+}
+
+void Benchmark_sampling_decision() {
+    static constexpr std::size_t c_iterations{10'000'000};
+
+    const BenchFolder folder;
+    EtwLog::MiniLog log{"Bench logger", folder.Path.string(), 1024, EtwLog::Backend::Portable};
+    const EtwLog::EventDescriptor sampled{100};
+    const EtwLog::EventDescriptor other{101};
+
+    Measure("MiniLog::IsEnabled", c_iterations, [&](std::size_t) { g_keepAlive = g_keepAlive + log.IsEnabled(sampled); });
+    Measure("MiniLog::Admit, no policy", c_iterations, [&](std::size_t) { g_keepAlive = g_keepAlive + log.Admit(sampled); });
+
+    log.SetSampling(sampled.Id, {.OneIn = 10});
+    Measure("MiniLog::Admit, 1 in 10 for the event id", c_iterations, [&](std::size_t) { g_keepAlive = g_keepAlive + log.Admit(sampled); });
+    Measure("MiniLog::Admit, other event id than the policy's", c_iterations, [&](std::size_t) { g_keepAlive = g_keepAlive + log.Admit(other); });
+
+    log.SetSampling(sampled.Id, {.Probability = 0.1});
+    Measure("MiniLog::Admit, probability 0.1", c_iterations, [&](std::size_t) { g_keepAlive = g_keepAlive + log.Admit(sampled); });
+
+    log.SetSampling(sampled.Id, {.RatePerSecond = 1000, .Burst = 100});
+    Measure("MiniLog::Admit, 1000 records per second", c_iterations, [&](std::size_t) { g_keepAlive = g_keepAlive + log.Admit(sampled); });
+}
+
+void Benchmark_logger_startup() {
+    static constexpr std::size_t c_loggerCount{20};
+
+    for (const auto backend : c_backends) {
+        const BenchFolder folder;
+
+        // Constructing on the spot, including the first use of the output folder.
+        std::chrono::steady_clock::duration cold{};
+        for (std::size_t l = 0; l != c_loggerCount; ++l) {
+            const auto suffix{std::to_string(l)};
+            const auto start{std::chrono::steady_clock::now()};
+            EtwLog::MiniLog log{("Bench logger " + suffix).c_str(), (folder.Path / "cold" / suffix).string(), 64, backend};
+            cold += std::chrono::steady_clock::now() - start;
+        }
+        PrintDuration(std::string{"MiniLog construction ("} + BackendName(backend) + ")", cold, c_loggerCount);
+
+        // Taking a logger the pool prepared ahead of time.
+        std::chrono::steady_clock::duration warm{};
+        EtwLog::MiniLogPool pool{"Bench pool", folder.Path / "warm", 64, 1, backend};
+        for (std::size_t l = 0; l != c_loggerCount; ++l) {
+            while (pool.Ready() == 0) {
+                std::this_thread::yield();
+            }
+
+            const auto start{std::chrono::steady_clock::now()};
+            auto log{pool.Take()};
+            warm += std::chrono::steady_clock::now() - start;
+        }
+        PrintDuration(std::string{"MiniLogPool::Take ("} + BackendName(backend) + ")", warm, c_loggerCount);
+    }
+}
+
+void Benchmark_logger_shutdown() {
+    static constexpr std::size_t c_recordCount{100'000};
+
+    for (const auto backend : c_backends) {
+        const BenchFolder folder;
+        const std::vector<std::byte> message(64, std::byte{'x'});
+
+        const auto makeLog{[&](const char* name) {
+            EtwLog::MiniLog log{name, (folder.Path / name).string(), 1024, backend};
+            for (std::size_t r = 0; r != c_recordCount; ++r) {
+                log(message);
+            }
+            return log;
+        }};
+
+        std::optional<EtwLog::MiniLog> destroyed{makeLog("destroyed")};
+        const auto destroyStart{std::chrono::steady_clock::now()};
+        destroyed.reset();
+        PrintDuration(std::string{"~MiniLog after 100k records ("} + BackendName(backend) + ")", std::chrono::steady_clock::now() - destroyStart, 1);
+
+        auto log{makeLog("closed")};
+        const auto start{std::chrono::steady_clock::now()};
+        const auto closed{log.CloseAsync()};
+        const auto handedOver{std::chrono::steady_clock::now() - start};
+        closed.wait();
+        const auto durable{std::chrono::steady_clock::now() - start};
+
+        PrintDuration(std::string{"MiniLog::CloseAsync returns ("} + BackendName(backend) + ")", handedOver, 1);
+        PrintDuration(std::string{"MiniLog::CloseAsync durable ("} + BackendName(backend) + ")", durable, 1);
+    }
+}
+
+void Benchmark_record_checksum() {
+    static constexpr std::size_t c_iterations{1'000'000};
+
+    // What RecordCrc covers of the write benchmark's records: the frame past its checksum, the header and a 16 byte payload.
+    constexpr std::size_t c_recordSize{sizeof(EtwLog::Portable::RecordFrame) - sizeof(std::uint32_t) + sizeof(EtwLog::RecordHeader) + 16};
+    const std::vector<std::byte> record(c_recordSize, std::byte{'x'});
+    Measure(std::format("Crc32c, {} byte record", c_recordSize).c_str(), c_iterations, [&](std::size_t i) { g_keepAlive = g_keepAlive + EtwLog::Crc32c(record, static_cast<std::uint32_t>(i)); });
+    Measure(std::format("Crc32cPortable, {} byte record", c_recordSize).c_str(), c_iterations, [&](std::size_t i) { g_keepAlive = g_keepAlive + EtwLog::Crc32cPortable(record, static_cast<std::uint32_t>(i)); });
+
+    const std::vector<std::byte> buffer(64 * 1024, std::byte{'x'});
+    Measure("Crc32c, 64KB buffer", c_iterations / 100, [&](std::size_t i) { g_keepAlive = g_keepAlive + EtwLog::Crc32c(buffer, static_cast<std::uint32_t>(i)); });
+    Measure("Crc32cPortable, 64KB buffer", c_iterations / 100, [&](std::size_t i) { g_keepAlive = g_keepAlive + EtwLog::Crc32cPortable(buffer, static_cast<std::uint32_t>(i)); });
+}
+
+void Benchmark_record_scan() {
+    static constexpr std::size_t c_repeats{10};
+
+    // Larger than the caches, like a log read from disk.
+    const auto buffer{MakePortableRecords(64 * 1024 * 1024)};
+    std::vector<std::uint32_t> offsets;
+    offsets.reserve(buffer.size() / 40);
+
+    auto start{std::chrono::steady_clock::now()};
+    for (std::size_t r = 0; r != c_repeats; ++r) {
+        offsets.clear();
+        g_keepAlive = g_keepAlive + EtwLog::Portable::ScanRecords(buffer, offsets).ValidBytes;
+    }
+    PrintThroughput("ScanRecords, record boundaries", buffer.size() * c_repeats, std::chrono::steady_clock::now() - start);
+
+    const auto measureSelect{[&](const char* name, auto select, const EtwLog::Portable::FrameFilter& filter) {
+        std::vector<std::uint32_t> selected;
+        std::chrono::steady_clock::duration elapsed{};
+        for (std::size_t r = 0; r != c_repeats; ++r) {
+            selected = offsets;
+            const auto selectStart{std::chrono::steady_clock::now()};
+            g_keepAlive = g_keepAlive + select(std::span<const std::byte>{buffer}, std::span<std::uint32_t>{selected}, filter);
+            elapsed += std::chrono::steady_clock::now() - selectStart;
+        }
+        PrintThroughput(name, buffer.size() * c_repeats, elapsed);
+    }};
+    EtwLog::Portable::FrameFilter oneEventId;
+    oneEventId.EventId = 103;
+    measureSelect("SelectRecords, 1 of 8 event ids (scalar)", EtwLog::Portable::SelectRecordsPortable, oneEventId);
+    if (EtwLog::Portable::IsRecordScanAccelerated()) {
+        measureSelect("SelectRecords, 1 of 8 event ids (AVX2)", EtwLog::Portable::SelectRecords, oneEventId);
+    }
+
+    // The whole reader, from the file to the callback, without and with a filter selecting 1% of the records.
+    const BenchFolder folder;
+    std::filesystem::path logFile;
+    {
+        EtwLog::MiniLog log{"Bench logger", folder.Path.string(), 1024, EtwLog::Backend::Portable};
+        logFile = log.LogFile();
+        const std::vector<std::byte> message(64, std::byte{'x'});
+        for (std::size_t r = 0; r != 1'000'000; ++r) {
+            log({static_cast<std::uint16_t>(100 + r % 100)}, message);
+        }
+    }
+
+    const auto measureRead{[&](const char* name, const EtwLog::RecordFilter& filter) {
+        const auto readStart{std::chrono::steady_clock::now()};
+        const auto result{EtwLog::ReadLog(logFile, filter, [](const EtwLog::RecordView& record) { g_keepAlive = g_keepAlive + record.Payload.size(); })};
+        PrintThroughput(name, result.ValidBytes, std::chrono::steady_clock::now() - readStart);
+    }};
+    measureRead("ReadLog, 1M records of 64 bytes (portable)", {});
+
+    EtwLog::RecordFilter onePercent;
+    onePercent.EventId = 150;
+    measureRead("ReadLog, 1M records, filter selecting 1% (portable)", onePercent);
+
+    // Keeping the records: one vector per payload, against a batch reused from read to read.
+    auto readStart{std::chrono::steady_clock::now()};
+    std::vector<std::vector<std::byte>> payloads;
+    const auto result{EtwLog::ReadLog(logFile, [&payloads](const EtwLog::RecordView& record) { payloads.emplace_back(record.Payload.begin(), record.Payload.end()); })};
+    PrintThroughput("ReadLog into a vector per payload, 1M records", result.ValidBytes, std::chrono::steady_clock::now() - readStart);
+
+    // The first read grows the batch, the measured ones reuse its memory.
+    EtwLog::RecordBatch batch;
+    EtwLog::ReadLog(logFile, {}, batch);
+    readStart = std::chrono::steady_clock::now();
+    for (std::size_t r = 0; r != c_repeats; ++r) {
+        batch.Clear();
+        EtwLog::ReadLog(logFile, {}, batch);
+    }
+    PrintThroughput("ReadLog into a reused RecordBatch, 1M records", result.ValidBytes * c_repeats, std::chrono::steady_clock::now() - readStart);
+    g_keepAlive = g_keepAlive + payloads.size() + batch.Size();
+}
+
+void Benchmark_columnar_export() {
+    // Several segments of a large log, so the export streams rather than fits in the page cache's favor.
+    static constexpr std::uint64_t c_inputBytes{2ull * 1024 * 1024 * 1024};
+
+    const BenchFolder folder;
+    std::filesystem::path logFile;
+    {
+        EtwLog::MiniLog log{"Bench logger", folder.Path.string(), 1024, EtwLog::Backend::Portable};
+        logFile = log.LogFile();
+        std::vector<std::byte> message(64, std::byte{'x'});
+        const auto recordSize{sizeof(EtwLog::Portable::RecordFrame) + sizeof(EtwLog::RecordHeader) + message.size()};
+        for (std::uint64_t r = 0; r != c_inputBytes / recordSize; ++r) {
+            std::memcpy(message.data(), &r, sizeof(r));
+            log({static_cast<std::uint16_t>(100 + r / 1000 % 8)}, message);
+        }
+    }
+
+    std::uint64_t inputBytes{0};
+    for (std::size_t index = 0; std::filesystem::exists(EtwLog::Portable::SegmentPath(logFile, index)); ++index) {
+        inputBytes += std::filesystem::file_size(EtwLog::Portable::SegmentPath(logFile, index));
+    }
+
+    const auto columnarFile{folder.Path / "log.columns"};
+    auto start{std::chrono::steady_clock::now()};
+    const auto exported{EtwLog::Columnar::Export(std::span{&logFile, 1}, columnarFile)};
+    PrintThroughput("Columnar::Export, 2GB portable log (input)", inputBytes, std::chrono::steady_clock::now() - start);
+    std::printf("%-56s %10.2f %%\n", "Columnar::Export, output size of input", 100.0 * static_cast<double>(exported.Bytes) / static_cast<double>(inputBytes));
+
+    start = std::chrono::steady_clock::now();
+    EtwLog::Columnar::Import(columnarFile, [](const EtwLog::Columnar::ColumnBatch& batch) { g_keepAlive = g_keepAlive + batch.Size(); });
+    PrintThroughput("Columnar::Import (output)", exported.Bytes, std::chrono::steady_clock::now() - start);
+}
+
+void RunBenchmarks() {
+    Benchmark_clock_reads();
+    Benchmark_portable_log_write();
+    Benchmark_deferred_formatting();
+    Benchmark_latency_histogram();
+    Benchmark_counter_update();
+    Benchmark_write_profile();
+    Benchmark_spill_burst();
+    Benchmark_backpressure_latency();
+    Benchmark_sink_fan_out();
+    Benchmark_buffer_placement();
+    Benchmark_file_writing();
+    Benchmark_sampling_decision();
+    Benchmark_record_checksum();
+    Benchmark_record_scan();
+    Benchmark_columnar_export();
+    Benchmark_logger_startup();
+    Benchmark_logger_shutdown();
+}
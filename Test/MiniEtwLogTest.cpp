@@ -1,87 +1,87 @@
 #include "MiniEtwLog.h"
+#include "Activity.h"
+#include "Clock.h"
+#include "ColumnarExport.h"
+#include "Crc32c.h"
+#include "Histogram.h"
+#include "LogReader.h"
+#include "Metrics.h"
+#include "MiniLogPool.h"
+#include "PortableFormat.h"
+#include "PortableSink.h"
+#include "RecordBatch.h"
+#include "RecordScan.h"
+#include "WriteProfiler.h"
 
+#ifdef _WIN32
+#include <Windows.h>
+#include <evntrace.h>
+#include <evntcons.h>
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
 #include <iostream>
+#include <map>
+#include <memory_resource>
+#include <mutex>
 #include <array>
 #include <filesystem>
+#include <fstream>
 #include <functional>
+#include <iterator>
 #include <random>
+#include <thread>
 #include <format>
 #include <cstdio>
-
-#define INITGUID
-#include <Windows.h>
-#include <evntrace.h>
-#include <evntcons.h>
+#include <cstring>
+#include <cstddef>
+#include <optional>
+#include <stdexcept>
 
 namespace Consumers {
-    struct AutoTraceHandle {
-        AutoTraceHandle(TRACEHANDLE trace) : Trace{trace} {
-            if (Trace == INVALID_PROCESSTRACE_HANDLE) {
-                throw std::invalid_argument{"Trace is invalid"};
-            }
-        }
-
-        ~AutoTraceHandle() { ::CloseTrace(Trace); }
-
-        AutoTraceHandle(const AutoTraceHandle&) = delete;
-        AutoTraceHandle& operator=(const AutoTraceHandle&) = delete;
-
-        TRACEHANDLE Trace;
-    };
-
-    struct EventHandler {
-        EventHandler(std::function<void(const EVENT_RECORD&)> callback) 
-            : 
-            m_callback{std::move(callback)} 
-        {}
-
-        EventHandler(const EventHandler&) = delete;
-        EventHandler& operator=(const EventHandler&) = delete;
-
-        void* Context{this};
-        PEVENT_RECORD_CALLBACK Callback = CallbackImpl;
-
-    private:
-        static void CallbackImpl(EVENT_RECORD* evt) {
-            static_cast<EventHandler*>(evt->UserContext)->m_callback(*evt);
-        }
-
-        std::function<void(const EVENT_RECORD&)> m_callback;
-    };
+    /// @brief Selects the records logged as plain messages, leaving out the ones the logger writes itself, such as its write profile.
+    EtwLog::RecordFilter Messages() {
+        EtwLog::RecordFilter filter;
+        filter.EventId = EtwLog::EventIds::Message;
+        return filter;
+    }
 
-    std::vector<std::vector<std::byte>> ReadRecords(const std::filesystem::path& file) {
-        std::vector<std::vector<std::byte>> results;
-        EVENT_TRACE_LOGFILEA traceFile;
+    EtwLog::RecordBatch ReadRecords(const std::filesystem::path& file) {
+        EtwLog::RecordBatch results;
+        EtwLog::ReadLog(file, Messages(), results);
+        return results;
+    }
 
-        EventHandler handler{[&results](const EVENT_RECORD& evt) {
-            // Skip metadata records with predefined EventTraceGuid guid.
-            if (::IsEqualGUID(evt.EventHeader.ProviderId, EventTraceGuid) == 0) {
-                const std::byte* data{static_cast<const std::byte*>(evt.UserData)};
-                const auto size{evt.UserDataLength};
-                results.emplace_back(data, data + size);
-            }
-        }};
+#ifdef _WIN32
+    void WINAPI CollectDescriptor(EVENT_RECORD* evt) {
+        static_cast<std::vector<EVENT_DESCRIPTOR>*>(evt->UserContext)->push_back(evt->EventHeader.EventDescriptor);
+    }
 
+    /// @brief Event descriptors of every event in the ETW log \a file, as ETW's own tools see them rather than as \a EtwLog::ReadLog does.
+    std::vector<EVENT_DESCRIPTOR> ReadEtwDescriptors(const std::filesystem::path& file) {
+        std::vector<EVENT_DESCRIPTOR> descriptors;
         const auto narrowString{file.string()};
+        EVENT_TRACE_LOGFILEA traceFile;
         ::ZeroMemory(&traceFile, sizeof(traceFile));
         traceFile.LogFileName = const_cast<char*>(narrowString.c_str());
-        traceFile.EventRecordCallback = handler.Callback;
+        traceFile.EventRecordCallback = CollectDescriptor;
         traceFile.ProcessTraceMode = PROCESS_TRACE_MODE_EVENT_RECORD;
-        traceFile.Context = handler.Context;
-
-        FILETIME startTime;
-        ::ZeroMemory(&startTime, sizeof(startTime));
-
-        FILETIME currentTime;
-        SYSTEMTIME st;
-
-        ::GetSystemTime(&st);
-        ::SystemTimeToFileTime(&st, &currentTime);
+        traceFile.Context = &descriptors;
 
-        AutoTraceHandle trace{::OpenTraceA(&traceFile)};
-        EtwLog::VerifyHResult(::ProcessTrace(&trace.Trace, 1, &startTime, &currentTime), "ProcessTrace", ERROR_SUCCESS);
-        return results;
+        auto trace{::OpenTraceA(&traceFile)};
+        if (trace == INVALID_PROCESSTRACE_HANDLE) {
+            throw std::runtime_error{"OpenTrace failed"};
+        }
+        const auto status{::ProcessTrace(&trace, 1, nullptr, nullptr)};
+        ::CloseTrace(trace);
+        if (status != ERROR_SUCCESS) {
+            throw std::runtime_error{std::format("ProcessTrace failed with {}", status)};
+        }
+        return descriptors;
     }
+#endif
 }
 
 namespace {
@@ -109,13 +109,26 @@ namespace {
         std::exit(1);
     }
 
-    void VerifyOneRecordWithText(const char* description, const std::filesystem::path& logFile, const std::string& expectedText) {
+    /// @brief Write profiles, which MiniLog writes every second and when it closes if built with \a EtwLog::c_profileWrites on.
+    /// Tests counting the records they logged leave them out.
+    bool IsWriteProfile(const EtwLog::RecordView& record) noexcept {
+        return record.Event.Id == EtwLog::EventIds::WriteProfile;
+    }
+
+    /// @brief Whether the \a kept records read back and the \a dropped ones account for the \a logged ones.
+    /// A write profile can be dropped as well, so with \a EtwLog::c_profileWrites on, drops may outnumber the records missing.
+    bool AllAccountedFor(std::uint64_t logged, std::uint64_t kept, std::uint64_t dropped) noexcept {
+        return EtwLog::c_profileWrites ? kept <= logged && kept + dropped >= logged : kept + dropped == logged;
+    }
+
+    void VerifyOneRecordWithText(std::string_view description, const std::filesystem::path& logFile, const std::string& expectedText) {
         const auto records{Consumers::ReadRecords(logFile)};
-        if (records.size() != 1) {
-            Error("{}: Found {} records instead of 1 in '{}'\n", description, records.size(), logFile.string());
+        if (records.Size() != 1) {
+            Error("{}: Found {} records instead of 1 in '{}'\n", description, records.Size(), logFile.string());
         }
 
-        const auto oneRecord{std::string{reinterpret_cast<const char*>(records[0].data()), records[0].size()}};
+        const auto payload{records.Payload(0)};
+        const auto oneRecord{std::string{reinterpret_cast<const char*>(payload.data()), payload.size()}};
         if (oneRecord != "Hello World!") {
             Error("{}: Found one record, with unexpected value '{}'\n", description, oneRecord);
         }
@@ -125,7 +138,7 @@ namespace {
     }
 
     template <typename TTest>
-    void RunTest(const char* description, TTest&& test) {
+    void RunTest(std::string_view description, TTest&& test) {
         try {
             test();
         } catch (const std::exception& e) {
@@ -139,28 +152,65 @@ namespace {
         std::memcpy(bytes.data(), fromText.data(), fromText.size());
         return bytes;
     }
+
+#ifdef _WIN32
+    constexpr EtwLog::Backend c_backends[]{EtwLog::Backend::Etw, EtwLog::Backend::Portable};
+#else
+    constexpr EtwLog::Backend c_backends[]{EtwLog::Backend::Portable};
+#endif
+
+    /// @brief Test name with the backend it runs against.
+    std::string Describe(std::string_view test, EtwLog::Backend backend) {
+        return std::format("{} ({})", test, backend == EtwLog::Backend::Etw ? "ETW" : "portable");
+    }
+
+    std::filesystem::path LogFile(const std::filesystem::path& folder, EtwLog::Backend backend) {
+        return folder / EtwLog::LogFileName(backend);
+    }
+
+    /// @brief Memory resource counting the allocations made through it.
+    class CountingMemory final : public std::pmr::memory_resource {
+    public:
+        std::size_t Allocations{0};
+
+    private:
+        void* do_allocate(std::size_t bytes, std::size_t alignment) override {
+            ++Allocations;
+            return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+        }
+
+        void do_deallocate(void* pointer, std::size_t bytes, std::size_t alignment) override {
+            std::pmr::new_delete_resource()->deallocate(pointer, bytes, alignment);
+        }
+
+        bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+            return this == &other;
+        }
+    };
 }
 
-void Construct_logger_and_log_one_record() {
+void Construct_logger_and_log_one_record(EtwLog::Backend backend) {
+    const auto description{Describe("Construct_logger_and_log_one_record", backend)};
     RunTest(
-        "Construct_logger_and_log_one_record", 
-        []{
+        description, 
+        [&]{
             const Fixture fixture;
 
             // Make sure the log dies before reading the messages 
             {
-                EtwLog::MiniLog log{"Mini logger", fixture.TempFolder.string(), 4};
+                EtwLog::MiniLog log{"Mini logger", fixture.TempFolder.string(), 4, backend};
                 log(MakeBytes("Hello World!"));
             }
 
-            VerifyOneRecordWithText("Construct_logger_and_log_one_record", fixture.TempFolder / "log.etl", "Hello, World!");
+            VerifyOneRecordWithText(description, LogFile(fixture.TempFolder, backend), "Hello, World!");
         });
 }
 
-void Construct_many_logggers_to_find_logger_count_limits() {
+void Construct_many_logggers_to_find_logger_count_limits(EtwLog::Backend backend) {
+    const auto description{Describe("Construct_many_logggers_to_find_logger_count_limits", backend)};
     RunTest(
-        "Construct_many_logggers_to_find_logger_count_limits",
-        [] {
+        description,
+        [&] {
             const Fixture fixture;
 
             static constexpr std::size_t c_logCount = 50;
@@ -171,7 +221,7 @@ void Construct_many_logggers_to_find_logger_count_limits() {
                 for (std::size_t l = 0; l != c_logCount; ++l) {
                     const auto suffix{std::to_string(l)};
                     Format("Making logger #{}\n", l);
-                    extraLogs.emplace_back(EtwLog::MiniLog{("Mini logger" + suffix).c_str(), (fixture.TempFolder / suffix).string() , 4});
+                    extraLogs.emplace_back(EtwLog::MiniLog{("Mini logger" + suffix).c_str(), (fixture.TempFolder / suffix).string() , 4, backend});
                 }
 
                 const auto message{MakeBytes("Hello World!")};
@@ -181,12 +231,2010 @@ void Construct_many_logggers_to_find_logger_count_limits() {
             }
 
             for (std::size_t l = 0; l != c_logCount; ++l) {
-                VerifyOneRecordWithText("Construct_many_logggers_to_find_logger_count_limits", fixture.TempFolder / std::to_string(l) / "log.etl", "Hello, World!");
+                VerifyOneRecordWithText(description, LogFile(fixture.TempFolder / std::to_string(l), backend), "Hello, World!");
+            }
+        });
+}
+
+void Log_many_records_and_find_no_sequence_gaps(EtwLog::Backend backend) {
+    const auto description{Describe("Log_many_records_and_find_no_sequence_gaps", backend)};
+    RunTest(
+        description,
+        [&] {
+            const Fixture fixture;
+
+            static constexpr std::size_t c_recordCount = 200;
+            {
+                EtwLog::MiniLog log{"Mini logger", fixture.TempFolder.string(), 64, backend};
+                const auto message{MakeBytes("Hello World!")};
+                for (std::size_t r = 0; r != c_recordCount; ++r) {
+                    log(message);
+                }
+            }
+
+            // Records the logger writes itself, such as its write profile, take sequence numbers too.
+            std::vector<std::uint64_t> sequences;
+            std::size_t messages{0};
+            EtwLog::ReadLog(LogFile(fixture.TempFolder, backend), [&](const EtwLog::RecordView& record) {
+                sequences.push_back(record.Header.Sequence);
+                messages += record.Event.Id == EtwLog::EventIds::Message ? 1 : 0;
+            });
+
+            for (std::size_t r = 0; r != sequences.size(); ++r) {
+                if (sequences[r] != r) {
+                    Error("{}: Record #{} has sequence number {}\n", description, r, sequences[r]);
+                }
+            }
+
+            const auto report{EtwLog::FindSequenceGaps(LogFile(fixture.TempFolder, backend))};
+            if (messages != c_recordCount || report.RecordsSeen != sequences.size() || report.RecordsMissing != 0 || !report.Gaps.empty()) {
+                Error("{}: Saw {} records, {} missing\n", description, report.RecordsSeen, report.RecordsMissing);
+            }
+            Format("{}: {} records in sequence\n", description, sequences.size());
+        });
+}
+
+void Gap_detector_reports_missing_and_reordered_sequence_numbers() {
+    RunTest(
+        "Gap_detector_reports_missing_and_reordered_sequence_numbers",
+        [] {
+            // 2 and 3 arrive out of order, 4 and 5 are lost, 1 is duplicated and 7 never arrives before 8.
+            EtwLog::GapDetector detector{2};
+            for (const std::uint64_t sequence : {0, 1, 3, 2, 1, 6, 8, 9, 10}) {
+                detector.Observe(sequence);
+            }
+
+            const auto report{detector.Report()};
+            if (report.RecordsSeen != 8 || report.RecordsDuplicated != 1 || report.RecordsMissing != 3 || report.Gaps.size() != 2
+                || report.Gaps[0].First != 4 || report.Gaps[0].Count != 2 || report.Gaps[1].First != 7 || report.Gaps[1].Count != 1) {
+                Error("Gap_detector_reports_missing_and_reordered_sequence_numbers: Unexpected report, {} seen, {} missing in {} gaps\n",
+                    report.RecordsSeen, report.RecordsMissing, report.Gaps.size());
+            }
+            else {
+                Format("Gap_detector_reports_missing_and_reordered_sequence_numbers: Found {} missing records, as expected\n", report.RecordsMissing);
+            }
+        });
+}
+
+void Records_are_timestamped_while_logging(EtwLog::Backend backend) {
+    const auto description{Describe("Records_are_timestamped_while_logging", backend)};
+    RunTest(
+        description,
+        [&] {
+            const Fixture fixture;
+
+            const auto before{std::chrono::system_clock::now()};
+            {
+                EtwLog::MiniLog log{"Mini logger", fixture.TempFolder.string(), 4, backend};
+                const auto message{MakeBytes("Hello World!")};
+                for (std::size_t r = 0; r != 10; ++r) {
+                    log(message);
+                }
+            }
+            const auto after{std::chrono::system_clock::now()};
+
+            // Allow for the error of the clock calibration.
+            static constexpr std::chrono::milliseconds c_tolerance{10};
+
+            std::chrono::sys_time<std::chrono::nanoseconds> previous{};
+            EtwLog::ReadLog(LogFile(fixture.TempFolder, backend), [&](const EtwLog::RecordView& record) {
+                if (record.Time < before - c_tolerance || record.Time > after + c_tolerance || record.Time < previous) {
+                    Error("{}: Record #{} has timestamp outside of the logging time\n", description, record.Header.Sequence);
+                }
+                previous = record.Time;
+            });
+
+            Format("{}: All records are timestamped while logging\n", description);
+        });
+}
+
+void Clock_converts_ticks_to_wall_time() {
+    RunTest(
+        "Clock_converts_ticks_to_wall_time",
+        [] {
+            std::vector<EtwLog::ClockSource> sources{EtwLog::ClockSource::Steady};
+            if (EtwLog::Clock::IsTscInvariant()) {
+                sources.push_back(EtwLog::ClockSource::Tsc);
+            }
+
+            for (const auto source : sources) {
+                const EtwLog::Clock clock{source};
+                const auto time{EtwLog::ToSystemTime(clock.Calibration(), clock.Now())};
+                const auto difference{std::chrono::abs(std::chrono::system_clock::now() - time)};
+                // The TSC is only given up for the steady clock when its rate can't be measured.
+                const auto used{clock.Calibration().Source};
+                if ((used != source && used != EtwLog::ClockSource::Steady) || difference > std::chrono::milliseconds{1}) {
+                    Error("Clock_converts_ticks_to_wall_time: Clock source {} is off by {}ns\n",
+                        static_cast<std::uint32_t>(source), std::chrono::duration_cast<std::chrono::nanoseconds>(difference).count());
+                }
+            }
+
+            Format("Clock_converts_ticks_to_wall_time: {} clock sources converted, as expected\n", sources.size());
+        });
+}
+
+void Clock_calibration_keeps_pace_with_the_steady_clock() {
+    RunTest(
+        "Clock_calibration_keeps_pace_with_the_steady_clock",
+        [] {
+            static constexpr std::chrono::milliseconds c_measureFor{100};
+
+            // A 0.1% error in the rate is a second of drift every 17 minutes of logging.
+            static constexpr double c_tolerance{1e-3};
+
+            const EtwLog::Clock clock;
+
+            // Each clock reading paired with the steady clock read around it, keeping the tightest of a few.
+            const auto readPair = [&clock] {
+                std::pair<std::uint64_t, std::chrono::steady_clock::time_point> best;
+                auto bracket{std::chrono::steady_clock::duration::max()};
+                for (int attempt = 0; attempt != 8; ++attempt) {
+                    const auto before{std::chrono::steady_clock::now()};
+                    const auto ticks{clock.Now()};
+                    const auto after{std::chrono::steady_clock::now()};
+                    if (after - before < bracket) {
+                        bracket = after - before;
+                        best = {ticks, before + bracket / 2};
+                    }
+                }
+                return best;
+            };
+
+            const auto start{readPair()};
+            std::this_thread::sleep_for(c_measureFor);
+            const auto end{readPair()};
+
+            const auto& calibration{clock.Calibration()};
+            const std::chrono::duration<double> converted{EtwLog::ToSystemTime(calibration, end.first) - EtwLog::ToSystemTime(calibration, start.first)};
+            const std::chrono::duration<double> steady{end.second - start.second};
+            const auto error{std::abs(converted / steady - 1)};
+            if (error > c_tolerance) {
+                Error("Clock_calibration_keeps_pace_with_the_steady_clock: Clock source {} at {} ticks per second is off by {:.4f}%\n",
+                    static_cast<std::uint32_t>(calibration.Source), calibration.TicksPerSecond, error * 100);
+            }
+
+            Format("Clock_calibration_keeps_pace_with_the_steady_clock: Clock source {} off by {:.4f}% over {} ms\n",
+                static_cast<std::uint32_t>(calibration.Source), error * 100, c_measureFor.count());
+        });
+}
+
+void Pool_hands_out_ready_loggers(EtwLog::Backend backend) {
+    const auto description{Describe("Pool_hands_out_ready_loggers", backend)};
+    RunTest(
+        description,
+        [&] {
+            const Fixture fixture;
+
+            static constexpr std::size_t c_logCount = 3;
+            std::vector<std::filesystem::path> logFiles;
+            {
+                EtwLog::MiniLogPool pool{"Mini logger", fixture.TempFolder, 4, 2, backend};
+                for (std::size_t attempt = 0; pool.Ready() != 2; ++attempt) {
+                    if (attempt == 1000) {
+                        Error("{}: Pool did not prepare its spare loggers\n", description);
+                    }
+                    std::this_thread::sleep_for(std::chrono::milliseconds{10});
+                }
+
+                // The third logger is constructed by Take itself, unless the pool was quick enough to replace a spare.
+                const auto message{MakeBytes("Hello World!")};
+                for (std::size_t l = 0; l != c_logCount; ++l) {
+                    auto log{pool.Take()};
+                    log(message);
+                    logFiles.push_back(log.LogFile());
+                }
+            }
+
+            for (const auto& logFile : logFiles) {
+                VerifyOneRecordWithText(description, logFile, "Hello, World!");
+            }
+        });
+}
+
+void Close_logger_in_background_and_wait_for_the_file(EtwLog::Backend backend) {
+    const auto description{Describe("Close_logger_in_background_and_wait_for_the_file", backend)};
+    RunTest(
+        description,
+        [&] {
+            const Fixture fixture;
+
+            static constexpr std::size_t c_recordCount = 100;
+            EtwLog::MiniLog log{"Mini logger", fixture.TempFolder.string(), 4, backend};
+            const auto logFile{log.LogFile()};
+
+            const auto message{MakeBytes("Hello World!")};
+            for (std::size_t r = 0; r != c_recordCount; ++r) {
+                log(message);
+            }
+
+            const auto closed{log.CloseAsync()};
+            closed.wait();
+
+            const auto records{Consumers::ReadRecords(logFile)};
+            if (records.Size() != c_recordCount) {
+                Error("{}: Found {} records instead of {}\n", description, records.Size(), c_recordCount);
+            }
+
+            Format("{}: Found all {} records after the close completed\n", description, records.Size());
+        });
+}
+
+void Portable_sink_rotates_preallocated_segments() {
+    RunTest(
+        "Portable_sink_rotates_preallocated_segments",
+        [] {
+            const Fixture fixture;
+            std::filesystem::create_directories(fixture.TempFolder);
+            const auto logFile{LogFile(fixture.TempFolder, EtwLog::Backend::Portable)};
+
+            static constexpr std::size_t c_recordCount = 1000;
+            {
+                const EtwLog::Clock clock;
+                EtwLog::Detail::PortableSink sink{logFile, 4, clock.Calibration(), {}, 64 * 1024};
+
+                const std::vector<std::byte> payload(200, std::byte{'x'});
+                for (std::uint64_t r = 0; r != c_recordCount; ++r) {
+                    sink.Write({}, {r, clock.Now()}, payload);
+                }
+            }
+
+            std::size_t segmentCount{0};
+            while (std::filesystem::exists(EtwLog::Portable::SegmentPath(logFile, segmentCount))) {
+                ++segmentCount;
+            }
+
+            // About 220KB of records into 64KB segments.
+            if (segmentCount != 4) {
+                Error("Portable_sink_rotates_preallocated_segments: Found {} segments instead of 4\n", segmentCount);
+            }
+
+            const auto report{EtwLog::FindSequenceGaps(logFile)};
+            if (report.RecordsSeen != c_recordCount || report.RecordsMissing != 0) {
+                Error("Portable_sink_rotates_preallocated_segments: Read {} records back, {} missing\n", report.RecordsSeen, report.RecordsMissing);
+            }
+
+            Format("Portable_sink_rotates_preallocated_segments: Read {} records from {} segments, as expected\n", report.RecordsSeen, segmentCount);
+        });
+}
+
+void Portable_sink_writes_with_io_uring_and_direct_io() {
+    RunTest(
+        "Portable_sink_writes_with_io_uring_and_direct_io",
+        [] {
+            static constexpr std::size_t c_recordCount = 1000;
+            constexpr EtwLog::FileWriting c_writings[]{{}, {.IoUring = true}, {.DirectIo = true}, {.IoUring = true, .DirectIo = true}};
+
+            for (const auto& writing : c_writings) {
+                const Fixture fixture;
+                std::filesystem::create_directories(fixture.TempFolder);
+                const auto logFile{LogFile(fixture.TempFolder, EtwLog::Backend::Portable)};
+                const auto description{std::format("Portable_sink_writes_with_io_uring_and_direct_io (io_uring {}, direct {})", writing.IoUring, writing.DirectIo)};
+
+                {
+                    const EtwLog::Clock clock;
+                    EtwLog::Detail::PortableSink sink{logFile, 4, clock.Calibration(), {}, 64 * 1024, {}, writing};
+
+                    // Sizes that leave every possible gap before the end of a block.
+                    for (std::uint64_t r = 0; r != c_recordCount; ++r) {
+                        const std::vector<std::byte> payload(100 + r % 61, static_cast<std::byte>(r));
+                        sink.Write({}, {r, clock.Now()}, payload);
+                    }
+                }
+
+                std::size_t segmentCount{0};
+                for (; std::filesystem::exists(EtwLog::Portable::SegmentPath(logFile, segmentCount)); ++segmentCount) {
+                    const auto size{std::filesystem::file_size(EtwLog::Portable::SegmentPath(logFile, segmentCount))};
+                    if (writing.DirectIo && size % 4096 != 0) {
+                        Error("{}: Segment {} has {} bytes, not whole blocks\n", description, segmentCount, size);
+                    }
+                }
+
+                std::uint64_t badPayloads{0};
+                const auto result{EtwLog::ReadLog(logFile, [&badPayloads](const EtwLog::RecordView& record) {
+                    const auto r{record.Header.Sequence};
+                    badPayloads += record.Payload.size() != 100 + r % 61 || record.Payload[0] != static_cast<std::byte>(r) ? 1 : 0;
+                })};
+                const auto report{EtwLog::FindSequenceGaps(logFile)};
+                if (result.Records != c_recordCount || result.DiscardedBytes != 0 || badPayloads != 0 || report.RecordsMissing != 0 || segmentCount < 2) {
+                    Error("{}: Read {} records from {} segments, {} bad, {} missing\n", description, result.Records, segmentCount, badPayloads, report.RecordsMissing);
+                }
+                Format("{}: {} records in {} segments\n", description, result.Records, segmentCount);
+            }
+        });
+}
+
+void Numa_local_buffers_in_huge_pages_keep_every_record() {
+    RunTest(
+        "Numa_local_buffers_in_huge_pages_keep_every_record",
+        [&] {
+            const Fixture fixture;
+
+            static constexpr std::size_t c_threadCount = 4;
+            static constexpr std::size_t c_recordsPerThread = 20000;
+
+            std::filesystem::path logFile;
+            {
+                EtwLog::MiniLog log{"Mini logger", fixture.TempFolder.string(), 64, EtwLog::Backend::Portable, {.NumaLocal = true, .HugePages = true}};
+                logFile = log.LogFile();
+
+                std::vector<std::jthread> writers;
+                for (std::size_t t = 0; t != c_threadCount; ++t) {
+                    writers.emplace_back([&log, t] {
+                        for (std::size_t r = 0; r != c_recordsPerThread; ++r) {
+                            log(MakeBytes(std::format("Thread {} record {}", t, r)));
+                        }
+                    });
+                }
+            }
+
+            // Buffers of different nodes reach the file in the order they fill, a whole log is enough of a window for that.
+            EtwLog::GapDetector detector{c_threadCount * c_recordsPerThread};
+            std::size_t messages{0};
+            EtwLog::ReadLog(logFile, [&](const EtwLog::RecordView& record) {
+                detector.Observe(record.Header.Sequence);
+                messages += IsWriteProfile(record) ? 0 : 1;
+            });
+            const auto report{detector.Report()};
+            if (messages != c_threadCount * c_recordsPerThread || report.RecordsMissing != 0 || report.RecordsDuplicated != 0) {
+                Error("Numa_local_buffers_in_huge_pages_keep_every_record: Read {} records, {} missing\n", messages, report.RecordsMissing);
+            }
+            Format("Numa_local_buffers_in_huge_pages_keep_every_record: {} records from {} threads\n", messages, c_threadCount);
+        });
+}
+
+void Crc32c_matches_known_values() {
+    RunTest(
+        "Crc32c_matches_known_values",
+        [] {
+            const auto bytes{MakeBytes("123456789")};
+            const std::span<const std::byte> data{bytes};
+            static constexpr std::uint32_t c_expected{0xE3069283};
+
+            const auto pieces{EtwLog::Crc32c(data.subspan(4), EtwLog::Crc32c(data.first(4)))};
+            if (EtwLog::Crc32c(data) != c_expected || EtwLog::Crc32cPortable(data) != c_expected || pieces != c_expected) {
+                Error("Crc32c_matches_known_values: CRC32C of '123456789' is {:x} (table {:x}, in pieces {:x})\n",
+                    EtwLog::Crc32c(data), EtwLog::Crc32cPortable(data), pieces);
+            }
+
+            Format("Crc32c_matches_known_values: Matches, accelerated: {}\n", EtwLog::IsCrc32cAccelerated());
+        });
+}
+
+void Torn_portable_log_is_read_up_to_the_last_valid_record() {
+    RunTest(
+        "Torn_portable_log_is_read_up_to_the_last_valid_record",
+        [] {
+            const Fixture fixture;
+
+            static constexpr std::size_t c_recordCount = 10;
+            std::filesystem::path logFile;
+            {
+                EtwLog::MiniLog log{"Mini logger", fixture.TempFolder.string(), 4, EtwLog::Backend::Portable};
+                logFile = log.LogFile();
+                const auto message{MakeBytes("Hello World!")};
+                for (std::size_t r = 0; r != c_recordCount; ++r) {
+                    log(message);
+                }
+            }
+
+            // Frame, header and payload: "Hello World!", or a write profile written on closing.
+            std::uint64_t lastPayloadSize{0};
+            const auto complete{EtwLog::ReadLog(logFile, [&lastPayloadSize](const EtwLog::RecordView& record) { lastPayloadSize = record.Payload.size(); })};
+            const auto lastRecordSize{sizeof(EtwLog::Portable::RecordFrame) + sizeof(EtwLog::RecordHeader) + lastPayloadSize};
+            const auto completeSize{std::filesystem::file_size(logFile)};
+
+            const auto verify{[&](const char* damage, std::uint64_t expectedDiscarded) {
+                const auto result{EtwLog::ReadLog(logFile, [](const EtwLog::RecordView&) {})};
+                if (result.Records != complete.Records - 1 || result.DiscardedBytes != expectedDiscarded || result.ValidBytes != completeSize - lastRecordSize) {
+                    Error("Torn_portable_log_is_read_up_to_the_last_valid_record: With {}, read {} records, {} valid and {} discarded bytes\n",
+                        damage, result.Records, result.ValidBytes, result.DiscardedBytes);
+                }
+                Format("Torn_portable_log_is_read_up_to_the_last_valid_record: With {}, recovered {} records as expected\n", damage, result.Records);
+            }};
+
+            // The last byte of the payload flipped.
+            {
+                std::fstream stream{logFile, std::ios::binary | std::ios::in | std::ios::out};
+                stream.seekg(static_cast<std::streamoff>(completeSize - 1));
+                const auto last{stream.get()};
+                stream.seekp(static_cast<std::streamoff>(completeSize - 1));
+                stream.put(static_cast<char>(~last));
+            }
+            verify("corrupted last record", lastRecordSize);
+
+            // The last record only partially written.
+            std::filesystem::resize_file(logFile, completeSize - 5);
+            verify("truncated last record", lastRecordSize - 5);
+        });
+}
+
+void Portable_logs_of_older_versions_are_read_and_newer_ones_refused() {
+    RunTest(
+        "Portable_logs_of_older_versions_are_read_and_newer_ones_refused",
+        [] {
+            const Fixture fixture;
+
+            static constexpr std::size_t c_recordCount = 10;
+            std::filesystem::path logFile;
+            {
+                EtwLog::MiniLog log{"Mini logger", fixture.TempFolder.string(), 4, EtwLog::Backend::Portable};
+                logFile = log.LogFile();
+                for (std::size_t r = 0; r != c_recordCount; ++r) {
+                    log(MakeBytes("Hello World!"));
+                }
             }
+
+            const auto readAs = [&logFile](std::uint32_t version) -> std::optional<std::uint64_t> {
+                {
+                    std::fstream stream{logFile, std::ios::binary | std::ios::in | std::ios::out};
+                    stream.seekp(offsetof(EtwLog::Portable::FileHeader, Version));
+                    stream.write(reinterpret_cast<const char*>(&version), sizeof(version));
+                }
+                try {
+                    std::uint64_t messages{0};
+                    EtwLog::ReadLog(logFile, Consumers::Messages(), [&messages](const EtwLog::RecordView&) { ++messages; });
+                    return messages;
+                } catch (const std::runtime_error&) {
+                    return std::nullopt;
+                }
+            };
+
+            // Records of the oldest version still read have none of the flags added since, so they read the same.
+            for (auto version = EtwLog::Portable::c_minVersion; version <= EtwLog::Portable::c_version; ++version) {
+                if (readAs(version) != c_recordCount) {
+                    Error("Portable_logs_of_older_versions_are_read_and_newer_ones_refused: Version {} not read\n", version);
+                }
+            }
+            if (readAs(EtwLog::Portable::c_minVersion - 1) || readAs(EtwLog::Portable::c_version + 1)) {
+                Error("Portable_logs_of_older_versions_are_read_and_newer_ones_refused: Read a log of a version it doesn't know\n");
+            }
+
+            Format("Portable_logs_of_older_versions_are_read_and_newer_ones_refused: Read versions {} to {}, as expected\n",
+                EtwLog::Portable::c_minVersion, EtwLog::Portable::c_version);
+        });
+}
+
+void Records_keep_their_event_descriptor(EtwLog::Backend backend) {
+    const auto description{Describe("Records_keep_their_event_descriptor", backend)};
+    RunTest(
+        description,
+        [&] {
+            const Fixture fixture;
+
+            const EtwLog::EventDescriptor events[]{
+                {},
+                {100, EtwLog::Level::Error, 0x1},
+                {101, EtwLog::Level::Verbose, 0x8000'0000'0000'0000},
+            };
+
+            std::filesystem::path logFile;
+            {
+                EtwLog::MiniLog log{"Mini logger", fixture.TempFolder.string(), 4, backend};
+                logFile = log.LogFile();
+                const auto message{MakeBytes("Hello World!")};
+                for (const auto& event : events) {
+                    log(event, message);
+                }
+            }
+
+            std::size_t index{0};
+            EtwLog::ReadLog(logFile, [&](const EtwLog::RecordView& record) {
+                if (IsWriteProfile(record)) {
+                    return;
+                }
+                const auto& expected{events[index++ % std::size(events)]};
+                if (record.Event.Id != expected.Id || record.Event.Level != expected.Level || record.Event.Keyword != expected.Keyword) {
+                    Error("{}: Record #{} has event id {}, level {}, keyword {:x}\n",
+                        description, record.Header.Sequence, record.Event.Id, static_cast<int>(record.Event.Level), record.Event.Keyword);
+                }
+            });
+
+            if (index != std::size(events)) {
+                Error("{}: Found {} records instead of {}\n", description, index, std::size(events));
+            }
+
+            Format("{}: All {} records have the event they were logged with\n", description, index);
         });
 }
 
-int main() {
-    Construct_logger_and_log_one_record();
-    Construct_many_logggers_to_find_logger_count_limits();
+void Record_scan_selects_like_the_scalar_path() {
+    RunTest(
+        "Record_scan_selects_like_the_scalar_path",
+        [] {
+            const Fixture fixture;
+
+            // Not a multiple of 8, so the vector path has a tail to finish one by one.
+            static constexpr std::size_t c_recordCount = 1003;
+            std::filesystem::path logFile;
+            std::uint64_t middleTicks{0};
+            {
+                const EtwLog::Clock clock;
+                EtwLog::MiniLog log{"Mini logger", fixture.TempFolder.string(), 64, EtwLog::Backend::Portable};
+                logFile = log.LogFile();
+                for (std::size_t r = 0; r != c_recordCount; ++r) {
+                    const std::vector<std::byte> payload(r % 50, std::byte{'x'});
+                    const EtwLog::EventDescriptor event{static_cast<std::uint16_t>(100 + r % 3), static_cast<EtwLog::Level>(1 + r % 5), 1ull << (r % 64)};
+                    log(event, payload);
+                    if (r == c_recordCount / 2) {
+                        middleTicks = clock.Now();
+                    }
+                }
+            }
+
+            std::vector<std::byte> buffer(std::filesystem::file_size(logFile) - sizeof(EtwLog::Portable::FileHeader));
+            std::ifstream stream{logFile, std::ios::binary};
+            stream.seekg(sizeof(EtwLog::Portable::FileHeader));
+            stream.read(reinterpret_cast<char*>(buffer.data()), static_cast<std::streamsize>(buffer.size()));
+
+            // Write profiles, if the logger wrote any, are scanned along with the records logged.
+            std::size_t profiles{0};
+            EtwLog::ReadLog(logFile, [&profiles](const EtwLog::RecordView& record) { profiles += IsWriteProfile(record) ? 1 : 0; });
+
+            std::vector<std::uint32_t> offsets;
+            const auto scan{EtwLog::Portable::ScanRecords(buffer, offsets)};
+            if (offsets.size() != c_recordCount + profiles || scan.ValidBytes != buffer.size() || scan.Damaged) {
+                Error("Record_scan_selects_like_the_scalar_path: Scanned {} records and {} of {} bytes\n", offsets.size(), scan.ValidBytes, buffer.size());
+            }
+
+            std::vector<EtwLog::Portable::FrameFilter> filters(5);
+            filters[1].EventId = 101;
+            filters[2].MaxLevel = 2;
+            filters[3].KeywordMask = 0xF0;
+            filters[4].FirstTicks = middleTicks;
+            filters[4].EventId = 102;
+
+            for (std::size_t f = 0; f != filters.size(); ++f) {
+                auto vector{offsets};
+                vector.resize(EtwLog::Portable::SelectRecords(buffer, vector, filters[f]));
+                auto scalar{offsets};
+                scalar.resize(EtwLog::Portable::SelectRecordsPortable(buffer, scalar, filters[f]));
+
+                if (vector != scalar || (f == 1 && scalar.size() != c_recordCount / 3)) {
+                    Error("Record_scan_selects_like_the_scalar_path: Filter #{} selected {} records, scalar path {}\n", f, vector.size(), scalar.size());
+                }
+            }
+
+            Format("Record_scan_selects_like_the_scalar_path: {} filters selected the same records, accelerated: {}\n", filters.size(), EtwLog::Portable::IsRecordScanAccelerated());
+        });
+}
+
+void Read_log_passes_only_records_the_filter_selects(EtwLog::Backend backend) {
+    const auto description{Describe("Read_log_passes_only_records_the_filter_selects", backend)};
+    RunTest(
+        description,
+        [&] {
+            const Fixture fixture;
+
+            static constexpr std::size_t c_recordCount = 300;
+            std::filesystem::path logFile;
+            EtwLog::ProviderId provider;
+            {
+                EtwLog::MiniLog log{"Mini logger", fixture.TempFolder.string(), 64, backend};
+                logFile = log.LogFile();
+                provider = log.Provider();
+                for (std::size_t r = 0; r != c_recordCount; ++r) {
+                    const EtwLog::EventDescriptor event{static_cast<std::uint16_t>(100 + r % 4), static_cast<EtwLog::Level>(1 + r % 5), 1ull << (r % 3)};
+                    log(event, MakeBytes(r % 10 == 0 ? "Hello World!" : "Goodbye World!"));
+                }
+            }
+
+            std::vector<EtwLog::RecordView> all;
+            std::vector<std::vector<std::byte>> payloads;
+            EtwLog::ReadLog(logFile, [&](const EtwLog::RecordView& record) {
+                all.push_back(record);
+                payloads.emplace_back(record.Payload.begin(), record.Payload.end());
+            });
+            for (std::size_t r = 0; r != all.size(); ++r) {
+                all[r].Payload = payloads[r];
+            }
+
+            std::vector<std::pair<std::string_view, EtwLog::RecordFilter>> filters(7);
+            filters[0] = {"event id", {}};
+            filters[0].second.EventId = 102;
+            filters[1] = {"level", {}};
+            filters[1].second.MaxLevel = EtwLog::Level::Error;
+            filters[2] = {"keyword", {}};
+            filters[2].second.KeywordMask = 0x6;
+            filters[3] = {"time range", {}};
+            filters[3].second.Begin = all[100].Time;
+            filters[3].second.End = all[200].Time;
+            filters[4] = {"payload prefix", {}};
+            filters[4].second.PayloadPrefix = MakeBytes("Hello");
+            filters[5] = {"provider", {}};
+            filters[5].second.Provider = provider;
+            filters[6] = {"everything combined", {}};
+            filters[6].second.EventId = 100;
+            filters[6].second.MaxLevel = EtwLog::Level::Warning;
+            filters[6].second.PayloadPrefix = MakeBytes("Hello");
+
+            for (const auto& [name, filter] : filters) {
+                const auto expected{std::count_if(all.begin(), all.end(), [&](const EtwLog::RecordView& record) {
+                    const auto& prefix{filter.PayloadPrefix};
+                    return (!filter.EventId || record.Event.Id == *filter.EventId)
+                        && (!filter.MaxLevel || record.Event.Level <= *filter.MaxLevel)
+                        && (filter.KeywordMask == 0 || (record.Event.Keyword & filter.KeywordMask) != 0)
+                        && (!filter.Begin || record.Time >= *filter.Begin)
+                        && (!filter.End || record.Time < *filter.End)
+                        && record.Payload.size() >= prefix.size() && std::equal(prefix.begin(), prefix.end(), record.Payload.begin());
+                })};
+
+                std::size_t passed{0};
+                const auto result{EtwLog::ReadLog(logFile, filter, [&](const EtwLog::RecordView&) { ++passed; })};
+                if (passed != static_cast<std::size_t>(expected) || result.Records != passed || result.RecordsFiltered != all.size() - passed) {
+                    Error("{}: Filtering by {} passed {} records instead of {}, {} filtered\n", description, name, passed, expected, result.RecordsFiltered);
+                }
+            }
+
+            EtwLog::RecordFilter otherProvider;
+            otherProvider.Provider = EtwLog::ProviderId{};
+            const auto result{EtwLog::ReadLog(logFile, otherProvider, [](const EtwLog::RecordView&) {})};
+            if (result.Records != 0) {
+                Error("{}: Read {} records of another provider\n", description, result.Records);
+            }
+
+            Format("{}: {} filters passed the expected records\n", description, filters.size());
+        });
+}
+
+void Export_logs_to_columns_and_import_them_back(EtwLog::Backend backend) {
+    const auto description{Describe("Export_logs_to_columns_and_import_them_back", backend)};
+    RunTest(
+        description,
+        [&] {
+            const Fixture fixture;
+
+            // Two loggers, and row groups small enough that each log takes several.
+            static constexpr std::size_t c_recordCount = 250;
+            std::vector<std::filesystem::path> logFiles;
+            for (std::size_t l = 0; l != 2; ++l) {
+                EtwLog::MiniLog log{"Mini logger", (fixture.TempFolder / std::to_string(l)).string(), 64, backend};
+                logFiles.push_back(log.LogFile());
+                for (std::size_t r = 0; r != c_recordCount; ++r) {
+                    log({static_cast<std::uint16_t>(100 + r / 10)}, MakeBytes(std::format("Record {} of logger {}", r, l)));
+                }
+            }
+
+            std::vector<EtwLog::RecordView> expected;
+            std::vector<std::vector<std::byte>> payloads;
+            for (const auto& logFile : logFiles) {
+                EtwLog::ReadLog(logFile, [&](const EtwLog::RecordView& record) {
+                    expected.push_back(record);
+                    payloads.emplace_back(record.Payload.begin(), record.Payload.end());
+                });
+            }
+
+            const auto columnarFile{fixture.TempFolder / "log.columns"};
+            const auto exported{EtwLog::Columnar::Export(logFiles, columnarFile, 100)};
+            if (exported.Records != expected.size() || exported.RowGroups != 6) {
+                Error("{}: Exported {} records in {} row groups\n", description, exported.Records, exported.RowGroups);
+            }
+
+            std::size_t index{0};
+            const auto imported{EtwLog::Columnar::Import(columnarFile, [&](const EtwLog::Columnar::ColumnBatch& batch) {
+                for (std::size_t r = 0; r != batch.Size(); ++r, ++index) {
+                    const auto& record{expected.at(index)};
+                    const auto payload{batch.Payload(r)};
+                    if (batch.Provider != record.Provider || batch.Times[r] != record.Time.time_since_epoch().count() || batch.EventIds[r] != record.Event.Id
+                        || batch.Sequences[r] != record.Header.Sequence || !std::equal(payload.begin(), payload.end(), payloads[index].begin(), payloads[index].end())) {
+                        Error("{}: Record #{} doesn't match the log\n", description, index);
+                    }
+                }
+            })};
+
+            if (imported != expected.size() || index != expected.size()) {
+                Error("{}: Imported {} records instead of {}\n", description, imported, expected.size());
+            }
+
+            Format("{}: Imported {} records from {} bytes, {} in the logs\n", description, imported, exported.Bytes,
+                std::filesystem::file_size(logFiles[0]) + std::filesystem::file_size(logFiles[1]));
+        });
+}
+
+void Record_batch_reads_a_log_in_a_few_allocations(EtwLog::Backend backend) {
+    const auto description{Describe("Record_batch_reads_a_log_in_a_few_allocations", backend)};
+    RunTest(
+        description,
+        [&] {
+            const Fixture fixture;
+
+            static constexpr std::size_t c_recordCount = 10000;
+            std::filesystem::path logFile;
+            std::size_t payloadBytes{0};
+            {
+                EtwLog::MiniLog log{"Mini logger", fixture.TempFolder.string(), 64, backend};
+                logFile = log.LogFile();
+                for (std::size_t r = 0; r != c_recordCount; ++r) {
+                    const auto message{MakeBytes(std::format("Record {}{}", r, std::string(r % 50, '!')))};
+                    payloadBytes += message.size();
+                    log(message);
+                }
+            }
+
+            CountingMemory memory;
+            EtwLog::RecordBatch batch{&memory};
+            EtwLog::ReadLog(logFile, Consumers::Messages(), batch);
+            const auto growing{memory.Allocations};
+
+            // The batch only grows geometrically, nothing is allocated per record.
+            if (batch.Size() != c_recordCount || batch.PayloadBytes() != payloadBytes || growing > 64) {
+                Error("{}: Read {} records of {} bytes with {} allocations\n", description, batch.Size(), batch.PayloadBytes(), growing);
+            }
+
+            for (std::size_t r = 0; r != batch.Size(); ++r) {
+                const auto record{batch[r]};
+                const auto expected{MakeBytes(std::format("Record {}{}", r, std::string(r % 50, '!')))};
+                if ((r != 0 && record.Header.Sequence <= batch[r - 1].Header.Sequence) || !std::equal(record.Payload.begin(), record.Payload.end(), expected.begin(), expected.end())) {
+                    Error("{}: Record #{} doesn't match what was logged\n", description, r);
+                }
+            }
+
+            // Read again into the same memory.
+            memory.Allocations = 0;
+            batch.Clear();
+            EtwLog::ReadLog(logFile, Consumers::Messages(), batch);
+            if (batch.Size() != c_recordCount || memory.Allocations != 0) {
+                Error("{}: Read {} records again with {} allocations instead of none\n", description, batch.Size(), memory.Allocations);
+            }
+
+            // Sized up front, a batch takes exactly two allocations: the records and the payload arena.
+            CountingMemory reservedMemory;
+            EtwLog::RecordBatch reserved{&reservedMemory};
+            reserved.Reserve(c_recordCount, payloadBytes);
+            EtwLog::ReadLog(logFile, Consumers::Messages(), reserved);
+            if (reserved.Size() != c_recordCount || reservedMemory.Allocations != 2) {
+                Error("{}: Read {} records into a reserved batch with {} allocations instead of 2\n", description, reserved.Size(), reservedMemory.Allocations);
+            }
+
+            Format("{}: Read {} records with {} allocations, none when the batch is reused\n", description, c_recordCount, growing);
+        });
+}
+
+void Sampling_keeps_the_configured_share_of_records(EtwLog::Backend backend) {
+    const auto description{Describe("Sampling_keeps_the_configured_share_of_records", backend)};
+    RunTest(
+        description,
+        [&] {
+            const Fixture fixture;
+
+            static constexpr std::uint16_t c_oneInTen{10};
+            static constexpr std::uint16_t c_unsampled{11};
+            static constexpr std::uint16_t c_rateLimited{12};
+            static constexpr std::uint16_t c_quarter{13};
+            static constexpr std::uint16_t c_onceAnAge{14};
+            static constexpr std::uint16_t c_endlessBurst{15};
+            static constexpr std::size_t c_recordCount = 1000;
+
+            std::filesystem::path logFile;
+            std::vector<EtwLog::SamplingCount> counts;
+            {
+                EtwLog::MiniLog log{"Mini logger", fixture.TempFolder.string(), 64, backend};
+                logFile = log.LogFile();
+                log.SetSampling(c_oneInTen, {.OneIn = 10});
+                log.SetSampling(c_rateLimited, {.RatePerSecond = 1, .Burst = 5});
+                log.SetSampling(c_quarter, {.Probability = 0.25});
+                // Intervals and bursts far beyond what the clock counts, kept to the longest it does.
+                log.SetSampling(c_onceAnAge, {.RatePerSecond = 1e-12});
+                log.SetSampling(c_endlessBurst, {.RatePerSecond = 1, .Burst = 1e30});
+
+                const auto message{MakeBytes("Hello World!")};
+                for (std::size_t r = 0; r != c_recordCount; ++r) {
+                    log({c_oneInTen}, message);
+                    log({c_unsampled}, message);
+                    log({c_rateLimited}, message);
+                    log({c_onceAnAge}, message);
+                    log({c_endlessBurst}, message);
+                    for (std::size_t q = 0; q != 4; ++q) {
+                        if (log.Admit({c_quarter})) {
+                            log.WriteAdmitted({c_quarter}, message);
+                        }
+                    }
+                }
+
+                // Nothing passes the logger's policy from now on.
+                log.SetSampling({.Probability = 0});
+                for (std::size_t r = 0; r != 100; ++r) {
+                    log({c_unsampled}, message);
+                }
+                counts = log.SamplingCounts();
+            }
+
+            std::map<std::uint16_t, std::size_t> kept;
+            std::vector<EtwLog::SamplingCount> logged;
+            EtwLog::ReadLog(logFile, [&](const EtwLog::RecordView& record) {
+                ++kept[record.Event.Id];
+                if (record.Event.Id == EtwLog::EventIds::SamplingCounts) {
+                    logged = EtwLog::DecodeSamplingCounts(record.Payload);
+                }
+            });
+
+            // The rate limit lets the burst through, plus one more if the test ran for over a second.
+            if (kept[c_oneInTen] != c_recordCount / 10 || kept[c_unsampled] != c_recordCount || kept[c_rateLimited] < 5 || kept[c_rateLimited] > 6
+                || kept[c_quarter] < c_recordCount * 8 / 10 || kept[c_quarter] > c_recordCount * 12 / 10) {
+                Error("{}: Kept {}, {}, {} and {} records\n", description, kept[c_oneInTen], kept[c_unsampled], kept[c_rateLimited], kept[c_quarter]);
+            }
+            if (kept[c_onceAnAge] != 1 || kept[c_endlessBurst] != c_recordCount) {
+                Error("{}: Kept {} records once an age and {} in an endless burst\n", description, kept[c_onceAnAge], kept[c_endlessBurst]);
+            }
+
+            // One counts record per policy change, and one at the end.
+            if (kept[EtwLog::EventIds::SamplingCounts] != 6) {
+                Error("{}: Found {} sampling count records instead of 6\n", description, kept[EtwLog::EventIds::SamplingCounts]);
+            }
+
+            const auto countOf{[&](std::uint32_t eventId) {
+                const auto found{std::find_if(logged.begin(), logged.end(), [eventId](const auto& count) { return count.EventId == eventId; })};
+                return found == logged.end() ? EtwLog::SamplingCount{} : *found;
+            }};
+            const auto oneInTen{countOf(c_oneInTen)};
+            const auto quarter{countOf(c_quarter)};
+            const auto all{countOf(EtwLog::SamplingCount::c_allEvents)};
+            if (logged.size() != 6 || counts.size() != 6 || oneInTen.Kept != 100 || oneInTen.Dropped != 900 || quarter.Kept != kept[c_quarter]
+                || quarter.Kept + quarter.Dropped != 4 * c_recordCount || all.Kept != 0 || all.Dropped != 100) {
+                Error("{}: Logged sampling counts don't match the records\n", description);
+            }
+
+            Format("{}: Kept {} of {} records sampled 1 in 4, counts logged for {} policies\n", description, quarter.Kept, 4 * c_recordCount, logged.size());
+        });
+}
+
+void Filter_changes_take_effect_while_logging(EtwLog::Backend backend) {
+    const auto description{Describe("Filter_changes_take_effect_while_logging", backend)};
+    RunTest(
+        description,
+        [&] {
+            const Fixture fixture;
+
+            // Every level, with no keyword and with keywords 0x1 and 0x2.
+            std::vector<EtwLog::EventDescriptor> events;
+            for (std::uint8_t level = 1; level <= 5; ++level) {
+                for (const std::uint64_t keyword : {0x0, 0x1, 0x2}) {
+                    events.push_back({static_cast<std::uint16_t>(100 + events.size()), static_cast<EtwLog::Level>(level), keyword});
+                }
+            }
+
+            // Each phase's filter, and the number of events it passes.
+            struct Phase {
+                EtwLog::Level MaxLevel;
+                std::uint64_t KeywordMask;
+                std::size_t Passing;
+            };
+            const Phase phases[]{
+                {EtwLog::Level::Verbose, 0, 15},
+                {EtwLog::Level::Warning, 0, 9},
+                {EtwLog::Level::Verbose, 0x2, 10},
+                {EtwLog::Level::Critical, 0x1, 2},
+            };
+
+            std::filesystem::path logFile;
+            std::vector<std::size_t> expected;
+            {
+                EtwLog::MiniLog log{"Mini logger", fixture.TempFolder.string(), 64, backend};
+                logFile = log.LogFile();
+                const auto message{MakeBytes("Hello World!")};
+                for (const auto& phase : phases) {
+                    log.SetFilter(phase.MaxLevel, phase.KeywordMask);
+
+                    std::size_t enabled{0};
+                    for (const auto& event : events) {
+                        enabled += log.IsEnabled(event) ? 1 : 0;
+                        log(event, message);
+                    }
+                    if (enabled != phase.Passing) {
+                        Error("{}: {} events enabled instead of {}\n", description, enabled, phase.Passing);
+                    }
+                    expected.push_back(enabled);
+                }
+            }
+
+            // The phases are told apart by the order of the records, as only written records are read back.
+            std::vector<std::size_t> found(std::size(phases));
+            std::uint64_t read{0};
+            EtwLog::ReadLog(logFile, [&](const EtwLog::RecordView& record) {
+                if (IsWriteProfile(record)) {
+                    return;
+                }
+                std::size_t phase{0};
+                std::uint64_t phaseEnd{expected[0]};
+                while (read >= phaseEnd && phase + 1 != std::size(phases)) {
+                    phaseEnd += expected[++phase];
+                }
+                ++read;
+                const auto& filter{phases[phase]};
+                if (record.Event.Level > filter.MaxLevel || (filter.KeywordMask != 0 && record.Event.Keyword != 0 && (record.Event.Keyword & filter.KeywordMask) == 0)) {
+                    Error("{}: Record #{} shouldn't have passed filter #{}\n", description, record.Header.Sequence, phase);
+                }
+                ++found[phase];
+            });
+
+            if (found != expected) {
+                Error("{}: Found {}, {}, {} and {} records for the filters\n", description, found[0], found[1], found[2], found[3]);
+            }
+
+            Format("{}: Each of {} filters passed the expected records\n", description, std::size(phases));
+        });
+}
+
+void Repeated_records_are_coalesced_and_expanded(EtwLog::Backend backend) {
+    const auto description{Describe("Repeated_records_are_coalesced_and_expanded", backend)};
+    RunTest(
+        description,
+        [&] {
+            const Fixture fixture;
+
+            static constexpr std::uint16_t c_failing{100};
+            static constexpr std::uint16_t c_other{101};
+            static constexpr std::size_t c_failures = 1000;
+
+            std::filesystem::path logFile;
+            {
+                EtwLog::MiniLog log{"Mini logger", fixture.TempFolder.string(), 64, backend};
+                logFile = log.LogFile();
+                log.SetCoalescing(true, std::chrono::hours{1});
+
+                // Records of another event id don't break the run, the run ends with another payload.
+                const auto failure{MakeBytes("Failed, retrying")};
+                for (std::size_t r = 0; r != c_failures; ++r) {
+                    log({c_failing}, failure);
+                    if (r % 100 == 0) {
+                        log({c_other}, MakeBytes(std::format("Other record {}", r)));
+                    }
+                }
+                log({c_failing}, MakeBytes("Recovered"));
+
+                // Still counting when the logger closes.
+                for (std::size_t r = 0; r != 3; ++r) {
+                    log({c_failing}, failure);
+                }
+            }
+
+            std::vector<std::uint64_t> failingRepeats;
+            std::size_t records{0};
+            EtwLog::ReadLog(logFile, [&](const EtwLog::RecordView& record) {
+                if (IsWriteProfile(record)) {
+                    return;
+                }
+                ++records;
+                if (record.Event.Id == c_failing) {
+                    failingRepeats.push_back(record.Repeats);
+                }
+                if (record.FirstTime > record.Time || (record.Repeats == 1 && record.FirstTime != record.Time)) {
+                    Error("{}: Record #{} has its first time after its last\n", description, record.Header.Sequence);
+                }
+            });
+
+            // The first failure, the run of the following ones, the recovery, then the first failure again and its run.
+            const std::vector<std::uint64_t> expectedRepeats{1, c_failures - 1, 1, 1, 2};
+            if (failingRepeats != expectedRepeats || records != failingRepeats.size() + 10) {
+                Error("{}: Found {} records, {} of the failing event\n", description, records, failingRepeats.size());
+            }
+
+            std::size_t expanded{0};
+            std::size_t failures{0};
+            EtwLog::ReadLog(logFile, EtwLog::ExpandRepeats([&](const EtwLog::RecordView& record) {
+                if (IsWriteProfile(record)) {
+                    return;
+                }
+                ++expanded;
+                const std::string_view payload{reinterpret_cast<const char*>(record.Payload.data()), record.Payload.size()};
+                failures += record.Event.Id == c_failing && payload == "Failed, retrying" ? 1 : 0;
+                if (record.Repeats != 1) {
+                    Error("{}: Expanded record #{} still stands for {} records\n", description, record.Header.Sequence, record.Repeats);
+                }
+            }));
+
+            if (expanded != c_failures + 1 + 3 + 10 || failures != c_failures + 3) {
+                Error("{}: Expanded to {} records, {} failures\n", description, expanded, failures);
+            }
+
+            // Repeats take no sequence numbers of their own.
+            const auto gaps{EtwLog::FindSequenceGaps(logFile)};
+            if (gaps.RecordsMissing != 0) {
+                Error("{}: {} records missing\n", description, gaps.RecordsMissing);
+            }
+
+            Format("{}: {} records stored as {}, expanded back to {}\n", description, c_failures + 1 + 3 + 10, records, expanded);
+        });
+}
+
+void Large_payloads_are_written_in_fragments_and_reassembled(EtwLog::Backend backend) {
+    const auto description{Describe("Large_payloads_are_written_in_fragments_and_reassembled", backend)};
+    RunTest(
+        description,
+        [&] {
+            const Fixture fixture;
+
+            static constexpr std::uint16_t c_large{200};
+            static constexpr std::size_t c_largePayloads = 4;
+
+            auto makeLarge = [](std::size_t index) {
+                std::vector<std::byte> payload((index + 1) * 1024 * 1024 + index);
+                for (std::size_t b = 0; b != payload.size(); ++b) {
+                    payload[b] = static_cast<std::byte>((b * 31 + index) % 251);
+                }
+                return payload;
+            };
+
+            std::filesystem::path logFile;
+            {
+                EtwLog::MiniLog log{"Mini logger", fixture.TempFolder.string(), 64, backend};
+                logFile = log.LogFile();
+                for (std::size_t index = 0; index != c_largePayloads; ++index) {
+                    log({c_large}, makeLarge(index));
+                    log(MakeBytes(std::format("Small record {}", index)));
+                }
+            }
+
+            std::size_t large{0};
+            std::size_t small{0};
+            EtwLog::ReadLog(logFile, [&](const EtwLog::RecordView& record) {
+                if (record.Event.Id != c_large) {
+                    small += record.Fragments == 1 && !IsWriteProfile(record) ? 1 : 0;
+                    return;
+                }
+
+                const auto expected{makeLarge(large)};
+                if (record.Fragments <= 1 || !std::ranges::equal(record.Payload, expected)) {
+                    Error("{}: Large record #{} of {} bytes in {} fragments doesn't match\n", description, large, record.Payload.size(), record.Fragments);
+                }
+                ++large;
+            });
+
+            if (large != c_largePayloads || small != c_largePayloads) {
+                Error("{}: Found {} large and {} small records\n", description, large, small);
+            }
+
+            // Fragments take a sequence number each, and nothing is missing in between.
+            const auto gaps{EtwLog::FindSequenceGaps(logFile)};
+            if (gaps.RecordsMissing != 0) {
+                Error("{}: {} records missing\n", description, gaps.RecordsMissing);
+            }
+
+            // The payload prefix is checked on the reassembled payload.
+            EtwLog::RecordFilter filter;
+            const auto third{makeLarge(2)};
+            filter.PayloadPrefix.assign(third.begin(), third.begin() + 100);
+            std::size_t selected{0};
+            const auto result{EtwLog::ReadLog(logFile, filter, [&](const EtwLog::RecordView& record) {
+                selected += record.Payload.size() == third.size() ? 1 : 0;
+            })};
+            if (selected != 1 || result.Records != 1 || result.IncompleteRecords != 0) {
+                Error("{}: Prefix selected {} records\n", description, result.Records);
+            }
+
+            Format("{}: {} payloads up to {} bytes, {} sequence numbers\n", description, c_largePayloads, makeLarge(c_largePayloads - 1).size(), gaps.RecordsSeen);
+        });
+}
+
+void Repeated_or_damaged_fragments_do_not_complete_a_payload() {
+    RunTest(
+        "Repeated_or_damaged_fragments_do_not_complete_a_payload",
+        [] {
+            const Fixture fixture;
+            std::filesystem::create_directories(fixture.TempFolder);
+            const auto logFile{LogFile(fixture.TempFolder, EtwLog::Backend::Portable)};
+
+            std::vector<std::byte> payload(100);
+            for (std::size_t b = 0; b != payload.size(); ++b) {
+                payload[b] = static_cast<std::byte>(b);
+            }
+            const std::span<const std::byte> bytes{payload};
+            {
+                const EtwLog::Clock clock;
+                EtwLog::Detail::PortableSink sink{logFile, 4, clock.Calibration(), {}};
+                const auto writeFragment = [&](std::uint64_t sequence, const EtwLog::FragmentHeader& fragment, std::span<const std::byte> part) {
+                    sink.Write({}, {sequence, clock.Now()}, {nullptr, &fragment, nullptr}, part);
+                };
+
+                // A whole payload, in fragments of 40, 40 and 20 bytes.
+                writeFragment(0, {0, 3, 0, 100}, bytes.subspan(0, 40));
+                writeFragment(1, {1, 3, 40, 100}, bytes.subspan(40, 40));
+                writeFragment(2, {2, 3, 80, 100}, bytes.subspan(80));
+
+                // The first fragment twice and the second one missing.
+                writeFragment(10, {0, 3, 0, 100}, bytes.subspan(0, 40));
+                writeFragment(10, {0, 3, 0, 100}, bytes.subspan(0, 40));
+                writeFragment(12, {2, 3, 80, 100}, bytes.subspan(80));
+
+                // A damaged header claiming a payload of 4 GB, far more than two fragments of 40 bytes carry.
+                writeFragment(20, {0, 2, 0, std::uint64_t{1} << 32}, bytes.subspan(0, 40));
+            }
+
+            std::size_t matching{0};
+            const auto result{EtwLog::ReadLog(logFile, [&](const EtwLog::RecordView& record) {
+                matching += std::ranges::equal(record.Payload, payload) ? 1 : 0;
+            })};
+            if (result.Records != 1 || matching != 1 || result.IncompleteRecords != 2) {
+                Error("Repeated_or_damaged_fragments_do_not_complete_a_payload: {} records read, {} intact, {} incomplete\n", result.Records, matching, result.IncompleteRecords);
+            }
+
+            Format("Repeated_or_damaged_fragments_do_not_complete_a_payload: {} payload reassembled, {} left incomplete, as expected\n", result.Records, result.IncompleteRecords);
+        });
+}
+
+void Messages_logged_with_format_are_formatted_when_read(EtwLog::Backend backend) {
+    const auto description{Describe("Messages_logged_with_format_are_formatted_when_read", backend)};
+    RunTest(
+        description,
+        [&] {
+            const Fixture fixture;
+
+            const std::string longText(1000, 'y');
+            std::vector<std::string> expected;
+            std::filesystem::path logFile;
+            {
+                EtwLog::MiniLog log{"Mini logger", fixture.TempFolder.string(), 64, backend};
+                logFile = log.LogFile();
+                log.SetFilter(EtwLog::Level::Information);
+
+                for (int r = 0; r != 100; ++r) {
+                    log.Log("Request {} took {:.3f} ms, status {:>5}", r, r * 0.25, r % 2 == 0 ? "ok" : "error");
+                    expected.push_back(std::format("Request {} took {:.3f} ms, status {:>5}", r, r * 0.25, r % 2 == 0 ? "ok" : "error"));
+                }
+                log.Log(EtwLog::Level::Warning, "{1} {0:#x} {2} {3} {{literal}}", 255u, 'c', true, std::int8_t{-5});
+                expected.push_back(std::format("{1} {0:#x} {2} {3} {{literal}}", 255u, 'c', true, std::int8_t{-5}));
+                log.Log("Long argument {}", longText);
+                expected.push_back(std::format("Long argument {}", longText));
+
+                // Filtered out, so never encoded.
+                log.Log(EtwLog::Level::Verbose, "Verbose {}", 1);
+            }
+
+            std::size_t index{0};
+            EtwLog::ReadLog(logFile, [&](const EtwLog::RecordView& record) {
+                const auto text{EtwLog::FormatMessage(record)};
+                if (record.Event.Id != EtwLog::EventIds::FormattedMessage) {
+                    if (text) {
+                        Error("{}: Record of event {} formatted as a message\n", description, record.Event.Id);
+                    }
+                    return;
+                }
+                if (index == expected.size() || text != expected[index]) {
+                    Error("{}: Message #{} is '{}' instead of '{}'\n", description, index, text.value_or("(none)"), index < expected.size() ? expected[index] : "");
+                }
+                ++index;
+            });
+
+            if (index != expected.size()) {
+                Error("{}: Found {} of {} messages\n", description, index, expected.size());
+            }
+            Format("{}: {} messages formatted when read, as when logged\n", description, index);
+        });
+}
+
+void Format_manifest_formats_messages_without_the_program(EtwLog::Backend backend) {
+    const auto description{Describe("Format_manifest_formats_messages_without_the_program", backend)};
+    RunTest(
+        description,
+        [&] {
+            using namespace EtwLog::Literals;
+            const Fixture fixture;
+
+            static constexpr std::array c_staticArguments{EtwLog::ArgumentType::UInt, EtwLog::ArgumentType::String};
+            constexpr auto c_staticId{EtwLog::FormatId("Connection {} closed: {}", c_staticArguments)};
+
+            std::vector<std::string> expected;
+            std::filesystem::path logFile;
+            {
+                EtwLog::MiniLog log{"Mini logger", fixture.TempFolder.string(), 64, backend};
+                logFile = log.LogFile();
+
+                // Formats written as "..."_format are in the manifest before they are first logged.
+                const auto atStart{EtwLog::FormatManifest::Read(logFile)};
+                const auto* registered{atStart.Find(c_staticId)};
+                if (registered == nullptr || registered->Text != "Connection {} closed: {}" || !std::ranges::equal(registered->Arguments, c_staticArguments)) {
+                    Error("{}: Static format missing from the manifest written at the start\n", description);
+                }
+
+                for (unsigned r = 0; r != 10; ++r) {
+                    log.Log("Connection {} closed: {}"_format, r, std::string_view{"timeout"});
+                    expected.push_back(std::format("Connection {} closed: {}", r, "timeout"));
+                    log.Log(EtwLog::Level::Error, "Retry {} of {:.1f}s backoff"_format, r, r * 1.5);
+                    expected.push_back(std::format("Retry {} of {:.1f}s backoff", r, r * 1.5));
+                    log.Log("Runtime format {:>4}", static_cast<int>(r));
+                    expected.push_back(std::format("Runtime format {:>4}", static_cast<int>(r)));
+                }
+            }
+
+            // Formatted from the manifest alone, as a decoder without this program would.
+            const auto manifest{EtwLog::FormatManifest::Read(logFile)};
+            std::size_t index{0};
+            EtwLog::ReadLog(logFile, [&](const EtwLog::RecordView& record) {
+                if (record.Event.Id != EtwLog::EventIds::FormattedMessage) {
+                    return;
+                }
+                const auto text{EtwLog::FormatMessage(record, manifest)};
+                if (index == expected.size() || text != expected[index]) {
+                    Error("{}: Message #{} is '{}'\n", description, index, text.value_or("(none)"));
+                }
+                ++index;
+            });
+
+            // Another format of the same id and other argument types isn't used to format the messages.
+            EtwLog::FormatManifest wrong;
+            wrong.Add({c_staticId, "Connection {} closed: {}", {EtwLog::ArgumentType::Int, EtwLog::ArgumentType::String}});
+            std::size_t rejected{0};
+            EtwLog::ReadLog(logFile, [&](const EtwLog::RecordView& record) {
+                rejected += record.Event.Id == EtwLog::EventIds::FormattedMessage && !EtwLog::FormatMessage(record, wrong) ? 1 : 0;
+            });
+
+            if (index != expected.size() || rejected != expected.size()) {
+                Error("{}: Formatted {} of {} messages, {} rejected by a mismatched manifest\n", description, index, expected.size(), rejected);
+            }
+
+            // An entry asking for more text or arguments than a manifest can hold is refused before anything is allocated for it.
+            const auto damagedLog{fixture.TempFolder / "damaged.mlog"};
+            const auto refused{[&](std::uint32_t textSize, std::uint32_t argumentCount) {
+                std::ifstream in{EtwLog::FormatManifestFile(logFile), std::ios::binary};
+                std::vector<char> bytes{std::istreambuf_iterator<char>{in}, std::istreambuf_iterator<char>{}};
+                // The first entry's sizes follow the magic and its id.
+                std::memcpy(bytes.data() + 8 + sizeof(std::uint64_t), &textSize, sizeof(textSize));
+                std::memcpy(bytes.data() + 8 + sizeof(std::uint64_t) + sizeof(textSize), &argumentCount, sizeof(argumentCount));
+                std::ofstream{EtwLog::FormatManifestFile(damagedLog), std::ios::binary}.write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+                try {
+                    EtwLog::FormatManifest::Read(damagedLog);
+                    return false;
+                } catch (const std::runtime_error&) {
+                    return true;
+                }
+            }};
+            if (!refused(0xFFFF'FFF0, 2) || !refused(1, 0xFFFF'FFF0)) {
+                Error("{}: Damaged manifest read\n", description);
+            }
+            Format("{}: {} messages formatted from a manifest of {} formats\n", description, index, manifest.Size());
+        });
+}
+
+void Activity_scopes_are_read_back_as_span_trees(EtwLog::Backend backend) {
+    const auto description{Describe("Activity_scopes_are_read_back_as_span_trees", backend)};
+    RunTest(
+        description,
+        [&] {
+            const Fixture fixture;
+
+            static constexpr EtwLog::EventDescriptor c_request{300};
+            static constexpr EtwLog::EventDescriptor c_query{301};
+            static constexpr EtwLog::EventDescriptor c_worker{302};
+            static constexpr EtwLog::EventDescriptor c_verbose{303, EtwLog::Level::Verbose};
+            static constexpr std::size_t c_requests{5};
+
+            std::filesystem::path logFile;
+            {
+                EtwLog::MiniLog log{"Mini logger", fixture.TempFolder.string(), 64, backend};
+                logFile = log.LogFile();
+                log.SetFilter(EtwLog::Level::Information);
+
+                for (std::size_t r = 0; r != c_requests; ++r) {
+                    const EtwLog::ActivityScope request{log, c_request, MakeBytes(std::format("Request {}", r))};
+                    for (int q = 0; q != 2; ++q) {
+                        const EtwLog::ActivityScope query{log, c_query};
+                        std::this_thread::sleep_for(std::chrono::milliseconds{1});
+
+                        // Filtered out, so its child becomes a root.
+                        const EtwLog::ActivityScope verbose{log, c_verbose};
+                        if (q == 1) {
+                            const EtwLog::ActivityScope orphan{log, c_query};
+                        }
+                    }
+
+                    // Work handed to another thread stays part of the request.
+                    std::thread{[&log, parent = request.Id()] {
+                        const EtwLog::ActivityScope worker{log, c_worker, parent};
+                        std::this_thread::sleep_for(std::chrono::milliseconds{1});
+                    }}.join();
+
+                    if (EtwLog::ActivityScope::Current() != request.Id()) {
+                        Error("{}: The request isn't the current activity after its children ended\n", description);
+                    }
+                }
+            }
+
+            const auto tree{EtwLog::ReadSpans(logFile)};
+            std::size_t requests{0};
+            std::size_t orphans{0};
+            for (const auto root : tree.Roots) {
+                const auto& span{tree.Spans[root]};
+                if (span.Event.Id == c_query.Id) {
+                    ++orphans;
+                    continue;
+                }
+
+                const auto expected{MakeBytes(std::format("Request {}", requests))};
+                std::chrono::nanoseconds children{0};
+                std::vector<std::uint16_t> childEvents;
+                for (const auto child : span.Children) {
+                    const auto& childSpan{tree.Spans[child]};
+                    children += childSpan.Duration;
+                    childEvents.push_back(childSpan.Event.Id);
+                    if (!childSpan.Stop || childSpan.Duration < std::chrono::milliseconds{1} || childSpan.Parent != root) {
+                        Error("{}: Child of request {} lasted {} ns\n", description, requests, childSpan.Duration.count());
+                    }
+                }
+
+                const std::vector<std::uint16_t> expectedChildren{c_query.Id, c_query.Id, c_worker.Id};
+                if (span.Event.Id != c_request.Id || !std::ranges::equal(span.Payload, expected) || childEvents != expectedChildren
+                    || span.Duration < children || span.SelfTime != span.Duration - children) {
+                    Error("{}: Request {} has {} children, {} ns long\n", description, requests, span.Children.size(), span.Duration.count());
+                }
+                ++requests;
+            }
+
+            if (requests != c_requests || orphans != c_requests || tree.UnmatchedStops != 0 || tree.Spans.size() != 5 * c_requests) {
+                Error("{}: {} spans, {} requests, {} orphans\n", description, tree.Spans.size(), requests, orphans);
+            }
+            Format("{}: {} spans in {} trees\n", description, tree.Spans.size(), tree.Roots.size());
+        });
+}
+
+#ifdef _WIN32
+void Activity_opcodes_reach_etw_consumers() {
+    const auto description{Describe("Activity_opcodes_reach_etw_consumers", EtwLog::Backend::Etw)};
+    RunTest(
+        description,
+        [&] {
+            const Fixture fixture;
+
+            static constexpr EtwLog::EventDescriptor c_request{300};
+
+            std::filesystem::path logFile;
+            {
+                EtwLog::MiniLog log{"Mini logger", fixture.TempFolder.string(), 64, EtwLog::Backend::Etw};
+                logFile = log.LogFile();
+                const EtwLog::ActivityScope request{log, c_request, MakeBytes("Request")};
+            }
+
+            // The start and stop opcodes go in the descriptor's opcode, leaving its task alone.
+            std::vector<EVENT_DESCRIPTOR> activity;
+            std::ranges::copy_if(Consumers::ReadEtwDescriptors(logFile), std::back_inserter(activity), [](const EVENT_DESCRIPTOR& descriptor) { return descriptor.Id == c_request.Id; });
+            if (activity.size() != 2 || activity[0].Opcode != static_cast<UCHAR>(EtwLog::ActivityOpcode::Start) || activity[1].Opcode != static_cast<UCHAR>(EtwLog::ActivityOpcode::Stop)
+                || activity[0].Task != 0 || activity[1].Task != 0) {
+                Error("{}: {} activity events, opcodes {} and {}\n", description, activity.size(),
+                    activity.empty() ? -1 : activity[0].Opcode, activity.size() < 2 ? -1 : activity[1].Opcode);
+            }
+            Format("{}: Start and stop opcodes read back\n", description);
+        });
+}
+#endif
+
+void Latency_histograms_are_snapshotted_and_merged(EtwLog::Backend backend) {
+    const auto description{Describe("Latency_histograms_are_snapshotted_and_merged", backend)};
+    RunTest(
+        description,
+        [&] {
+            const Fixture fixture;
+
+            static constexpr std::uint32_t c_requestKey{1};
+            static constexpr std::uint32_t c_rareKey{2};
+            static constexpr int c_threads{4};
+            static constexpr std::uint64_t c_valuesPerThread{20'000};
+
+            // The same values go into an exact histogram, and into the logs of two loggers, half each.
+            EtwLog::Histogram exact;
+            std::vector<std::uint64_t> values;
+            std::vector<std::filesystem::path> logFiles;
+            std::uint64_t snapshots{0};
+            for (int l = 0; l != 2; ++l) {
+                {
+                    EtwLog::MiniLog log{"Mini logger", (fixture.TempFolder / std::to_string(l)).string(), 64, backend};
+                    logFiles.push_back(log.LogFile());
+                    log.SetHistogramInterval(std::chrono::milliseconds{5});
+                    auto& requests{log.Latencies(c_requestKey)};
+                    log.Latencies(c_rareKey).Record(std::chrono::microseconds{l + 1});
+
+                    std::vector<std::thread> threads;
+                    for (int t = 0; t != c_threads; ++t) {
+                        threads.emplace_back([&requests, seed = l * c_threads + t] {
+                            for (std::uint64_t i = 0; i != c_valuesPerThread; ++i) {
+                                requests.RecordValue((i * 2'654'435'761 + static_cast<std::uint64_t>(seed)) % 50'000'000);
+                                if (i % 1000 == 0) {
+                                    std::this_thread::sleep_for(std::chrono::milliseconds{1});
+                                }
+                            }
+                        });
+                    }
+                    for (auto& thread : threads) {
+                        thread.join();
+                    }
+                }
+
+                for (int t = 0; t != c_threads; ++t) {
+                    for (std::uint64_t i = 0; i != c_valuesPerThread; ++i) {
+                        values.push_back((i * 2'654'435'761 + static_cast<std::uint64_t>(l * c_threads + t)) % 50'000'000);
+                        exact.Add(values.back());
+                    }
+                }
+
+                EtwLog::RecordFilter filter;
+                filter.EventId = EtwLog::EventIds::HistogramSnapshot;
+                EtwLog::ReadLog(logFiles.back(), filter, [&](const EtwLog::RecordView& record) {
+                    const auto snapshot{EtwLog::DecodeHistogramSnapshot(record)};
+                    if (!snapshot || snapshot->End - snapshot->Begin <= std::chrono::nanoseconds{0}) {
+                        Error("{}: Snapshot {} doesn't decode\n", description, snapshots);
+                    }
+                    ++snapshots;
+                });
+            }
+
+            const auto merged{EtwLog::ReadHistograms(logFiles, {})};
+            const auto requests{merged.find(c_requestKey)};
+            const auto rare{merged.find(c_rareKey)};
+            if (merged.size() != 2 || requests == merged.end() || rare == merged.end()) {
+                Error("{}: {} histograms read\n", description, merged.size());
+                return;
+            }
+            if (rare->second.Count() != 2 || rare->second.Min() != 1000 || rare->second.Max() != 2000) {
+                Error("{}: Rare histogram has {} values from {} to {}\n", description, rare->second.Count(), rare->second.Min(), rare->second.Max());
+            }
+
+            const auto& histogram{requests->second};
+            if (histogram.Count() != exact.Count() || histogram.Sum() != exact.Sum() || histogram.Min() != exact.Min() || histogram.Max() != exact.Max()) {
+                Error("{}: {} values from {} to {}, expected {} from {} to {}\n",
+                    description, histogram.Count(), histogram.Min(), histogram.Max(), exact.Count(), exact.Min(), exact.Max());
+            }
+
+            std::ranges::sort(values);
+            for (const auto quantile : {0.0, 0.5, 0.9, 0.99, 0.999, 1.0}) {
+                const auto rank{std::max<std::size_t>(1, static_cast<std::size_t>(std::ceil(quantile * static_cast<double>(values.size()))))};
+                const auto expected{values[rank - 1]};
+                const auto found{histogram.ValueAtQuantile(quantile)};
+                if (found < expected || found - expected > expected / EtwLog::Histogram::c_subBuckets) {
+                    Error("{}: Quantile {} is {}, expected {}\n", description, quantile, found, expected);
+                }
+            }
+
+            // Several intervals per logger, so snapshots were merged across time as well as across logs.
+            if (snapshots < 4) {
+                Error("{}: Only {} snapshots written\n", description, snapshots);
+            }
+            Format("{}: {} snapshots, p99.9 {} ns\n", description, snapshots, histogram.ValueAtQuantile(0.999));
+        });
+}
+
+void Counters_and_gauges_are_flushed_every_interval(EtwLog::Backend backend) {
+    const auto description{Describe("Counters_and_gauges_are_flushed_every_interval", backend)};
+    RunTest(
+        description,
+        [&] {
+            const Fixture fixture;
+
+            static constexpr std::uint32_t c_requestsKey{1};
+            static constexpr std::uint32_t c_bytesKey{2};
+            static constexpr std::uint32_t c_depthKey{1};
+            static constexpr int c_threads{4};
+            static constexpr std::uint64_t c_updatesPerThread{20'000};
+
+            std::filesystem::path logFile;
+            {
+                EtwLog::MiniLog log{"Mini logger", fixture.TempFolder.string(), 64, backend};
+                logFile = log.LogFile();
+                log.SetMetricsInterval(std::chrono::milliseconds{5});
+                auto& requests{log.CounterOf(c_requestsKey)};
+                auto& bytes{log.CounterOf(c_bytesKey)};
+                auto& depth{log.GaugeOf(c_depthKey)};
+
+                std::vector<std::thread> threads;
+                for (int t = 0; t != c_threads; ++t) {
+                    threads.emplace_back([&, t] {
+                        for (std::uint64_t i = 0; i != c_updatesPerThread; ++i) {
+                            depth.Add(2);
+                            requests.Add();
+                            bytes.Add(i % 100);
+                            depth.Subtract(2);
+                            if (i % 1000 == 0) {
+                                std::this_thread::sleep_for(std::chrono::milliseconds{1});
+                            }
+                        }
+                        // Left in the queue.
+                        depth.Add(t);
+                    });
+                }
+                for (auto& thread : threads) {
+                    thread.join();
+                }
+            }
+
+            const auto snapshots{EtwLog::ReadMetrics(logFile, {})};
+            std::uint64_t requestCount{0};
+            std::uint64_t byteCount{0};
+            std::optional<std::int64_t> lastDepth;
+            for (std::size_t s = 0; s != snapshots.size(); ++s) {
+                const auto& snapshot{snapshots[s]};
+                if (snapshot.End <= snapshot.Begin || (s != 0 && snapshot.Begin != snapshots[s - 1].End)) {
+                    Error("{}: Snapshot {} doesn't follow the one before\n", description, s);
+                }
+                for (const auto& value : snapshot.Values) {
+                    if (value.Kind == EtwLog::MetricKind::Counter && value.Key == c_requestsKey) {
+                        requestCount += static_cast<std::uint64_t>(value.Value);
+                    } else if (value.Kind == EtwLog::MetricKind::Counter && value.Key == c_bytesKey) {
+                        byteCount += static_cast<std::uint64_t>(value.Value);
+                    } else if (value.Kind == EtwLog::MetricKind::Gauge && value.Key == c_depthKey) {
+                        lastDepth = value.Value;
+                    } else {
+                        Error("{}: Unknown metric {} in snapshot {}\n", description, value.Key, s);
+                    }
+                }
+            }
+
+            std::uint64_t expectedBytes{0};
+            for (std::uint64_t i = 0; i != c_updatesPerThread; ++i) {
+                expectedBytes += c_threads * (i % 100);
+            }
+            if (requestCount != c_threads * c_updatesPerThread || byteCount != expectedBytes || lastDepth != 0 + 1 + 2 + 3) {
+                Error("{}: {} requests, {} bytes, depth {}\n", description, requestCount, byteCount, lastDepth.value_or(-1));
+            }
+            if (snapshots.size() < 2) {
+                Error("{}: Only {} snapshots written\n", description, snapshots.size());
+            }
+            Format("{}: {} snapshots\n", description, snapshots.size());
+        });
+}
+
+void Write_profile_times_each_stage(EtwLog::Backend backend) {
+    const auto description{Describe("Write_profile_times_each_stage", backend)};
+    RunTest(
+        description,
+        [&] {
+            const Fixture fixture;
+
+            static constexpr int c_threads{3};
+            static constexpr int c_timings{50};
+
+            // The profiler works whether or not MiniLog is built to use it, so it is tested with timers forced on.
+            const EtwLog::Clock clock;
+            EtwLog::Detail::WriteProfiler profiler{clock};
+            std::vector<std::thread> threads;
+            for (int t = 0; t != c_threads; ++t) {
+                threads.emplace_back([&profiler] {
+                    for (int i = 0; i != c_timings; ++i) {
+                        const EtwLog::Detail::BasicStageTimer<true> admit{&profiler, EtwLog::WriteStage::Admit};
+                        if (i % 10 == 0) {
+                            const EtwLog::Detail::BasicStageTimer<true> wait{&profiler, EtwLog::WriteStage::BufferWait};
+                            std::this_thread::sleep_for(std::chrono::milliseconds{1});
+                        }
+                    }
+                });
+            }
+            for (auto& thread : threads) {
+                thread.join();
+            }
+
+            const auto interval{profiler.TakeInterval()};
+            const auto millisecond{static_cast<std::uint64_t>(clock.Calibration().TicksPerSecond / 1000)};
+            if (interval.size() != 2 || interval[0].Name != "Admit" || interval[0].Ticks.Count() != c_threads * c_timings
+                || interval[1].Name != "BufferWait" || interval[1].Ticks.Count() != c_threads * c_timings / 10 || interval[1].Ticks.Min() < millisecond) {
+                Error("{}: {} stages timed\n", description, interval.size());
+            }
+            if (!profiler.TakeInterval().empty() || profiler.Totals().size() != 2) {
+                Error("{}: Timings were taken twice, or dropped from the totals\n", description);
+            }
+
+            // The record stands on its own: stage names and clock rate go with the histograms.
+            const auto payload{EtwLog::EncodeWriteProfile(std::chrono::seconds{1}, clock.Calibration().TicksPerSecond, interval)};
+            EtwLog::RecordView written;
+            written.Event.Id = EtwLog::EventIds::WriteProfile;
+            written.Time = std::chrono::system_clock::now();
+            written.FirstTime = written.Time;
+            written.Payload = payload;
+            const auto decoded{EtwLog::DecodeWriteProfile(written)};
+            if (!decoded || decoded->Stages.size() != 2 || decoded->End - decoded->Begin != std::chrono::seconds{1}
+                || decoded->TicksPerSecond != clock.Calibration().TicksPerSecond) {
+                Error("{}: Profile not decoded\n", description);
+                return;
+            }
+            for (std::size_t stage = 0; stage != interval.size(); ++stage) {
+                const auto& read{decoded->Stages[stage]};
+                if (read.Name != interval[stage].Name || read.Ticks.Count() != interval[stage].Ticks.Count() || read.Ticks.Max() != interval[stage].Ticks.Max()) {
+                    Error("{}: Stage {} read back as {}\n", description, interval[stage].Name, read.Name);
+                }
+            }
+
+            std::filesystem::path logFile;
+            {
+                EtwLog::MiniLog log{"Mini logger", fixture.TempFolder.string(), 64, backend};
+                logFile = log.LogFile();
+                for (int i = 0; i != c_timings; ++i) {
+                    log(MakeBytes(std::format("Record {}", i)));
+                }
+                const auto profile{log.Profile()};
+                const auto sinkWrite{std::ranges::find(profile, std::string{"SinkWrite"}, &EtwLog::StageProfile::Name)};
+                if (EtwLog::c_profileWrites ? sinkWrite == profile.end() || sinkWrite->Ticks.Count() < c_timings : !profile.empty()) {
+                    Error("{}: Logger profiled {} stages\n", description, profile.size());
+                }
+            }
+
+            std::vector<EtwLog::WriteProfileSnapshot> snapshots;
+            EtwLog::RecordFilter filter;
+            filter.EventId = EtwLog::EventIds::WriteProfile;
+            EtwLog::ReadLog(logFile, filter, [&](const EtwLog::RecordView& record) {
+                if (auto snapshot{EtwLog::DecodeWriteProfile(record)}) {
+                    snapshots.push_back(std::move(*snapshot));
+                }
+            });
+
+            // The logger's own when it profiles, written as it closes.
+            if (snapshots.size() != (EtwLog::c_profileWrites ? 1 : 0)) {
+                Error("{}: {} profiles read back\n", description, snapshots.size());
+            }
+            if (EtwLog::c_profileWrites) {
+                const auto& stages{snapshots[0].Stages};
+                const auto sinkWrite{std::ranges::find(stages, std::string{"SinkWrite"}, &EtwLog::StageProfile::Name)};
+                if (sinkWrite == stages.end() || sinkWrite->Ticks.Count() < c_timings) {
+                    Error("{}: Logger's profile read back without its writes\n", description);
+                }
+            }
+            Format("{}: BufferWait p50 {} ticks, profiling {}\n", description, interval[1].Ticks.ValueAtQuantile(0.5), EtwLog::c_profileWrites ? "on" : "off");
+        });
+}
+
+void Memory_ring_keeps_the_latest_records_the_file_leaves_out(EtwLog::Backend backend) {
+    const auto description{Describe("Memory_ring_keeps_the_latest_records_the_file_leaves_out", backend)};
+    RunTest(
+        description,
+        [&] {
+            const Fixture fixture;
+
+            static constexpr int c_records{20'000};
+            static constexpr int c_warningEvery{100};
+            const EtwLog::EventDescriptor verbose{EtwLog::EventIds::Message, EtwLog::Level::Verbose};
+            const EtwLog::EventDescriptor warning{EtwLog::EventIds::Message, EtwLog::Level::Warning};
+
+            // The file only takes warnings, the ring takes everything, and is dumped with the logger still writing to it.
+            std::filesystem::path logFile;
+            const auto dumpFile{fixture.TempFolder / "ring.mlog"};
+            std::uint64_t dumped{0};
+            {
+                EtwLog::MiniLog log{"Mini logger", fixture.TempFolder.string(), 64, backend};
+                logFile = log.LogFile();
+                const auto ring{log.AddMemoryRing(64)};
+                log.SetSinkFilter(EtwLog::c_fileSink, EtwLog::Level::Warning);
+
+                for (int i = 0; i != c_records; ++i) {
+                    log(i % c_warningEvery == 0 ? warning : verbose, MakeBytes(std::format("Record {}", i)));
+                }
+                dumped = log.DumpMemoryRing(ring, dumpFile);
+            }
+
+            // The latest records, of every level, with no gaps: the oldest were pushed out.
+            std::vector<std::uint64_t> sequences;
+            std::vector<std::byte> lastPayload;
+            EtwLog::ReadLog(dumpFile, [&](const EtwLog::RecordView& record) {
+                sequences.push_back(record.Header.Sequence);
+                if (record.Event.Id == EtwLog::EventIds::Message) {
+                    lastPayload.assign(record.Payload.begin(), record.Payload.end());
+                }
+            });
+            if (sequences.size() != dumped || dumped == 0 || dumped >= c_records) {
+                Error("{}: {} records read back of {} dumped\n", description, sequences.size(), dumped);
+                return;
+            }
+            if (std::ranges::adjacent_find(sequences, [](std::uint64_t a, std::uint64_t b) { return b != a + 1; }) != sequences.end()) {
+                Error("{}: Dumped records aren't consecutive\n", description);
+            }
+            if (!std::ranges::equal(lastPayload, MakeBytes(std::format("Record {}", c_records - 1)))) {
+                Error("{}: Newest record wasn't dumped\n", description);
+            }
+
+            std::uint64_t written{0};
+            bool verboseWritten{false};
+            EtwLog::ReadLog(logFile, Consumers::Messages(), [&](const EtwLog::RecordView& record) {
+                ++written;
+                verboseWritten |= record.Event.Level != EtwLog::Level::Warning;
+            });
+            if (written != c_records / c_warningEvery || verboseWritten) {
+                Error("{}: {} records written to the file\n", description, written);
+            }
+
+            // A ring has to take the largest fragment the file's buffers do, or it is refused; one that does drops no fragment.
+            const auto largeDumpFile{fixture.TempFolder / "large.mlog"};
+            const std::vector<std::byte> large(600 * 1024, std::byte{'l'});
+            std::uint64_t largeDropped{0};
+            {
+                EtwLog::MiniLog log{"Mini logger", (fixture.TempFolder / "large").string(), 256, backend};
+                bool refused{false};
+                try {
+                    log.AddMemoryRing(64);
+                } catch (const std::invalid_argument&) {
+                    refused = true;
+                }
+                // ETW caps events at 64 KB, whatever its buffers.
+                if (refused != (backend == EtwLog::Backend::Portable)) {
+                    Error("{}: Ring smaller than the file's buffers refused: {}\n", description, refused);
+                }
+
+                const auto ring{log.AddMemoryRing(1024)};
+                log(large);
+                log.DumpMemoryRing(ring, largeDumpFile);
+                largeDropped = log.DroppedRecords(ring);
+            }
+            std::uint32_t largeFragments{0};
+            EtwLog::ReadLog(largeDumpFile, Consumers::Messages(), [&](const EtwLog::RecordView& record) {
+                if (std::ranges::equal(record.Payload, large)) {
+                    largeFragments = record.Fragments;
+                }
+            });
+            if (largeFragments < 2 || largeDropped != 0) {
+                Error("{}: Large record dumped in {} fragments, {} dropped\n", description, largeFragments, largeDropped);
+            }
+            Format("{}: {} records kept by a 64 KB ring\n", description, dumped);
+        });
+}
+
+void Reserved_event_ids_are_refused_from_callers(EtwLog::Backend backend) {
+    const auto description{Describe("Reserved_event_ids_are_refused_from_callers", backend)};
+    RunTest(
+        description,
+        [&] {
+            const Fixture fixture;
+
+            // Ids of the logger's own records, which would otherwise pass every sink filter, and on ETW be taken for the clock calibration.
+            std::filesystem::path logFile;
+            int refused{0};
+            int reserved{0};
+            {
+                EtwLog::MiniLog log{"Mini logger", fixture.TempFolder.string(), 64, backend};
+                logFile = log.LogFile();
+                log.SetSinkFilter(EtwLog::c_fileSink, EtwLog::Level::Warning);
+
+                const auto payload{MakeBytes(std::string(sizeof(EtwLog::ClockCalibration), 'x'))};
+                const std::vector<std::function<void(const EtwLog::EventDescriptor&)>> writes{
+                    [&](const EtwLog::EventDescriptor& event) { log(event, payload); },
+                    [&](const EtwLog::EventDescriptor& event) { static_cast<void>(log.Admit(event)); },
+                    [&](const EtwLog::EventDescriptor& event) { log.WriteAdmitted(event, payload); },
+                    [&](const EtwLog::EventDescriptor& event) { const EtwLog::ActivityScope scope{log, event, payload}; },
+                };
+                for (std::uint16_t id = 0; id != 16; ++id) {
+                    if (!EtwLog::EventIds::IsReserved(id)) {
+                        continue;
+                    }
+                    ++reserved;
+                    for (const auto& write : writes) {
+                        try {
+                            write(EtwLog::EventDescriptor{id, EtwLog::Level::Verbose});
+                        } catch (const std::invalid_argument&) {
+                            ++refused;
+                        }
+                    }
+                }
+                log(EtwLog::EventDescriptor{EtwLog::EventIds::Message, EtwLog::Level::Warning}, payload);
+            }
+            if (reserved != 5 || refused != reserved * 4) {
+                Error("{}: {} writes of {} reserved ids refused\n", description, refused, reserved);
+            }
+
+            std::uint64_t messages{0};
+            std::uint64_t ownRecords{0};
+            EtwLog::ReadLog(logFile, [&](const EtwLog::RecordView& record) {
+                if (record.Event.Id == EtwLog::EventIds::Message) {
+                    ++messages;
+                } else if (EtwLog::EventIds::IsReserved(record.Event.Id) && !IsWriteProfile(record)) {
+                    ++ownRecords;
+                }
+            });
+            if (messages != 1 || ownRecords != 0) {
+                Error("{}: {} messages and {} records with reserved ids read back\n", description, messages, ownRecords);
+            }
+            Format("{}: {} writes refused\n", description, refused);
+        });
+}
+
+void Backpressure_policies_account_for_every_record() {
+    const auto description{std::string{"Backpressure_policies_account_for_every_record"}};
+    RunTest(
+        description,
+        [&] {
+            const Fixture fixture;
+
+            static constexpr int c_threads{4};
+            static constexpr std::uint64_t c_recordsPerThread{20'000};
+
+            // Buffers of 1 KB fill in a few records, so writers outpace the flush thread and every policy gets to act.
+            // Their write latencies are measured by Benchmark_backpressure_latency: a bound on them would fail on a loaded machine.
+            const std::pair<const char*, EtwLog::BackpressurePolicy> c_policies[]{
+                {"Block", {}},
+                {"DropNewest", {EtwLog::Backpressure::DropNewest}},
+                {"DropOldest", {EtwLog::Backpressure::DropOldest}},
+                {"BlockWithTimeout", {EtwLog::Backpressure::BlockWithTimeout, std::chrono::microseconds{200}}},
+                {"Spill", {EtwLog::Backpressure::Spill, {}, 64 * 1024}},
+            };
+            for (const auto& [name, policy] : c_policies) {
+                std::uint64_t dropped{0};
+                std::filesystem::path logFile;
+                {
+                    EtwLog::MiniLog log{"Mini logger", (fixture.TempFolder / name).string(), 1, EtwLog::Backend::Portable};
+                    logFile = log.LogFile();
+                    log.SetBackpressure(policy);
+
+                    std::vector<std::thread> threads;
+                    for (int t = 0; t != c_threads; ++t) {
+                        threads.emplace_back([&] {
+                            const std::vector<std::byte> message(200, std::byte{'x'});
+                            for (std::uint64_t r = 0; r != c_recordsPerThread; ++r) {
+                                log(message);
+                            }
+                        });
+                    }
+                    for (auto& thread : threads) {
+                        thread.join();
+                    }
+                    // Records the logger writes on closing, such as its write profile, wait rather than drop uncounted.
+                    log.SetBackpressure({});
+                    dropped = log.DroppedRecords();
+                }
+
+                // Spilled records reach the file after records other lanes wrote meanwhile: wait for all of them before calling any lost.
+                EtwLog::GapDetector gaps{c_threads * c_recordsPerThread};
+                std::uint64_t kept{0};
+                EtwLog::ReadLog(logFile, [&](const EtwLog::RecordView& record) {
+                    gaps.Observe(record.Header.Sequence);
+                    kept += IsWriteProfile(record) ? 0 : 1;
+                });
+                const auto report{gaps.Report()};
+                const bool dropsAllowed{policy.Mode != EtwLog::Backpressure::Block && policy.Mode != EtwLog::Backpressure::Spill};
+                if (!AllAccountedFor(c_threads * c_recordsPerThread, kept, dropped) || report.RecordsDuplicated != 0 || (!dropsAllowed && dropped != 0)) {
+                    Error("{}: {} kept {} records ({} late) and dropped {}\n", description, name, kept, report.RecordsDuplicated, dropped);
+                }
+                Format("{}: {:<16} {} kept, {} dropped\n", description, name, kept, dropped);
+            }
+        });
+}
+
+void Spilled_records_reach_the_file_in_order() {
+    const auto description{std::string{"Spilled_records_reach_the_file_in_order"}};
+    RunTest(
+        description,
+        [&] {
+            const Fixture fixture;
+
+            static constexpr std::uint64_t c_records{20'000};
+
+            // One writer takes its sequence numbers in order, so its records have to reach the file in that order too,
+            // whether they went to a buffer or through the spill file: a slot drained out of turn shows as a step back.
+            std::filesystem::path logFile;
+            {
+                EtwLog::MiniLog log{"Mini logger", fixture.TempFolder.string(), 1, EtwLog::Backend::Portable};
+                logFile = log.LogFile();
+                log.SetBackpressure({EtwLog::Backpressure::Spill, {}, 64 * 1024});
+
+                const std::vector<std::byte> message(200, std::byte{'x'});
+                for (std::uint64_t r = 0; r != c_records; ++r) {
+                    log(message);
+                }
+            }
+
+            std::uint64_t read{0};
+            std::uint64_t outOfOrder{0};
+            std::optional<std::uint64_t> previous;
+            EtwLog::ReadLog(logFile, Consumers::Messages(), [&](const EtwLog::RecordView& record) {
+                ++read;
+                outOfOrder += previous && record.Header.Sequence <= *previous ? 1 : 0;
+                previous = record.Header.Sequence;
+            });
+            if (read != c_records || outOfOrder != 0) {
+                Error("{}: Read {} of {} records, {} out of order\n", description, read, c_records, outOfOrder);
+            }
+            Format("{}: {} records in sequence order\n", description, read);
+        });
+}
+
+void Priority_lanes_keep_critical_records_through_a_flood() {
+    const auto description{std::string{"Priority_lanes_keep_critical_records_through_a_flood"}};
+    RunTest(
+        description,
+        [&] {
+            const Fixture fixture;
+
+            static constexpr int c_floodThreads{3};
+            static constexpr std::uint64_t c_floodRecords{20'000};
+            static constexpr std::uint64_t c_criticalRecords{200};
+            static constexpr std::chrono::milliseconds c_flushInterval{5};
+
+            const EtwLog::EventDescriptor verbose{EtwLog::EventIds::Message, EtwLog::Level::Verbose};
+            const EtwLog::EventDescriptor critical{EtwLog::EventIds::Message, EtwLog::Level::Critical};
+
+            std::filesystem::path logFile;
+            std::uint64_t dropped{0};
+            bool flushedInTime{false};
+            {
+                EtwLog::MiniLog log{"Mini logger", fixture.TempFolder.string(), 1, EtwLog::Backend::Portable, {}, {}, {EtwLog::Level::Error, 4, c_flushInterval}};
+                logFile = log.LogFile();
+                // Verbose records flooding the shared buffers are dropped rather than waited for; critical ones have buffers of their own.
+                log.SetBackpressure({EtwLog::Backpressure::DropNewest});
+
+                std::vector<std::thread> threads;
+                for (int t = 0; t != c_floodThreads; ++t) {
+                    threads.emplace_back([&] {
+                        const std::vector<std::byte> message(200, std::byte{'v'});
+                        for (std::uint64_t r = 0; r != c_floodRecords; ++r) {
+                            log(verbose, message);
+                        }
+                    });
+                }
+                for (std::uint64_t r = 0; r != c_criticalRecords; ++r) {
+                    log(critical, MakeBytes("Critical"));
+                    std::this_thread::sleep_for(std::chrono::microseconds{50});
+                }
+                for (auto& thread : threads) {
+                    thread.join();
+                }
+                dropped = log.DroppedRecords();
+
+                // A lone critical record reaches the file within a flush interval or so, without its buffer filling up.
+                log(critical, MakeBytes("Last"));
+                std::this_thread::sleep_for(20 * c_flushInterval);
+                EtwLog::RecordFilter last;
+                last.PayloadPrefix = MakeBytes("Last");
+                EtwLog::ReadLog(logFile, last, [&flushedInTime](const EtwLog::RecordView&) { flushedInTime = true; });
+            }
+
+            EtwLog::RecordFilter criticalOnly;
+            criticalOnly.MaxLevel = EtwLog::Level::Critical;
+            const auto criticalRead{EtwLog::ReadLog(logFile, criticalOnly, [](const EtwLog::RecordView&) {})};
+
+            std::uint64_t outOfOrder{0};
+            auto previous{std::chrono::sys_time<std::chrono::nanoseconds>::min()};
+            const auto all{EtwLog::ReadLogByTime(logFile, Consumers::Messages(), [&](const EtwLog::RecordView& record) {
+                outOfOrder += record.Time < previous ? 1 : 0;
+                previous = record.Time;
+            })};
+
+            if (criticalRead.Records != c_criticalRecords + 1 || !flushedInTime) {
+                Error("{}: Kept {} of {} critical records, last one flushed in time: {}\n", description, criticalRead.Records, c_criticalRecords + 1, flushedInTime);
+            }
+            if (!AllAccountedFor(c_floodThreads * c_floodRecords + c_criticalRecords + 1, all.Records, dropped) || outOfOrder != 0) {
+                Error("{}: Read {} records, {} dropped, {} out of time order\n", description, all.Records, dropped, outOfOrder);
+            }
+            Format("{}: {} critical records kept, {} flood records dropped\n", description, criticalRead.Records, dropped);
+        });
+}
+
+/// @brief Timing loops, run instead of the tests with --bench. Defined in MiniEtwLogBench.cpp.
+void RunBenchmarks();
+
+int main(int argc, char** argv) {
+    if (argc > 1 && std::string_view{argv[1]} == "--bench") {
+        RunBenchmarks();
+        return 0;
+    }
+
+    for (const auto backend : c_backends) {
+        Construct_logger_and_log_one_record(backend);
+        Construct_many_logggers_to_find_logger_count_limits(backend);
+        Log_many_records_and_find_no_sequence_gaps(backend);
+        Records_are_timestamped_while_logging(backend);
+        Pool_hands_out_ready_loggers(backend);
+        Close_logger_in_background_and_wait_for_the_file(backend);
+        Records_keep_their_event_descriptor(backend);
+        Read_log_passes_only_records_the_filter_selects(backend);
+        Export_logs_to_columns_and_import_them_back(backend);
+        Record_batch_reads_a_log_in_a_few_allocations(backend);
+        Sampling_keeps_the_configured_share_of_records(backend);
+        Filter_changes_take_effect_while_logging(backend);
+        Repeated_records_are_coalesced_and_expanded(backend);
+        Large_payloads_are_written_in_fragments_and_reassembled(backend);
+        Messages_logged_with_format_are_formatted_when_read(backend);
+        Format_manifest_formats_messages_without_the_program(backend);
+        Activity_scopes_are_read_back_as_span_trees(backend);
+        Latency_histograms_are_snapshotted_and_merged(backend);
+        Counters_and_gauges_are_flushed_every_interval(backend);
+        Write_profile_times_each_stage(backend);
+        Memory_ring_keeps_the_latest_records_the_file_leaves_out(backend);
+        Reserved_event_ids_are_refused_from_callers(backend);
+    }
+
+    Gap_detector_reports_missing_and_reordered_sequence_numbers();
+    Clock_converts_ticks_to_wall_time();
+    Clock_calibration_keeps_pace_with_the_steady_clock();
+    Portable_sink_rotates_preallocated_segments();
+    Portable_sink_writes_with_io_uring_and_direct_io();
+    Numa_local_buffers_in_huge_pages_keep_every_record();
+    Crc32c_matches_known_values();
+    Torn_portable_log_is_read_up_to_the_last_valid_record();
+    Portable_logs_of_older_versions_are_read_and_newer_ones_refused();
+    Repeated_or_damaged_fragments_do_not_complete_a_payload();
+    Record_scan_selects_like_the_scalar_path();
+    Backpressure_policies_account_for_every_record();
+    Spilled_records_reach_the_file_in_order();
+    Priority_lanes_keep_critical_records_through_a_flood();
+#ifdef _WIN32
+    Activity_opcodes_reach_etw_consumers();
+#endif
 }
\ No newline at end of file